@@ -23,12 +23,21 @@ void App::signal_handler(int)
     log_info("caught SIGINT, quiting");
     assert(g_app != nullptr);
     g_app->m_heartbeat.stop();
+    g_app->m_pressure_monitor.stop();
     g_app->m_fuse.stop();
     g_app->m_background_loader.stop();
-    g_app->m_transport.stop();
+    // the transport is stopped after the write-back uploads
     std::signal(SIGINT, SIG_DFL);
 }
 
+//--------------------------------------------------------------------------
+
+void App::stats_signal_handler(int)
+{
+    assert(g_app != nullptr);
+    g_app->m_pressure_monitor.request_stats();
+}
+
 //==========================================================================
 
 App::App(const boost::program_options::variables_map& options)
@@ -50,18 +59,44 @@ void App::run()
     m_transport.set_endpoint(endpoint);
     const auto mountpoint = m_options["mountpoint"].as<std::string>();
     m_fuse.set_mountpoint(mountpoint);
+    {
+        const auto cache_size = m_options["cache-size"].as<size_t>();
+        auto lg = m_cache.lock();
+        m_cache.set_content_capacity(cache_size * 1024 * 1024);
+    }
+    const auto tree_depth = m_options["tree-depth"].as<uint32_t>();
+    m_cached_vfs.set_tree_depth(tree_depth);
+    m_background_loader.set_tree_depth(tree_depth);
+    m_cached_vfs.set_write_back(m_options["write-back"].as<size_t>() * 1024 * 1024);
+    if (m_options.count("disk-cache"))
+    {
+        const auto disk_cache_size = m_options["disk-cache-size"].as<size_t>();
+        const boost::filesystem::path directory{m_options["disk-cache"].as<std::string>()};
+        m_disk_store.open(directory, disk_cache_size * 1024 * 1024);
+        m_background_loader.load_snapshot(directory / "tree", endpoint);
+    }
 
     m_transport.start();
+    m_cached_vfs.start();
     m_background_loader.start();
     m_heartbeat.start();
+    m_pressure_monitor.start();
     m_fuse.start();
 
     std::signal(SIGINT, signal_handler);
+    std::signal(SIGUSR1, stats_signal_handler);
 
     m_fuse.wait();
+    // the files are released (flushed) by now
+    m_cached_vfs.stop();
+    m_cached_vfs.wait();
+    m_transport.stop();
     m_heartbeat.wait();
+    m_pressure_monitor.wait();
     m_background_loader.wait();
     m_transport.wait();
+
+    m_background_loader.save_snapshot();
 }
 
 //==========================================================================
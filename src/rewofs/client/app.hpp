@@ -13,6 +13,7 @@
 
 #include "rewofs/client/fuse.hpp"
 #include "rewofs/client/heartbeat.hpp"
+#include "rewofs/client/pressure.hpp"
 #include "rewofs/client/transport.hpp"
 #include "rewofs/client/vfs.hpp"
 
@@ -30,6 +31,7 @@ public:
     //--------------------------------
 private:
     static void signal_handler(int);
+    static void stats_signal_handler(int);
 
     const boost::program_options::variables_map& m_options;
     Serializer m_serializer{};
@@ -39,11 +41,14 @@ private:
     IdDispenser m_id_dispenser{};
     RemoteVfs m_remote_vfs{m_serializer, m_deserializer, m_id_dispenser};
     cache::Cache m_cache{};
+    cache::DiskStore m_disk_store{};
     CachedVfs m_cached_vfs{m_remote_vfs, m_serializer, m_deserializer, m_id_dispenser,
-                           m_cache};
+                           m_cache, m_disk_store};
     BackgroundLoader m_background_loader{m_serializer, m_deserializer, m_distributor,
                                          m_cache};
-    Heartbeat m_heartbeat{m_serializer, m_deserializer, m_background_loader};
+    Heartbeat m_heartbeat{m_serializer, m_deserializer, m_background_loader,
+                          m_remote_vfs};
+    PressureMonitor m_pressure_monitor{m_cache};
     Fuse m_fuse{m_cached_vfs};
 };
 
@@ -2,281 +2,499 @@
 ///
 /// @file
 
+#include <algorithm>
+#include <utility>
+
 #include "rewofs/client/cache.hpp"
+#include "rewofs/hash.hpp"
 
 //==========================================================================
 namespace rewofs::client::cache {
 //==========================================================================
 
-static bool path_has_prefix(const Path& path, const Path& prefix)
+FrequencySketch::FrequencySketch(const size_t items)
 {
-    auto pair = std::mismatch(path.begin(), path.end(), prefix.begin(), prefix.end());
-    return pair.second == prefix.end();
+    size_t width{64};
+    while (width < items)
+    {
+        width <<= 1;
+    }
+    m_counters.resize(DEPTH * width, 0);
+    m_width_mask = width - 1;
 }
 
-//==========================================================================
+//--------------------------------------------------------------------------
 
-Tree::Tree()
+void FrequencySketch::increment(const uint64_t hash)
 {
-    m_root.name = ".";
-    // directory with read permissions
-    m_root.st.st_mode = 040444;
+    for (size_t row = 0; row < DEPTH; ++row)
+    {
+        auto& counter = m_counters[index(hash, row)];
+        if (counter < MAX_COUNT)
+        {
+            ++counter;
+        }
+    }
+
+    if (++m_increments >= SAMPLE_FACTOR * (m_width_mask + 1))
+    {
+        age();
+    }
 }
 
 //--------------------------------------------------------------------------
 
-Node& Tree::get_root()
+uint8_t FrequencySketch::frequency(const uint64_t hash) const
 {
-    return m_root;
+    uint8_t res{MAX_COUNT};
+    for (size_t row = 0; row < DEPTH; ++row)
+    {
+        res = std::min(res, m_counters[index(hash, row)]);
+    }
+    return res;
 }
 
 //--------------------------------------------------------------------------
 
-const Node& Tree::get_root() const
+size_t FrequencySketch::index(const uint64_t hash, const size_t row) const
 {
-    return m_root;
+    static constexpr std::array<uint64_t, DEPTH> SEEDS{
+        {0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull, 0x94d049bb133111ebull,
+         0xd6e8feb86659fd93ull}};
+    const auto mixed = detail::hash_mix(hash ^ SEEDS[row], SEEDS[row]);
+    return row * (m_width_mask + 1) + (static_cast<size_t>(mixed) & m_width_mask);
 }
 
 //--------------------------------------------------------------------------
 
-Node& Tree::make_node(Node& parent, const std::string& name)
+void FrequencySketch::age()
+{
+    for (auto& counter: m_counters)
+    {
+        counter = static_cast<uint8_t>(counter >> 1);
+    }
+    m_increments /= 2;
+}
+
+//==========================================================================
+
+double Content::Stats::hit_ratio() const
+{
+    const auto total = hit_bytes + miss_bytes;
+    if (total == 0)
+    {
+        return 0.0;
+    }
+    return static_cast<double>(hit_bytes) / static_cast<double>(total);
+}
+
+//==========================================================================
+
+void Content::reset()
 {
-    assert(parent.children.find(name) == parent.children.end());
-    Node new_node{};
-    new_node.name = name;
-    auto [it, inserted] = parent.children.emplace(name, std::move(new_node));
-    assert(inserted); (void) inserted;
-    return it->second;
+    m_files.clear();
+    m_window.clear();
+    m_main.clear();
+    m_size = 0;
+    m_window_size = 0;
 }
 
 //--------------------------------------------------------------------------
 
-void Tree::reset()
+void Content::set_capacity(const size_t capacity)
 {
-    m_root.children.clear();
+    m_capacity = capacity;
+    m_sketch = FrequencySketch{std::min(capacity / PAGE_SIZE, MAX_SKETCH_PAGES)};
+    admit();
 }
 
 //--------------------------------------------------------------------------
 
-void Tree::remove_single(const Path& path)
+void Content::shrink(const size_t target)
 {
-    if (path == "/")
-    {
-        throw std::system_error{EACCES, std::generic_category()};
-    }
-    auto& parent_node = get_node(path.parent_path());
-    const auto nit = parent_node.children.find(path.filename().native());
-    if (nit == parent_node.children.end())
+    // the window holds the most recent pages
+    while (m_size > target)
     {
-        throw std::system_error{ENOENT, std::generic_category()};
+        evict_page(std::prev(m_main.empty() ? m_window.end() : m_main.end()));
     }
-    if (nit->second.children.size() > 0)
-    {
-        throw std::system_error{ENOTEMPTY, std::generic_category()};
-    }
-    parent_node.children.erase(nit);
 }
 
 //--------------------------------------------------------------------------
 
-Node& Tree::make_node(const Path& path)
+Content::Stats Content::get_stats() const
+{
+    return {m_size,      m_capacity,  m_window.size() + m_main.size(),
+            m_evictions, m_hit_bytes, m_miss_bytes};
+}
+
+//--------------------------------------------------------------------------
+
+bool Content::read(const Path& path, const uintmax_t start, const size_t size,
+                   const std::function<void(const gsl::span<const uint8_t>)>& store_cb)
 {
-    if (path == "/")
+    const auto file_it = m_files.find(path);
+    if (file_it == m_files.end())
+    {
+        return false;
+    }
+    auto& file = file_it->second;
+    const auto& extents = file.extents;
+
+    // the extent containing `start`
+    auto it = extents.upper_bound(start);
+    if (it == extents.begin())
+    {
+        return false;
+    }
+    const auto first = std::prev(it);
+
+    // check the coverage first, the callback can be called only on a hit
+    const auto end = start + size;
+    auto covered = first->first + first->second.size();
+    for (it = std::next(first); (covered < end) and (it != extents.end()); ++it)
+    {
+        if (it->first != covered)
+        {
+            break;
+        }
+        covered += it->second.size();
+    }
+    if (covered < end)
     {
-        throw std::system_error{EEXIST, std::generic_category()};
+        return false;
     }
-    auto& parent_node = get_node(path.parent_path());
-    const auto nit = parent_node.children.find(path.filename().native());
-    if (nit != parent_node.children.end())
+
+    assert(!!store_cb);
+    touch(path, &file, start, end);
+    auto pos = start;
+    for (it = first; pos < end; ++it)
     {
-        throw std::system_error{EEXIST, std::generic_category()};
+        const auto begin = it->second.data() + (pos - it->first);
+        const auto piece_end = std::min<uintmax_t>(end, it->first + it->second.size());
+        store_cb(gsl::span<const uint8_t>{begin, begin + (piece_end - pos)});
+        pos = piece_end;
     }
-    Node new_node{};
-    new_node.name = path.filename().string();
-    auto [it, inserted]
-        = parent_node.children.emplace(path.filename().string(), std::move(new_node));
-    assert(inserted); (void) inserted;
-    return it->second;
+    return true;
 }
 
 //--------------------------------------------------------------------------
 
-void Tree::rename(const Path& from, const Path& to)
+std::vector<Content::Range> Content::read_partial(const Path& path, const uintmax_t start,
+                                                  const gsl::span<uint8_t> output)
 {
-    if ((from == "/") or (to == "/"))
+    const auto file_it = m_files.find(path);
+    auto* const file = (file_it == m_files.end()) ? nullptr : &file_it->second;
+    touch(path, file, start, start + output.size());
+    static const Extents NO_EXTENTS{};
+    const auto missing
+        = read_extents((file == nullptr) ? NO_EXTENTS : file->extents, start, output);
+
+    size_t missing_size{0};
+    for (const auto& range: missing)
     {
-        throw std::system_error{EEXIST, std::generic_category()};
+        missing_size += range.size;
     }
+    m_hit_bytes += output.size() - missing_size;
+    m_miss_bytes += missing_size;
+    return missing;
+}
+
+//--------------------------------------------------------------------------
 
-    auto& parent_from = get_node(from.parent_path());
-    const auto nit_from = parent_from.children.find(from.filename().native());
-    if (nit_from == parent_from.children.end())
+void Content::write(const Path& path, const uintmax_t start, std::vector<uint8_t> content)
+{
+    if (content.empty())
     {
-        throw std::system_error{ENOENT, std::generic_category()};
+        return;
     }
 
-    auto& parent_to = get_node(to.parent_path());
-    const auto nit_to = parent_to.children.find(to.filename().native());
-    if (nit_to != parent_to.children.end())
+    const auto file_it = m_files.try_emplace(path).first;
+    auto& file = file_it->second;
+    const auto end = start + content.size();
+    for (auto pos = start; pos < end;)
     {
-        throw std::system_error{EEXIST, std::generic_category()};
+        const auto page_begin = pos - pos % PAGE_SIZE;
+        const auto page_end = std::min<uintmax_t>(end, page_begin + PAGE_SIZE);
+        const auto begin = content.data() + (pos - start);
+        write_page(file.extents, pos, {begin, begin + (page_end - pos)});
+
+        auto page_it = file.pages.find(page_begin);
+        if (page_it == file.pages.end())
+        {
+            m_window.push_front(
+                {&file_it->first, page_begin, 0, page_hash(path, page_begin), true});
+            page_it = file.pages.emplace(page_begin, m_window.begin()).first;
+        }
+        else
+        {
+            auto& lru = lru_of(*page_it->second);
+            lru.splice(lru.begin(), lru, page_it->second);
+        }
+        // a write never shrinks a page
+        auto& page = *page_it->second;
+        const auto new_size = page_size(file.extents, page_begin);
+        assert(new_size >= page.size);
+        m_size += new_size - page.size;
+        if (page.in_window)
+        {
+            m_window_size += new_size - page.size;
+        }
+        page.size = new_size;
+
+        pos = page_end;
     }
 
-    Node tmp{std::move(nit_from->second)};
-    parent_from.children.erase(nit_from);
-    auto [it, inserted]
-        = parent_to.children.emplace(to.filename().string(), std::move(tmp));
-    (void) it;
-    assert(inserted); (void) inserted;
+    admit();
 }
 
 //--------------------------------------------------------------------------
 
-void Tree::exchange(const Path& path1, const Path& path2)
+void Content::delete_file(const Path& path)
 {
-    if (path_has_prefix(path1, path2) or path_has_prefix(path2, path1))
+    const auto it = m_files.find(path);
+    if (it != m_files.end())
     {
-        throw std::system_error{EINVAL, std::generic_category()};
+        erase_file(it);
     }
+}
 
-    auto& node1 = get_node(path1);
-    auto& node2 = get_node(path2);
+//--------------------------------------------------------------------------
 
-    std::swap(node1.st, node2.st);
-    std::swap(node1.children, node2.children);
+void Content::delete_files_if(const std::function<bool(const Path&)>& pred)
+{
+    for (auto it = m_files.begin(); it != m_files.end();)
+    {
+        if (pred(it->first))
+        {
+            it = erase_file(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
 }
 
 //--------------------------------------------------------------------------
 
-Node& Tree::get_node(const Path& path)
+void Content::write_page(Extents& extents, const uintmax_t start,
+                         const gsl::span<const uint8_t> data)
 {
-    assert((path.native().size() > 0) and (path.native()[0] == '/'));
+    const auto end = start + data.size();
+    const auto page_begin = start - start % PAGE_SIZE;
+    const auto page_end = page_begin + PAGE_SIZE;
+    assert(end <= page_end);
+
+    // an extent in the page overlapping or touching the new data from the left
+    auto it = extents.upper_bound(start);
+    if (it != extents.begin())
+    {
+        const auto prev = std::prev(it);
+        if ((prev->first >= page_begin) and (prev->first + prev->second.size() >= start))
+        {
+            it = prev;
+        }
+    }
 
-    Node* node = &m_root;
-    auto it = path.begin();
-    // skip the initial "/"
-    ++it;
-    for (; it != path.end(); ++it)
+    if ((it != extents.end()) and (it->first <= start))
     {
-        const auto nit = node->children.find(it->native());
-        if (nit == node->children.end())
+        auto& buf = it->second;
+        const auto offset = static_cast<size_t>(start - it->first);
+        if (buf.size() < offset + data.size())
         {
-            throw std::system_error{ENOENT, std::generic_category()};
+            buf.resize(offset + data.size());
         }
-        node = &nit->second;
+        std::copy(data.begin(), data.end(), buf.begin() + static_cast<ssize_t>(offset));
+    }
+    else
+    {
+        it = extents.emplace_hint(it, start, std::vector<uint8_t>(data.begin(), data.end()));
     }
 
-    assert(node != nullptr);
-    return *node;
+    // absorb the following extents overlapping or touching the merged one
+    auto& merged = it->second;
+    for (auto next = std::next(it); (next != extents.end()) and (next->first < page_end);)
+    {
+        const auto merged_end = it->first + merged.size();
+        if (next->first > merged_end)
+        {
+            break;
+        }
+        const auto next_end = next->first + next->second.size();
+        if (next_end > merged_end)
+        {
+            // the older data only where not overwritten
+            merged.insert(merged.end(),
+                          next->second.end() - static_cast<ssize_t>(next_end - merged_end),
+                          next->second.end());
+        }
+        next = extents.erase(next);
+    }
 }
 
-//==========================================================================
+//--------------------------------------------------------------------------
 
-void Content::reset()
+std::vector<Content::Range> Content::read_extents(const Extents& extents,
+                                                  const uintmax_t start,
+                                                  const gsl::span<uint8_t> output)
 {
-    m_blocks.clear();
+    std::vector<Range> missing{};
+    const auto end = start + output.size();
+    auto pos = start;
+
+    // the extent containing `start` or the first one after it
+    auto it = extents.upper_bound(start);
+    if (it != extents.begin())
+    {
+        --it;
+    }
+    for (; (pos < end) and (it != extents.end()) and (it->first < end); ++it)
+    {
+        const auto extent_end = it->first + it->second.size();
+        if (extent_end <= pos)
+        {
+            continue;
+        }
+        if (it->first > pos)
+        {
+            missing.push_back({pos, static_cast<size_t>(it->first - pos)});
+            pos = it->first;
+        }
+        const auto piece_end = std::min<uintmax_t>(end, extent_end);
+        const auto begin = it->second.begin() + static_cast<ssize_t>(pos - it->first);
+        std::copy(begin, begin + static_cast<ssize_t>(piece_end - pos),
+                  output.begin() + static_cast<ssize_t>(pos - start));
+        pos = piece_end;
+    }
+
+    if (pos < end)
+    {
+        missing.push_back({pos, static_cast<size_t>(end - pos)});
+    }
+    return missing;
 }
 
 //--------------------------------------------------------------------------
 
-bool Content::read(const Path& path, const uintmax_t start, const size_t size,
-                   const std::function<void(const gsl::span<const uint8_t>)>& store_cb)
+size_t Content::page_size(const Extents& extents, const uintmax_t page_begin)
 {
-    const auto file_it = m_blocks.find(path);
-    if (file_it == m_blocks.end())
+    size_t size{0};
+    for (auto it = extents.lower_bound(page_begin);
+         (it != extents.end()) and (it->first < page_begin + PAGE_SIZE); ++it)
     {
-        return false;
+        size += it->second.size();
     }
+    return size;
+}
 
-    const auto it = std::find_if(
-        file_it->second.begin(), file_it->second.end(), [&](const auto& block) {
-            return (block.start <= start)
-                   and (block.content.size() >= (start - block.start + size));
-        });
-    if (it == file_it->second.end())
-    {
-        return false;
-    }
+//--------------------------------------------------------------------------
 
-    const auto begin = it->content.data() + static_cast<ssize_t>(start - it->start);
-    assert(!!store_cb);
-    store_cb(gsl::span<const uint8_t>{begin, begin + size});
-    return true;
+uint64_t Content::page_hash(const Path& path, const uintmax_t page_begin)
+{
+    return hash_bytes(path.native(), page_begin);
 }
 
 //--------------------------------------------------------------------------
 
-void Content::write(const Path& path, const uintmax_t start, std::vector<uint8_t> content)
+void Content::touch(const Path& path, File* const file, const uintmax_t start,
+                    const uintmax_t end)
 {
-    const auto file_it = m_blocks.find(path);
-    if (file_it != m_blocks.end())
+    for (auto page_begin = start - start % PAGE_SIZE; page_begin < end;
+         page_begin += PAGE_SIZE)
     {
-        const auto it = std::find_if(
-            file_it->second.begin(), file_it->second.end(), [&](const auto& block) {
-                return (block.start <= start)
-                       and (block.content.size()
-                            >= (start - block.start + content.size()));
-            });
-        if (it != file_it->second.end())
+        if (file != nullptr)
         {
-            std::copy(
-                content.begin(), content.end(),
-                std::next(it->content.begin(), static_cast<ssize_t>(start - it->start)));
-            return;
+            const auto it = file->pages.find(page_begin);
+            if (it != file->pages.end())
+            {
+                auto& lru = lru_of(*it->second);
+                lru.splice(lru.begin(), lru, it->second);
+                m_sketch.increment(it->second->hash);
+                continue;
+            }
         }
+        m_sketch.increment(page_hash(path, page_begin));
     }
+}
+
+//--------------------------------------------------------------------------
 
-    Block b{};
-    b.start = start;
-    b.content = std::move(content);
-    m_blocks[path].emplace_back(std::move(b));
-    flatten(path);
+Content::Lru& Content::lru_of(const PageRef& page)
+{
+    return page.in_window ? m_window : m_main;
 }
 
 //--------------------------------------------------------------------------
 
-void Content::delete_file(const Path& path)
+void Content::admit()
 {
-    m_blocks.erase(path);
+    const auto window_capacity = m_capacity / 100 * WINDOW_PERCENT;
+    while (m_window_size > window_capacity)
+    {
+        const auto candidate = std::prev(m_window.end());
+        candidate->in_window = false;
+        m_window_size -= candidate->size;
+        m_main.splice(m_main.begin(), m_window, candidate);
+
+        const auto candidate_frequency = m_sketch.frequency(candidate->hash);
+        while ((m_size > m_capacity) and (std::prev(m_main.end()) != candidate))
+        {
+            const auto victim = std::prev(m_main.end());
+            if (candidate_frequency > m_sketch.frequency(victim->hash))
+            {
+                evict_page(victim);
+            }
+            else
+            {
+                evict_page(candidate);
+                break;
+            }
+        }
+    }
+
+    shrink(m_capacity);
 }
 
 //--------------------------------------------------------------------------
 
-void Content::flatten(const Path& path)
+void Content::evict_page(const Lru::iterator page)
 {
-    auto& blocks = m_blocks.at(path);
+    const auto file_it = m_files.find(*page->path);
+    assert(file_it != m_files.end());
+    auto& file = file_it->second;
+
+    file.extents.erase(file.extents.lower_bound(page->page_begin),
+                       file.extents.lower_bound(page->page_begin + PAGE_SIZE));
+    file.pages.erase(page->page_begin);
+    m_size -= page->size;
+    if (page->in_window)
+    {
+        m_window_size -= page->size;
+    }
+    ++m_evictions;
+    lru_of(*page).erase(page);
 
-    if (blocks.size() <= 1)
+    if (file.pages.empty())
     {
-        return;
+        m_files.erase(file_it);
     }
+}
 
-    blocks.sort([](const Block& b1, const Block& b2) { return b1.start < b2.start; });
+//--------------------------------------------------------------------------
 
-    auto it = blocks.begin();
-    while (it != std::prev(blocks.end()))
+Content::Files::iterator Content::erase_file(const Files::iterator it)
+{
+    for (const auto& item: it->second.pages)
     {
-        const auto next_it = std::next(it);
-
-        if ((it->start + it->content.size()) >= next_it->start)
+        const auto page = item.second;
+        m_size -= page->size;
+        if (page->in_window)
         {
-            const size_t offset = next_it->start - it->start;
-            assert(offset <= it->content.size());
-            const size_t new_size
-                = std::max(it->content.size(), offset + next_it->content.size());
-            assert(new_size <= (it->content.size() + next_it->content.size()));
-            std::vector<uint8_t> new_content(new_size);
-            std::copy(it->content.begin(), it->content.end(), new_content.begin());
-            std::copy(next_it->content.begin(), next_it->content.end(),
-                      new_content.begin() + static_cast<ssize_t>(offset));
-            it->content = std::move(new_content);
-            blocks.erase(next_it);
-        }
-        else
-        {
-            ++it;
+            m_window_size -= page->size;
         }
+        lru_of(*page).erase(page);
     }
+    return m_files.erase(it);
 }
 
 //==========================================================================
@@ -288,17 +506,63 @@ std::unique_lock<std::mutex> Cache::lock()
 
 //--------------------------------------------------------------------------
 
+std::shared_ptr<const Tree> Cache::snapshot() const
+{
+    return std::atomic_load(&m_snapshot);
+}
+
+//--------------------------------------------------------------------------
+
+void Cache::publish()
+{
+    m_tree.rehash_ancestors(m_touched);
+    m_touched.clear();
+    m_tree.compact_names();
+    // The old version is freed by whoever drops the last reference to it.
+    std::atomic_store(&m_snapshot, std::make_shared<const Tree>(m_tree));
+}
+
+//--------------------------------------------------------------------------
+
 void Cache::reset()
 {
     m_tree.reset();
+    m_touched.clear();
     m_content.reset();
 }
 
 //--------------------------------------------------------------------------
 
+void Cache::reset(Tree tree)
+{
+    m_content.delete_files_if([this, &tree](const Path& path) {
+        if (not m_tree.exists(path) or not tree.exists(path))
+        {
+            return true;
+        }
+        return not is_same_content(std::as_const(m_tree).get_node(path).st,
+                                   std::as_const(tree).get_node(path).st);
+    });
+    m_tree = std::move(tree);
+    // loaded and streamed trees come without the hashes
+    m_tree.rehash_subtree("/");
+    m_touched.clear();
+}
+
+//--------------------------------------------------------------------------
+
+const Tree& Cache::get_tree() const
+{
+    return m_tree;
+}
+
+//--------------------------------------------------------------------------
+
 Node& Cache::get_root()
 {
-    return m_tree.get_root();
+    auto& root = m_tree.get_root();
+    m_touched.push_back(root.id);
+    return root;
 }
 
 //--------------------------------------------------------------------------
@@ -310,38 +574,82 @@ const Node& Cache::get_root() const
 
 //--------------------------------------------------------------------------
 
-Node& Cache::make_node(Node& parent, const std::string& name)
+Node& Cache::make_node(Node& parent, const std::string_view name)
 {
-    return m_tree.make_node(parent, name);
+    auto& node = m_tree.make_node(parent, name);
+    touch(node);
+    return node;
 }
 
 //--------------------------------------------------------------------------
 
 Node& Cache::get_node(const Path& name)
 {
-    return m_tree.get_node(name);
+    // the caller may change the attributes
+    auto& node = m_tree.get_node(name);
+    touch(node);
+    return node;
+}
+
+//--------------------------------------------------------------------------
+
+bool Cache::exists(const Path& path) const
+{
+    return m_tree.exists(path);
+}
+
+//--------------------------------------------------------------------------
+
+bool Cache::has_child(const Node& parent, const std::string_view name) const
+{
+    return m_tree.has_child(parent, name);
 }
 
 //--------------------------------------------------------------------------
 
 void Cache::remove_single(const Path& path)
 {
+    touch_parent(path);
     m_tree.remove_single(path);
     m_content.delete_file(path);
 }
 
 //--------------------------------------------------------------------------
 
+void Cache::remove(const Path& path)
+{
+    std::vector<std::pair<Path, const Node*>> stack{
+        {path, &std::as_const(m_tree).get_node(path)}};
+    while (not stack.empty())
+    {
+        const auto item = stack.back();
+        stack.pop_back();
+        m_content.delete_file(item.first);
+        m_tree.for_each_child(*item.second, [&stack, &item](const std::string_view name,
+                                                            const Node& child) {
+            stack.emplace_back(item.first / Path{name.begin(), name.end()}, &child);
+        });
+    }
+    touch_parent(path);
+    m_tree.remove(path);
+}
+
+//--------------------------------------------------------------------------
+
 Node& Cache::make_node(const Path& path)
 {
-    return m_tree.make_node(path);
+    auto& node = m_tree.make_node(path);
+    touch(node);
+    return node;
 }
 
 //--------------------------------------------------------------------------
 
 void Cache::rename(const Path& from, const Path& to)
 {
+    touch_parent(from);
     m_tree.rename(from, to);
+    touch_parent(to);
     // now: naive solution
     // TODO: rename paths in the cache
     m_content.delete_file(from);
@@ -353,6 +661,8 @@ void Cache::rename(const Path& from, const Path& to)
 void Cache::exchange(const Path& node1, const Path& node2)
 {
     m_tree.exchange(node1, node2);
+    touch_parent(node1);
+    touch_parent(node2);
     // now: naive solution
     // TODO: exchange paths in the cache
     m_content.delete_file(node1);
@@ -361,6 +671,34 @@ void Cache::exchange(const Path& node1, const Path& node2)
 
 //--------------------------------------------------------------------------
 
+void Cache::invalidate_content(const Path& path)
+{
+    m_content.delete_file(path);
+}
+
+//--------------------------------------------------------------------------
+
+void Cache::set_content_capacity(const size_t capacity)
+{
+    m_content.set_capacity(capacity);
+}
+
+//--------------------------------------------------------------------------
+
+void Cache::shrink_content(const size_t target)
+{
+    m_content.shrink(target);
+}
+
+//--------------------------------------------------------------------------
+
+Content::Stats Cache::get_content_stats() const
+{
+    return m_content.get_stats();
+}
+
+//--------------------------------------------------------------------------
+
 bool Cache::read(const Path& path, const uintmax_t start, const size_t size,
                  const std::function<void(const gsl::span<const uint8_t>)>& store_cb)
 {
@@ -369,10 +707,36 @@ bool Cache::read(const Path& path, const uintmax_t start, const size_t size,
 
 //--------------------------------------------------------------------------
 
+std::vector<Content::Range> Cache::read_partial(const Path& path, const uintmax_t start,
+                                                const gsl::span<uint8_t> output)
+{
+    return m_content.read_partial(path, start, output);
+}
+
+//--------------------------------------------------------------------------
+
 void Cache::write(const Path& path, const uintmax_t start, std::vector<uint8_t> content)
 {
     m_content.write(path, start, content);
 }
 
+//--------------------------------------------------------------------------
+
+void Cache::touch(const Node& node)
+{
+    m_touched.push_back(node.id);
+    m_touched.push_back(node.parent);
+}
+
+//--------------------------------------------------------------------------
+
+void Cache::touch_parent(const Path& path)
+{
+    if (m_tree.exists(path.parent_path()))
+    {
+        m_touched.push_back(std::as_const(m_tree).get_node(path.parent_path()).id);
+    }
+}
+
 //==========================================================================
 } // namespace rewofs::client::cache
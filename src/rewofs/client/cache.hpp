@@ -6,18 +6,29 @@
 #ifndef CACHE_HPP__NCBG14HO
 #define CACHE_HPP__NCBG14HO
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <sys/stat.h>
 
 #include "rewofs/disablewarnings.hpp"
 #include <boost/filesystem.hpp>
-#include <boost/noncopyable.hpp>
 #include <gsl/span>
 #include "rewofs/enablewarnings.hpp"
 
+#include "rewofs/tree.hpp"
+
 namespace std {
     template<>
     struct hash<boost::filesystem::path>
@@ -34,100 +45,237 @@ namespace rewofs::client::cache {
 //==========================================================================
 
 using Path = boost::filesystem::path;
+/// The cache works on the common tree.
+using rewofs::ChildSet;
+using rewofs::copy;
+using rewofs::INVALID_NODE;
+using rewofs::is_same_content;
+using rewofs::NamePool;
+using rewofs::Node;
+using rewofs::NodeId;
+using rewofs::Stat;
+using rewofs::Tree;
+using rewofs::UNKNOWN_HASH;
 
 //==========================================================================
 
-struct Node
-{
-    std::string name{};
-    struct stat st{};
-    // TODO better map structure
-    std::map<std::string, Node> children{};
-
-    Node(const Node&) = delete;
-    Node(Node&&) = default;
-};
-
-//==========================================================================
-
-class Tree
+/// Approximate access frequencies (count-min sketch with 4 bit counters). All
+/// counters are halved after a number of increments proportional to the width so
+/// the old history fades away.
+class FrequencySketch
 {
 public:
-    Tree();
-
-    /// Drop the whole tree.
-    void reset();
+    /// @param items expected number of distinct items of interest
+    explicit FrequencySketch(const size_t items = 1024);
 
-    Node& get_root();
-    const Node& get_root() const;
-    Node& make_node(Node& parent, const std::string& name);
-    Node& get_node(const Path& name);
-    /// Remove a node only if it has no children.
-    void remove_single(const Path& path);
-    Node& make_node(const Path& path);
-    /// Fails if `to` exists.
-    void rename(const Path& from, const Path& to);
-    void exchange(const Path& node1, const Path& node2);
+    void increment(const uint64_t hash);
+    uint8_t frequency(const uint64_t hash) const;
 
 private:
-    Node m_root{};
+    static constexpr size_t DEPTH{4};
+    static constexpr uint8_t MAX_COUNT{15};
+    /// increments per counter before aging
+    static constexpr size_t SAMPLE_FACTOR{10};
+
+    size_t index(const uint64_t hash, const size_t row) const;
+    void age();
+
+    /// DEPTH rows of the same width
+    std::vector<uint8_t> m_counters{};
+    size_t m_width_mask{};
+    size_t m_increments{0};
 };
 
 //==========================================================================
 
-/// Files content cache.
-/// TODO optimize, very naive now
+/// Files content cache. The cached data are kept in extents ordered by offset.
+/// An extent never crosses a page boundary and overlapping or adjacent extents
+/// within a page are merged, so a fully cached page is a single extent and
+/// a write copies at most a page worth of the existing data.
+///
+/// The amount of cached data is limited by a capacity (W-TinyLFU). New pages enter
+/// a small LRU window. Pages leaving the window replace the least recently used
+/// pages of the main LRU only if they were accessed more often (see
+/// FrequencySketch), so a one-shot scan does not flush frequently read files.
 class Content
 {
 public:
+    static constexpr size_t PAGE_SIZE{64 * 1024};
+
+    /// Byte range of a file.
+    struct Range
+    {
+        uintmax_t start{};
+        size_t size{};
+    };
+    /// extent start -> data
+    using Extents = std::map<uintmax_t, std::vector<uint8_t>>;
+
+    struct Stats
+    {
+        /// cached bytes
+        size_t size{};
+        size_t capacity{};
+        size_t pages{};
+        /// number of evicted pages
+        uint64_t evictions{};
+        /// bytes requested by read_partial() found in the cache
+        uint64_t hit_bytes{};
+        /// bytes requested by read_partial() not found in the cache
+        uint64_t miss_bytes{};
+
+        double hit_ratio() const;
+    };
+
     /// Delete all content.
     void reset();
+    /// Evict pages if the current size exceeds the new capacity. Resets the
+    /// frequency history.
+    void set_capacity(const size_t capacity);
+    /// Evict the least recently used pages until the size drops to `target`.
+    void shrink(const size_t target);
+    Stats get_stats() const;
 
-    /// @return false if the block was not found
+    /// @param store_cb called with consecutive pieces of the range, only if the
+    ///                 whole range is cached
+    /// @return false if the range is not cached completely
     bool read(const Path& path, const uintmax_t start, const size_t size,
               const std::function<void(const gsl::span<const uint8_t>)>& store_cb);
+    /// Copy the cached parts of the range starting at `start` to `output`.
+    /// @return the ranges not cached (ordered by offset), the corresponding parts of
+    ///         `output` are left untouched
+    std::vector<Range> read_partial(const Path& path, const uintmax_t start,
+                                    const gsl::span<uint8_t> output);
     void write(const Path& path, const uintmax_t start, std::vector<uint8_t> content);
     /// Delete all blocks related to the path.
     void delete_file(const Path& path);
+    /// Delete all blocks of the files matching the predicate.
+    void delete_files_if(const std::function<bool(const Path&)>& pred);
+
+    /// Merge data into the page extents.
+    /// @param data must not cross a page boundary
+    static void write_page(Extents& extents, const uintmax_t start,
+                           const gsl::span<const uint8_t> data);
+    /// Copy the parts of the range covered by the extents to `output`.
+    /// @return the ranges not covered
+    static std::vector<Range> read_extents(const Extents& extents, const uintmax_t start,
+                                           const gsl::span<uint8_t> output);
 
 private:
-    struct Block
+    /// share of the capacity for the window
+    static constexpr size_t WINDOW_PERCENT{1};
+    /// limits the frequency sketch size for huge capacities
+    static constexpr size_t MAX_SKETCH_PAGES{1u << 20};
+
+    struct PageRef
     {
-        uintmax_t start{};
-        std::vector<uint8_t> content{};
+        /// key of the m_files entry
+        const Path* path{};
+        uintmax_t page_begin{};
+        size_t size{};
+        /// see page_hash()
+        uint64_t hash{};
+        bool in_window{true};
     };
+    /// the most recently used first
+    using Lru = std::list<PageRef>;
 
-    /// Flatten/unify adjacent and overlapping blocks.
-    void flatten(const Path& path);
+    struct File
+    {
+        Extents extents{};
+        /// page start -> position in the window or the main LRU
+        std::unordered_map<uintmax_t, Lru::iterator> pages{};
+    };
+    using Files = std::unordered_map<Path, File>;
+
+    static size_t page_size(const Extents& extents, const uintmax_t page_begin);
+    static uint64_t page_hash(const Path& path, const uintmax_t page_begin);
+    /// Count an access to the pages overlapping the range and mark the cached ones
+    /// as the most recently used.
+    /// @param file nullptr if nothing is cached
+    void touch(const Path& path, File* const file, const uintmax_t start,
+               const uintmax_t end);
+    Lru& lru_of(const PageRef& page);
+    /// Move pages from the overflowing window to the main LRU if they win against
+    /// the main LRU victims, then evict down to the capacity.
+    void admit();
+    void evict_page(const Lru::iterator page);
+    Files::iterator erase_file(const Files::iterator it);
 
-    std::unordered_map<Path, std::list<Block>> m_blocks{};
+    Files m_files{};
+    Lru m_window{};
+    Lru m_main{};
+    FrequencySketch m_sketch{};
+    size_t m_size{0};
+    size_t m_window_size{0};
+    size_t m_capacity{std::numeric_limits<size_t>::max()};
+    uint64_t m_evictions{0};
+    uint64_t m_hit_bytes{0};
+    uint64_t m_miss_bytes{0};
 };
 
 //==========================================================================
 
-/// Wrapper around Tree and Content
+/// Wrapper around Tree and Content.
+///
+/// Writers modify the tree and the content with the lock held. Tree changes are
+/// not visible to snapshot() readers until publish() is called.
 class Cache
 {
 public:
     std::unique_lock<std::mutex> lock();
+    /// The last published tree version. Does not need the lock, the snapshot
+    /// stays unchanged and valid as long as the caller holds it.
+    std::shared_ptr<const Tree> snapshot() const;
+    /// Make the tree modifications visible to the readers. The directory hashes
+    /// are updated first. Invalidates references to the nodes (see
+    /// Tree::compact_names()).
+    void publish();
     void reset();
+    /// Replace the tree and hash it. Content is kept only for files which are
+    /// present in both trees and did not change (see is_same_content()).
+    void reset(Tree tree);
 
+    /// The working (unpublished) tree version.
+    const Tree& get_tree() const;
     Node& get_root();
     const Node& get_root() const;
-    Node& make_node(Node& parent, const std::string& name);
+    Node& make_node(Node& parent, const std::string_view name);
     Node& get_node(const Path& name);
+    bool exists(const Path& path) const;
+    bool has_child(const Node& parent, const std::string_view name) const;
     void remove_single(const Path& path);
+    /// Remove a subtree including the content of its files.
+    void remove(const Path& path);
     Node& make_node(const Path& path);
     void rename(const Path& from, const Path& to);
     void exchange(const Path& node1, const Path& node2);
+    /// Drop the cached content of a file.
+    void invalidate_content(const Path& path);
+    void set_content_capacity(const size_t capacity);
+    /// Evict the least recently used content until its size drops to `target`.
+    void shrink_content(const size_t target);
+    Content::Stats get_content_stats() const;
     bool read(const Path& path, const uintmax_t start, const size_t size,
               const std::function<void(const gsl::span<const uint8_t>)>& store_cb);
+    /// @copydoc Content::read_partial
+    std::vector<Content::Range> read_partial(const Path& path, const uintmax_t start,
+                                             const gsl::span<uint8_t> output);
     void write(const Path& path, const uintmax_t start, std::vector<uint8_t> content);
 
 private:
+    /// Let publish() rehash the node (a directory) and its parent.
+    void touch(const Node& node);
+    void touch_parent(const Path& path);
+
     cache::Tree m_tree{};
+    /// nodes which may have changed since the last publish(), see
+    /// Tree::rehash_ancestors()
+    std::vector<NodeId> m_touched{};
     cache::Content m_content{};
     std::mutex m_mutex{};
+    /// accessed only through std::atomic_load/std::atomic_store
+    std::shared_ptr<const Tree> m_snapshot{std::make_shared<const Tree>()};
 };
 
 //==========================================================================
@@ -0,0 +1,485 @@
+/// @copydoc disk_store.hpp
+///
+/// @file
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <utility>
+
+#include "rewofs/client/disk_store.hpp"
+#include "rewofs/hash.hpp"
+#include "rewofs/log.hpp"
+
+//==========================================================================
+namespace rewofs::client::cache {
+//==========================================================================
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+constexpr uint32_t PAGE_MAGIC{0x50445752}; // "RWDP"
+constexpr uint32_t PAGE_VERSION{1};
+constexpr size_t KEY_DIGITS{16};
+
+/// Page file layout: header, path, (ExtentHeader, data)*.
+struct PageHeader
+{
+    uint32_t magic{};
+    uint32_t version{};
+    uint64_t page_begin{};
+    int64_t st_size{};
+    int64_t mtime_sec{};
+    int64_t mtime_nsec{};
+    int64_t ctime_sec{};
+    int64_t ctime_nsec{};
+    uint32_t st_mode{};
+    uint32_t path_size{};
+    uint32_t extents_count{};
+    uint32_t reserved{};
+};
+
+struct ExtentHeader
+{
+    uint64_t start{};
+    uint64_t size{};
+};
+
+} // namespace
+
+//==========================================================================
+
+DiskStore::~DiskStore()
+{
+    persist_recency();
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::open(const Path& directory, const size_t capacity)
+{
+    std::lock_guard<std::mutex> lg{m_mutex};
+
+    fs::create_directories(directory);
+    m_directory = directory;
+    m_capacity = capacity;
+    m_size = 0;
+    m_lru.clear();
+    m_index.clear();
+    m_used.clear();
+
+    struct Found
+    {
+        uint64_t key;
+        size_t size;
+        std::time_t time;
+    };
+    std::vector<Found> found{};
+    for (const auto& item: fs::directory_iterator{directory})
+    {
+        const auto& path = item.path();
+        boost::system::error_code ec{};
+        if (path.extension() == ".tmp")
+        {
+            // an interrupted store
+            fs::remove(path, ec);
+            continue;
+        }
+        const auto name = path.filename().native();
+        if ((name.size() != KEY_DIGITS) or not fs::is_regular_file(item.status()))
+        {
+            continue;
+        }
+        char* end{};
+        const auto key = std::strtoull(name.c_str(), &end, 16);
+        const auto size = fs::file_size(path, ec);
+        const auto time = fs::last_write_time(path, ec);
+        if ((end != name.c_str() + name.size()) or ec)
+        {
+            continue;
+        }
+        found.push_back({key, static_cast<size_t>(size), time});
+    }
+
+    // the most recently used first
+    std::sort(found.begin(), found.end(),
+              [](const Found& f1, const Found& f2) { return f1.time > f2.time; });
+    for (const auto& page: found)
+    {
+        m_lru.push_back({page.key, page.size});
+        m_index.emplace(page.key, std::prev(m_lru.end()));
+        m_size += page.size;
+    }
+
+    log_info("disk cache {}: {} pages, {} bytes", directory.native(), m_lru.size(),
+             m_size);
+    evict();
+}
+
+//--------------------------------------------------------------------------
+
+bool DiskStore::is_open() const
+{
+    std::lock_guard<std::mutex> lg{m_mutex};
+    return not m_directory.empty();
+}
+
+//--------------------------------------------------------------------------
+
+DiskStore::Stats DiskStore::get_stats() const
+{
+    std::lock_guard<std::mutex> lg{m_mutex};
+    return {m_size, m_capacity, m_lru.size(), m_evictions, m_hit_bytes};
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<Content::Range> DiskStore::read(const Path& path, const Stat& st,
+                                            const uintmax_t start,
+                                            const gsl::span<uint8_t> output)
+{
+    std::unique_lock<std::mutex> lg{m_mutex};
+    const auto directory = m_directory;
+    std::vector<std::pair<uintmax_t, uint64_t>> stored{};
+    const auto end = start + output.size();
+    for (auto page_begin = start - start % Content::PAGE_SIZE;
+         (not directory.empty()) and (page_begin < end);
+         page_begin += Content::PAGE_SIZE)
+    {
+        const auto key = page_key(path, page_begin);
+        if (m_index.count(key) > 0)
+        {
+            stored.emplace_back(page_begin, key);
+        }
+    }
+    lg.unlock();
+
+    Content::Extents extents{};
+    std::vector<uint64_t> changed{};
+    std::vector<uint64_t> loaded{};
+    for (const auto& [page_begin, key]: stored)
+    {
+        auto page = load_page(directory, key, path, st, page_begin);
+        if (page.has_value())
+        {
+            extents.merge(*page);
+            loaded.push_back(key);
+        }
+        else
+        {
+            changed.push_back(key);
+        }
+    }
+
+    const auto missing = Content::read_extents(extents, start, output);
+    size_t missing_size{0};
+    for (const auto& range: missing)
+    {
+        missing_size += range.size;
+    }
+
+    lg.lock();
+    // the file has changed
+    for (const auto key: changed)
+    {
+        if (m_index.count(key) > 0)
+        {
+            erase(key);
+        }
+    }
+    const auto now = std::time(nullptr);
+    for (const auto key: loaded)
+    {
+        const auto it = m_index.find(key);
+        if (it == m_index.end())
+        {
+            continue;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        if (it->second->used == 0)
+        {
+            m_used.push_back(key);
+        }
+        it->second->used = now;
+    }
+    m_hit_bytes += output.size() - missing_size;
+    return missing;
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::write(const Path& path, const Stat& st, const uintmax_t start,
+                      const gsl::span<const uint8_t> data)
+{
+    std::unique_lock<std::mutex> lg{m_mutex};
+    const auto directory = m_directory;
+    lg.unlock();
+    if (directory.empty())
+    {
+        return;
+    }
+
+    const auto end = start + data.size();
+    for (auto pos = start; pos < end;)
+    {
+        const auto page_begin = pos - pos % Content::PAGE_SIZE;
+        const auto page_end = std::min<uintmax_t>(end, page_begin + Content::PAGE_SIZE);
+        const auto key = page_key(path, page_begin);
+
+        // merge with the stored page of the same file version
+        lg.lock();
+        const auto is_stored = m_index.count(key) > 0;
+        lg.unlock();
+        std::optional<Content::Extents> extents{};
+        if (is_stored)
+        {
+            extents = load_page(directory, key, path, st, page_begin);
+        }
+        if (not extents.has_value())
+        {
+            extents.emplace();
+        }
+        const auto begin = data.data() + (pos - start);
+        Content::write_page(*extents, pos, {begin, begin + (page_end - pos)});
+
+        // concurrent stores of the same page must not share the file
+        auto tmp = entry_path(directory, key);
+        tmp += fmt::format(".{}.tmp", m_tmp_counter++);
+        const auto size = store_page(tmp, path, st, page_begin, *extents);
+        lg.lock();
+        if (size > 0)
+        {
+            commit_page(tmp, key, size);
+        }
+        else if (m_index.count(key) > 0)
+        {
+            erase(key);
+        }
+        lg.unlock();
+        pos = page_end;
+    }
+
+    lg.lock();
+    evict();
+    lg.unlock();
+    persist_recency();
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t DiskStore::page_key(const Path& path, const uintmax_t page_begin)
+{
+    return hash_bytes(path.native(), page_begin);
+}
+
+//--------------------------------------------------------------------------
+
+Path DiskStore::entry_path(const Path& directory, const uint64_t key)
+{
+    return directory / fmt::format("{:016x}", key);
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<Content::Extents> DiskStore::load_page(const Path& directory,
+                                                     const uint64_t key, const Path& path,
+                                                     const Stat& st,
+                                                     const uintmax_t page_begin)
+{
+    std::ifstream file{entry_path(directory, key).native(), std::ios::binary};
+    PageHeader header{};
+    if (not file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return std::nullopt;
+    }
+    if ((header.magic != PAGE_MAGIC) or (header.version != PAGE_VERSION)
+        or (header.page_begin != page_begin)
+        or (header.path_size != path.native().size()))
+    {
+        return std::nullopt;
+    }
+
+    Stat stored{};
+    stored.st_mode = static_cast<mode_t>(header.st_mode);
+    stored.st_size = static_cast<off_t>(header.st_size);
+    stored.st_mtim.tv_sec = static_cast<time_t>(header.mtime_sec);
+    stored.st_mtim.tv_nsec = static_cast<long>(header.mtime_nsec);
+    stored.st_ctim.tv_sec = static_cast<time_t>(header.ctime_sec);
+    stored.st_ctim.tv_nsec = static_cast<long>(header.ctime_nsec);
+    if (not is_same_content(stored, st))
+    {
+        return std::nullopt;
+    }
+
+    // a different path with the same key
+    std::string stored_path(header.path_size, '\0');
+    if (not file.read(stored_path.data(), static_cast<std::streamsize>(stored_path.size()))
+        or (stored_path != path.native()))
+    {
+        return std::nullopt;
+    }
+
+    Content::Extents extents{};
+    for (uint32_t i = 0; i < header.extents_count; ++i)
+    {
+        ExtentHeader extent{};
+        if (not file.read(reinterpret_cast<char*>(&extent), sizeof(extent)))
+        {
+            return std::nullopt;
+        }
+        if ((extent.start < page_begin) or (extent.size > Content::PAGE_SIZE)
+            or (extent.start + extent.size > page_begin + Content::PAGE_SIZE))
+        {
+            return std::nullopt;
+        }
+        std::vector<uint8_t> data(extent.size);
+        if (not file.read(reinterpret_cast<char*>(data.data()),
+                          static_cast<std::streamsize>(data.size())))
+        {
+            return std::nullopt;
+        }
+        extents.emplace(extent.start, std::move(data));
+    }
+    return extents;
+}
+
+//--------------------------------------------------------------------------
+
+size_t DiskStore::store_page(const Path& tmp, const Path& path, const Stat& st,
+                             const uintmax_t page_begin, const Content::Extents& extents)
+{
+    PageHeader header{};
+    header.magic = PAGE_MAGIC;
+    header.version = PAGE_VERSION;
+    header.page_begin = page_begin;
+    header.st_size = st.st_size;
+    header.mtime_sec = st.st_mtim.tv_sec;
+    header.mtime_nsec = st.st_mtim.tv_nsec;
+    header.ctime_sec = st.st_ctim.tv_sec;
+    header.ctime_nsec = st.st_ctim.tv_nsec;
+    header.st_mode = st.st_mode;
+    header.path_size = static_cast<uint32_t>(path.native().size());
+    header.extents_count = static_cast<uint32_t>(extents.size());
+
+    size_t size{sizeof(header) + path.native().size()};
+    {
+        std::ofstream file{tmp.native(), std::ios::binary | std::ios::trunc};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(path.native().data(),
+                   static_cast<std::streamsize>(path.native().size()));
+        for (const auto& item: extents)
+        {
+            const ExtentHeader extent{item.first, item.second.size()};
+            file.write(reinterpret_cast<const char*>(&extent), sizeof(extent));
+            file.write(reinterpret_cast<const char*>(item.second.data()),
+                       static_cast<std::streamsize>(item.second.size()));
+            size += sizeof(extent) + item.second.size();
+        }
+        file.flush();
+        if (not file)
+        {
+            log_warning("can't write {}", tmp.native());
+            boost::system::error_code ec{};
+            fs::remove(tmp, ec);
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::commit_page(const Path& tmp, const uint64_t key, const size_t size)
+{
+    // the page is replaced atomically, a reader never sees a partial file
+    const auto target = entry_path(m_directory, key);
+    boost::system::error_code ec{};
+    fs::rename(tmp, target, ec);
+    if (ec)
+    {
+        log_warning("can't store {}: {}", target.native(), ec.message());
+        fs::remove(tmp, ec);
+        if (m_index.count(key) > 0)
+        {
+            erase(key);
+        }
+        return;
+    }
+    insert(key, size);
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::insert(const uint64_t key, const size_t size)
+{
+    const auto it = m_index.find(key);
+    if (it == m_index.end())
+    {
+        m_lru.push_front({key, size});
+        m_index.emplace(key, m_lru.begin());
+    }
+    else
+    {
+        m_size -= it->second->size;
+        it->second->size = size;
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+    }
+    m_size += size;
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::erase(const uint64_t key)
+{
+    const auto it = m_index.find(key);
+    assert(it != m_index.end());
+    boost::system::error_code ec{};
+    fs::remove(entry_path(m_directory, key), ec);
+    m_size -= it->second->size;
+    m_lru.erase(it->second);
+    m_index.erase(it);
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::evict()
+{
+    while ((m_size > m_capacity) and not m_lru.empty())
+    {
+        erase(m_lru.back().key);
+        ++m_evictions;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void DiskStore::persist_recency()
+{
+    std::vector<std::pair<uint64_t, std::time_t>> used{};
+    std::unique_lock<std::mutex> lg{m_mutex};
+    const auto directory = m_directory;
+    for (const auto key: m_used)
+    {
+        const auto it = m_index.find(key);
+        // a duplicate or a page stored again after the use
+        if ((it != m_index.end()) and (it->second->used != 0))
+        {
+            used.emplace_back(key, std::exchange(it->second->used, 0));
+        }
+    }
+    m_used.clear();
+    lg.unlock();
+
+    // open() orders the pages by the mtimes
+    for (const auto& [key, time]: used)
+    {
+        boost::system::error_code ec{};
+        fs::last_write_time(entry_path(directory, key), time, ec);
+    }
+}
+
+//==========================================================================
+} // namespace rewofs::client::cache
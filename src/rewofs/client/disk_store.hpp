@@ -0,0 +1,121 @@
+/// Persistent content cache.
+///
+/// @file
+
+#pragma once
+#ifndef DISK_STORE_HPP__J6RPX2VE
+#define DISK_STORE_HPP__J6RPX2VE
+
+#include <atomic>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <gsl/span>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/cache.hpp"
+
+//==========================================================================
+namespace rewofs::client::cache {
+//==========================================================================
+
+/// Content pages kept in a local directory, a file per page. Every page is
+/// tagged with the file attributes (see is_same_content()) it was fetched at, so
+/// it is used only while the file is unchanged on the server. The stored size is
+/// limited, the least recently used pages are removed.
+///
+/// The store is optional, all methods are no-op until open() is called. Thread
+/// safe, the page data are read and written without holding the index lock. The use
+/// order is kept in the memory and stored as the page file mtimes lazily (by
+/// write() and on destruction).
+class DiskStore : private boost::noncopyable
+{
+public:
+    struct Stats
+    {
+        /// stored bytes including the page headers
+        size_t size{};
+        size_t capacity{};
+        size_t pages{};
+        /// number of removed pages
+        uint64_t evictions{};
+        /// bytes requested by read() found in the store
+        uint64_t hit_bytes{};
+    };
+
+    ~DiskStore();
+
+    /// Index the pages present in the directory (created if missing).
+    void open(const Path& directory, const size_t capacity);
+    bool is_open() const;
+    Stats get_stats() const;
+
+    /// Copy the stored parts of the range starting at `start` to `output`.
+    /// Pages stored for other file attributes are removed.
+    /// @return the ranges not stored
+    std::vector<Content::Range> read(const Path& path, const Stat& st,
+                                     const uintmax_t start,
+                                     const gsl::span<uint8_t> output);
+    /// Store file data fetched while the file had the attributes `st`.
+    void write(const Path& path, const Stat& st, const uintmax_t start,
+               const gsl::span<const uint8_t> data);
+
+private:
+    struct Entry
+    {
+        uint64_t key{};
+        size_t size{};
+        /// the last use not stored in the page file yet, 0 if none
+        std::time_t used{0};
+    };
+    /// the most recently used first
+    using Lru = std::list<Entry>;
+
+    static uint64_t page_key(const Path& path, const uintmax_t page_begin);
+    static Path entry_path(const Path& directory, const uint64_t key);
+    /// @return nullopt if the page is not stored for the path and attributes
+    static std::optional<Content::Extents> load_page(const Path& directory,
+                                                     const uint64_t key, const Path& path,
+                                                     const Stat& st,
+                                                     const uintmax_t page_begin);
+    /// Write a temporary page file, see commit_page().
+    /// @return the size of the page file, 0 on failure
+    static size_t store_page(const Path& tmp, const Path& path, const Stat& st,
+                             const uintmax_t page_begin,
+                             const Content::Extents& extents);
+    /// Replace the page file by the stored temporary one and index it. The page
+    /// files are renamed and removed only under the lock so the index matches
+    /// them.
+    void commit_page(const Path& tmp, const uint64_t key, const size_t size);
+    void insert(const uint64_t key, const size_t size);
+    void erase(const uint64_t key);
+    /// Remove the least recently used pages until the size fits the capacity.
+    void evict();
+    /// Store the recent uses as the page file mtimes (see open()).
+    void persist_recency();
+
+    mutable std::mutex m_mutex{};
+    Path m_directory{};
+    size_t m_capacity{0};
+    size_t m_size{0};
+    Lru m_lru{};
+    std::unordered_map<uint64_t, Lru::iterator> m_index{};
+    /// keys of the pages used since persist_recency()
+    std::vector<uint64_t> m_used{};
+    uint64_t m_evictions{0};
+    uint64_t m_hit_bytes{0};
+    /// unique temporary names of concurrent stores
+    std::atomic<uint64_t> m_tmp_counter{0};
+};
+
+//==========================================================================
+} // namespace rewofs::client::cache
+
+#endif /* include guard */
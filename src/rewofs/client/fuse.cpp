@@ -222,7 +222,7 @@ static int create(const char* path, mode_t mode, struct fuse_file_info* fi) noex
     log_trace("path:{} mode:{:o}", path, mode);
     try
     {
-        fi->fh = g_vfs->create(path, fi->flags, mode).value_of();
+        fi->fh = g_vfs->create(path, fi->flags, mode).fh.value_of();
         log_trace("handle:{}", fi->fh);
     }
     catch (...)
@@ -285,7 +285,8 @@ static int write(const char* path, const char* input, size_t size, off_t offset,
     {
         return static_cast<int>(
             g_vfs->write(IVfs::FileHandle{fi->fh},
-                         {reinterpret_cast<const uint8_t*>(input), size}, offset));
+                         {reinterpret_cast<const uint8_t*>(input), size}, offset)
+                .size);
     }
     catch (...)
     {
@@ -293,6 +294,115 @@ static int write(const char* path, const char* input, size_t size, off_t offset,
     }
 }
 
+static int flush(const char* path, struct fuse_file_info* fi) noexcept
+{
+    log_trace("path:{} handle:{}", path, fi->fh);
+    try
+    {
+        g_vfs->flush(IVfs::FileHandle{fi->fh});
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+static int fsync(const char* path, int datasync, struct fuse_file_info* fi) noexcept
+{
+    log_trace("path:{} handle:{} datasync:{}", path, fi->fh, datasync);
+    try
+    {
+        g_vfs->fsync(IVfs::FileHandle{fi->fh}, datasync != 0);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+static int fallocate(const char* path, int mode, off_t offset, off_t length,
+                     struct fuse_file_info* fi) noexcept
+{
+    log_trace("path:{} handle:{} mode:{} ofs:{} len:{}", path, fi->fh, mode, offset,
+              length);
+    try
+    {
+        g_vfs->fallocate(IVfs::FileHandle{fi->fh}, mode, offset, length);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8)
+static off_t lseek(const char* path, off_t offset, int whence,
+                   struct fuse_file_info* fi) noexcept
+{
+    log_trace("path:{} handle:{} ofs:{} whence:{}", path, fi->fh, offset, whence);
+    try
+    {
+        return g_vfs->lseek(IVfs::FileHandle{fi->fh}, offset, whence);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+}
+#endif
+
+static int statfs(const char* path, struct statvfs* stbuf) noexcept
+{
+    log_trace("path:{}", path);
+    try
+    {
+        g_vfs->statfs(path, *stbuf);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+static int access(const char* path, int mask) noexcept
+{
+    log_trace("path:{} mask:{}", path, mask);
+    try
+    {
+        g_vfs->access(path, mask);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+static int opendir(const char* path, struct fuse_file_info*) noexcept
+{
+    log_trace("path:{}", path);
+    try
+    {
+        g_vfs->opendir(path);
+    }
+    catch (...)
+    {
+        return gen_return_error_code();
+    }
+    return 0;
+}
+
+/// The directories are read by paths, there is no handle to release.
+static int releasedir(const char* path, struct fuse_file_info*) noexcept
+{
+    log_trace("path:{}", path);
+    return 0;
+}
+
 //==========================================================================
 } // namespace callbacks
 //==========================================================================
@@ -318,6 +428,16 @@ Fuse::Fuse(IVfs& vfs)
     g_oper.release = callbacks::release;
     g_oper.read = callbacks::read;
     g_oper.write = callbacks::write;
+    g_oper.flush = callbacks::flush;
+    g_oper.fsync = callbacks::fsync;
+    g_oper.fallocate = callbacks::fallocate;
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 8)
+    g_oper.lseek = callbacks::lseek;
+#endif
+    g_oper.statfs = callbacks::statfs;
+    g_oper.access = callbacks::access;
+    g_oper.opendir = callbacks::opendir;
+    g_oper.releasedir = callbacks::releasedir;
 }
 
 //--------------------------------------------------------------------------
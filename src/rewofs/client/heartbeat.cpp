@@ -9,10 +9,11 @@ namespace rewofs::client {
 //==========================================================================
 
 Heartbeat::Heartbeat(Serializer& serializer, Deserializer& deserializer,
-                     BackgroundLoader& loader)
+                     BackgroundLoader& loader, RemoteVfs& remote_vfs)
     : m_serializer{serializer}
     , m_deserializer{deserializer}
     , m_loader{loader}
+    , m_remote_vfs{remote_vfs}
 {
 }
 
@@ -57,7 +58,7 @@ void Heartbeat::run()
         {
             if (not m_connected)
             {
-                on_connect();
+                on_connect(res.message());
                 m_connected = true;
             }
             std::this_thread::sleep_for(std::chrono::seconds{1});
@@ -75,10 +76,17 @@ void Heartbeat::run()
 
 //--------------------------------------------------------------------------
 
-void Heartbeat::on_connect()
+void Heartbeat::on_connect(const messages::Pong& pong)
 {
     log_info("connected");
-    m_loader.invalidate_tree();
+    cache::TreeTag server{};
+    if (pong.server_id() != nullptr)
+    {
+        server.server_id = pong.server_id()->str();
+    }
+    server.generation = pong.generation();
+    m_remote_vfs.set_capabilities(pong.capabilities());
+    m_loader.connected(server, pong.capabilities());
 }
 
 //--------------------------------------------------------------------------
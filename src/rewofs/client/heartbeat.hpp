@@ -18,19 +18,21 @@ namespace rewofs::client {
 class Heartbeat
 {
 public:
-    Heartbeat(Serializer& serializer, Deserializer& deserializer, BackgroundLoader& loader);
+    Heartbeat(Serializer& serializer, Deserializer& deserializer, BackgroundLoader& loader,
+              RemoteVfs& remote_vfs);
     void start();
     void stop();
     void wait();
 
 private:
     void run();
-    void on_connect();
+    void on_connect(const messages::Pong& pong);
     void on_disconnect();
 
     Serializer& m_serializer;
     Deserializer& m_deserializer;
     BackgroundLoader& m_loader;
+    RemoteVfs& m_remote_vfs;
     std::thread m_runner{};
     std::atomic<bool> m_quit{false};
     Serializer::QueueRef m_queue{m_serializer.new_queue(Serializer::PRIORITY_HIGH)};
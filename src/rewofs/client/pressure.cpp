@@ -0,0 +1,252 @@
+/// @copydoc pressure.hpp
+///
+/// @file
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "rewofs/client/pressure.hpp"
+#include "rewofs/log.hpp"
+
+//==========================================================================
+namespace rewofs::client {
+//==========================================================================
+
+/// Call `func(line)` for all lines of the content.
+template<typename _Func>
+static void for_each_line(std::string_view content, _Func&& func)
+{
+    while (not content.empty())
+    {
+        const auto eol = content.find('\n');
+        func(content.substr(0, eol));
+        if (eol == std::string_view::npos)
+        {
+            break;
+        }
+        content.remove_prefix(eol + 1);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+static std::optional<std::string> read_file(const std::string& path)
+{
+    std::ifstream file{path};
+    if (not file)
+    {
+        return std::nullopt;
+    }
+    std::stringstream content{};
+    content << file.rdbuf();
+    return content.str();
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<double> parse_psi_some_avg10(const std::string_view content)
+{
+    static constexpr std::string_view PREFIX{"some "};
+    static constexpr std::string_view FIELD{"avg10="};
+
+    std::optional<double> res{};
+    for_each_line(content, [&res](const std::string_view line) {
+        if (line.substr(0, PREFIX.size()) != PREFIX)
+        {
+            return;
+        }
+        const auto pos = line.find(FIELD);
+        if (pos == std::string_view::npos)
+        {
+            return;
+        }
+        const std::string value{line.substr(pos + FIELD.size())};
+        char* end{};
+        const auto avg = std::strtod(value.c_str(), &end);
+        if (end != value.c_str())
+        {
+            res = avg;
+        }
+    });
+    return res;
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<uint64_t> parse_memory_events(const std::string_view content)
+{
+    std::optional<uint64_t> res{};
+    for_each_line(content, [&res](const std::string_view line) {
+        const auto sep = line.find(' ');
+        const auto name = line.substr(0, sep);
+        if ((sep == std::string_view::npos) or ((name != "high") and (name != "max")))
+        {
+            return;
+        }
+        const std::string value{line.substr(sep + 1)};
+        char* end{};
+        const auto counter = std::strtoull(value.c_str(), &end, 10);
+        if (end != value.c_str())
+        {
+            res = res.value_or(0) + counter;
+        }
+    });
+    return res;
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<std::string> parse_cgroup_path(const std::string_view content)
+{
+    // cgroup v2 has only the hierarchy 0 without controllers
+    static constexpr std::string_view PREFIX{"0::"};
+
+    std::optional<std::string> res{};
+    for_each_line(content, [&res](const std::string_view line) {
+        if (line.substr(0, PREFIX.size()) == PREFIX)
+        {
+            res = std::string{line.substr(PREFIX.size())};
+        }
+    });
+    return res;
+}
+
+//==========================================================================
+
+PressureMonitor::PressureMonitor(cache::Cache& cache)
+    : m_cache{cache}
+{
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::start()
+{
+    m_runner = std::thread{&PressureMonitor::run, this};
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::stop()
+{
+    m_quit = true;
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::wait()
+{
+    if (m_runner.joinable())
+    {
+        m_runner.join();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::request_stats()
+{
+    m_stats_requested = true;
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::run()
+{
+    log_info("starting memory pressure monitor");
+
+    const auto cgroup = read_file("/proc/self/cgroup");
+    const auto cgroup_path = cgroup.has_value() ? parse_cgroup_path(*cgroup) : std::nullopt;
+    if (cgroup_path.has_value())
+    {
+        m_memory_events_path = "/sys/fs/cgroup" + *cgroup_path + "/memory.events";
+        // only the events from now on
+        has_memory_events();
+    }
+
+    while (not m_quit)
+    {
+        if (m_stats_requested.exchange(false))
+        {
+            log_stats();
+        }
+
+        // the cgroup limits are hard, do not wait for them
+        const auto events = has_memory_events();
+        const auto holdoff_passed
+            = std::chrono::steady_clock::now() - m_last_shrink >= PSI_HOLDOFF;
+        if (events or (holdoff_passed and has_psi_pressure()))
+        {
+            shrink();
+        }
+
+        std::this_thread::sleep_for(CHECK_PERIOD);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+bool PressureMonitor::has_psi_pressure() const
+{
+    const auto content = read_file("/proc/pressure/memory");
+    if (not content.has_value())
+    {
+        return false;
+    }
+    const auto avg10 = parse_psi_some_avg10(*content);
+    return avg10.has_value() and (*avg10 >= PSI_THRESHOLD);
+}
+
+//--------------------------------------------------------------------------
+
+bool PressureMonitor::has_memory_events()
+{
+    if (m_memory_events_path.empty())
+    {
+        return false;
+    }
+    const auto content = read_file(m_memory_events_path);
+    const auto events = content.has_value() ? parse_memory_events(*content) : std::nullopt;
+    if (not events.has_value())
+    {
+        m_memory_events_path.clear();
+        return false;
+    }
+    const auto changed = *events != m_memory_events;
+    m_memory_events = *events;
+    return changed;
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::shrink()
+{
+    m_last_shrink = std::chrono::steady_clock::now();
+
+    auto lg = m_cache.lock();
+    const auto size = m_cache.get_content_stats().size;
+    m_cache.shrink_content(size / 2);
+    lg.unlock();
+
+    if (size > 0)
+    {
+        log_info("memory pressure, content cache shrunk from {} to {} bytes", size,
+                 size / 2);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void PressureMonitor::log_stats()
+{
+    auto lg = m_cache.lock();
+    const auto stats = m_cache.get_content_stats();
+    lg.unlock();
+
+    log_info("content cache: {} of {} bytes in {} pages, {} evictions, hit ratio {:.3f}",
+             stats.size, stats.capacity, stats.pages, stats.evictions, stats.hit_ratio());
+}
+
+//==========================================================================
+} // namespace rewofs::client
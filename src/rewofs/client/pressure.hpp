@@ -0,0 +1,70 @@
+/// Memory pressure response.
+///
+/// @file
+
+#pragma once
+#ifndef PRESSURE_HPP__W3KQZ7PA
+#define PRESSURE_HPP__W3KQZ7PA
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "rewofs/client/cache.hpp"
+
+//==========================================================================
+namespace rewofs::client {
+//==========================================================================
+
+/// @return "avg10" of the "some" line of a PSI file (/proc/pressure/memory)
+std::optional<double> parse_psi_some_avg10(const std::string_view content);
+/// @return sum of the "high" and "max" counters of a cgroup v2 memory.events file
+std::optional<uint64_t> parse_memory_events(const std::string_view content);
+/// @return cgroup v2 path from /proc/self/cgroup
+std::optional<std::string> parse_cgroup_path(const std::string_view content);
+
+//==========================================================================
+
+/// Shrinks the content cache when the kernel reports memory pressure (PSI) or the
+/// process cgroup hits its memory limits. Logs the cache statistics on request.
+class PressureMonitor
+{
+public:
+    PressureMonitor(cache::Cache& cache);
+    void start();
+    void stop();
+    void wait();
+    /// Log the cache statistics. Can be called from a signal handler.
+    void request_stats();
+
+private:
+    static constexpr std::chrono::seconds CHECK_PERIOD{1};
+    /// PSI "some avg10" threshold in percents
+    static constexpr double PSI_THRESHOLD{10.0};
+    /// the PSI average stays high for a while after the pressure is gone
+    static constexpr std::chrono::seconds PSI_HOLDOFF{10};
+
+    void run();
+    bool has_psi_pressure() const;
+    /// @return true if the cgroup memory limits were hit since the last call
+    bool has_memory_events();
+    void shrink();
+    void log_stats();
+
+    cache::Cache& m_cache;
+    std::thread m_runner{};
+    std::atomic<bool> m_quit{false};
+    std::atomic<bool> m_stats_requested{false};
+    /// empty if cgroup v2 memory events are not available
+    std::string m_memory_events_path{};
+    uint64_t m_memory_events{0};
+    std::chrono::steady_clock::time_point m_last_shrink{};
+};
+
+//==========================================================================
+} // namespace rewofs::client
+
+#endif /* include guard */
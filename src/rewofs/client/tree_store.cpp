@@ -0,0 +1,275 @@
+/// @copydoc tree_store.hpp
+///
+/// @file
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/scope_exit.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/tree_store.hpp"
+#include "rewofs/log.hpp"
+
+//==========================================================================
+namespace rewofs::client::cache {
+//==========================================================================
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+constexpr uint32_t TREE_MAGIC{0x54445752}; // "RWDT"
+constexpr uint32_t TREE_VERSION{2};
+
+/// File layout: header, endpoint, server ID, (NodeRecord, name)* in pre-order.
+struct TreeHeader
+{
+    uint32_t magic{};
+    uint32_t version{};
+    uint64_t generation{};
+    uint64_t nodes{};
+    uint32_t endpoint_size{};
+    uint32_t server_id_size{};
+};
+
+struct NodeRecord
+{
+    /// index of the parent record, the root has none
+    uint32_t parent{};
+    uint32_t name_size{};
+    uint32_t st_mode{};
+    uint32_t flags{};
+    int64_t st_size{};
+    int64_t mtime_sec{};
+    int64_t mtime_nsec{};
+    int64_t ctime_sec{};
+    int64_t ctime_nsec{};
+    /// Node::hash of an unloaded directory, the others are hashed when needed
+    uint64_t hash{};
+};
+
+constexpr uint32_t NO_PARENT{std::numeric_limits<uint32_t>::max()};
+constexpr uint32_t FLAG_UNLOADED{1u << 0};
+
+//--------------------------------------------------------------------------
+
+/// Bounds checked reader of the mapped file.
+class Cursor
+{
+public:
+    Cursor(const char* const data, const size_t size)
+        : m_data{data}
+        , m_end{data + size}
+    {
+    }
+
+    template<typename _Pod>
+    bool read(_Pod& value)
+    {
+        if (static_cast<size_t>(m_end - m_data) < sizeof(value))
+        {
+            return false;
+        }
+        std::memcpy(&value, m_data, sizeof(value));
+        m_data += sizeof(value);
+        return true;
+    }
+
+    std::optional<std::string_view> read_string(const size_t size)
+    {
+        if (static_cast<size_t>(m_end - m_data) < size)
+        {
+            return std::nullopt;
+        }
+        const std::string_view res{m_data, size};
+        m_data += size;
+        return res;
+    }
+
+private:
+    const char* m_data{};
+    const char* const m_end{};
+};
+
+//--------------------------------------------------------------------------
+
+void write_node(std::ofstream& file, const Tree& tree, const Node& node,
+                const uint32_t parent, uint32_t& index)
+{
+    const auto name = Tree::get_name(node);
+    NodeRecord record{};
+    record.parent = parent;
+    record.name_size = static_cast<uint32_t>(name.size());
+    record.st_mode = node.st.st_mode;
+    record.flags = node.unloaded ? FLAG_UNLOADED : 0;
+    record.st_size = node.st.st_size;
+    record.mtime_sec = node.st.st_mtim.tv_sec;
+    record.mtime_nsec = node.st.st_mtim.tv_nsec;
+    record.ctime_sec = node.st.st_ctim.tv_sec;
+    record.ctime_nsec = node.st.st_ctim.tv_nsec;
+    record.hash = node.unloaded ? node.hash : UNKNOWN_HASH;
+    file.write(reinterpret_cast<const char*>(&record), sizeof(record));
+    file.write(name.data(), static_cast<std::streamsize>(name.size()));
+
+    const auto current = index++;
+    tree.for_each_child(node, [&](const std::string_view, const Node& child) {
+        write_node(file, tree, child, current, index);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<TreeSnapshot> parse_tree(Cursor& cursor, const std::string& endpoint)
+{
+    TreeHeader header{};
+    if (not cursor.read(header) or (header.magic != TREE_MAGIC)
+        or (header.version != TREE_VERSION) or (header.nodes == 0))
+    {
+        return std::nullopt;
+    }
+    const auto stored_endpoint = cursor.read_string(header.endpoint_size);
+    if (not stored_endpoint.has_value() or (*stored_endpoint != endpoint))
+    {
+        return std::nullopt;
+    }
+    const auto server_id = cursor.read_string(header.server_id_size);
+    if (not server_id.has_value())
+    {
+        return std::nullopt;
+    }
+
+    TreeSnapshot snapshot{};
+    snapshot.tag.server_id = std::string{*server_id};
+    snapshot.tag.generation = header.generation;
+
+    // records in pre-order, a parent always precedes its children
+    std::vector<Node*> nodes{};
+    for (uint64_t i = 0; i < header.nodes; ++i)
+    {
+        NodeRecord record{};
+        if (not cursor.read(record))
+        {
+            return std::nullopt;
+        }
+        const auto name = cursor.read_string(record.name_size);
+        if (not name.has_value())
+        {
+            return std::nullopt;
+        }
+
+        Node* node{};
+        if (i == 0)
+        {
+            node = &snapshot.tree.get_root();
+        }
+        else if ((record.parent < nodes.size()) and not name->empty()
+                 and (name->find('/') == std::string_view::npos)
+                 and not snapshot.tree.has_child(*nodes[record.parent], *name))
+        {
+            node = &snapshot.tree.make_node(*nodes[record.parent], *name);
+        }
+        else
+        {
+            return std::nullopt;
+        }
+
+        node->st.st_mode = static_cast<mode_t>(record.st_mode);
+        node->st.st_size = static_cast<off_t>(record.st_size);
+        node->st.st_mtim.tv_sec = static_cast<time_t>(record.mtime_sec);
+        node->st.st_mtim.tv_nsec = static_cast<long>(record.mtime_nsec);
+        node->st.st_ctim.tv_sec = static_cast<time_t>(record.ctime_sec);
+        node->st.st_ctim.tv_nsec = static_cast<long>(record.ctime_nsec);
+        node->unloaded = (record.flags & FLAG_UNLOADED) != 0;
+        node->hash = record.hash;
+        nodes.push_back(node);
+    }
+    return snapshot;
+}
+
+} // namespace
+
+//==========================================================================
+
+void save_tree(const Path& file, const std::string& endpoint, const TreeTag& tag,
+               const Tree& tree)
+{
+    TreeHeader header{};
+    header.magic = TREE_MAGIC;
+    header.version = TREE_VERSION;
+    header.generation = tag.generation;
+    header.nodes = tree.size();
+    header.endpoint_size = static_cast<uint32_t>(endpoint.size());
+    header.server_id_size = static_cast<uint32_t>(tag.server_id.size());
+
+    auto tmp = file;
+    tmp += ".tmp";
+    {
+        std::ofstream output{tmp.native(), std::ios::binary | std::ios::trunc};
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(endpoint.data(), static_cast<std::streamsize>(endpoint.size()));
+        output.write(tag.server_id.data(),
+                     static_cast<std::streamsize>(tag.server_id.size()));
+        uint32_t index{0};
+        write_node(output, tree, tree.get_root(), NO_PARENT, index);
+        output.flush();
+        if (not output)
+        {
+            boost::system::error_code ec{};
+            fs::remove(tmp, ec);
+            throw std::system_error{EIO, std::generic_category()};
+        }
+    }
+    fs::rename(tmp, file);
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<TreeSnapshot> load_tree(const Path& file, const std::string& endpoint)
+{
+    const auto fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return std::nullopt;
+    }
+    BOOST_SCOPE_EXIT_ALL(fd)
+    {
+        ::close(fd);
+    };
+
+    struct stat st{};
+    if ((fstat(fd, &st) != 0) or (st.st_size <= 0))
+    {
+        return std::nullopt;
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    auto* const data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        log_warning("can't map {}: {}", file.native(), strerror(errno));
+        return std::nullopt;
+    }
+    BOOST_SCOPE_EXIT_ALL(data, size)
+    {
+        munmap(data, size);
+    };
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    Cursor cursor{static_cast<const char*>(data), size};
+    auto snapshot = parse_tree(cursor, endpoint);
+    if (not snapshot.has_value())
+    {
+        log_warning("ignoring tree snapshot {}", file.native());
+    }
+    return snapshot;
+}
+
+//==========================================================================
+} // namespace rewofs::client::cache
@@ -0,0 +1,50 @@
+/// Tree snapshot kept between client runs.
+///
+/// @file
+
+#pragma once
+#ifndef TREE_STORE_HPP__W3QK8ZDN
+#define TREE_STORE_HPP__W3QK8ZDN
+
+#include <optional>
+#include <string>
+
+#include "rewofs/client/cache.hpp"
+
+//==========================================================================
+namespace rewofs::client::cache {
+//==========================================================================
+
+/// Identifies a version of the served tree.
+struct TreeTag
+{
+    /// unique for the served directory, see messages::Pong
+    std::string server_id{};
+    /// bumped by the server on every change
+    uint64_t generation{};
+
+    bool operator==(const TreeTag& other) const
+    {
+        return (server_id == other.server_id) and (generation == other.generation);
+    }
+    bool operator!=(const TreeTag& other) const { return not (*this == other); }
+};
+
+struct TreeSnapshot
+{
+    TreeTag tag{};
+    Tree tree{};
+};
+
+/// Store the tree to a file. The file is replaced atomically.
+/// @param endpoint remote endpoint the tree was fetched from
+void save_tree(const Path& file, const std::string& endpoint, const TreeTag& tag,
+               const Tree& tree);
+/// Load the tree stored by save_tree() (the file is memory mapped).
+/// @return nullopt if the file is missing, damaged or stored for another endpoint
+std::optional<TreeSnapshot> load_tree(const Path& file, const std::string& endpoint);
+
+//==========================================================================
+} // namespace rewofs::client::cache
+
+#endif /* include guard */
@@ -2,15 +2,27 @@
 ///
 /// @file
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <ctime>
+#include <deque>
+#include <memory>
 #include <regex>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <linux/falloc.h>
+#include <unistd.h>
 
 #include "rewofs/client/vfs.hpp"
 #include "rewofs/messages.hpp"
 #include "rewofs/transport.hpp"
+#include "rewofs/tree_codec.hpp"
 
 //==========================================================================
 namespace rewofs::client {
@@ -30,6 +42,62 @@ uint64_t IdDispenser::get()
 
 //==========================================================================
 
+std::vector<size_t> IVfs::read_ranges(const FileHandle fh,
+                                      const std::vector<ReadRange>& ranges)
+{
+    std::vector<size_t> sizes{};
+    sizes.reserve(ranges.size());
+    for (const auto& range: ranges)
+    {
+        sizes.push_back(read(fh, range.output, range.offset));
+    }
+    return sizes;
+}
+
+//--------------------------------------------------------------------------
+
+void IVfs::flush(const FileHandle)
+{
+}
+
+//==========================================================================
+
+/// @return nullopt if absent
+static std::optional<struct stat> reported_stat(const messages::Stat* fbb_st)
+{
+    if (fbb_st == nullptr)
+    {
+        return std::nullopt;
+    }
+    struct stat st{};
+    copy(*fbb_st, st);
+    return st;
+}
+
+//--------------------------------------------------------------------------
+
+/// @return attributes reported by a successful command
+static IVfs::Mutation reported_mutation(const messages::ResultErrno& message)
+{
+    return {reported_stat(message.st()), reported_stat(message.parent_st()),
+            reported_stat(message.old_parent_st())};
+}
+
+//--------------------------------------------------------------------------
+
+/// The server acts as the owner of all files, only the owner bits are checked.
+static void check_access(const mode_t mode, const int mask)
+{
+    if (((mask & R_OK) and not (mode & S_IRUSR))
+        or ((mask & W_OK) and not (mode & S_IWUSR))
+        or ((mask & X_OK) and not (mode & S_IXUSR)))
+    {
+        throw std::system_error{EACCES, std::generic_category()};
+    }
+}
+
+//==========================================================================
+
 RemoteVfs::RemoteVfs(Serializer& serializer, Deserializer& deserializer,
                      IdDispenser& id_dispenser)
     : m_serializer{serializer}
@@ -40,6 +108,13 @@ RemoteVfs::RemoteVfs(Serializer& serializer, Deserializer& deserializer,
 
 //--------------------------------------------------------------------------
 
+void RemoteVfs::set_capabilities(const uint64_t capabilities)
+{
+    m_capabilities = capabilities;
+}
+
+//--------------------------------------------------------------------------
+
 void RemoteVfs::getattr(const Path& path, struct stat& st)
 {
     flatbuffers::FlatBufferBuilder fbb{};
@@ -103,7 +178,7 @@ IVfs::Path RemoteVfs::readlink(const Path& path)
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::mkdir(const Path& path, mode_t mode)
+IVfs::Mutation RemoteVfs::mkdir(const Path& path, mode_t mode)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command = messages::CreateCommandMkdirDirect(fbb, path.c_str(), mode);
@@ -114,11 +189,12 @@ void RemoteVfs::mkdir(const Path& path, mode_t mode)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::rmdir(const Path& path)
+IVfs::Mutation RemoteVfs::rmdir(const Path& path)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command = messages::CreateCommandRmdirDirect(fbb, path.c_str());
@@ -129,11 +205,12 @@ void RemoteVfs::rmdir(const Path& path)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::unlink(const Path& path)
+IVfs::Mutation RemoteVfs::unlink(const Path& path)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command = messages::CreateCommandUnlinkDirect(fbb, path.c_str());
@@ -144,11 +221,12 @@ void RemoteVfs::unlink(const Path& path)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::symlink(const Path& target, const Path& link_path)
+IVfs::Mutation RemoteVfs::symlink(const Path& target, const Path& link_path)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command
@@ -160,11 +238,13 @@ void RemoteVfs::symlink(const Path& target, const Path& link_path)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::rename(const Path& old_path, const Path& new_path, const uint32_t flags)
+IVfs::Mutation RemoteVfs::rename(const Path& old_path, const Path& new_path,
+                                 const uint32_t flags)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command = messages::CreateCommandRenameDirect(fbb, old_path.c_str(),
@@ -176,11 +256,12 @@ void RemoteVfs::rename(const Path& old_path, const Path& new_path, const uint32_
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::chmod(const Path& path, const mode_t mode)
+IVfs::Mutation RemoteVfs::chmod(const Path& path, const mode_t mode)
 {
     flatbuffers::FlatBufferBuilder fbb{};
     const auto command = messages::CreateCommandChmodDirect(fbb, path.c_str(), mode);
@@ -191,11 +272,12 @@ void RemoteVfs::chmod(const Path& path, const mode_t mode)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::utimens(const Path& path, const struct timespec tv[2])
+IVfs::Mutation RemoteVfs::utimens(const Path& path, const struct timespec tv[2])
 {
     flatbuffers::FlatBufferBuilder fbb{};
     // work only with mtime
@@ -209,11 +291,12 @@ void RemoteVfs::utimens(const Path& path, const struct timespec tv[2])
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void RemoteVfs::truncate(const Path& path, const off_t length)
+IVfs::Mutation RemoteVfs::truncate(const Path& path, const off_t length)
 {
     if (length < 0)
     {
@@ -230,16 +313,17 @@ void RemoteVfs::truncate(const Path& path, const off_t length)
     {
         throw std::system_error{message.res_errno(), std::generic_category()};
     }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-IVfs::FileHandle RemoteVfs::open_common(const Path& path, const int flags,
-                                        const std::optional<mode_t> mode)
+IVfs::Created RemoteVfs::open_common(const Path& path, const int flags,
+                                     const std::optional<mode_t> mode,
+                                     const uint64_t new_open_id)
 {
     log_trace("opening '{}'", path.native());
     flatbuffers::FlatBufferBuilder fbb{};
-    const auto new_open_id = m_id_dispenser.get();
     const auto msg_path = fbb.CreateString(path.native());
     messages::CommandOpenBuilder cmd_bld{fbb};
     cmd_bld.add_path(msg_path);
@@ -258,21 +342,21 @@ IVfs::FileHandle RemoteVfs::open_common(const Path& path, const int flags,
     }
 
     log_trace("open fh:{} '{}'", new_open_id, path.native());
-    return FileHandle{new_open_id};
+    return {FileHandle{new_open_id}, reported_mutation(message)};
 }
 
 //--------------------------------------------------------------------------
 
-IVfs::FileHandle RemoteVfs::create(const Path& path, const int flags, const mode_t mode)
+IVfs::Created RemoteVfs::create(const Path& path, const int flags, const mode_t mode)
 {
-    return open_common(path, flags, mode);
+    return open_common(path, flags, mode, m_id_dispenser.get());
 }
 
 //--------------------------------------------------------------------------
 
 IVfs::FileHandle RemoteVfs::open(const Path& path, const int flags)
 {
-    return open_common(path, flags, std::nullopt);
+    return open_common(path, flags, std::nullopt, m_id_dispenser.get()).fh;
 }
 
 //--------------------------------------------------------------------------
@@ -295,30 +379,50 @@ void RemoteVfs::close(const FileHandle fh)
 size_t RemoteVfs::read(const FileHandle fh, const gsl::span<uint8_t> output,
                        const off_t offset)
 {
+    return read_ranges(fh, {{offset, output}}).front();
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<size_t> RemoteVfs::read_ranges(const FileHandle fh,
+                                           const std::vector<ReadRange>& ranges)
+{
+    struct Fragment
+    {
+        MessageId mid;
+        size_t range_idx;
+        size_t range_ofs;
+    };
+
     auto queue = m_serializer.new_queue(Serializer::PRIORITY_DEFAULT);
-    std::vector<MessageId> mids{};
+    std::vector<Fragment> fragments{};
 
     // queue chunks to improve responses over slow lines
-    size_t block_ofs{0};
-    mids.reserve(output.size() / IO_FRAGMENT_SIZE + 1);
-    while (block_ofs < output.size())
+    for (size_t idx = 0; idx < ranges.size(); ++idx)
     {
-        const size_t block_size{std::min(output.size() - block_ofs, IO_FRAGMENT_SIZE)};
-
-        flatbuffers::FlatBufferBuilder fbb{};
-        const auto command = messages::CreateCommandRead(
-            fbb, strong::value_of(fh), static_cast<size_t>(offset) + block_ofs,
-            block_size);
-        mids.emplace_back(m_serializer.add_command(queue, fbb, command));
-        log_trace("mid:{}", strong::value_of(mids.back()));
-        block_ofs += block_size;
+        const auto& range = ranges[idx];
+        size_t block_ofs{0};
+        while (block_ofs < range.output.size())
+        {
+            const size_t block_size{
+                std::min(range.output.size() - block_ofs, IO_FRAGMENT_SIZE)};
+
+            flatbuffers::FlatBufferBuilder fbb{};
+            const auto command = messages::CreateCommandRead(
+                fbb, strong::value_of(fh), static_cast<size_t>(range.offset) + block_ofs,
+                block_size);
+            fragments.push_back({m_serializer.add_command(queue, fbb, command), idx,
+                                 block_ofs});
+            log_trace("mid:{}", strong::value_of(fragments.back().mid));
+            block_ofs += block_size;
+        }
     }
 
-    size_t read_size{0};
-    for (const auto mid: mids)
+    std::vector<size_t> read_sizes(ranges.size(), 0);
+    for (const auto& fragment: fragments)
     {
-        const auto res
-            = m_deserializer.wait_for_result<messages::ResultRead>(mid, TIMEOUT);
+        const auto res = m_deserializer.wait_for_result<messages::ResultRead>(
+            fragment.mid, TIMEOUT);
         if (not res.is_valid())
         {
             throw std::system_error{EHOSTUNREACH, std::generic_category()};
@@ -329,18 +433,19 @@ size_t RemoteVfs::read(const FileHandle fh, const gsl::span<uint8_t> output,
             throw std::system_error{message.res_errno(), std::generic_category()};
         }
 
+        const auto& output = ranges[fragment.range_idx].output;
         std::copy(message.data()->begin(), message.data()->end(),
-                  output.begin() + static_cast<ssize_t>(read_size));
-        read_size += message.data()->size();
+                  output.begin() + static_cast<ssize_t>(fragment.range_ofs));
+        read_sizes[fragment.range_idx] += message.data()->size();
     }
 
-    return read_size;
+    return read_sizes;
 }
 
 //--------------------------------------------------------------------------
 
-size_t RemoteVfs::write(const FileHandle fh, const gsl::span<const uint8_t> input,
-                        const off_t offset)
+IVfs::Written RemoteVfs::write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                               const off_t offset)
 {
     auto queue = m_serializer.new_queue(Serializer::PRIORITY_DEFAULT);
     std::vector<MessageId> mids{};
@@ -361,7 +466,7 @@ size_t RemoteVfs::write(const FileHandle fh, const gsl::span<const uint8_t> inpu
         block_ofs += block_size;
     }
 
-    size_t write_size{0};
+    Written written{};
     for (const auto mid: mids)
     {
         const auto res
@@ -376,393 +481,2216 @@ size_t RemoteVfs::write(const FileHandle fh, const gsl::span<const uint8_t> inpu
             throw std::system_error{message.res_errno(), std::generic_category()};
         }
 
-        write_size += static_cast<size_t>(message.res());
+        written.size += static_cast<size_t>(message.res());
+        const auto st = reported_stat(message.st());
+        if (not st.has_value())
+        {
+            continue;
+        }
+        // the fragments may be processed in any order, the file only grows
+        if (not written.st.has_value())
+        {
+            written.st = st;
+            continue;
+        }
+        const auto later = [](const timespec& t1, const timespec& t2) {
+            return std::tie(t1.tv_sec, t1.tv_nsec) > std::tie(t2.tv_sec, t2.tv_nsec);
+        };
+        written.st->st_size = std::max(written.st->st_size, st->st_size);
+        if (later(st->st_mtim, written.st->st_mtim))
+        {
+            written.st->st_mtim = st->st_mtim;
+        }
+        if (later(st->st_ctim, written.st->st_ctim))
+        {
+            written.st->st_ctim = st->st_ctim;
+        }
     }
 
-    return write_size;
+    return written;
 }
 
-//==========================================================================
+//--------------------------------------------------------------------------
 
-CachedVfs::CachedVfs(IVfs& subvfs, Serializer& serializer, Deserializer& deserializer,
-                     IdDispenser& id_dispenser, cache::Cache& cache)
-    : m_subvfs{subvfs}
-    , m_serializer{serializer}
-    , m_deserializer{deserializer}
-    , m_id_dispenser{id_dispenser}
-    , m_cache{cache}
+void RemoteVfs::fsync(const FileHandle fh, const bool datasync)
 {
-}
+    // an older server leaves it on the kernel
+    if (not has_capability(messages::Capability::FileCommands))
+    {
+        return;
+    }
 
-//--------------------------------------------------------------------------
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command
+        = messages::CreateCommandFsync(fbb, strong::value_of(fh), datasync);
+    const auto res = m_comm.single_command<messages::ResultErrno>(fbb, command);
 
-void CachedVfs::getattr(const Path& path, struct stat& st)
-{
-    auto lg = m_cache.lock();
-    st = m_cache.get_node(path).st;
+    const auto& message = res.message();
+    if (message.res_errno() != 0)
+    {
+        throw std::system_error{message.res_errno(), std::generic_category()};
+    }
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::readdir(const Path& path, const DirFiller& filler)
+IVfs::Mutation RemoteVfs::fallocate(const FileHandle fh, const int mode,
+                                    const off_t offset, const off_t length)
 {
-    auto lg = m_cache.lock();
-    const auto& node = m_cache.get_node(path);
-
-    for (const auto& [name, child]: node.children)
+    if (not has_capability(messages::Capability::FileCommands))
     {
-        filler(name, child.st);
+        throw std::system_error{EOPNOTSUPP, std::generic_category()};
+    }
+    if ((offset < 0) or (length <= 0))
+    {
+        throw std::system_error{EINVAL, std::generic_category()};
     }
-}
 
-//--------------------------------------------------------------------------
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command = messages::CreateCommandFallocate(
+        fbb, strong::value_of(fh), mode, static_cast<uint64_t>(offset),
+        static_cast<uint64_t>(length));
+    const auto res = m_comm.single_command<messages::ResultErrno>(fbb, command);
 
-IVfs::Path CachedVfs::readlink(const Path& path)
-{
-    return m_subvfs.readlink(path);
+    const auto& message = res.message();
+    if (message.res_errno() != 0)
+    {
+        throw std::system_error{message.res_errno(), std::generic_category()};
+    }
+    return reported_mutation(message);
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::mkdir(const Path& path, mode_t mode)
+off_t RemoteVfs::lseek(const FileHandle fh, const off_t offset, const int whence)
 {
-    m_subvfs.mkdir(path, mode);
+    if (not has_capability(messages::Capability::FileCommands))
+    {
+        throw std::system_error{ENOSYS, std::generic_category()};
+    }
 
-    struct stat st{};
-    m_subvfs.getattr(path, st);
-    struct stat parent_st{};
-    m_subvfs.getattr(path.parent_path(), parent_st);
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command
+        = messages::CreateCommandLseek(fbb, strong::value_of(fh), offset, whence);
+    const auto res = m_comm.single_command<messages::ResultLseek>(fbb, command);
 
-    auto lg = m_cache.lock();
-    m_cache.get_node(path.parent_path()).st = parent_st;
-    auto& new_node = m_cache.make_node(path);
-    new_node.st = st;
+    const auto& message = res.message();
+    if (message.res() < 0)
+    {
+        throw std::system_error{message.res_errno(), std::generic_category()};
+    }
+    return static_cast<off_t>(message.res());
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::rmdir(const Path& path)
+void RemoteVfs::statfs(const Path& path, struct statvfs& st)
 {
-    m_subvfs.rmdir(path);
+    if (not has_capability(messages::Capability::FileCommands))
+    {
+        throw std::system_error{ENOSYS, std::generic_category()};
+    }
 
-    struct stat parent_st{};
-    m_subvfs.getattr(path.parent_path(), parent_st);
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command = messages::CreateCommandStatfsDirect(fbb, path.c_str());
+    const auto res = m_comm.single_command<messages::ResultStatfs>(fbb, command);
 
-    auto lg = m_cache.lock();
-    m_cache.remove_single(path);
-    m_cache.get_node(path.parent_path()).st = parent_st;
+    const auto& message = res.message();
+    if (message.res_errno() != 0)
+    {
+        throw std::system_error{message.res_errno(), std::generic_category()};
+    }
+    st = {};
+    st.f_bsize = message.bsize();
+    st.f_frsize = message.frsize();
+    st.f_blocks = message.blocks();
+    st.f_bfree = message.bfree();
+    st.f_bavail = message.bavail();
+    st.f_files = message.files();
+    st.f_ffree = message.ffree();
+    st.f_favail = message.favail();
+    st.f_namemax = message.namemax();
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::unlink(const Path& path)
+void RemoteVfs::access(const Path& path, const int mask)
 {
-    m_subvfs.unlink(path);
+    struct stat st{};
+    getattr(path, st);
+    check_access(st.st_mode, mask);
+}
 
-    struct stat parent_st{};
-    m_subvfs.getattr(path.parent_path(), parent_st);
+//--------------------------------------------------------------------------
 
-    auto lg = m_cache.lock();
-    m_cache.remove_single(path);
-    m_cache.get_node(path.parent_path()).st = parent_st;
+void RemoteVfs::opendir(const Path& path)
+{
+    struct stat st{};
+    getattr(path, st);
+    if (not S_ISDIR(st.st_mode))
+    {
+        throw std::system_error{ENOTDIR, std::generic_category()};
+    }
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::symlink(const Path& target, const Path& link_path)
+bool RemoteVfs::has_capability(const messages::Capability capability) const
 {
-    m_subvfs.symlink(target, link_path);
+    return m_capabilities & static_cast<uint64_t>(capability);
+}
 
-    struct stat st{};
-    m_subvfs.getattr(link_path, st);
-    struct stat parent_st{};
-    m_subvfs.getattr(link_path.parent_path(), parent_st);
+//==========================================================================
 
-    auto lg = m_cache.lock();
-    m_cache.make_node(link_path).st = st;
-    m_cache.get_node(link_path.parent_path()).st = parent_st;
+template<typename _Command>
+static flatbuffers::Offset<messages::BatchItem>
+    batch_operation(flatbuffers::FlatBufferBuilder& fbb,
+                    const flatbuffers::Offset<_Command> command)
+{
+    return messages::CreateBatchItem(fbb, messages::MessageTraits<_Command>::enum_value,
+                                     command.Union());
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::rename(const Path& old_path, const Path& new_path, const uint32_t flags)
+static RemoteVfs::Batch::Result batch_result(const messages::BatchItem& item)
 {
-    m_subvfs.rename(old_path, new_path, flags);
-
-    auto lg = m_cache.lock();
-#ifndef RENAME_EXCHANGE
-    #define RENAME_EXCHANGE (1 << 1)
-#endif
-    if (flags & RENAME_EXCHANGE)
+    RemoteVfs::Batch::Result result{};
+    if (const auto* errno_result = item.message_as_ResultErrno(); errno_result != nullptr)
     {
-        m_cache.exchange(old_path, new_path);
+        result.res_errno = errno_result->res_errno();
+        result.mutation = reported_mutation(*errno_result);
+    }
+    else if (const auto* write_result = item.message_as_ResultWrite();
+             write_result != nullptr)
+    {
+        result.res_errno = (write_result->res() < 0) ? write_result->res_errno() : 0;
+        if (result.res_errno == 0)
+        {
+            result.size = static_cast<size_t>(write_result->res());
+            result.mutation.st = reported_stat(write_result->st());
+        }
     }
     else
     {
-        m_cache.rename(old_path, new_path);
+        result.res_errno = EPROTO;
     }
+    return result;
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::chmod(const Path& path, const mode_t mode)
+/// Run an operation of a batch by a single command.
+template<typename _Func>
+static RemoteVfs::Batch::Result run_alone(const _Func& func)
 {
-    m_subvfs.chmod(path, mode);
-    auto lg = m_cache.lock();
-    m_cache.get_node(path).st.st_mode = mode;
+    RemoteVfs::Batch::Result result{};
+    try
+    {
+        func(result);
+        result.res_errno = 0;
+    }
+    catch (const std::system_error& err)
+    {
+        if (err.code().value() == EHOSTUNREACH)
+        {
+            throw;
+        }
+        result.res_errno = err.code().value();
+    }
+    return result;
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::utimens(const Path& path, const struct timespec tv[2])
+RemoteVfs::Batch::Batch(RemoteVfs& vfs)
+    : m_vfs{vfs}
 {
-    // work only with mtime
+}
 
-    if (tv[1].tv_nsec == UTIME_OMIT)
-    {
-        return;
-    }
+//--------------------------------------------------------------------------
 
-    m_subvfs.utimens(path, tv);
+void RemoteVfs::Batch::mkdir(const Path& path, const mode_t mode)
+{
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [path, mode](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(
+                 fbb, messages::CreateCommandMkdirDirect(fbb, path.c_str(), mode));
+         },
+         [&vfs, path, mode] {
+             return run_alone([&](Result& res) { res.mutation = vfs.mkdir(path, mode); });
+         }});
+}
 
-    // for UTIME_NOW we need to get the precise remote time, can't just use tv[1]
-    // TODO let the command return the stat
-    struct stat st{};
-    m_subvfs.getattr(path, st);
+//--------------------------------------------------------------------------
 
-    auto lg = m_cache.lock();
-    m_cache.get_node(path).st = st;
+void RemoteVfs::Batch::rmdir(const Path& path)
+{
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [path](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(
+                 fbb, messages::CreateCommandRmdirDirect(fbb, path.c_str()));
+         },
+         [&vfs, path] {
+             return run_alone([&](Result& res) { res.mutation = vfs.rmdir(path); });
+         }});
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::truncate(const Path& path, const off_t length)
+void RemoteVfs::Batch::unlink(const Path& path)
 {
-    m_subvfs.truncate(path, length);
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [path](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(
+                 fbb, messages::CreateCommandUnlinkDirect(fbb, path.c_str()));
+         },
+         [&vfs, path] {
+             return run_alone([&](Result& res) { res.mutation = vfs.unlink(path); });
+         }});
+}
 
-    // TODO let the create command return the stat
-    struct stat st{};
-    m_subvfs.getattr(path, st);
+//--------------------------------------------------------------------------
 
-    auto lg = m_cache.lock();
-    auto& node = m_cache.get_node(path);
-    node.st = st;
+void RemoteVfs::Batch::symlink(const Path& target, const Path& link_path)
+{
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [target, link_path](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(fbb,
+                                    messages::CreateCommandSymlinkDirect(
+                                        fbb, link_path.c_str(), target.c_str()));
+         },
+         [&vfs, target, link_path] {
+             return run_alone(
+                 [&](Result& res) { res.mutation = vfs.symlink(target, link_path); });
+         }});
 }
 
 //--------------------------------------------------------------------------
 
-IVfs::FileHandle CachedVfs::create(const Path& path, const int flags, const mode_t mode)
+void RemoteVfs::Batch::rename(const Path& old_path, const Path& new_path,
+                              const uint32_t flags)
 {
-    const auto subvfs_handle = m_subvfs.create(path, flags, mode);
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [old_path, new_path, flags](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(fbb,
+                                    messages::CreateCommandRenameDirect(
+                                        fbb, old_path.c_str(), new_path.c_str(), flags));
+         },
+         [&vfs, old_path, new_path, flags] {
+             return run_alone([&](Result& res) {
+                 res.mutation = vfs.rename(old_path, new_path, flags);
+             });
+         }});
+}
 
-    // TODO let the create command return the stat
-    struct stat st{};
-    m_subvfs.getattr(path, st);
+//--------------------------------------------------------------------------
 
-    auto lg = m_cache.lock();
-    m_cache.make_node(path).st = st;
-    File file{flags, subvfs_handle, path};
-    const auto handle = FileHandle{m_id_dispenser.get()};
-    m_opened_files.emplace(std::make_pair(handle, std::move(file)));
-    return handle;
+void RemoteVfs::Batch::chmod(const Path& path, const mode_t mode)
+{
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [path, mode](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(
+                 fbb, messages::CreateCommandChmodDirect(fbb, path.c_str(), mode));
+         },
+         [&vfs, path, mode] {
+             return run_alone([&](Result& res) { res.mutation = vfs.chmod(path, mode); });
+         }});
 }
 
 //--------------------------------------------------------------------------
 
-IVfs::FileHandle CachedVfs::open(const Path& path, const int flags)
+void RemoteVfs::Batch::utimens(const Path& path, const struct timespec tv[2])
 {
-    std::optional<FileHandle> subvfs_handle{};
-    // lazy open on read only
-    if ((flags & O_WRONLY) or (flags & O_RDWR) or (flags & O_APPEND))
-    {
-        subvfs_handle = m_subvfs.open(path, flags);
-    }
-    File file{flags, subvfs_handle, path};
-    auto lg = m_cache.lock();
-    const auto handle = FileHandle{m_id_dispenser.get()};
-    m_opened_files.emplace(std::make_pair(handle, std::move(file)));
-    return handle;
+    auto& vfs = m_vfs;
+    const std::array<timespec, 2> times{tv[0], tv[1]};
+    m_operations.push_back(
+        {m_calls++,
+         [path, times](flatbuffers::FlatBufferBuilder& fbb) {
+             // work only with mtime
+             messages::Time mtime{};
+             copy(times[1], mtime);
+             return batch_operation(
+                 fbb, messages::CreateCommandUtimeDirect(fbb, path.c_str(), &mtime));
+         },
+         [&vfs, path, times] {
+             return run_alone(
+                 [&](Result& res) { res.mutation = vfs.utimens(path, times.data()); });
+         }});
 }
 
 //--------------------------------------------------------------------------
 
-void CachedVfs::close(const FileHandle fh)
+void RemoteVfs::Batch::truncate(const Path& path, const off_t length)
 {
-    auto lg = m_cache.lock();
-    const auto it = m_opened_files.find(fh);
-    if (it == m_opened_files.end())
-    {
-        throw std::system_error{EBADF, std::generic_category()};
-    }
-    const auto subhandle = it->second.subvfs_handle;
-    lg.unlock();
-
-    if (subhandle.has_value())
+    if (length < 0)
     {
-        m_subvfs.close(*subhandle);
+        throw std::system_error{EINVAL, std::generic_category()};
     }
 
-    lg.lock();
-    m_opened_files.erase(it);
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [path, length](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(fbb, messages::CreateCommandTruncateDirect(
+                                             fbb, path.c_str(),
+                                             static_cast<uint64_t>(length)));
+         },
+         [&vfs, path, length] {
+             return run_alone(
+                 [&](Result& res) { res.mutation = vfs.truncate(path, length); });
+         }});
 }
 
 //--------------------------------------------------------------------------
 
-size_t CachedVfs::read(const FileHandle fh, const gsl::span<uint8_t> output,
-                       const off_t offset)
+IVfs::FileHandle RemoteVfs::Batch::create(const Path& path, const int flags,
+                                          const mode_t mode)
 {
-    auto lg = m_cache.lock();
-    const auto it = m_opened_files.find(fh);
-    if (it == m_opened_files.end())
-    {
-        throw std::system_error{EBADF, std::generic_category()};
-    }
+    auto& vfs = m_vfs;
+    const auto open_id = m_vfs.m_id_dispenser.get();
+    m_operations.push_back(
+        {m_calls++,
+         [path, flags, mode, open_id](flatbuffers::FlatBufferBuilder& fbb) {
+             const auto msg_path = fbb.CreateString(path.native());
+             messages::CommandOpenBuilder cmd_bld{fbb};
+             cmd_bld.add_path(msg_path);
+             cmd_bld.add_file_handle(open_id);
+             cmd_bld.add_flags(flags);
+             cmd_bld.add_mode(mode);
+             return batch_operation(fbb, cmd_bld.Finish());
+         },
+         [&vfs, path, flags, mode, open_id] {
+             return run_alone([&](Result& res) {
+                 res.mutation = vfs.open_common(path, flags, mode, open_id).mutation;
+             });
+         }});
+    return FileHandle{open_id};
+}
 
-    bool has_cached_block = m_cache.read(
-        it->second.path, static_cast<uintmax_t>(offset), output.size(),
-        [&output](const auto& content) {
-            assert(content.size() == output.size());
-            std::copy(content.begin(), content.end(), output.begin());
-        });
+//--------------------------------------------------------------------------
 
-    if (has_cached_block)
-    {
-        log_trace("cache hit");
-        return output.size();
-    }
-    else
+void RemoteVfs::Batch::write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                             const off_t offset)
+{
+    auto& vfs = m_vfs;
+    const auto call = m_calls++;
+    // fragments as RemoteVfs::write()
+    size_t block_ofs{0};
+    do
     {
-        log_trace("cache miss");
-        auto subhandle = it->second.subvfs_handle;
-        lg.unlock();
-        if (not subhandle.has_value())
-        {
-            subhandle = m_subvfs.open(it->second.path, it->second.open_flags);
-        }
-        const auto ret = m_subvfs.read(*subhandle, output, offset);
-        lg.lock();
-        const auto refreshed_it = m_opened_files.find(fh);
-        refreshed_it->second.subvfs_handle = subhandle;
-        m_cache.write(refreshed_it->second.path, static_cast<uintmax_t>(offset),
-                      {output.begin(), output.end()});
-        return ret;
-    }
+        const size_t block_size{std::min(input.size() - block_ofs, IO_FRAGMENT_SIZE)};
+        const auto block_offset = offset + static_cast<off_t>(block_ofs);
+        auto data = std::make_shared<const std::vector<uint8_t>>(
+            input.begin() + static_cast<ssize_t>(block_ofs),
+            input.begin() + static_cast<ssize_t>(block_ofs + block_size));
+        m_operations.push_back(
+            {call,
+             [fh, block_offset, data](flatbuffers::FlatBufferBuilder& fbb) {
+                 const auto fbb_data = fbb.CreateVector(*data);
+                 return batch_operation(
+                     fbb, messages::CreateCommandWrite(fbb, strong::value_of(fh),
+                                                       static_cast<size_t>(block_offset),
+                                                       fbb_data));
+             },
+             [&vfs, fh, block_offset, data] {
+                 return run_alone([&](Result& res) {
+                     const auto written
+                         = vfs.write(fh, {data->data(), data->size()}, block_offset);
+                     res.size = written.size;
+                     res.mutation.st = written.st;
+                 });
+             }});
+        block_ofs += block_size;
+    } while (block_ofs < input.size());
 }
 
 //--------------------------------------------------------------------------
 
-size_t CachedVfs::write(const FileHandle fh, const gsl::span<const uint8_t> input,
-                        const off_t offset)
+void RemoteVfs::Batch::close(const FileHandle fh)
 {
-    auto lg = m_cache.lock();
-    const auto it = m_opened_files.find(fh);
-    if ((it == m_opened_files.end()) or (not it->second.subvfs_handle.has_value()))
-    {
-        throw std::system_error{EBADF, std::generic_category()};
-    }
-    const auto file = it->second;
-    lg.unlock();
+    auto& vfs = m_vfs;
+    m_operations.push_back(
+        {m_calls++,
+         [fh](flatbuffers::FlatBufferBuilder& fbb) {
+             return batch_operation(
+                 fbb, messages::CreateCommandClose(fbb, strong::value_of(fh)));
+         },
+         [&vfs, fh] { return run_alone([&](Result&) { vfs.close(fh); }); }});
+}
 
-    const auto res = m_subvfs.write(*file.subvfs_handle, input, offset);
+//--------------------------------------------------------------------------
 
-    lg.lock();
+bool RemoteVfs::Batch::empty() const
+{
+    return m_operations.empty();
+}
 
-    // TODO let the main command return the stat
-    struct stat st{};
-    m_subvfs.getattr(file.path, st);
+//--------------------------------------------------------------------------
+
+std::vector<RemoteVfs::Batch::Result> RemoteVfs::Batch::run(const bool stop_on_error)
+{
+    const auto operations = std::move(m_operations);
+    m_operations.clear();
+    std::vector<Result> results(m_calls);
+    std::vector<bool> started(m_calls, false);
+    m_calls = 0;
+
+    // a write split to fragments has a single result
+    const auto merge = [&results, &started](const size_t call, const Result& result) {
+        auto& merged = results[call];
+        if (not started[call])
+        {
+            merged = result;
+            started[call] = true;
+        }
+        else if (merged.res_errno == 0)
+        {
+            merged.res_errno = result.res_errno;
+            merged.size += result.size;
+            if (result.mutation.st.has_value())
+            {
+                merged.mutation.st = result.mutation.st;
+            }
+        }
+    };
+
+    if (not m_vfs.has_capability(messages::Capability::Batch))
+    {
+        for (const auto& operation: operations)
+        {
+            const auto result = operation.run();
+            merge(operation.call, result);
+            if (stop_on_error and (result.res_errno != 0))
+            {
+                break;
+            }
+        }
+        return results;
+    }
+
+    size_t begin{0};
+    while (begin < operations.size())
+    {
+        flatbuffers::FlatBufferBuilder fbb{};
+        std::vector<flatbuffers::Offset<messages::BatchItem>> items{};
+        auto end = begin;
+        while ((end < operations.size())
+               and ((end == begin) or (fbb.GetSize() < FRAME_SIZE)))
+        {
+            items.push_back(operations[end].build(fbb));
+            ++end;
+        }
+        const auto command
+            = messages::CreateCommandBatchDirect(fbb, &items, stop_on_error);
+        const auto res = m_vfs.m_comm.single_command<messages::ResultBatch>(fbb, command);
+        log_trace("batch operations:{}", items.size());
+
+        bool failed{false};
+        const auto* fbb_results = res.message().results();
+        if (fbb_results != nullptr)
+        {
+            auto idx = begin;
+            for (const auto* item: *fbb_results)
+            {
+                if (idx == end)
+                {
+                    break;
+                }
+                const auto result = batch_result(*item);
+                merge(operations[idx].call, result);
+                failed = failed or (result.res_errno != 0);
+                ++idx;
+            }
+        }
+        if (stop_on_error and failed)
+        {
+            break;
+        }
+        begin = end;
+    }
+    return results;
+}
+
+//==========================================================================
+
+/// @param tree cache::Tree or cache::Cache
+template<typename _Tree>
+static void populate_node(_Tree& tree, cache::Node& node,
+                          const messages::TreeNode& fbb_node)
+{
+    copy(*fbb_node.st(), node.st);
+    node.unloaded = fbb_node.unloaded();
+    for (const auto& child: *fbb_node.children())
+    {
+        auto& new_child = tree.make_node(
+            node, std::string_view{child->name()->c_str(), child->name()->size()});
+        populate_node(tree, new_child, *child);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+/// Directories of a streamed tree waiting for their children, in the order the
+/// server lists them (see tree_codec.hpp).
+using PendingListings = std::deque<IVfs::Path>;
+
+//--------------------------------------------------------------------------
+
+/// @return the directory if its children are to be inserted
+template<typename _Tree>
+static cache::Node* unloaded_directory(_Tree& tree, const IVfs::Path& path)
+{
+    if (not tree.exists(path))
+    {
+        return nullptr;
+    }
+    auto& node = tree.get_node(path);
+    // loaded on demand meanwhile otherwise
+    return node.unloaded ? &node : nullptr;
+}
+
+//--------------------------------------------------------------------------
+
+template<typename _Tree>
+static void insert_listed_child(_Tree& tree, cache::Node& directory,
+                                const std::string_view name, const cache::Stat& st)
+{
+    if (tree.has_child(directory, name))
+    {
+        // made locally meanwhile
+        return;
+    }
+    auto& child = tree.make_node(directory, name);
+    child.st = st;
+    // listed later unless left out by the depth limit
+    child.unloaded = S_ISDIR(st.st_mode);
+}
+
+//--------------------------------------------------------------------------
+
+/// Insert a chunk of a streamed tree (see messages::ResultReadTreeChunk).
+/// Directories stay unloaded until their children arrive so a partially inserted
+/// tree is consistent.
+/// @param tree cache::Tree or cache::Cache
+/// @param pending carried over to the next chunk
+template<typename _Tree>
+static void insert_tree_chunk(_Tree& tree, const messages::ResultReadTreeChunk& chunk,
+                              PendingListings& pending)
+{
+    if (chunk.root() != nullptr)
+    {
+        auto& root = tree.get_root();
+        copy(*chunk.root()->st(), root.st);
+        root.unloaded = S_ISDIR(root.st.st_mode);
+        if (root.unloaded)
+        {
+            pending.push_back("/");
+        }
+    }
+
+    if (chunk.packed() != nullptr)
+    {
+        tree_codec::Decoder decoder{{chunk.packed()->data(), chunk.packed()->size()}};
+        while (const auto directory = decoder.next_directory())
+        {
+            if (pending.empty())
+            {
+                throw std::system_error{EPROTO, std::generic_category()};
+            }
+            const auto path = pending.front();
+            if (not directory->continued)
+            {
+                pending.pop_front();
+            }
+            auto* const node = unloaded_directory(tree, path);
+            for (uint32_t i = 0; i < directory->entries; ++i)
+            {
+                const auto entry = decoder.next_entry();
+                if (S_ISDIR(entry.st_mode) and not entry.unloaded)
+                {
+                    pending.push_back(path / std::string{entry.name});
+                }
+                if (node != nullptr)
+                {
+                    const cache::Stat st{static_cast<mode_t>(entry.st_mode),
+                                         static_cast<off_t>(entry.st_size),
+                                         entry.st_mtim, entry.st_ctim};
+                    insert_listed_child(tree, *node, entry.name, st);
+                }
+            }
+            if (node != nullptr)
+            {
+                node->unloaded = directory->continued;
+            }
+        }
+        return;
+    }
+
+    if (chunk.directories() == nullptr)
+    {
+        return;
+    }
+    for (const auto* directory: *chunk.directories())
+    {
+        auto* const node
+            = unloaded_directory(tree, IVfs::Path{"/"} / directory->path()->str());
+        if (node == nullptr)
+        {
+            continue;
+        }
+        for (const auto* child: *directory->children())
+        {
+            cache::Stat st{};
+            copy(*child->st(), st);
+            insert_listed_child(
+                tree, *node, {child->name()->c_str(), child->name()->size()}, st);
+        }
+        node->unloaded = directory->continued();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+/// @return attributes of the file in the published tree
+static std::optional<cache::Stat> published_stat(const cache::Cache& cache,
+                                                 const IVfs::Path& path)
+{
+    const auto tree = cache.snapshot();
+    if (not tree->exists(path))
+    {
+        return std::nullopt;
+    }
+    return tree->get_node(path).st;
+}
+
+//--------------------------------------------------------------------------
+
+/// @return the attributes reported by a mutation, fetched if not reported (older
+///         servers)
+static struct stat reported_or_current(IVfs& vfs, const std::optional<struct stat>& st,
+                                       const IVfs::Path& path)
+{
+    if (st.has_value())
+    {
+        return *st;
+    }
+    struct stat current{};
+    vfs.getattr(path, current);
+    return current;
+}
+
+//--------------------------------------------------------------------------
+
+/// @return the new path of `path` if it is `from` or inside it, nullopt otherwise
+static std::optional<IVfs::Path> moved_path(const IVfs::Path& path,
+                                            const IVfs::Path& from, const IVfs::Path& to)
+{
+    auto it = path.begin();
+    for (const auto& component: from)
+    {
+        if ((it == path.end()) or (*it != component))
+        {
+            return std::nullopt;
+        }
+        ++it;
+    }
+    auto moved = to;
+    for (; it != path.end(); ++it)
+    {
+        moved /= *it;
+    }
+    return moved;
+}
+
+//--------------------------------------------------------------------------
+
+CachedVfs::CachedVfs(IVfs& subvfs, Serializer& serializer, Deserializer& deserializer,
+                     IdDispenser& id_dispenser, cache::Cache& cache,
+                     cache::DiskStore& disk_store)
+    : m_subvfs{subvfs}
+    , m_serializer{serializer}
+    , m_deserializer{deserializer}
+    , m_id_dispenser{id_dispenser}
+    , m_cache{cache}
+    , m_disk_store{disk_store}
+{
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::set_tree_depth(const uint32_t depth)
+{
+    m_tree_depth = depth;
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::set_write_back(const size_t capacity)
+{
+    m_write_back_enabled = capacity > 0;
+    m_write_back.set_capacity(capacity);
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::start()
+{
+    if (m_write_back_enabled)
+    {
+        m_write_back.start();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::stop()
+{
+    m_write_back.stop();
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::wait()
+{
+    m_write_back.wait();
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::getattr(const Path& path, struct stat& st)
+{
+    const auto tree = loaded_tree(path, false);
+    copy(tree->get_node(path).st, st);
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::readdir(const Path& path, const DirFiller& filler)
+{
+    const auto tree = loaded_tree(path, true);
+    const auto& node = tree->get_node(path);
+
+    tree->for_each_child(
+        node, [&filler](const std::string_view name, const cache::Node& child) {
+            struct stat st{};
+            copy(child.st, st);
+            filler(Path{name.begin(), name.end()}, st);
+        });
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Path CachedVfs::readlink(const Path& path)
+{
+    return m_subvfs.readlink(path);
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::mkdir(const Path& path, mode_t mode)
+{
+    const auto mutation = m_subvfs.mkdir(path, mode);
+    const auto st = reported_or_current(m_subvfs, mutation.st, path);
+    const auto parent_st
+        = reported_or_current(m_subvfs, mutation.parent_st, path.parent_path());
+
+    auto lg = m_cache.lock();
+    copy(parent_st, m_cache.get_node(path.parent_path()).st);
+    auto& new_node = m_cache.make_node(path);
+    copy(st, new_node.st);
+    m_cache.publish();
+    return {st, parent_st, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::rmdir(const Path& path)
+{
+    const auto mutation = m_subvfs.rmdir(path);
+    const auto parent_st
+        = reported_or_current(m_subvfs, mutation.parent_st, path.parent_path());
+
+    auto lg = m_cache.lock();
+    m_cache.remove_single(path);
+    copy(parent_st, m_cache.get_node(path.parent_path()).st);
+    m_cache.publish();
+    return {std::nullopt, parent_st, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::unlink(const Path& path)
+{
+    flush_written(path);
+    const auto mutation = m_subvfs.unlink(path);
+    const auto parent_st
+        = reported_or_current(m_subvfs, mutation.parent_st, path.parent_path());
+
+    auto lg = m_cache.lock();
+    m_cache.remove_single(path);
+    for (auto& item: m_opened_files)
+    {
+        if (item.second.path == path)
+        {
+            item.second.path.clear();
+        }
+    }
+    copy(parent_st, m_cache.get_node(path.parent_path()).st);
+    m_cache.publish();
+    return {std::nullopt, parent_st, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::symlink(const Path& target, const Path& link_path)
+{
+    const auto mutation = m_subvfs.symlink(target, link_path);
+    const auto st = reported_or_current(m_subvfs, mutation.st, link_path);
+    const auto parent_st
+        = reported_or_current(m_subvfs, mutation.parent_st, link_path.parent_path());
+
+    auto lg = m_cache.lock();
+    copy(st, m_cache.make_node(link_path).st);
+    copy(parent_st, m_cache.get_node(link_path.parent_path()).st);
+    m_cache.publish();
+    return {st, parent_st, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::rename(const Path& old_path, const Path& new_path,
+                                 const uint32_t flags)
+{
+    // the cached content is dropped, the server must have it
+    flush_written(old_path);
+    flush_written(new_path);
+    const auto mutation = m_subvfs.rename(old_path, new_path, flags);
+
+    auto lg = m_cache.lock();
+#ifndef RENAME_EXCHANGE
+    #define RENAME_EXCHANGE (1 << 1)
+#endif
+    const bool exchange = flags & RENAME_EXCHANGE;
+    if (exchange)
+    {
+        m_cache.exchange(old_path, new_path);
+    }
+    else
+    {
+        m_cache.rename(old_path, new_path);
+    }
+    rename_opened(old_path, new_path, exchange);
+    // older servers do not report the attributes, keep the cached ones
+    if (mutation.st.has_value())
+    {
+        copy(*mutation.st, m_cache.get_node(new_path).st);
+    }
+    if (mutation.parent_st.has_value())
+    {
+        copy(*mutation.parent_st, m_cache.get_node(new_path.parent_path()).st);
+    }
+    if (mutation.old_parent_st.has_value())
+    {
+        copy(*mutation.old_parent_st, m_cache.get_node(old_path.parent_path()).st);
+    }
+    m_cache.publish();
+    return mutation;
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::chmod(const Path& path, const mode_t mode)
+{
+    const auto mutation = m_subvfs.chmod(path, mode);
+    auto lg = m_cache.lock();
+    auto& node = m_cache.get_node(path);
+    if (mutation.st.has_value())
+    {
+        copy(*mutation.st, node.st);
+    }
+    else
+    {
+        node.st.st_mode = mode;
+    }
+    m_cache.publish();
+    return mutation;
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::utimens(const Path& path, const struct timespec tv[2])
+{
+    // work only with mtime
+
+    if (tv[1].tv_nsec == UTIME_OMIT)
+    {
+        return {};
+    }
+
+    flush_written(path);
+    const auto mutation = m_subvfs.utimens(path, tv);
+    // for UTIME_NOW we need the precise remote time, can't just use tv[1]
+    const auto st = reported_or_current(m_subvfs, mutation.st, path);
+
+    auto lg = m_cache.lock();
+    copy(st, m_cache.get_node(path).st);
+    m_cache.publish();
+    return {st, std::nullopt, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::truncate(const Path& path, const off_t length)
+{
+    flush_written(path);
+    const auto mutation = m_subvfs.truncate(path, length);
+    const auto st = reported_or_current(m_subvfs, mutation.st, path);
+
+    auto lg = m_cache.lock();
+    auto& node = m_cache.get_node(path);
+    copy(st, node.st);
+    m_cache.publish();
+    return {st, std::nullopt, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Created CachedVfs::create(const Path& path, const int flags, const mode_t mode)
+{
+    const auto created = m_subvfs.create(path, flags, mode);
+    const auto st = reported_or_current(m_subvfs, created.mutation.st, path);
+
+    auto lg = m_cache.lock();
+    copy(st, m_cache.make_node(path).st);
+    if (created.mutation.parent_st.has_value())
+    {
+        copy(*created.mutation.parent_st, m_cache.get_node(path.parent_path()).st);
+    }
+    m_cache.publish();
+    File file{flags, created.fh, path};
+    const auto handle = FileHandle{m_id_dispenser.get()};
+    m_opened_files.emplace(std::make_pair(handle, std::move(file)));
+    return {handle, {st, created.mutation.parent_st, std::nullopt}};
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::FileHandle CachedVfs::open(const Path& path, const int flags)
+{
+    std::optional<FileHandle> subvfs_handle{};
+    // lazy open on read only
+    if ((flags & O_WRONLY) or (flags & O_RDWR) or (flags & O_APPEND))
+    {
+        if (flags & O_TRUNC)
+        {
+            flush_written(path);
+        }
+        subvfs_handle = m_subvfs.open(path, flags);
+    }
+    File file{flags, subvfs_handle, path};
+    auto lg = m_cache.lock();
+    const auto handle = FileHandle{m_id_dispenser.get()};
+    m_opened_files.emplace(std::make_pair(handle, std::move(file)));
+    return handle;
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::close(const FileHandle fh)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if (it == m_opened_files.end())
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto subhandle = it->second.subvfs_handle;
+    const auto path = it->second.path;
+    lg.unlock();
+
+    if (m_write_back_enabled)
+    {
+        // close(2) got the error from flush(), release can not report it
+        try
+        {
+            m_write_back.flush(strong::value_of(fh));
+        }
+        catch (const std::system_error& err)
+        {
+            log_error("write-back of '{}' failed: {}", path.native(), err.what());
+        }
+        m_write_back.forget(strong::value_of(fh));
+    }
+    if (subhandle.has_value())
+    {
+        m_subvfs.close(*subhandle);
+    }
+
+    // other files were opened meanwhile, the iterator may be invalid
+    lg.lock();
+    m_opened_files.erase(fh);
+}
+
+//--------------------------------------------------------------------------
+
+size_t CachedVfs::read(const FileHandle fh, const gsl::span<uint8_t> output,
+                       const off_t offset)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if (it == m_opened_files.end())
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto file = it->second;
+
+    auto missing = m_cache.read_partial(file.path, static_cast<uintmax_t>(offset), output);
+    if (missing.empty())
+    {
+        log_trace("cache hit");
+        return output.size();
+    }
+    lg.unlock();
+
+    if (m_disk_store.is_open())
+    {
+        missing = read_disk_store(file.path, offset, output, missing);
+        if (missing.empty())
+        {
+            log_trace("disk cache hit");
+            return output.size();
+        }
+    }
+
+    log_trace("cache miss, {} missing extents", missing.size());
+    flush_written(file.path);
+    std::vector<ReadRange> ranges{};
+    ranges.reserve(missing.size());
+    for (const auto& range: missing)
+    {
+        const auto output_ofs = static_cast<size_t>(range.start)
+                                - static_cast<size_t>(offset);
+        ranges.push_back({static_cast<off_t>(range.start),
+                          output.subspan(output_ofs, range.size)});
+    }
+
+    auto subhandle = file.subvfs_handle;
+    if (not subhandle.has_value())
+    {
+        subhandle = m_subvfs.open(file.path, file.open_flags);
+    }
+    const auto read_sizes = m_subvfs.read_ranges(*subhandle, ranges);
+    const auto st = published_stat(m_cache, file.path);
+    lg.lock();
+    const auto refreshed_it = m_opened_files.find(fh);
+    refreshed_it->second.subvfs_handle = subhandle;
+    // renamed or removed meanwhile, keep the content out of other files
+    const bool current
+        = (not file.path.empty()) and (refreshed_it->second.path == file.path);
+
+    // store only what was really read, a short read means the end of the file
+    size_t ret{output.size()};
+    size_t stored_ranges{0};
+    for (; stored_ranges < ranges.size(); ++stored_ranges)
+    {
+        const auto& range = ranges[stored_ranges];
+        const auto size = read_sizes[stored_ranges];
+        const auto data = range.output.first(size);
+        if (current)
+        {
+            m_cache.write(file.path, static_cast<uintmax_t>(range.offset),
+                          {data.begin(), data.end()});
+        }
+        if (size < range.output.size())
+        {
+            ret = static_cast<size_t>(range.offset - offset) + size;
+            ++stored_ranges;
+            break;
+        }
+    }
+    lg.unlock();
+
+    if (current and st.has_value())
+    {
+        for (size_t idx = 0; idx < stored_ranges; ++idx)
+        {
+            const auto& range = ranges[idx];
+            m_disk_store.write(file.path, *st, static_cast<uintmax_t>(range.offset),
+                               range.output.first(read_sizes[idx]));
+        }
+    }
+    return ret;
+}
+
+//--------------------------------------------------------------------------
+
+std::shared_ptr<const cache::Tree> CachedVfs::loaded_tree(const Path& path,
+                                                          const bool with_children)
+{
+    auto tree = m_cache.snapshot();
+    while (true)
+    {
+        std::optional<Path> unloaded{};
+        if (tree->exists(path))
+        {
+            if (with_children and tree->get_node(path).unloaded)
+            {
+                unloaded = path;
+            }
+        }
+        else
+        {
+            unloaded = tree->unloaded_ancestor(path);
+        }
+        if (not unloaded.has_value())
+        {
+            return tree;
+        }
+
+        // the loaded subtree may have unloaded directories deeper on the path
+        load_subtree(*unloaded);
+        tree = m_cache.snapshot();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::load_subtree(const Path& path)
+{
+    std::unique_lock<std::mutex> lg{m_subtree_mutex};
+    const auto it = m_subtree_loads.find(path);
+    if (it != m_subtree_loads.end())
+    {
+        const auto pending = it->second;
+        lg.unlock();
+        pending.get();
+        return;
+    }
+    std::promise<void> promise{};
+    m_subtree_loads.emplace(path, promise.get_future().share());
+    lg.unlock();
+
+    std::exception_ptr error{};
+    try
+    {
+        fetch_subtree(path);
+        promise.set_value();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+        promise.set_exception(error);
+    }
+
+    lg.lock();
+    m_subtree_loads.erase(path);
+    lg.unlock();
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::fetch_subtree(const Path& path)
+{
+    log_info("loading subtree {}", path.native());
+
+    // with the whole tree preloaded a directory is unloaded only until the tree
+    // stream reaches it, its subdirectories are coming too
+    const auto depth = (m_tree_depth == 0) ? 1 : m_tree_depth;
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command = messages::CreateCommandReadTreeDirect(fbb, path.c_str(), depth);
+    const auto res = m_comm.single_command<messages::ResultReadTree>(
+        fbb, command, std::chrono::seconds{60});
+    const auto& message = res.message();
+    if (message.res_errno() != 0)
+    {
+        throw std::system_error{message.res_errno(), std::generic_category()};
+    }
+
+    auto lg = m_cache.lock();
+    // removed or reloaded meanwhile
+    if (not m_cache.exists(path) or not m_cache.get_node(path).unloaded)
+    {
+        return;
+    }
+    // nodes made meanwhile are in the fetched subtree too
+    std::vector<Path> children{};
+    const auto& tree = m_cache.get_tree();
+    tree.for_each_child(tree.get_node(path),
+                        [&children, &path](const std::string_view name, const auto&) {
+                            children.push_back(path / Path{name.begin(), name.end()});
+                        });
+    for (const auto& child: children)
+    {
+        m_cache.remove(child);
+    }
+    populate_node(m_cache, m_cache.get_node(path), *message.tree());
+    m_cache.publish();
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<cache::Content::Range>
+    CachedVfs::read_disk_store(const Path& path, const off_t offset,
+                               const gsl::span<uint8_t> output,
+                               const std::vector<cache::Content::Range>& missing)
+{
+    const auto st = published_stat(m_cache, path);
+    if (not st.has_value())
+    {
+        return missing;
+    }
+
+    std::vector<cache::Content::Range> still_missing{};
+    for (const auto& range: missing)
+    {
+        const auto output_ofs = static_cast<size_t>(range.start)
+                                - static_cast<size_t>(offset);
+        const auto not_stored = m_disk_store.read(path, *st, range.start,
+                                                  output.subspan(output_ofs, range.size));
+
+        // keep the found parts in the memory too
+        auto pos = range.start;
+        const auto cache_up_to = [this, &path, &output, offset, &pos](const uintmax_t end) {
+            if (end > pos)
+            {
+                const auto data = output.subspan(
+                    static_cast<size_t>(pos) - static_cast<size_t>(offset),
+                    static_cast<size_t>(end - pos));
+                auto lg = m_cache.lock();
+                m_cache.write(path, pos, {data.begin(), data.end()});
+            }
+        };
+        for (const auto& gap: not_stored)
+        {
+            cache_up_to(gap.start);
+            pos = gap.start + gap.size;
+        }
+        cache_up_to(range.start + range.size);
+
+        still_missing.insert(still_missing.end(), not_stored.begin(), not_stored.end());
+    }
+    return still_missing;
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Written CachedVfs::write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                               const off_t offset)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if ((it == m_opened_files.end()) or (not it->second.subvfs_handle.has_value()))
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto file = it->second;
+    lg.unlock();
+
+    if (m_write_back_enabled)
+    {
+        m_write_back.write(strong::value_of(fh), file.path, offset, input);
+
+        // the server attributes come with the upload (see upload())
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        lg.lock();
+        // renamed or removed meanwhile
+        const auto& path = m_opened_files.at(fh).path;
+        auto* const node = opened_node(path);
+        if (node == nullptr)
+        {
+            return {input.size(), std::nullopt};
+        }
+        node->st.st_size
+            = std::max(node->st.st_size, offset + static_cast<off_t>(input.size()));
+        node->st.st_mtim = now;
+        node->st.st_ctim = now;
+        struct stat st{};
+        copy(node->st, st);
+        m_cache.publish();
+        m_cache.write(path, static_cast<uintmax_t>(offset), {input.begin(), input.end()});
+        return {input.size(), st};
+    }
+
+    const auto written = m_subvfs.write(*file.subvfs_handle, input, offset);
+    if (file.path.empty())
+    {
+        return written;
+    }
+    const auto st = reported_or_current(m_subvfs, written.st, file.path);
+
+    lg.lock();
+    const auto& path = m_opened_files.at(fh).path;
+    auto* const node = opened_node(path);
+    if (node != nullptr)
+    {
+        copy(st, node->st);
+        m_cache.publish();
+        m_cache.write(path, static_cast<uintmax_t>(offset), {input.begin(), input.end()});
+    }
+    return {written.size, st};
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::flush(const FileHandle fh)
+{
+    if (m_write_back_enabled)
+    {
+        m_write_back.flush(strong::value_of(fh));
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::fsync(const FileHandle fh, const bool datasync)
+{
+    flush(fh);
+
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if (it == m_opened_files.end())
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto subhandle = it->second.subvfs_handle;
+    lg.unlock();
+
+    // a lazily opened file has nothing written
+    if (subhandle.has_value())
+    {
+        m_subvfs.fsync(*subhandle, datasync);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+IVfs::Mutation CachedVfs::fallocate(const FileHandle fh, const int mode,
+                                    const off_t offset, const off_t length)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if ((it == m_opened_files.end()) or (not it->second.subvfs_handle.has_value()))
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto file = it->second;
+    lg.unlock();
+
+    flush_written(file.path);
+    const auto mutation = m_subvfs.fallocate(*file.subvfs_handle, mode, offset, length);
+    if (file.path.empty())
+    {
+        // removed, nothing cached
+        return {mutation.st, std::nullopt, std::nullopt};
+    }
+    const auto st = reported_or_current(m_subvfs, mutation.st, file.path);
+
+    lg.lock();
+    const auto& path = m_opened_files.at(fh).path;
+    auto* const node = opened_node(path);
+    if (node != nullptr)
+    {
+        copy(st, node->st);
+        // a plain allocation keeps the content, punching/zeroing/collapsing not
+        if ((mode & ~FALLOC_FL_KEEP_SIZE) != 0)
+        {
+            m_cache.invalidate_content(path);
+        }
+        m_cache.publish();
+    }
+    return {st, std::nullopt, std::nullopt};
+}
+
+//--------------------------------------------------------------------------
+
+off_t CachedVfs::lseek(const FileHandle fh, const off_t offset, const int whence)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(fh);
+    if (it == m_opened_files.end())
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    if (((whence != SEEK_DATA) and (whence != SEEK_HOLE)) or (offset < 0))
+    {
+        throw std::system_error{EINVAL, std::generic_category()};
+    }
+    const auto file = it->second;
+    if (file.path.empty())
+    {
+        lg.unlock();
+        // removed, only the server knows the file
+        if (not file.subvfs_handle.has_value())
+        {
+            throw std::system_error{ENXIO, std::generic_category()};
+        }
+        flush(fh);
+        return m_subvfs.lseek(*file.subvfs_handle, offset, whence);
+    }
+    const auto size = m_cache.get_tree().get_node(file.path).st.st_size;
+    lg.unlock();
+
+    if (offset >= size)
+    {
+        throw std::system_error{ENXIO, std::generic_category()};
+    }
+    return (whence == SEEK_DATA) ? offset : size;
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::statfs(const Path& path, struct statvfs& st)
+{
+    std::lock_guard lg{m_statfs_mutex};
+    const auto now = std::chrono::steady_clock::now();
+    if (m_statfs.has_value() and (now - m_statfs_time < STATFS_TTL))
+    {
+        st = *m_statfs;
+        return;
+    }
+
+    struct statvfs fresh{};
+    try
+    {
+        m_subvfs.statfs(path, fresh);
+    }
+    catch (const std::system_error& err)
+    {
+        if (err.code().value() != ENOSYS)
+        {
+            if (not m_statfs.has_value())
+            {
+                throw;
+            }
+            // e.g. disconnected, keep `df` working
+            log_warning("statfs failed: {}", err.what());
+            st = *m_statfs;
+            return;
+        }
+        // an older server, the sizes are unknown
+        fresh = {};
+        fresh.f_bsize = 4096;
+        fresh.f_frsize = 4096;
+        fresh.f_namemax = NAME_MAX;
+    }
+    m_statfs = fresh;
+    m_statfs_time = now;
+    st = fresh;
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::access(const Path& path, const int mask)
+{
+    const auto tree = loaded_tree(path, false);
+    check_access(tree->get_node(path).st.st_mode, mask);
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::opendir(const Path& path)
+{
+    // readdir follows, load the children now
+    const auto tree = loaded_tree(path, true);
+    if (not S_ISDIR(tree->get_node(path).st.st_mode))
+    {
+        throw std::system_error{ENOTDIR, std::generic_category()};
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::upload(const WriteBack::Handle handle, const off_t offset,
+                       const gsl::span<const uint8_t> data)
+{
+    auto lg = m_cache.lock();
+    const auto it = m_opened_files.find(FileHandle{handle});
+    if ((it == m_opened_files.end()) or (not it->second.subvfs_handle.has_value()))
+    {
+        throw std::system_error{EBADF, std::generic_category()};
+    }
+    const auto file = it->second;
+    lg.unlock();
+
+    const auto written = m_subvfs.write(*file.subvfs_handle, data, offset);
+    if (written.size < data.size())
+    {
+        throw std::system_error{EIO, std::generic_category()};
+    }
+
+    lg.lock();
+    // the local attributes are newer while more writes wait
+    if (not written.st.has_value() or m_write_back.has_queued(handle))
+    {
+        return;
+    }
+    // the node at the current path of the file (see File::path)
+    const auto refreshed_it = m_opened_files.find(FileHandle{handle});
+    auto* const node = (refreshed_it == m_opened_files.end())
+                           ? nullptr
+                           : opened_node(refreshed_it->second.path);
+    if (node != nullptr)
+    {
+        copy(*written.st, node->st);
+        m_cache.publish();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::flush_written(const Path& path)
+{
+    if (m_write_back_enabled)
+    {
+        m_write_back.flush_path(path);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+cache::Node* CachedVfs::opened_node(const Path& path)
+{
+    if (path.empty() or not m_cache.exists(path))
+    {
+        return nullptr;
+    }
+    return &m_cache.get_node(path);
+}
+
+//--------------------------------------------------------------------------
+
+void CachedVfs::rename_opened(const Path& old_path, const Path& new_path,
+                              const bool exchange)
+{
+    for (auto& item: m_opened_files)
+    {
+        auto& path = item.second.path;
+        if (const auto moved = moved_path(path, old_path, new_path))
+        {
+            path = *moved;
+        }
+        else if (const auto replaced = moved_path(path, new_path, old_path))
+        {
+            // a replaced target is removed
+            path = exchange ? *replaced : Path{};
+        }
+    }
+}
+
+//==========================================================================
+
+static bool is_same_time(const timespec& t1, const timespec& t2)
+{
+    return (t1.tv_sec == t2.tv_sec) and (t1.tv_nsec == t2.tv_nsec);
+}
+
+//==========================================================================
+
+BackgroundLoader::BackgroundLoader(Serializer& serializer, Deserializer& deserializer,
+                                   Distributor& distributor, cache::Cache& cache)
+    : m_serializer{serializer}
+    , m_deserializer{deserializer}
+    , m_distributor{distributor}
+    , m_cache{cache}
+{
+#define SUB(_Msg, func) \
+    m_distributor.subscribe<messages::_Msg>( \
+        [this](const MessageId, const auto& msg) { \
+            BackgroundLoader::func(msg); \
+        });
+    SUB(NotifyChanged, process_remote_changed);
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::start()
+{
+    m_tree_loader_thread = std::thread{&BackgroundLoader::tree_loader, this};
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::stop()
+{
+    m_quit = true;
+    m_cv.notify_one();
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::wait()
+{
+    if (m_tree_loader_thread.joinable())
+    {
+        m_tree_loader_thread.join();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::set_tree_depth(const uint32_t depth)
+{
+    m_tree_depth = depth;
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::invalidate_tree()
+{
+    m_tree_invalidated = true;
+    m_cv.notify_one();
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::connected(const cache::TreeTag& server,
+                                 const uint64_t capabilities)
+{
+    auto lg = m_cache.lock();
+    m_server_id = server.server_id;
+    m_server_capabilities = capabilities;
+    // an older server does not tell its version
+    const auto up_to_date = not server.server_id.empty() and (m_tree_tag == server);
+    lg.unlock();
+
+    if (up_to_date)
+    {
+        log_info("tree is up to date (generation {})", server.generation);
+        return;
+    }
+    invalidate_tree();
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::load_snapshot(const IVfs::Path& file, const std::string& endpoint)
+{
+    m_snapshot_file = file;
+    m_endpoint = endpoint;
+
+    auto snapshot = cache::load_tree(file, endpoint);
+    if (not snapshot.has_value())
+    {
+        return;
+    }
+    log_info("tree snapshot loaded, {} nodes, generation {}", snapshot->tree.size(),
+             snapshot->tag.generation);
+
+    auto lg = m_cache.lock();
+    m_cache.reset(std::move(snapshot->tree));
+    m_cache.publish();
+    m_tree_tag = std::move(snapshot->tag);
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::save_snapshot()
+{
+    if (m_snapshot_file.empty())
+    {
+        return;
+    }
+
+    // the tag first, the tree may be only newer than the tag, never older
+    auto lg = m_cache.lock();
+    if (not m_tree_tag.has_value())
+    {
+        return;
+    }
+    const auto tag = *m_tree_tag;
+    lg.unlock();
+    const auto snapshot = m_cache.snapshot();
+
+    try
+    {
+        cache::save_tree(m_snapshot_file, m_endpoint, tag, *snapshot);
+        log_info("tree snapshot saved, {} nodes", snapshot->size());
+    }
+    catch (const std::exception& err)
+    {
+        log_warning("can't save the tree snapshot: {}", err.what());
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::populate_tree()
+{
+    log_info("populating tree");
 
-    auto& node = m_cache.get_node(file.path);
-    node.st = st;
-    m_cache.write(file.path, static_cast<uintmax_t>(offset),
-                  {input.begin(), input.end()});
+    auto lg = m_cache.lock();
+    const auto server_id = m_server_id;
+    const auto packed
+        = (m_server_capabilities
+           & static_cast<uint64_t>(messages::Capability::PackedTree))
+          != 0;
+    const auto hashes
+        = (m_server_capabilities
+           & static_cast<uint64_t>(messages::Capability::TreeHashes))
+          != 0;
+    // nothing to serve yet, let the readers use the tree as it arrives
+    const auto progressive = (m_cache.get_tree().size() == 1);
+    // the server sends only the changes since if it still knows them
+    auto since_generation
+        = (m_tree_tag.has_value() and not progressive
+           and (m_tree_tag->server_id == server_id))
+              ? m_tree_tag->generation
+              : uint64_t{0};
+    lg.unlock();
+
+    if ((since_generation != 0) and hashes)
+    {
+        try
+        {
+            update_tree(server_id, since_generation);
+            return;
+        }
+        catch (const std::exception& err)
+        {
+            log_warning("can't update the tree ({}), reloading", err.what());
+        }
+        since_generation = 0;
+    }
+
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command = messages::CreateCommandReadTreeDirect(
+        fbb, "/", m_tree_depth, true, packed, since_generation);
+    auto queue = m_serializer.new_queue(Serializer::PRIORITY_DEFAULT);
+    const auto mid = m_serializer.add_command(queue, fbb, command);
+
+    // otherwise build the new version aside, readers keep using the published one
+    cache::Tree tree{};
+    PendingListings pending{};
+    uint64_t generation{};
+    size_t chunks{0};
+    for (bool last = false; not last; ++chunks)
+    {
+        const auto res
+            = m_deserializer.wait_for_result<messages::ResultReadTreeChunk>(mid, TIMEOUT);
+        if (not res.is_valid())
+        {
+            throw std::system_error{EHOSTUNREACH, std::generic_category()};
+        }
+        const auto& chunk = res.message();
+        if (chunk.res_errno() != 0)
+        {
+            throw std::system_error{chunk.res_errno(), std::generic_category()};
+        }
+        if (chunks == 0)
+        {
+            generation = chunk.generation();
+            if (chunk.incremental())
+            {
+                apply_tree_changes(chunk, cache::TreeTag{server_id, generation});
+                return;
+            }
+        }
+        last = chunk.last();
+
+        if (progressive)
+        {
+            lg.lock();
+            insert_tree_chunk(m_cache, chunk, pending);
+            m_cache.publish();
+            lg.unlock();
+        }
+        else
+        {
+            insert_tree_chunk(tree, chunk, pending);
+        }
+    }
+
+    lg.lock();
+    if (not progressive)
+    {
+        m_cache.reset(std::move(tree));
+        m_cache.publish();
+    }
+    m_tree_tag = cache::TreeTag{server_id, generation};
+    lg.unlock();
 
-    return res;
+    log_info("populating tree done, {} chunks", chunks);
 }
 
-//==========================================================================
+//--------------------------------------------------------------------------
 
-BackgroundLoader::BackgroundLoader(Serializer& serializer, Deserializer& deserializer,
-                                   Distributor& distributor, cache::Cache& cache)
-    : m_serializer{serializer}
-    , m_deserializer{deserializer}
-    , m_distributor{distributor}
-    , m_cache{cache}
+void BackgroundLoader::update_tree(const std::string& server_id,
+                                   const uint64_t since_generation)
 {
-#define SUB(_Msg, func) \
-    m_distributor.subscribe<messages::_Msg>( \
-        [this](const MessageId, const auto& msg) { \
-            BackgroundLoader::func(msg); \
-        });
-    SUB(NotifyChanged, process_remote_changed);
+    flatbuffers::FlatBufferBuilder fbb{};
+    const auto command = messages::CreateCommandReadTreeDirect(
+        fbb, "/", m_tree_depth, true, false, since_generation, true);
+    const auto res = m_comm.single_command<messages::ResultReadTreeChunk>(fbb, command);
+    const auto& chunk = res.message();
+    if (chunk.res_errno() == ESTALE)
+    {
+        // the journal does not reach that far
+        sync_tree(server_id);
+        return;
+    }
+    if (chunk.res_errno() != 0)
+    {
+        throw std::system_error{chunk.res_errno(), std::generic_category()};
+    }
+    if (not chunk.incremental())
+    {
+        throw std::system_error{EPROTO, std::generic_category()};
+    }
+    apply_tree_changes(chunk, cache::TreeTag{server_id, chunk.generation()});
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::start()
+void BackgroundLoader::sync_tree(const std::string& server_id)
 {
-    m_tree_loader_thread = std::thread{&BackgroundLoader::tree_loader, this};
+    log_info("comparing tree hashes");
+    // the published hashes are current (see Cache::publish())
+    const auto tree = m_cache.snapshot();
+
+    std::vector<Change> changes{};
+    std::vector<std::pair<IVfs::Path, uint64_t>> hashes{};
+    std::deque<IVfs::Path> pending{"/"};
+    std::optional<uint64_t> generation{};
+    size_t listed{0};
+    while (not pending.empty())
+    {
+        std::vector<std::string> paths{};
+        while (not pending.empty() and (paths.size() < HASHES_BATCH))
+        {
+            paths.push_back(pending.front().native());
+            pending.pop_front();
+        }
+        flatbuffers::FlatBufferBuilder fbb{};
+        const auto fbb_paths = fbb.CreateVectorOfStrings(paths);
+        const auto command = messages::CreateCommandReadTreeHashes(fbb, fbb_paths);
+        const auto res
+            = m_comm.single_command<messages::ResultReadTreeHashes>(fbb, command);
+        const auto& msg = res.message();
+        if (msg.res_errno() != 0)
+        {
+            throw std::system_error{msg.res_errno(), std::generic_category()};
+        }
+        if ((msg.directories() == nullptr) or (msg.directories()->size() != paths.size()))
+        {
+            throw std::system_error{EPROTO, std::generic_category()};
+        }
+        if (not generation.has_value())
+        {
+            // the oldest listing, newer changes are notified
+            generation = msg.generation();
+        }
+        for (const auto* directory: *msg.directories())
+        {
+            diff_directory(*tree, *directory, changes, pending, hashes);
+        }
+        listed += paths.size();
+    }
+
+    apply_changes(changes);
+    auto lg = m_cache.lock();
+    // the next sync compares the unloaded directories without listing them
+    for (const auto& [path, hash]: hashes)
+    {
+        if (m_cache.exists(path) and m_cache.get_tree().get_node(path).unloaded)
+        {
+            m_cache.get_node(path).hash = hash;
+        }
+    }
+    m_cache.publish();
+    m_tree_tag = cache::TreeTag{server_id, *generation};
+    lg.unlock();
+    log_info("tree synchronized to generation {}, {} directories listed", *generation,
+             listed);
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::stop()
+void BackgroundLoader::diff_directory(
+    const cache::Tree& tree, const messages::HashedDirectory& directory,
+    std::vector<Change>& changes, std::deque<IVfs::Path>& pending,
+    std::vector<std::pair<IVfs::Path, uint64_t>>& hashes)
 {
-    m_quit = true;
+    if ((directory.res_errno() != 0) or (directory.path() == nullptr))
+    {
+        // changed meanwhile, the parent listing tells
+        return;
+    }
+    const IVfs::Path path{directory.path()->str()};
+    if (not tree.exists(path))
+    {
+        return;
+    }
+    const auto& node = tree.get_node(path);
+    if (node.hash == directory.hash())
+    {
+        return;
+    }
+
+    std::unordered_set<std::string_view> names{};
+    if (directory.children() != nullptr)
+    {
+        for (const auto* child: *directory.children())
+        {
+            if ((child->name() == nullptr) or (child->st() == nullptr))
+            {
+                throw std::system_error{EPROTO, std::generic_category()};
+            }
+            const std::string_view name{child->name()->c_str(), child->name()->size()};
+            names.insert(name);
+            const auto child_path = path / child->name()->str();
+            cache::Stat st{};
+            copy(*child->st(), st);
+
+            if (not tree.has_child(node, name))
+            {
+                changes.push_back({messages::ChangeType::Created, child_path, {}, st});
+                if (S_ISDIR(st.st_mode))
+                {
+                    hashes.emplace_back(child_path, child->hash());
+                }
+                continue;
+            }
+            const auto& cached = tree.get_node(child_path);
+            if (not cache::is_same_content(cached.st, st)
+                or (cached.st.st_mode != st.st_mode))
+            {
+                changes.push_back({messages::ChangeType::Modified, child_path, {}, st});
+            }
+            // unloaded directories are fetched with the current content later
+            if (S_ISDIR(st.st_mode) and cached.unloaded)
+            {
+                hashes.emplace_back(child_path, child->hash());
+            }
+            else if (S_ISDIR(st.st_mode) and S_ISDIR(cached.st.st_mode)
+                     and (cached.hash != child->hash()))
+            {
+                pending.push_back(child_path);
+            }
+        }
+    }
+    tree.for_each_child(node, [&](const std::string_view name, const cache::Node&) {
+        if (names.count(name) == 0)
+        {
+            changes.push_back(
+                {messages::ChangeType::Deleted, path / std::string{name}, {}, {}});
+        }
+    });
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::wait()
+void BackgroundLoader::apply_tree_changes(const messages::ResultReadTreeChunk& chunk,
+                                          const cache::TreeTag& tag)
 {
-    if (m_tree_loader_thread.joinable())
+    try
     {
-        m_tree_loader_thread.join();
+        const auto changes
+            = (chunk.changes() == nullptr)
+                  ? std::optional<std::vector<Change>>{std::vector<Change>{}}
+                  : parse_changes(*chunk.changes());
+        if (not changes.has_value())
+        {
+            throw std::system_error{EPROTO, std::generic_category()};
+        }
+        apply_changes(*changes);
+    }
+    catch (const std::exception& err)
+    {
+        log_warning("can't apply the tree changes ({}), reloading", err.what());
+        auto lg = m_cache.lock();
+        // the next request gets the whole tree
+        m_tree_tag.reset();
+        lg.unlock();
+        populate_tree();
+        return;
     }
+
+    auto lg = m_cache.lock();
+    m_tree_tag = tag;
+    lg.unlock();
+    log_info("tree updated to generation {}", tag.generation);
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::invalidate_tree()
+void BackgroundLoader::apply_changes(const std::vector<Change>& changes)
 {
-    m_tree_invalidated = true;
-    m_cv.notify_one();
+    log_info("applying {} remote changes", changes.size());
+    for (const auto& change: changes)
+    {
+        apply_change(change);
+    }
+
+    auto lg = m_cache.lock();
+    m_cache.publish();
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::populate_tree()
+void BackgroundLoader::apply_change(const Change& change)
 {
-    log_info("populating tree");
+    log_trace("remote change {} '{}'", messages::EnumNameChangeType(change.type),
+              change.path.native());
 
-    flatbuffers::FlatBufferBuilder fbb{};
-    const auto command = messages::CreateCommandReadTreeDirect(fbb, "/");
-    const auto res = m_comm.single_command<messages::ResultReadTree>(
-        fbb, command, std::chrono::seconds{60});
+    // unloaded directories are fetched with the current content later
+    if (change.type != messages::ChangeType::Renamed)
+    {
+        auto lg = m_cache.lock();
+        if (m_cache.get_tree().unloaded_ancestor(change.path).has_value())
+        {
+            return;
+        }
+    }
 
-    const auto& message = res.message();
-    if (message.res_errno() != 0)
+    switch (change.type)
     {
-        throw std::system_error{message.res_errno(), std::generic_category()};
+        case messages::ChangeType::Created:
+            create_node(change.path, change.st);
+            break;
+        case messages::ChangeType::Deleted:
+        {
+            auto lg = m_cache.lock();
+            if (m_cache.exists(change.path))
+            {
+                m_cache.remove(change.path);
+            }
+            break;
+        }
+        case messages::ChangeType::Modified:
+            if (change.reload)
+            {
+                // the content is not watched by the server (excluded)
+                unload_directory(change.path);
+            }
+            update_node(change.path, change.st);
+            break;
+        case messages::ChangeType::Renamed:
+        {
+            auto lg = m_cache.lock();
+            if (m_cache.get_tree().unloaded_ancestor(change.new_path).has_value())
+            {
+                // moved out of the loaded part
+                if (m_cache.exists(change.path))
+                {
+                    m_cache.remove(change.path);
+                }
+                break;
+            }
+            if (m_cache.exists(change.new_path))
+            {
+                m_cache.remove(change.new_path);
+            }
+            if (m_cache.exists(change.path))
+            {
+                m_cache.rename(change.path, change.new_path);
+                m_cache.get_node(change.new_path).st = change.st;
+            }
+            else
+            {
+                lg.unlock();
+                create_node(change.new_path, change.st);
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error{"unknown change type"};
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void BackgroundLoader::create_node(const IVfs::Path& path, const cache::Stat& st)
+{
+    // content of a new directory is not necessarily reported
+    std::optional<Deserializer::Result<messages::ResultReadTree>> subtree{};
+    if (S_ISDIR(st.st_mode))
+    {
+        flatbuffers::FlatBufferBuilder fbb{};
+        const auto command
+            = messages::CreateCommandReadTreeDirect(fbb, path.c_str(), m_tree_depth);
+        subtree = m_comm.single_command<messages::ResultReadTree>(fbb, command);
+        if (subtree->message().res_errno() != 0)
+        {
+            throw std::system_error{subtree->message().res_errno(),
+                                    std::generic_category()};
+        }
+    }
+
+    auto lg = m_cache.lock();
+    if (m_cache.exists(path))
+    {
+        m_cache.remove(path);
+    }
+    auto& node = m_cache.make_node(path);
+    node.st = st;
+    if (subtree.has_value())
+    {
+        populate_node(m_cache, node, *subtree->message().tree());
     }
+}
+
+//--------------------------------------------------------------------------
 
+void BackgroundLoader::update_node(const IVfs::Path& path, const cache::Stat& st)
+{
     auto lg = m_cache.lock();
-    m_cache.reset();
-    populate_tree(m_cache.get_root(), *message.tree());
+    if (not m_cache.exists(path)
+        or ((m_cache.get_node(path).st.st_mode & S_IFMT) != (st.st_mode & S_IFMT)))
+    {
+        lg.unlock();
+        create_node(path, st);
+        return;
+    }
 
-    log_info("populating tree done");
+    auto& node = m_cache.get_node(path);
+    // attributes only (e.g. chmod) keep the content
+    const auto content_changed = (node.st.st_size != st.st_size)
+                                 or not is_same_time(node.st.st_mtim, st.st_mtim);
+    node.st = st;
+    if (content_changed)
+    {
+        m_cache.invalidate_content(path);
+    }
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::populate_tree(cache::Node& node, const messages::TreeNode& fbb_node)
+void BackgroundLoader::unload_directory(const IVfs::Path& path)
 {
-    node.name = fbb_node.name()->str();
-    copy(*fbb_node.st(), node.st);
-    for (const auto& child: *fbb_node.children())
+    auto lg = m_cache.lock();
+    if (not m_cache.exists(path) or (path == "/"))
     {
-        auto& new_child = m_cache.make_node(node, child->name()->str());
-        populate_tree(new_child, *child);
+        return;
+    }
+    const auto& node = m_cache.get_node(path);
+    if (not S_ISDIR(node.st.st_mode) or node.unloaded)
+    {
+        return;
     }
+    const auto st = node.st;
+    m_cache.remove(path);
+    auto& unloaded = m_cache.make_node(path);
+    unloaded.st = st;
+    unloaded.hash = cache::UNKNOWN_HASH;
+    unloaded.unloaded = true;
 }
 
 //--------------------------------------------------------------------------
@@ -807,6 +2735,7 @@ void BackgroundLoader::preload_files_bulks(const _It begin, const _It end)
                 std::vector<uint8_t> buf(block_aligned_size(message.data()->size()));
                 assert(buf.size() >= message.data()->size());
                 std::copy(message.data()->begin(), message.data()->end(), buf.begin());
+                auto lg = m_cache.lock();
                 m_cache.write(message.path()->str(), message.offset(), std::move(buf));
             }
         };
@@ -814,8 +2743,23 @@ void BackgroundLoader::preload_files_bulks(const _It begin, const _It end)
         // a size limit for a send buffer on the server side
         static constexpr uint64_t BULK_SIZE{1024 * 1024};
         uint64_t size_counter{0};
+
+        // do not evict already cached content by preloading
+        uint64_t budget{};
+        {
+            auto lg = m_cache.lock();
+            const auto stats = m_cache.get_content_stats();
+            budget = stats.capacity - std::min(stats.size, stats.capacity);
+        }
+
         for (auto files_it = begin; files_it != end; ++files_it)
         {
+            if (files_it->size > budget)
+            {
+                log_info("content cache is full, preloading stopped");
+                break;
+            }
+            budget -= files_it->size;
             log_trace("preloading {}", files_it->path.native());
             uint64_t offset{0};
             while (offset < files_it->size)
@@ -857,16 +2801,16 @@ void BackgroundLoader::preload_files()
 
     log_info("preloading content");
 
-    auto lg = m_cache.lock();
     std::vector<FileInfo> files_list{};
+    const auto snapshot = m_cache.snapshot();
+    const auto& tree = *snapshot;
     const auto browser
-        = [&files_list](const IVfs::Path& parent_, const cache::Node& node_) -> void
+        = [&files_list, &tree](const IVfs::Path& path_, const cache::Node& node_) -> void
     {
         const auto browser_impl
-            = [&files_list](const IVfs::Path& parent, const cache::Node& node,
-                            auto& browser_ref) -> void
+            = [&files_list, &tree](const IVfs::Path& node_path, const cache::Node& node,
+                                   auto& browser_ref) -> void
         {
-            const IVfs::Path node_path{(parent == "") ? "/" : parent / node.name};
             const auto is_directory
                 = static_cast<bool>((node.st.st_mode & S_IFDIR) == S_IFDIR);
             const auto is_symlink
@@ -883,14 +2827,25 @@ void BackgroundLoader::preload_files()
                     }
                 }
             }
-            for (const auto& child : node.children)
-            {
-                browser_ref(node_path, child.second, browser_ref);
-            }
+            tree.for_each_child(node, [&](const std::string_view name,
+                                          const cache::Node& child) {
+                browser_ref(node_path / IVfs::Path{name.begin(), name.end()}, child,
+                            browser_ref);
+            });
         };
-        browser_impl(parent_, node_, browser_impl);
+        browser_impl(path_, node_, browser_impl);
     };
-    browser("", m_cache.get_root());
+    browser("/", tree.get_root());
+
+    // content kept from the previous tree version
+    {
+        auto lg = m_cache.lock();
+        const auto is_cached = [this](const FileInfo& file) {
+            return m_cache.read(file.path, 0, file.size, [](const auto) {});
+        };
+        files_list.erase(std::remove_if(files_list.begin(), files_list.end(), is_cached),
+                         files_list.end());
+    }
 
     preload_files_bulks(files_list.begin(), files_list.end());
 
@@ -904,14 +2859,25 @@ void BackgroundLoader::tree_loader()
     while (not m_quit)
     {
         auto lg = m_cache.lock();
-        m_cv.wait(lg, [this]() { return m_tree_invalidated.load(); });
+        m_cv.wait(lg, [this]() {
+            return m_quit.load() or m_tree_invalidated.load()
+                   or not m_pending_changes.empty();
+        });
+        if (m_quit)
+        {
+            break;
+        }
+        auto changes = std::move(m_pending_changes);
+        m_pending_changes.clear();
         lg.unlock();
 
         if (m_tree_invalidated.load())
         {
+            // the reload covers the pending changes too
             try
             {
                 populate_tree();
+                save_snapshot();
                 preload_files();
             }
             catch (const std::exception& err)
@@ -920,14 +2886,74 @@ void BackgroundLoader::tree_loader()
             }
             m_tree_invalidated = false;
         }
+        else
+        {
+            try
+            {
+                apply_changes(changes);
+            }
+            catch (const std::exception& err)
+            {
+                log_warning("can't apply remote changes ({}), reloading", err.what());
+                invalidate_tree();
+            }
+        }
     }
 }
 
 //--------------------------------------------------------------------------
 
-void BackgroundLoader::process_remote_changed(const messages::NotifyChanged&)
+void BackgroundLoader::process_remote_changed(const messages::NotifyChanged& message)
 {
-    invalidate_tree();
+    if (message.changes() == nullptr)
+    {
+        invalidate_tree();
+        return;
+    }
+
+    auto changes = parse_changes(*message.changes());
+    if (not changes.has_value())
+    {
+        invalidate_tree();
+        return;
+    }
+
+    auto lg = m_cache.lock();
+    std::move(changes->begin(), changes->end(), std::back_inserter(m_pending_changes));
+    m_cv.notify_one();
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<std::vector<BackgroundLoader::Change>> BackgroundLoader::parse_changes(
+    const flatbuffers::Vector<flatbuffers::Offset<messages::Change>>& fbb_changes)
+{
+    std::vector<Change> changes{};
+    changes.reserve(fbb_changes.size());
+    for (const auto* fbb_change: fbb_changes)
+    {
+        const auto is_renamed = (fbb_change->type() == messages::ChangeType::Renamed);
+        if ((fbb_change->path() == nullptr)
+            or (is_renamed and (fbb_change->new_path() == nullptr)))
+        {
+            return std::nullopt;
+        }
+
+        Change change{};
+        change.type = fbb_change->type();
+        change.path = fbb_change->path()->str();
+        if (is_renamed)
+        {
+            change.new_path = fbb_change->new_path()->str();
+        }
+        if (fbb_change->st() != nullptr)
+        {
+            copy(*fbb_change->st(), change.st);
+        }
+        change.reload = fbb_change->reload();
+        changes.emplace_back(std::move(change));
+    }
+    return changes;
 }
 
 //==========================================================================
@@ -6,11 +6,16 @@
 #ifndef VFS_HPP__TI3ABKYJ
 #define VFS_HPP__TI3ABKYJ
 
+#include <chrono>
+#include <deque>
+#include <future>
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <vector>
 
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 
 #include "rewofs/disablewarnings.hpp"
 #include <boost/filesystem.hpp>
@@ -18,7 +23,10 @@
 
 #include "rewofs/client/config.hpp"
 #include "rewofs/client/cache.hpp"
+#include "rewofs/client/disk_store.hpp"
 #include "rewofs/client/transport.hpp"
+#include "rewofs/client/tree_store.hpp"
+#include "rewofs/client/write_back.hpp"
 #include "rewofs/transport.hpp"
 
 //==========================================================================
@@ -53,28 +61,79 @@ public:
     using Path = boost::filesystem::path;
     using DirFiller = std::function<void(const Path&, const struct stat&)>;
 
+    struct ReadRange
+    {
+        off_t offset{};
+        gsl::span<uint8_t> output{};
+    };
+
+    /// Attributes after a successful mutation as reported by the server, nullopt
+    /// if not reported (older servers, removed targets).
+    struct Mutation
+    {
+        std::optional<struct stat> st{};
+        std::optional<struct stat> parent_st{};
+        /// rename only
+        std::optional<struct stat> old_parent_st{};
+    };
+
+    struct Created
+    {
+        FileHandle fh;
+        Mutation mutation{};
+    };
+
+    struct Written
+    {
+        size_t size{};
+        /// the file after the write
+        std::optional<struct stat> st{};
+    };
+
     virtual void getattr(const Path& path, struct stat& st) = 0;
     virtual void readdir(const Path& path, const DirFiller& filler)
         = 0;
     virtual Path readlink(const Path& path) = 0;
-    virtual void mkdir(const Path& path, mode_t mode) = 0;
-    virtual void rmdir(const Path& path) = 0;
-    virtual void unlink(const Path& path) = 0;
-    virtual void symlink(const Path& target, const Path& link_path) = 0;
-    virtual void rename(const Path& old_path, const Path& new_path, const uint32_t flags)
+    virtual Mutation mkdir(const Path& path, mode_t mode) = 0;
+    virtual Mutation rmdir(const Path& path) = 0;
+    virtual Mutation unlink(const Path& path) = 0;
+    virtual Mutation symlink(const Path& target, const Path& link_path) = 0;
+    virtual Mutation rename(const Path& old_path, const Path& new_path,
+                            const uint32_t flags)
         = 0;
-    virtual void chmod(const Path& path, const mode_t mode) = 0;
-    virtual void utimens(const Path& path, const struct timespec tv[2]) = 0;
-    virtual void truncate(const Path& path, const off_t length) = 0;
-    virtual FileHandle create(const Path& path, const int flags, const mode_t mode) = 0;
+    virtual Mutation chmod(const Path& path, const mode_t mode) = 0;
+    virtual Mutation utimens(const Path& path, const struct timespec tv[2]) = 0;
+    virtual Mutation truncate(const Path& path, const off_t length) = 0;
+    virtual Created create(const Path& path, const int flags, const mode_t mode) = 0;
     virtual FileHandle open(const Path& path, const int flags) = 0;
     virtual void close(const FileHandle fh) = 0;
     virtual size_t read(const FileHandle fh, const gsl::span<uint8_t> output,
                         const off_t offset)
         = 0;
-    virtual size_t write(const FileHandle fh, const gsl::span<const uint8_t> input,
-                         const off_t offset)
+    /// Read several ranges of a file at once.
+    /// @return read size of each range
+    virtual std::vector<size_t> read_ranges(const FileHandle fh,
+                                            const std::vector<ReadRange>& ranges);
+    virtual Written write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                          const off_t offset)
+        = 0;
+    /// Wait until the written data are stored on the server. Throws an error of a
+    /// failed background write.
+    virtual void flush(const FileHandle fh);
+    /// flush() and make the data durable on the server
+    virtual void fsync(const FileHandle fh, const bool datasync) = 0;
+    virtual Mutation fallocate(const FileHandle fh, const int mode, const off_t offset,
+                               const off_t length)
         = 0;
+    /// @param whence SEEK_DATA or SEEK_HOLE
+    virtual off_t lseek(const FileHandle fh, const off_t offset, const int whence) = 0;
+    virtual void statfs(const Path& path, struct statvfs& st) = 0;
+    /// Check the permission bits of the owner, the server acts as the owner of
+    /// all files.
+    /// @param mask F_OK or R_OK, W_OK and X_OK
+    virtual void access(const Path& path, const int mask) = 0;
+    /// Check that the path is a directory.
+    virtual void opendir(const Path& path) = 0;
 
 private:
 };
@@ -84,37 +143,119 @@ private:
 class RemoteVfs : public IVfs, private boost::noncopyable
 {
 public:
+    class Batch;
+
     RemoteVfs(Serializer& serializer, Deserializer& deserializer,
               IdDispenser& id_dispenser);
 
+    /// @param capabilities see messages::Pong
+    void set_capabilities(const uint64_t capabilities);
+
     void getattr(const Path& path, struct stat& st) override;
     void readdir(const Path& path, const DirFiller& filler) override;
     Path readlink(const Path& path) override;
-    void mkdir(const Path& path, mode_t mode) override;
-    void rmdir(const Path& path) override;
-    void unlink(const Path& path) override;
-    void symlink(const Path& target, const Path& link_path) override;
-    void rename(const Path& old_path, const Path& new_path, const uint32_t flags) override;
-    void chmod(const Path& path, const mode_t mode) override;
-    void utimens(const Path& path, const struct timespec tv[2]) override;
-    void truncate(const Path& path, const off_t length) override;
-    FileHandle create(const Path& path, const int flags, const mode_t mode) override;
+    Mutation mkdir(const Path& path, mode_t mode) override;
+    Mutation rmdir(const Path& path) override;
+    Mutation unlink(const Path& path) override;
+    Mutation symlink(const Path& target, const Path& link_path) override;
+    Mutation rename(const Path& old_path, const Path& new_path,
+                    const uint32_t flags) override;
+    Mutation chmod(const Path& path, const mode_t mode) override;
+    Mutation utimens(const Path& path, const struct timespec tv[2]) override;
+    Mutation truncate(const Path& path, const off_t length) override;
+    Created create(const Path& path, const int flags, const mode_t mode) override;
     FileHandle open(const Path& path, const int flags) override;
     void close(const FileHandle fh) override;
     size_t read(const FileHandle fh, const gsl::span<uint8_t> output,
                 const off_t offset) override;
-    size_t write(const FileHandle fh, const gsl::span<const uint8_t> input,
-                 const off_t offset) override;
+    /// All fragments of all ranges are queued before waiting for the results.
+    std::vector<size_t> read_ranges(const FileHandle fh,
+                                    const std::vector<ReadRange>& ranges) override;
+    Written write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                  const off_t offset) override;
+    void fsync(const FileHandle fh, const bool datasync) override;
+    Mutation fallocate(const FileHandle fh, const int mode, const off_t offset,
+                       const off_t length) override;
+    off_t lseek(const FileHandle fh, const off_t offset, const int whence) override;
+    void statfs(const Path& path, struct statvfs& st) override;
+    void access(const Path& path, const int mask) override;
+    void opendir(const Path& path) override;
 
     //--------------------------------
 private:
-    FileHandle open_common(const Path& path, const int flags,
-                           const std::optional<mode_t> mode);
+    Created open_common(const Path& path, const int flags,
+                        const std::optional<mode_t> mode, const uint64_t open_id);
+    bool has_capability(const messages::Capability capability) const;
 
     Serializer& m_serializer;
     Deserializer& m_deserializer;
     IdDispenser& m_id_dispenser;
     SingleComm m_comm{m_serializer, m_deserializer};
+    /// messages::Capability bits of the connected server
+    std::atomic<uint64_t> m_capabilities{0};
+};
+
+//--------------------------------------------------------------------------
+
+/// Operations sent together in a messages::CommandBatch and run in order by the
+/// server, a round trip per batch instead of one per operation. A server without
+/// messages::Capability::Batch gets them one by one.
+class RemoteVfs::Batch : private boost::noncopyable
+{
+public:
+    struct Result
+    {
+        /// 0 on success, ECANCELED if skipped after a failure
+        int res_errno{ECANCELED};
+        Mutation mutation{};
+        /// written size
+        size_t size{};
+    };
+
+    explicit Batch(RemoteVfs& vfs);
+
+    void mkdir(const Path& path, const mode_t mode);
+    void rmdir(const Path& path);
+    void unlink(const Path& path);
+    void symlink(const Path& target, const Path& link_path);
+    void rename(const Path& old_path, const Path& new_path, const uint32_t flags);
+    void chmod(const Path& path, const mode_t mode);
+    void utimens(const Path& path, const struct timespec tv[2]);
+    void truncate(const Path& path, const off_t length);
+    /// @return handle usable by the following operations, valid only if the
+    ///         creation succeeds
+    FileHandle create(const Path& path, const int flags, const mode_t mode);
+    /// The data is copied.
+    void write(const FileHandle fh, const gsl::span<const uint8_t> input,
+               const off_t offset);
+    void close(const FileHandle fh);
+
+    bool empty() const;
+    /// Send the operations and wait for the results, the batch is then empty.
+    /// Throws std::system_error(EHOSTUNREACH) if the server does not respond.
+    /// @param stop_on_error skip the operations following a failed one
+    /// @return a result per call in the order of the calls
+    std::vector<Result> run(const bool stop_on_error);
+
+private:
+    /// size of a CommandBatch frame to start a next one, the server receives up
+    /// to 1MB
+    static constexpr size_t FRAME_SIZE{512 * 1024};
+
+    struct Operation
+    {
+        /// the index of the call, a write is split to more operations
+        size_t call{};
+        std::function<flatbuffers::Offset<messages::BatchItem>(
+            flatbuffers::FlatBufferBuilder&)>
+            build{};
+        /// without a batch support
+        std::function<Result()> run{};
+    };
+
+    RemoteVfs& m_vfs;
+    std::vector<Operation> m_operations{};
+    size_t m_calls{0};
 };
 
 //==========================================================================
@@ -123,42 +264,107 @@ class CachedVfs:public IVfs
 {
 public:
     CachedVfs(IVfs& subvfs, Serializer& serializer, Deserializer& deserializer,
-              IdDispenser& id_dispenser, cache::Cache& cache);
+              IdDispenser& id_dispenser, cache::Cache& cache,
+              cache::DiskStore& disk_store);
+
+    /// See BackgroundLoader::set_tree_depth().
+    void set_tree_depth(const uint32_t depth);
+    /// Return from writes right after caching the data and upload them in the
+    /// background (see WriteBack). flush() and close() wait for the upload.
+    /// @param capacity of the dirty data in bytes, 0 for synchronous writes
+    void set_write_back(const size_t capacity);
+    void start();
+    void stop();
+    void wait();
 
     void getattr(const Path&, struct stat& st) override;
     void readdir(const Path&, const DirFiller& filler) override;
     Path readlink(const Path& path) override;
-    void mkdir(const Path& path, mode_t mode) override;
-    void rmdir(const Path& path) override;
-    void unlink(const Path& path) override;
-    void symlink(const Path& target, const Path& link_path) override;
-    void rename(const Path& old_path, const Path& new_path, const uint32_t flags) override;
-    void chmod(const Path& path, const mode_t mode) override;
-    void utimens(const Path& path, const struct timespec tv[2]) override;
-    void truncate(const Path& path, const off_t length) override;
-    FileHandle create(const Path& path, const int flags, const mode_t mode) override;
+    Mutation mkdir(const Path& path, mode_t mode) override;
+    Mutation rmdir(const Path& path) override;
+    Mutation unlink(const Path& path) override;
+    Mutation symlink(const Path& target, const Path& link_path) override;
+    Mutation rename(const Path& old_path, const Path& new_path,
+                    const uint32_t flags) override;
+    Mutation chmod(const Path& path, const mode_t mode) override;
+    Mutation utimens(const Path& path, const struct timespec tv[2]) override;
+    Mutation truncate(const Path& path, const off_t length) override;
+    Created create(const Path& path, const int flags, const mode_t mode) override;
     FileHandle open(const Path& path, const int flags) override;
     void close(const FileHandle fh) override;
     size_t read(const FileHandle fh, const gsl::span<uint8_t> output,
                 const off_t offset) override;
-    size_t write(const FileHandle fh, const gsl::span<const uint8_t> input,
-                 const off_t offset) override;
+    Written write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                  const off_t offset) override;
+    void flush(const FileHandle fh) override;
+    void fsync(const FileHandle fh, const bool datasync) override;
+    Mutation fallocate(const FileHandle fh, const int mode, const off_t offset,
+                       const off_t length) override;
+    /// Answered from the cached size, the files are considered without holes.
+    off_t lseek(const FileHandle fh, const off_t offset, const int whence) override;
+    /// The server answer is kept for STATFS_TTL.
+    void statfs(const Path& path, struct statvfs& st) override;
+    /// Evaluated from the cached attributes.
+    void access(const Path& path, const int mask) override;
+    void opendir(const Path& path) override;
 
 private:
+    static constexpr std::chrono::seconds STATFS_TTL{5};
+
     struct File
     {
         int open_flags{};
         std::optional<FileHandle> subvfs_handle{};
+        /// follows renames, empty if the file was removed (the tree is not updated by
+        /// the file then)
         Path path{};
     };
 
+    /// Load the unloaded directories on the path.
+    /// @param with_children also the children of the path itself
+    /// @return a published tree version with the path loaded (if it exists)
+    std::shared_ptr<const cache::Tree> loaded_tree(const Path& path,
+                                                   const bool with_children);
+    /// Concurrent loads of the same subtree wait for the first one.
+    void load_subtree(const Path& path);
+    void fetch_subtree(const Path& path);
+    /// Fill the missing ranges from the disk store and cache them in the memory.
+    /// @return the ranges still missing
+    std::vector<cache::Content::Range>
+        read_disk_store(const Path& path, const off_t offset,
+                        const gsl::span<uint8_t> output,
+                        const std::vector<cache::Content::Range>& missing);
+    /// WriteBack::Uploader
+    void upload(const WriteBack::Handle handle, const off_t offset,
+                const gsl::span<const uint8_t> data);
+    /// Let the server see the data written to the path before it is read or
+    /// modified there.
+    void flush_written(const Path& path);
+    /// @return the tree node of an opened file, nullptr if removed (needs the cache
+    ///         lock)
+    cache::Node* opened_node(const Path& path);
+    /// Let the opened files follow a rename (needs the cache lock).
+    void rename_opened(const Path& old_path, const Path& new_path, const bool exchange);
+
     IVfs& m_subvfs;
     Serializer& m_serializer;
     Deserializer& m_deserializer;
     IdDispenser& m_id_dispenser;
     SingleComm m_comm{m_serializer, m_deserializer};
     cache::Cache& m_cache;
+    cache::DiskStore& m_disk_store;
     std::unordered_map<FileHandle, File> m_opened_files{};
+    uint32_t m_tree_depth{0};
+    std::mutex m_subtree_mutex{};
+    /// loads in progress
+    std::unordered_map<Path, std::shared_future<void>> m_subtree_loads{};
+    bool m_write_back_enabled{false};
+    std::mutex m_statfs_mutex{};
+    std::optional<struct statvfs> m_statfs{};
+    std::chrono::steady_clock::time_point m_statfs_time{};
+    WriteBack m_write_back{
+        [this](const WriteBack::Handle handle, const off_t offset,
+               const gsl::span<const uint8_t> data) { upload(handle, offset, data); }};
 };
 
 //==========================================================================
@@ -174,18 +380,71 @@ public:
     void stop();
     void wait();
 
+    /// Fetch only `depth` levels of the tree (0 for the whole tree), deeper
+    /// directories are loaded on the first access.
+    void set_tree_depth(const uint32_t depth);
     void invalidate_tree();
+    /// Reload the tree unless it is the current server version.
+    /// @param capabilities see messages::Pong
+    void connected(const cache::TreeTag& server, const uint64_t capabilities);
+    /// Serve the tree stored by a previous run until the server is reachable.
+    /// The snapshot file is then updated after every tree reload.
+    void load_snapshot(const IVfs::Path& file, const std::string& endpoint);
+    void save_snapshot();
 
 private:
+    /// directories per CommandReadTreeHashes
+    static constexpr size_t HASHES_BATCH{256};
+
     struct FileInfo
     {
         IVfs::Path path{};
         uint64_t size{};
     };
 
-    /// Prefill the tree.
+    /// See messages::Change.
+    struct Change
+    {
+        messages::ChangeType type{};
+        IVfs::Path path{};
+        IVfs::Path new_path{};
+        cache::Stat st{};
+        bool reload{false};
+    };
+
+    /// Prefill the tree or bring it up to date.
     void populate_tree();
-    void populate_tree(cache::Node& node, const messages::TreeNode& fbb_node);
+    /// Bring an older tree version up to date by the journaled changes or by
+    /// comparing the directory hashes (see messages::Capability::TreeHashes).
+    void update_tree(const std::string& server_id, const uint64_t since_generation);
+    /// Fetch the listings of the directories whose hashes differ from the cached
+    /// ones, descending from the root.
+    void sync_tree(const std::string& server_id);
+    /// Compare a listing with the cached directory (hashed on
+    /// cache::Cache::publish()). Differing subdirectories are queued to
+    /// `pending`. The hashes of the subdirectories not loaded are collected to
+    /// `hashes` (see cache::Node::hash).
+    static void diff_directory(const cache::Tree& tree,
+                               const messages::HashedDirectory& directory,
+                               std::vector<Change>& changes,
+                               std::deque<IVfs::Path>& pending,
+                               std::vector<std::pair<IVfs::Path, uint64_t>>& hashes);
+    /// Apply an incremental reply to CommandReadTree. Reloads the whole tree if the
+    /// changes do not fit.
+    void apply_tree_changes(const messages::ResultReadTreeChunk& chunk,
+                            const cache::TreeTag& tag);
+    /// @return nullopt if malformed
+    static std::optional<std::vector<Change>> parse_changes(
+        const flatbuffers::Vector<flatbuffers::Offset<messages::Change>>& fbb_changes);
+    /// Update the tree in place. Throws if the changes do not fit the cached tree.
+    void apply_changes(const std::vector<Change>& changes);
+    void apply_change(const Change& change);
+    /// Replace or create a node. Directory subtrees are fetched.
+    void create_node(const IVfs::Path& path, const cache::Stat& st);
+    void update_node(const IVfs::Path& path, const cache::Stat& st);
+    /// Forget the loaded children of a directory, they are fetched on the next
+    /// access.
+    void unload_directory(const IVfs::Path& path);
     template<typename _It>
     void preload_files_bulks(const _It begin, const _It end);
     void preload_files();
@@ -200,6 +459,17 @@ private:
     std::thread m_tree_loader_thread{};
     std::condition_variable m_cv{};
     std::atomic<bool> m_tree_invalidated{false};
+    /// guarded by the cache lock
+    std::vector<Change> m_pending_changes{};
+    /// version of the last loaded tree, guarded by the cache lock
+    std::optional<cache::TreeTag> m_tree_tag{};
+    /// guarded by the cache lock
+    std::string m_server_id{};
+    /// messages::Capability bits, guarded by the cache lock
+    uint64_t m_server_capabilities{0};
+    IVfs::Path m_snapshot_file{};
+    std::string m_endpoint{};
+    uint32_t m_tree_depth{0};
     std::atomic<bool> m_quit{false};
 };
 
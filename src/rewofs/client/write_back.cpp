@@ -0,0 +1,349 @@
+/// @copydoc write_back.hpp
+///
+/// @file
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "rewofs/client/write_back.hpp"
+#include "rewofs/log.hpp"
+
+//==========================================================================
+namespace rewofs::client {
+//==========================================================================
+
+void DirtyExtents::add(const off_t offset, const gsl::span<const uint8_t> data)
+{
+    if (data.empty())
+    {
+        return;
+    }
+    auto start = offset;
+    auto end = offset + static_cast<off_t>(data.size());
+    const auto extent_end = [](const auto& extent) {
+        return extent.first + static_cast<off_t>(extent.second.size());
+    };
+    // adjacent extents are merged only while the result stays small
+    const auto joins = [&start, &end, &extent_end](const auto& extent) {
+        const auto ext_start = extent.first;
+        const auto ext_end = extent_end(extent);
+        if ((ext_start < end) and (ext_end > start))
+        {
+            return true;
+        }
+        const auto joined_size
+            = static_cast<size_t>(std::max(end, ext_end) - std::min(start, ext_start));
+        return ((ext_start == end) or (ext_end == start)) and (joined_size <= MAX_EXTENT);
+    };
+
+    auto first = m_extents.upper_bound(offset);
+    if ((first != m_extents.begin()) and joins(*std::prev(first)))
+    {
+        --first;
+    }
+    auto last = first;
+    while ((last != m_extents.end()) and joins(*last))
+    {
+        start = std::min(start, last->first);
+        end = std::max(end, extent_end(*last));
+        ++last;
+    }
+
+    std::vector<uint8_t> merged(static_cast<size_t>(end - start));
+    for (auto it = first; it != last; ++it)
+    {
+        std::copy(it->second.begin(), it->second.end(),
+                  merged.begin() + (it->first - start));
+        m_size -= it->second.size();
+    }
+    std::copy(data.begin(), data.end(), merged.begin() + (offset - start));
+    m_size += merged.size();
+    m_extents.erase(first, last);
+    m_extents.emplace(start, std::move(merged));
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<DirtyExtents::Extent> DirtyExtents::pop()
+{
+    if (m_extents.empty())
+    {
+        return std::nullopt;
+    }
+    const auto it = m_extents.begin();
+    Extent extent{it->first, std::move(it->second)};
+    m_extents.erase(it);
+    m_size -= extent.data.size();
+    return extent;
+}
+
+//--------------------------------------------------------------------------
+
+bool DirtyExtents::empty() const
+{
+    return m_extents.empty();
+}
+
+//--------------------------------------------------------------------------
+
+size_t DirtyExtents::size() const
+{
+    return m_size;
+}
+
+//--------------------------------------------------------------------------
+
+size_t DirtyExtents::count() const
+{
+    return m_extents.size();
+}
+
+//==========================================================================
+
+WriteBack::WriteBack(Uploader uploader)
+    : m_uploader{std::move(uploader)}
+{
+}
+
+//--------------------------------------------------------------------------
+
+WriteBack::~WriteBack()
+{
+    stop();
+    wait();
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::set_capacity(const size_t capacity)
+{
+    std::lock_guard lg{m_mutex};
+    m_capacity = capacity;
+    m_cv.notify_all();
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::start()
+{
+    m_runner = std::thread{&WriteBack::run, this};
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::stop()
+{
+    std::lock_guard lg{m_mutex};
+    m_quit = true;
+    m_cv.notify_all();
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::wait()
+{
+    if (m_runner.joinable())
+    {
+        m_runner.join();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::write(const Handle handle, const Path& path, const off_t offset,
+                      const gsl::span<const uint8_t> data)
+{
+    std::unique_lock lg{m_mutex};
+    // a single large write is let through
+    m_cv.wait(lg, [this, &data] {
+        return m_quit or (m_dirty_size == 0)
+               or (m_dirty_size + data.size() <= m_capacity);
+    });
+    if (m_quit)
+    {
+        throw std::system_error{ESHUTDOWN, std::generic_category()};
+    }
+
+    auto& file = m_files[handle];
+    file.path = path;
+    const auto size_before = file.extents.size();
+    file.extents.add(offset, data);
+    m_dirty_size = m_dirty_size - size_before + file.extents.size();
+    m_cv.notify_all();
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::flush(const Handle handle)
+{
+    std::unique_lock lg{m_mutex};
+    const auto it = m_files.find(handle);
+    if (it == m_files.end())
+    {
+        return;
+    }
+    m_cv.wait(lg, [this, &file = it->second] { return m_quit or file.is_clean(); });
+    if (not it->second.is_clean())
+    {
+        throw std::system_error{ESHUTDOWN, std::generic_category()};
+    }
+    const auto error = std::exchange(it->second.error, {});
+    if (error)
+    {
+        throw std::system_error{error};
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::flush_path(const Path& path)
+{
+    // a renamed directory moves the files inside
+    const auto clean = [&path](const auto& item) {
+        const auto& file_path = item.second.path;
+        const auto inside = path.empty()
+                                ? file_path.empty()
+                                : std::mismatch(path.begin(), path.end(),
+                                                file_path.begin(), file_path.end())
+                                          .first
+                                      == path.end();
+        return not inside or item.second.is_clean();
+    };
+    std::unique_lock lg{m_mutex};
+    m_cv.wait(lg, [this, &clean] {
+        return m_quit or std::all_of(m_files.begin(), m_files.end(), clean);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+bool WriteBack::has_queued(const Handle handle) const
+{
+    std::lock_guard lg{m_mutex};
+    const auto it = m_files.find(handle);
+    return (it != m_files.end()) and not it->second.extents.empty();
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::forget(const Handle handle)
+{
+    std::lock_guard lg{m_mutex};
+    const auto it = m_files.find(handle);
+    if (it == m_files.end())
+    {
+        return;
+    }
+    // an upload in progress is accounted by run()
+    m_dirty_size -= it->second.extents.size();
+    m_files.erase(it);
+    m_cv.notify_all();
+}
+
+//--------------------------------------------------------------------------
+
+size_t WriteBack::dirty_size() const
+{
+    std::lock_guard lg{m_mutex};
+    return m_dirty_size;
+}
+
+//--------------------------------------------------------------------------
+
+std::map<WriteBack::Handle, WriteBack::File>::iterator WriteBack::next_queued()
+{
+    const auto queued = [](const auto& item) { return not item.second.extents.empty(); };
+    const auto after = m_files.upper_bound(m_last);
+    auto it = std::find_if(after, m_files.end(), queued);
+    if (it == m_files.end())
+    {
+        it = std::find_if(m_files.begin(), after, queued);
+        if (it == after)
+        {
+            return m_files.end();
+        }
+    }
+    return it;
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::run()
+{
+    std::unique_lock lg{m_mutex};
+    while (true)
+    {
+        auto it = m_files.end();
+        m_cv.wait(lg, [this, &it] {
+            it = next_queued();
+            return m_quit or (it != m_files.end());
+        });
+        // the queued data are uploaded before quitting
+        if (it == m_files.end())
+        {
+            break;
+        }
+
+        const auto handle = it->first;
+        auto extent = *it->second.extents.pop();
+        it->second.uploading = true;
+        m_last = handle;
+        lg.unlock();
+
+        log_trace("uploading handle:{} ofs:{} size:{}", handle, extent.offset,
+                  extent.data.size());
+        std::error_code error{};
+        try
+        {
+            m_uploader(handle, extent.offset, extent.data);
+        }
+        catch (const std::system_error& err)
+        {
+            log_warning("upload failed: {}", err.what());
+            error = err.code();
+        }
+
+        lg.lock();
+        m_dirty_size -= extent.data.size();
+        const auto refreshed_it = m_files.find(handle);
+        if (refreshed_it != m_files.end())
+        {
+            auto& file = refreshed_it->second;
+            file.uploading = false;
+            if (error and not file.error)
+            {
+                file.error = error;
+            }
+        }
+        m_cv.notify_all();
+        if (m_quit and error)
+        {
+            // the server is likely gone, do not wait for every upload to fail
+            drop_queued();
+            break;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void WriteBack::drop_queued()
+{
+    for (auto& item: m_files)
+    {
+        auto& file = item.second;
+        if (file.extents.empty())
+        {
+            continue;
+        }
+        log_error("write-back of '{}' dropped, {} bytes not uploaded",
+                  file.path.native(), file.extents.size());
+        m_dirty_size -= file.extents.size();
+        file.extents = DirtyExtents{};
+    }
+    m_cv.notify_all();
+}
+
+//==========================================================================
+} // namespace rewofs::client
@@ -0,0 +1,134 @@
+/// Asynchronous upload of written data.
+///
+/// @file
+
+#pragma once
+#ifndef WRITE_BACK_HPP__R7DN2XQE
+#define WRITE_BACK_HPP__R7DN2XQE
+
+#include <condition_variable>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <gsl/span>
+#include "rewofs/enablewarnings.hpp"
+
+//==========================================================================
+namespace rewofs::client {
+//==========================================================================
+
+/// Written data of a file not yet uploaded. Overlapping writes are merged,
+/// adjacent ones up to MAX_EXTENT.
+class DirtyExtents
+{
+public:
+    /// limits the coalescing of adjacent writes, overlapping ones are merged always
+    static constexpr size_t MAX_EXTENT{1024 * 1024};
+
+    struct Extent
+    {
+        off_t offset{};
+        std::vector<uint8_t> data{};
+    };
+
+    void add(const off_t offset, const gsl::span<const uint8_t> data);
+    /// Remove the extent with the lowest offset.
+    std::optional<Extent> pop();
+    bool empty() const;
+    /// bytes
+    size_t size() const;
+    size_t count() const;
+
+private:
+    /// offset -> data
+    std::map<off_t, std::vector<uint8_t>> m_extents{};
+    size_t m_size{0};
+};
+
+//==========================================================================
+
+/// Write-back of the file writes. Writes are kept as DirtyExtents and uploaded by
+/// a background thread. An upload failure is reported by the next flush() of the
+/// file, the way NFS reports it on fsync/close.
+class WriteBack : private boost::noncopyable
+{
+public:
+    using Handle = uint64_t;
+    using Path = boost::filesystem::path;
+    /// Store a range on the server, throws std::system_error.
+    using Uploader
+        = std::function<void(const Handle, const off_t, const gsl::span<const uint8_t>)>;
+
+    explicit WriteBack(Uploader uploader);
+    ~WriteBack();
+
+    /// @param capacity dirty bytes, writes wait for uploads above it
+    void set_capacity(const size_t capacity);
+    void start();
+    /// Upload the queued data and stop. If an upload fails meanwhile the rest is
+    /// dropped and logged.
+    void stop();
+    void wait();
+
+    /// Queue a write. Blocks while the dirty data exceed the capacity.
+    void write(const Handle handle, const Path& path, const off_t offset,
+               const gsl::span<const uint8_t> data);
+    /// Wait until the data written by the handle are uploaded. Throws
+    /// std::system_error of the first failed upload since the last flush.
+    void flush(const Handle handle);
+    /// Wait until the data written to the path (or inside it) by any handle are
+    /// uploaded. The failures are left for flush().
+    void flush_path(const Path& path);
+    /// @return true if the handle has data waiting for an upload, not counting an
+    ///         upload in progress
+    bool has_queued(const Handle handle) const;
+    /// Drop the state of a closed file.
+    void forget(const Handle handle);
+    /// queued and in progress bytes
+    size_t dirty_size() const;
+
+private:
+    struct File
+    {
+        Path path{};
+        DirtyExtents extents{};
+        bool uploading{false};
+        /// the first failed upload since the last flush
+        std::error_code error{};
+
+        bool is_clean() const { return extents.empty() and not uploading; }
+    };
+
+    void run();
+    /// Log and discard the queued data.
+    void drop_queued();
+    /// @return the next file to upload, round robin
+    std::map<Handle, File>::iterator next_queued();
+
+    Uploader m_uploader;
+    mutable std::mutex m_mutex{};
+    std::condition_variable m_cv{};
+    std::map<Handle, File> m_files{};
+    size_t m_dirty_size{0};
+    size_t m_capacity{std::numeric_limits<size_t>::max()};
+    /// the last uploaded handle
+    Handle m_last{0};
+    std::thread m_runner{};
+    bool m_quit{false};
+};
+
+//==========================================================================
+} // namespace rewofs::client
+
+#endif /* include guard */
@@ -0,0 +1,76 @@
+/// Fast non-cryptographic hashing.
+///
+/// @file
+
+#pragma once
+#ifndef HASH_HPP__Q8XMB2RT
+#define HASH_HPP__Q8XMB2RT
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+//==========================================================================
+namespace rewofs {
+//==========================================================================
+
+namespace detail {
+
+__extension__ using uint128_t = unsigned __int128;
+
+/// 64x64->128 multiplication folded back to 64 bits.
+inline uint64_t hash_mix(const uint64_t a, const uint64_t b)
+{
+    const auto r = static_cast<uint128_t>(a) * b;
+    return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+}
+
+} // namespace detail
+
+//--------------------------------------------------------------------------
+
+/// Hash consuming 16 bytes per step (wyhash-like multiply-mix).
+/// @param seed allows chaining, e.g. hashing path components one by one
+inline uint64_t hash_bytes(const void* data, size_t size, const uint64_t seed = 0)
+{
+    static constexpr uint64_t P0{0xa0761d6478bd642full};
+    static constexpr uint64_t P1{0xe7037ed1a0b428dbull};
+    static constexpr uint64_t P2{0x8ebc6af09c88c6e3ull};
+
+    const auto* ptr = static_cast<const uint8_t*>(data);
+    uint64_t h{seed ^ P0 ^ size};
+    while (size >= 16)
+    {
+        uint64_t w1{};
+        uint64_t w2{};
+        std::memcpy(&w1, ptr, 8);
+        std::memcpy(&w2, ptr + 8, 8);
+        h = detail::hash_mix(w1 ^ P1 ^ h, w2 ^ P2);
+        ptr += 16;
+        size -= 16;
+    }
+    uint64_t w1{};
+    uint64_t w2{};
+    if (size > 0)
+    {
+        std::memcpy(&w1, ptr, size < 8 ? size : 8);
+    }
+    if (size > 8)
+    {
+        std::memcpy(&w2, ptr + 8, size - 8);
+    }
+    h = detail::hash_mix(w1 ^ P1 ^ h, w2 ^ P2);
+    return detail::hash_mix(h ^ P0, P1);
+}
+
+//--------------------------------------------------------------------------
+
+inline uint64_t hash_bytes(const std::string_view data, const uint64_t seed = 0)
+{
+    return hash_bytes(data.data(), data.size(), seed);
+}
+
+//==========================================================================
+} // namespace rewofs
+
+#endif /* include guard */
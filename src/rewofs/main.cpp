@@ -26,12 +26,37 @@ int main(int argc, char *argv[])
         conf_server.add_options()
             ("serve", po::value<std::string>(), "serve a directory")
             ("listen", po::value<std::string>(), "server endpoint")
+            ("notify-quiet", po::value<uint32_t>()->default_value(100),
+             "notify the clients after the local changes are quiet for this many ms "
+             "(the latency statistics are logged on SIGUSR1)")
+            ("notify-max-latency", po::value<uint32_t>()->default_value(1000),
+             "but at most this many ms after the first change")
+            ("exclude", po::value<std::vector<std::string>>()->composing(),
+             "directories to serve only on demand (not preloaded nor watched), a "
+             ".gitignore pattern, can be repeated")
+            ("exclude-gitignore", po::bool_switch(),
+             "also the directories matching the .gitignore of the served directory")
+            ("watcher", po::value<std::string>()->default_value("inotify"),
+             "local changes watcher: inotify, or fanotify for large trees (needs "
+             "CAP_SYS_ADMIN and CAP_DAC_READ_SEARCH, falls back to inotify)")
             ;
 
         po::options_description conf_client{"Client options"};
         conf_client.add_options()
             ("mountpoint", po::value<std::string>(), "mount point")
             ("connect", po::value<std::string>(), "remote endpoint")
+            ("cache-size", po::value<size_t>()->default_value(1024),
+             "content cache size in MB (statistics are logged on SIGUSR1)")
+            ("disk-cache", po::value<std::string>(),
+             "directory keeping the tree and read files between client runs")
+            ("disk-cache-size", po::value<size_t>()->default_value(4096),
+             "disk cache size in MB")
+            ("tree-depth", po::value<uint32_t>()->default_value(0),
+             "preloaded tree levels, deeper directories are loaded on access "
+             "(0 for the whole tree)")
+            ("write-back", po::value<size_t>()->default_value(0),
+             "upload written data in the background, buffering up to this many MB "
+             "(0 for synchronous writes), failures are reported by fsync/close")
             ;
 
         po::options_description desc{};
@@ -40,7 +65,7 @@ int main(int argc, char *argv[])
         po::store(po::parse_command_line(argc, argv, desc), vm);
         po::notify(vm);
 
-        if (vm.count("help") or (vm.size() == 0))
+        if (vm.count("help") or (argc <= 1))
         {
             std::cout << desc << "\n";
             return 1;
@@ -32,7 +32,9 @@ inline void copy(const messages::Time& src, timespec& dst)
 
 //--------------------------------------------------------------------------
 
-inline void copy(struct stat& src, messages::Stat& dst)
+/// @param src `struct stat` or anything with the same field names
+template<typename _Stat>
+inline void copy(const _Stat& src, messages::Stat& dst)
 {
     dst.mutate_st_mode(src.st_mode);
     dst.mutate_st_size(src.st_size);
@@ -42,7 +44,9 @@ inline void copy(struct stat& src, messages::Stat& dst)
 
 //--------------------------------------------------------------------------
 
-inline void copy(const messages::Stat& src, struct stat& dst)
+/// @param dst `struct stat` or anything with the same field names
+template<typename _Stat>
+inline void copy(const messages::Stat& src, _Stat& dst)
 {
     dst.st_mode = src.st_mode();
     dst.st_size = src.st_size();
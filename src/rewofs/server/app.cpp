@@ -3,6 +3,7 @@
 /// @file
 
 #include <csignal>
+#include <stdexcept>
 
 #include "rewofs/server/app.hpp"
 
@@ -26,6 +27,14 @@ void App::signal_handler(int)
     std::signal(SIGINT, SIG_DFL);
 }
 
+//--------------------------------------------------------------------------
+
+void App::stats_signal_handler(int)
+{
+    assert(g_app != nullptr);
+    g_app->m_watcher.request_stats();
+}
+
 //==========================================================================
 
 App::App(const boost::program_options::variables_map& options)
@@ -43,13 +52,40 @@ void App::run()
     boost::filesystem::current_path(served_directory);
     log_info("actual served directory: {}", boost::filesystem::current_path().native());
 
+    if (m_options.count("exclude") > 0)
+    {
+        for (const auto& pattern: m_options["exclude"].as<std::vector<std::string>>())
+        {
+            m_excludes.add(pattern);
+        }
+    }
+    if (m_options["exclude-gitignore"].as<bool>()
+        and boost::filesystem::exists(".gitignore"))
+    {
+        // nested .gitignore files are not read
+        m_excludes.load(".gitignore");
+    }
+
     const auto endpoint = m_options["listen"].as<std::string>();
     m_transport.set_endpoint(endpoint);
+    m_watcher.set_debounce(
+        std::chrono::milliseconds{m_options["notify-quiet"].as<uint32_t>()},
+        std::chrono::milliseconds{m_options["notify-max-latency"].as<uint32_t>()});
+    const auto watcher = m_options["watcher"].as<std::string>();
+    if (watcher == "fanotify")
+    {
+        m_watcher.set_backend(Watcher::Backend::Fanotify);
+    }
+    else if (watcher != "inotify")
+    {
+        throw std::invalid_argument{"unknown watcher " + watcher};
+    }
 
     m_worker.start();
     m_watcher.start();
 
     std::signal(SIGINT, signal_handler);
+    std::signal(SIGUSR1, stats_signal_handler);
 
     m_watcher.wait();
     m_worker.wait();
@@ -11,6 +11,7 @@
 #include <boost/program_options.hpp>
 #include "rewofs/enablewarnings.hpp"
 
+#include "rewofs/server/excludes.hpp"
 #include "rewofs/server/transport.hpp"
 #include "rewofs/server/watcher.hpp"
 #include "rewofs/server/worker.hpp"
@@ -29,12 +30,20 @@ public:
     //--------------------------------
 private:
     static void signal_handler(int);
+    static void stats_signal_handler(int);
 
     const boost::program_options::variables_map& m_options;
     server::Transport m_transport{};
     TemporalIgnores m_temporal_ignores{std::chrono::seconds{1}};
-    Watcher m_watcher{m_transport, m_temporal_ignores};
-    Worker m_worker{m_transport, m_temporal_ignores};
+    Generation m_generation{};
+    /// filled before the threads start
+    Excludes m_excludes{};
+    /// the served directory is the current one
+    ServedTree m_served_tree{".", &m_excludes};
+    Watcher m_watcher{m_transport, m_temporal_ignores, m_generation, m_served_tree,
+                      m_excludes};
+    Worker m_worker{m_transport, m_temporal_ignores, m_generation, m_served_tree,
+                    m_excludes};
 };
 
 //==========================================================================
@@ -0,0 +1,47 @@
+/// Filesystem change notifications.
+///
+/// @file
+
+#pragma once
+#ifndef EVENT_SOURCE_HPP__P2HX7CWN
+#define EVENT_SOURCE_HPP__P2HX7CWN
+
+#include <chrono>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+/// Events of a watched tree (see InotifySession, FanotifySession).
+class IEventSource
+{
+public:
+    using Path = boost::filesystem::path;
+
+    struct Event
+    {
+        /// inotify event bits (fanotify uses the same values), IN_ISDIR for
+        /// directories
+        uint32_t mask{};
+        /// the same for both halves of a rename
+        uint32_t cookie{};
+        /// relative to the root, starts with "/", empty for IN_Q_OVERFLOW
+        Path path{};
+    };
+
+    virtual ~IEventSource() = default;
+
+    /// Read all pending events. IN_Q_OVERFLOW means some events were lost.
+    /// @param timeout for the first event
+    virtual std::vector<Event> read(const std::chrono::milliseconds timeout) = 0;
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
@@ -0,0 +1,198 @@
+/// @copydoc excludes.hpp
+///
+/// @file
+
+#include <fstream>
+#include <system_error>
+
+#include <fnmatch.h>
+
+#include "rewofs/log.hpp"
+#include "rewofs/server/excludes.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+namespace {
+
+std::vector<std::string> split(const std::string& path)
+{
+    std::vector<std::string> components{};
+    std::string::size_type begin{0};
+    while (begin <= path.size())
+    {
+        auto end = path.find('/', begin);
+        if (end == std::string::npos)
+        {
+            end = path.size();
+        }
+        if (end > begin)
+        {
+            components.push_back(path.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return components;
+}
+
+//--------------------------------------------------------------------------
+
+/// Match the path components, `*` stays within a component and a `**` component
+/// matches zero or more of them (at least one if it is the last).
+bool match(const std::vector<std::string>& pattern, const size_t pattern_index,
+           const std::vector<std::string>& path, const size_t path_index)
+{
+    if (pattern_index == pattern.size())
+    {
+        return path_index == path.size();
+    }
+    const auto& component = pattern[pattern_index];
+    if (component == "**")
+    {
+        const auto last = pattern_index + 1 == pattern.size();
+        for (auto skipped = path_index + (last ? 1 : 0); skipped <= path.size();
+             ++skipped)
+        {
+            if (match(pattern, pattern_index + 1, path, skipped))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    return (path_index < path.size())
+           and (fnmatch(component.c_str(), path[path_index].c_str(), 0) == 0)
+           and match(pattern, pattern_index + 1, path, path_index + 1);
+}
+
+} // namespace
+
+//==========================================================================
+
+void Excludes::add(const std::string& pattern)
+{
+    Rule rule{pattern, {}, false, false};
+    auto& text = rule.pattern;
+    // trailing spaces are not significant unless escaped
+    while (not text.empty() and (text.back() == ' ')
+           and not ((text.size() >= 2) and (text[text.size() - 2] == '\\')))
+    {
+        text.pop_back();
+    }
+    if (text.empty() or (text.front() == '#'))
+    {
+        return;
+    }
+    if (text.front() == '!')
+    {
+        rule.negated = true;
+        text.erase(0, 1);
+    }
+    // only directories are excluded anyway
+    while (not text.empty() and (text.back() == '/'))
+    {
+        text.pop_back();
+    }
+    if (text.empty())
+    {
+        return;
+    }
+    rule.anchored = text.find('/') != std::string::npos;
+    if (text.front() == '/')
+    {
+        text.erase(0, 1);
+    }
+    if (rule.anchored)
+    {
+        rule.components = split(text);
+    }
+    log_info("exclude {}{}", rule.negated ? "!" : "", text);
+    m_rules.push_back(std::move(rule));
+}
+
+//--------------------------------------------------------------------------
+
+void Excludes::load(const Path& file)
+{
+    std::ifstream input{file.native()};
+    if (not input)
+    {
+        throw std::system_error{errno, std::generic_category(), file.native()};
+    }
+    std::string line{};
+    while (std::getline(input, line))
+    {
+        if (not line.empty() and (line.back() == '\r'))
+        {
+            line.pop_back();
+        }
+        add(line);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+bool Excludes::empty() const
+{
+    return m_rules.empty();
+}
+
+//--------------------------------------------------------------------------
+
+bool Excludes::excluded(const Path& directory) const
+{
+    if (m_rules.empty() or (directory == "/"))
+    {
+        return false;
+    }
+    const auto relative = split(directory.relative_path().native());
+    const auto name = directory.filename().native();
+    bool result{false};
+    for (const auto& rule: m_rules)
+    {
+        if (rule.negated != result)
+        {
+            // would not change anything
+            continue;
+        }
+        const auto matched = rule.anchored
+                                 ? match(rule.components, 0, relative, 0)
+                                 : fnmatch(rule.pattern.c_str(), name.c_str(), 0) == 0;
+        if (matched)
+        {
+            result = not rule.negated;
+        }
+    }
+    return result;
+}
+
+//--------------------------------------------------------------------------
+
+bool Excludes::inside_excluded(const Path& path) const
+{
+    return excluded_ancestor(path).has_value();
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<Excludes::Path> Excludes::excluded_ancestor(const Path& path) const
+{
+    std::optional<Path> outermost{};
+    if (m_rules.empty())
+    {
+        return outermost;
+    }
+    for (auto ancestor = path.parent_path(); ancestor.has_relative_path();
+         ancestor = ancestor.parent_path())
+    {
+        if (excluded(ancestor))
+        {
+            outermost = ancestor;
+        }
+    }
+    return outermost;
+}
+
+//==========================================================================
+} // namespace rewofs::server
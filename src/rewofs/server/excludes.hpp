@@ -0,0 +1,69 @@
+/// Parts of the served tree left out of the tree transfers and watching.
+///
+/// @file
+
+#pragma once
+#ifndef EXCLUDES_HPP__Q4ZLM8TW
+#define EXCLUDES_HPP__Q4ZLM8TW
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+/// Directories matching the patterns are kept in the served tree as unloaded
+/// entries, their content is not scanned, watched nor hashed. A client loads it on
+/// demand, so nothing disappears. Changes inside are notified only as a change of
+/// the outermost excluded directory.
+///
+/// The patterns use the .gitignore syntax: a pattern without a slash matches the
+/// name at any level, otherwise the path relative to the root (`*` stays within a
+/// level, a `**` component matches any number of levels), `!` includes the matches
+/// again, the last matching pattern decides.
+/// Only directories are excluded, files are always served.
+class Excludes
+{
+public:
+    using Path = boost::filesystem::path;
+
+    /// Add a pattern. Empty ones and comments are skipped.
+    void add(const std::string& pattern);
+    /// Add the patterns of a file, one per line. Throws std::system_error.
+    void load(const Path& file);
+    bool empty() const;
+
+    /// @param directory relative to the root, starts with "/"
+    /// @return true if the content is left out, the ancestors are not checked
+    bool excluded(const Path& directory) const;
+    /// @param path relative to the root, starts with "/"
+    /// @return true if an ancestor is excluded
+    bool inside_excluded(const Path& path) const;
+    /// @param path relative to the root, starts with "/"
+    /// @return the outermost excluded ancestor, nullopt if none
+    std::optional<Path> excluded_ancestor(const Path& path) const;
+
+private:
+    struct Rule
+    {
+        std::string pattern{};
+        /// pattern split by slashes if anchored
+        std::vector<std::string> components{};
+        /// matched to the relative path, otherwise to the name
+        bool anchored{false};
+        bool negated{false};
+    };
+
+    std::vector<Rule> m_rules{};
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
@@ -0,0 +1,351 @@
+/// @copydoc fanotify.hpp
+///
+/// @file
+
+#include <array>
+#include <climits>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rewofs/log.hpp"
+#include "rewofs/server/fanotify.hpp"
+
+// older headers
+#ifndef FAN_REPORT_DFID_NAME
+#define FAN_REPORT_DIR_FID 0x00000400
+#define FAN_REPORT_NAME 0x00000800
+#define FAN_REPORT_DFID_NAME (FAN_REPORT_DIR_FID | FAN_REPORT_NAME)
+#define FAN_EVENT_INFO_TYPE_DFID_NAME 2
+#endif
+#ifndef FAN_RENAME
+#define FAN_RENAME 0x10000000
+#define FAN_EVENT_INFO_TYPE_OLD_DFID_NAME 10
+#define FAN_EVENT_INFO_TYPE_NEW_DFID_NAME 12
+#endif
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+namespace {
+
+// the event bits are shared
+static_assert((FAN_CREATE == IN_CREATE) and (FAN_DELETE == IN_DELETE)
+              and (FAN_MOVED_FROM == IN_MOVED_FROM) and (FAN_MOVED_TO == IN_MOVED_TO)
+              and (FAN_MODIFY == IN_MODIFY) and (FAN_ATTRIB == IN_ATTRIB)
+              and (FAN_ONDIR == IN_ISDIR) and (FAN_Q_OVERFLOW == IN_Q_OVERFLOW));
+
+constexpr uint32_t DIRECTORY_CHANGES{FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE
+                                     | FAN_RENAME};
+
+} // namespace
+
+//==========================================================================
+
+FanotifySession::FanotifySession(const Path& root, const uint32_t events)
+    : m_root{boost::filesystem::canonical(root)}
+{
+    m_fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK
+                             | FAN_REPORT_DFID_NAME,
+                         O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        throw std::system_error{errno, std::generic_category()};
+    }
+    m_mount_fd = open(m_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_mount_fd < 0)
+    {
+        const auto err = errno;
+        close();
+        throw std::system_error{err, std::generic_category()};
+    }
+
+    const uint64_t mask = (events & (IN_MODIFY | IN_ATTRIB)) | FAN_CREATE | FAN_DELETE
+                          | FAN_ONDIR;
+    auto res = fanotify_mark(m_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask | FAN_RENAME,
+                             AT_FDCWD, m_root.c_str());
+    if ((res != 0) and (errno == EINVAL))
+    {
+        // older kernel, the halves of a rename are not paired
+        res = fanotify_mark(m_fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+                            mask | FAN_MOVED_FROM | FAN_MOVED_TO, AT_FDCWD, m_root.c_str());
+    }
+    if (res != 0)
+    {
+        const auto err = errno;
+        close();
+        throw std::system_error{err, std::generic_category()};
+    }
+    log_info("watching the filesystem of {}", m_root.native());
+}
+
+//--------------------------------------------------------------------------
+
+FanotifySession::~FanotifySession()
+{
+    close();
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<IEventSource::Event>
+    FanotifySession::read(const std::chrono::milliseconds timeout)
+{
+    std::vector<Event> events{};
+    pollfd pfd{m_fd, POLLIN, 0};
+    const auto ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+        {
+            return events;
+        }
+        throw std::system_error{errno, std::generic_category()};
+    }
+    if (ready == 0)
+    {
+        return events;
+    }
+
+    alignas(fanotify_event_metadata) std::array<char, 64 * 1024> buffer{};
+    bool overflow{false};
+    while (true)
+    {
+        auto size = ::read(m_fd, buffer.data(), buffer.size());
+        if (size < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            throw std::system_error{errno, std::generic_category()};
+        }
+        for (auto* metadata = reinterpret_cast<const fanotify_event_metadata*>(buffer.data());
+             FAN_EVENT_OK(metadata, size); metadata = FAN_EVENT_NEXT(metadata, size))
+        {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+            {
+                throw std::system_error{EPROTO, std::generic_category()};
+            }
+            if (metadata->fd >= 0)
+            {
+                ::close(metadata->fd);
+            }
+            if (metadata->mask & FAN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+            process(events, *metadata);
+        }
+    }
+
+    if (overflow)
+    {
+        log_warning("fanotify queue overflow");
+        m_directories.clear();
+        events.push_back({IN_Q_OVERFLOW, 0, {}});
+    }
+    return events;
+}
+
+//--------------------------------------------------------------------------
+
+void FanotifySession::close()
+{
+    if (m_mount_fd >= 0)
+    {
+        ::close(m_mount_fd);
+        m_mount_fd = -1;
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void FanotifySession::process(std::vector<Event>& events,
+                              const fanotify_event_metadata& metadata)
+{
+    std::optional<Path> path{};
+    std::optional<Path> old_path{};
+    std::optional<Path> new_path{};
+    const auto* begin = reinterpret_cast<const char*>(&metadata);
+    for (auto pos = metadata.metadata_len;
+         pos + sizeof(fanotify_event_info_header) <= metadata.event_len;)
+    {
+        const auto* info = reinterpret_cast<const fanotify_event_info_fid*>(begin + pos);
+        if (info->hdr.len == 0)
+        {
+            break;
+        }
+        pos += info->hdr.len;
+
+        const auto type = info->hdr.info_type;
+        if ((type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+            and (type != FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+            and (type != FAN_EVENT_INFO_TYPE_NEW_DFID_NAME))
+        {
+            continue;
+        }
+        const auto* handle = reinterpret_cast<const file_handle*>(info->handle);
+        // the name follows the handle
+        const auto* name = reinterpret_cast<const char*>(handle->f_handle
+                                                         + handle->handle_bytes);
+        auto entry = entry_path(*handle, name);
+        if (type == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME)
+        {
+            old_path = std::move(entry);
+        }
+        else if (type == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME)
+        {
+            new_path = std::move(entry);
+        }
+        else
+        {
+            path = std::move(entry);
+        }
+    }
+
+    const auto mask = static_cast<uint32_t>(metadata.mask);
+    const auto is_dir = mask & IN_ISDIR;
+    const auto add = [&events, is_dir](const uint32_t bits, const uint32_t cookie,
+                                       const Path& entry) {
+        events.push_back({bits | is_dir, cookie, entry});
+    };
+
+    if (mask & FAN_RENAME)
+    {
+        // a half outside of the root is a deletion or a creation
+        ++m_cookie;
+        if (old_path.has_value())
+        {
+            add(IN_MOVED_FROM, m_cookie, *old_path);
+        }
+        if (new_path.has_value())
+        {
+            add(IN_MOVED_TO, m_cookie, *new_path);
+        }
+    }
+    if (path.has_value())
+    {
+        if (mask & IN_MOVED_FROM)
+        {
+            add(IN_MOVED_FROM, ++m_cookie, *path);
+        }
+        // merged events of the same name, the last one wins
+        const auto replaced = (mask & IN_DELETE) and (mask & IN_CREATE);
+        struct stat st{};
+        const auto exists
+            = replaced
+              and (lstat((m_root / path->relative_path()).c_str(), &st) == 0);
+        if ((mask & IN_DELETE) and exists)
+        {
+            add(IN_DELETE, 0, *path);
+        }
+        if (mask & IN_CREATE)
+        {
+            add(IN_CREATE, 0, *path);
+        }
+        if ((mask & IN_DELETE) and not exists)
+        {
+            add(IN_DELETE, 0, *path);
+        }
+        if (mask & IN_MOVED_TO)
+        {
+            add(IN_MOVED_TO, ++m_cookie, *path);
+        }
+        if (mask & (IN_MODIFY | IN_ATTRIB))
+        {
+            add(mask & (IN_MODIFY | IN_ATTRIB), 0, *path);
+        }
+    }
+
+    if (is_dir and (mask & DIRECTORY_CHANGES))
+    {
+        // paths of the cached descendants changed
+        m_directories.clear();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<IEventSource::Path> FanotifySession::entry_path(const file_handle& directory,
+                                                            const char* name)
+{
+    auto path = resolve(directory);
+    if (path.has_value() and (std::string_view{name} != "."))
+    {
+        *path /= name;
+    }
+    return path;
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<IEventSource::Path> FanotifySession::resolve(const file_handle& directory)
+{
+    const std::string key{reinterpret_cast<const char*>(&directory),
+                          sizeof(file_handle) + directory.handle_bytes};
+    const auto cached = m_directories.find(key);
+    if (cached != m_directories.end())
+    {
+        return cached->second;
+    }
+    if (m_directories.size() >= MAX_CACHED_DIRECTORIES)
+    {
+        m_directories.clear();
+    }
+
+    const auto fd = open_by_handle_at(m_mount_fd, const_cast<file_handle*>(&directory),
+                                      O_PATH | O_CLOEXEC);
+    if (fd < 0)
+    {
+        // removed meanwhile
+        return std::nullopt;
+    }
+    std::array<char, PATH_MAX> target{};
+    const auto size = readlink(("/proc/self/fd/" + std::to_string(fd)).c_str(),
+                               target.data(), target.size());
+    ::close(fd);
+    if (size <= 0)
+    {
+        return std::nullopt;
+    }
+
+    const std::string_view absolute{target.data(), static_cast<size_t>(size)};
+    const auto& root = m_root.native();
+    std::optional<Path> path{};
+    if (absolute == root)
+    {
+        path = Path{"/"};
+    }
+    else if (root == "/")
+    {
+        path = Path{std::string{absolute}};
+    }
+    else if ((absolute.size() > root.size()) and (absolute.compare(0, root.size(), root) == 0)
+             and (absolute[root.size()] == '/'))
+    {
+        path = Path{std::string{absolute.substr(root.size())}};
+    }
+    m_directories.emplace(key, path);
+    return path;
+}
+
+//==========================================================================
+} // namespace rewofs::server
@@ -0,0 +1,66 @@
+/// Whole filesystem watching by fanotify.
+///
+/// @file
+
+#pragma once
+#ifndef FANOTIFY_HPP__H9RBQ4LU
+#define FANOTIFY_HPP__H9RBQ4LU
+
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "rewofs/server/event_source.hpp"
+
+struct file_handle;
+struct fanotify_event_metadata;
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+/// Watches the filesystem of the root by a single fanotify mark, there is no
+/// per-directory watch. Events carry the directory handle and the entry name
+/// (FAN_REPORT_DFID_NAME), the directory is resolved to a path by
+/// `open_by_handle_at()` and events outside of the root are dropped. Filesystems
+/// mounted under the root are not watched.
+///
+/// The filesystem mark needs CAP_SYS_ADMIN, the handle resolution
+/// CAP_DAC_READ_SEARCH.
+class FanotifySession : public IEventSource
+{
+public:
+    /// Throws std::system_error if fanotify is not available or not permitted.
+    /// @param events inotify mask, the creations, deletions and renames are added
+    FanotifySession(const Path& root, const uint32_t events);
+    ~FanotifySession() override;
+    FanotifySession(const FanotifySession&) = delete;
+    FanotifySession& operator=(const FanotifySession&) = delete;
+
+    std::vector<Event> read(const std::chrono::milliseconds timeout) override;
+
+private:
+    /// the cache is dropped if it grows larger
+    static constexpr size_t MAX_CACHED_DIRECTORIES{100000};
+
+    void close();
+    void process(std::vector<Event>& events, const fanotify_event_metadata& metadata);
+    /// @return nullopt if gone or outside of the root
+    std::optional<Path> entry_path(const file_handle& directory, const char* name);
+    std::optional<Path> resolve(const file_handle& directory);
+
+    /// absolute
+    Path m_root{};
+    int m_fd{-1};
+    /// the root, for `open_by_handle_at()`
+    int m_mount_fd{-1};
+    /// directory handle -> path relative to the root, nullopt outside of it
+    std::unordered_map<std::string, std::optional<Path>> m_directories{};
+    /// pairs the halves of a rename (see Event::cookie)
+    uint32_t m_cookie{0};
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
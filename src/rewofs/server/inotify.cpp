@@ -0,0 +1,392 @@
+/// @copydoc inotify.hpp
+///
+/// @file
+
+#include <array>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "rewofs/log.hpp"
+#include "rewofs/server/inotify.hpp"
+#include "rewofs/server/scanner.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+InotifySession::InotifySession(Path root, const uint32_t events,
+                               const Excludes* excludes)
+    : m_root{std::move(root)}
+    , m_events{events | IN_CREATE | IN_DELETE | IN_MOVE | IN_ONLYDIR | IN_DONT_FOLLOW}
+    , m_excludes{excludes}
+{
+    open();
+}
+
+//--------------------------------------------------------------------------
+
+InotifySession::~InotifySession()
+{
+    close();
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<InotifySession::Event>
+    InotifySession::read(const std::chrono::milliseconds timeout)
+{
+    std::vector<Event> events{};
+    pollfd pfd{m_fd, POLLIN, 0};
+    const auto ready = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+        {
+            return events;
+        }
+        throw std::system_error{errno, std::generic_category()};
+    }
+    if (ready == 0)
+    {
+        return events;
+    }
+
+    alignas(inotify_event) std::array<char, 64 * 1024> buffer{};
+    bool overflow{false};
+    while (true)
+    {
+        const auto size = ::read(m_fd, buffer.data(), buffer.size());
+        if (size < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            throw std::system_error{errno, std::generic_category()};
+        }
+        for (ssize_t pos = 0; pos < size;)
+        {
+            const auto* event = reinterpret_cast<const inotify_event*>(&buffer[pos]);
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+            }
+            else
+            {
+                // the name is padded by zeros
+                process(events, event->mask, event->cookie, event->wd,
+                        (event->len > 0) ? event->name : "");
+            }
+            pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+        }
+    }
+
+    // the other half of a rename comes right after, moved out of the tree
+    for (const auto& move: m_moves)
+    {
+        remove_tree(move.second);
+    }
+    m_moves.clear();
+
+    if (overflow)
+    {
+        log_warning("inotify queue overflow, watching the tree again");
+        close();
+        open();
+        events.push_back({IN_Q_OVERFLOW, 0, {}});
+    }
+    return events;
+}
+
+//--------------------------------------------------------------------------
+
+size_t InotifySession::watches_count() const
+{
+    return m_watches.size();
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::open()
+{
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+    {
+        throw std::system_error{errno, std::generic_category()};
+    }
+    try
+    {
+        watch_tree(-1, {});
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+    log_info("watching {} directories", m_watches.size());
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_root_wd = -1;
+    m_watches.clear();
+    m_children.clear();
+    m_moves.clear();
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::watch_tree(const int parent, const std::string& name)
+{
+    struct Pending
+    {
+        int parent{};
+        std::string name{};
+    };
+    // a directory is watched before it is listed, so nothing created in it is
+    // missed
+    std::vector<Pending> pending{{parent, name}};
+    while (not pending.empty())
+    {
+        const auto item = std::move(pending.back());
+        pending.pop_back();
+
+        auto path = m_root;
+        bool exclude{false};
+        if (item.parent >= 0)
+        {
+            const auto parent_path = path_of(item.parent);
+            if (not parent_path.has_value() or entries_only(item.parent))
+            {
+                continue;
+            }
+            exclude = excluded(*parent_path / item.name);
+            path /= parent_path->relative_path();
+            path /= item.name;
+        }
+
+        const auto wd = inotify_add_watch(m_fd, path.c_str(), m_events);
+        if (wd < 0)
+        {
+            if ((errno == ENOSPC) or (item.parent < 0))
+            {
+                throw std::system_error{errno, std::generic_category()};
+            }
+            // removed meanwhile
+            continue;
+        }
+        add_watch(wd, item.parent, item.name, exclude);
+        if (exclude)
+        {
+            continue;
+        }
+
+        std::vector<ScanNode> listing{};
+        try
+        {
+            listing = Scanner::list(path);
+        }
+        catch (const std::system_error&)
+        {
+            continue;
+        }
+        for (auto& child: listing)
+        {
+            if ((child.stat_errno == 0) and S_ISDIR(child.st.st_mode))
+            {
+                pending.push_back({wd, std::move(child.name)});
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::add_watch(const int wd, const int parent, const std::string& name,
+                               const bool entries_only)
+{
+    // the same directory (e.g. moved) yields the same descriptor
+    detach(wd);
+    m_watches[wd] = {parent, name, entries_only};
+    if (parent >= 0)
+    {
+        m_children[{parent, name}] = wd;
+    }
+    else
+    {
+        m_root_wd = wd;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::detach(const int wd)
+{
+    const auto watch = m_watches.find(wd);
+    if (watch == m_watches.end())
+    {
+        return;
+    }
+    const auto child = m_children.find({watch->second.parent, watch->second.name});
+    if ((child != m_children.end()) and (child->second == wd))
+    {
+        m_children.erase(child);
+    }
+    watch->second.parent = -1;
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::remove_tree(const int wd)
+{
+    std::vector<int> pending{wd};
+    while (not pending.empty())
+    {
+        const auto id = pending.back();
+        pending.pop_back();
+        auto child = m_children.lower_bound({id, {}});
+        while ((child != m_children.end()) and (child->first.first == id))
+        {
+            pending.push_back(child->second);
+            child = m_children.erase(child);
+        }
+        detach(id);
+        m_watches.erase(id);
+        // the following IN_IGNORED finds nothing
+        inotify_rm_watch(m_fd, id);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<InotifySession::Path> InotifySession::path_of(int wd) const
+{
+    std::vector<const std::string*> names{};
+    while (wd != m_root_wd)
+    {
+        const auto watch = m_watches.find(wd);
+        if ((watch == m_watches.end()) or (watch->second.parent < 0))
+        {
+            // being removed
+            return std::nullopt;
+        }
+        names.push_back(&watch->second.name);
+        wd = watch->second.parent;
+    }
+    if (wd < 0)
+    {
+        return std::nullopt;
+    }
+
+    Path path{"/"};
+    for (auto it = names.rbegin(); it != names.rend(); ++it)
+    {
+        path /= **it;
+    }
+    return path;
+}
+
+//--------------------------------------------------------------------------
+
+bool InotifySession::excluded(const Path& directory) const
+{
+    return (m_excludes != nullptr) and m_excludes->excluded(directory);
+}
+
+//--------------------------------------------------------------------------
+
+bool InotifySession::entries_only(const int wd) const
+{
+    const auto watch = m_watches.find(wd);
+    return (watch != m_watches.end()) and watch->second.entries_only;
+}
+
+//--------------------------------------------------------------------------
+
+void InotifySession::process(std::vector<Event>& events, const uint32_t mask,
+                             const uint32_t cookie, const int wd, const std::string& name)
+{
+    if (mask & IN_IGNORED)
+    {
+        // deleted, the subdirectories went first
+        detach(wd);
+        m_watches.erase(wd);
+        return;
+    }
+    const auto parent_path = path_of(wd);
+    if (not parent_path.has_value())
+    {
+        return;
+    }
+    auto path = *parent_path;
+    if (not name.empty())
+    {
+        path /= name;
+    }
+
+    if (mask & IN_ISDIR)
+    {
+        std::optional<int> moved{};
+        if (mask & IN_MOVED_FROM)
+        {
+            const auto child = m_children.find({wd, name});
+            if (child != m_children.end())
+            {
+                m_moves[cookie] = child->second;
+                detach(child->second);
+            }
+        }
+        else if (mask & IN_MOVED_TO)
+        {
+            const auto move = m_moves.find(cookie);
+            if (move != m_moves.end())
+            {
+                moved = move->second;
+                m_moves.erase(move);
+            }
+        }
+
+        if (moved.has_value() and (entries_only(*moved) == excluded(path))
+            and not entries_only(wd))
+        {
+            // the watches go with the directory
+            add_watch(*moved, wd, name, entries_only(*moved));
+        }
+        else if (mask & (IN_CREATE | IN_MOVED_TO))
+        {
+            if (moved.has_value())
+            {
+                // watched differently at the new place
+                remove_tree(*moved);
+            }
+            try
+            {
+                watch_tree(wd, name);
+            }
+            catch (const std::system_error& err)
+            {
+                log_error("can't watch '{}': {}, increase fs.inotify.max_user_watches",
+                          path.native(), err.what());
+            }
+        }
+    }
+
+    events.push_back({mask, cookie, std::move(path)});
+}
+
+//==========================================================================
+} // namespace rewofs::server
@@ -0,0 +1,84 @@
+/// Recursive inotify watching.
+///
+/// @file
+
+#pragma once
+#ifndef INOTIFY_HPP__K3WQ8ZJD
+#define INOTIFY_HPP__K3WQ8ZJD
+
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include "rewofs/server/event_source.hpp"
+#include "rewofs/server/excludes.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+/// A single inotify instance watching a directory tree. The watches follow the
+/// reported changes: created directories are watched, deleted ones dropped, moved
+/// ones keep their watches. The whole tree is watched again only after the event
+/// queue overflows. Excluded directories are watched for the changes of their
+/// entries only, their subdirectories are not watched.
+class InotifySession : public IEventSource
+{
+public:
+    /// Watch the tree. Throws std::system_error (ENOSPC if out of watches).
+    /// @param events inotify mask, the events needed for the watch maintenance are
+    ///        added
+    /// @param excludes not owned
+    InotifySession(Path root, const uint32_t events, const Excludes* excludes = nullptr);
+    ~InotifySession() override;
+    InotifySession(const InotifySession&) = delete;
+    InotifySession& operator=(const InotifySession&) = delete;
+
+    /// IN_IGNORED is handled internally, IN_Q_OVERFLOW is reported after the tree
+    /// is watched again.
+    std::vector<Event> read(const std::chrono::milliseconds timeout) override;
+    size_t watches_count() const;
+
+private:
+    struct Watch
+    {
+        /// -1 for the root and for a directory moved away
+        int parent{-1};
+        std::string name{};
+        /// excluded, the subdirectories are not watched
+        bool entries_only{false};
+    };
+
+    void open();
+    void close();
+    /// Watch a directory and all its subdirectories.
+    /// @param parent -1 for the root
+    void watch_tree(const int parent, const std::string& name);
+    void add_watch(const int wd, const int parent, const std::string& name,
+                   const bool entries_only);
+    void detach(const int wd);
+    /// Stop watching a directory moved out of the tree.
+    void remove_tree(const int wd);
+    std::optional<Path> path_of(int wd) const;
+    bool excluded(const Path& directory) const;
+    bool entries_only(const int wd) const;
+    void process(std::vector<Event>& events, const uint32_t mask, const uint32_t cookie,
+                 const int wd, const std::string& name);
+
+    const Path m_root;
+    const uint32_t m_events;
+    const Excludes* const m_excludes;
+    int m_fd{-1};
+    int m_root_wd{-1};
+    std::unordered_map<int, Watch> m_watches{};
+    /// (parent, name) -> wd
+    std::map<std::pair<int, std::string>, int> m_children{};
+    /// directories moved from a watched one, cookie -> wd
+    std::unordered_map<uint32_t, int> m_moves{};
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
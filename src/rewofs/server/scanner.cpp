@@ -0,0 +1,401 @@
+/// @copydoc scanner.hpp
+///
+/// @file
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "rewofs/log.hpp"
+#include "rewofs/server/scanner.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+namespace {
+
+/// `struct linux_dirent64`, glibc exports it only since 2.30
+struct Dirent64Header
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+};
+constexpr size_t DIRENT_NAME_OFFSET{offsetof(Dirent64Header, d_type) + 1};
+constexpr size_t DIRENTS_BUFFER_SIZE{64 * 1024};
+
+//--------------------------------------------------------------------------
+
+/// Closes the descriptor on destruction.
+class Fd : private boost::noncopyable
+{
+public:
+    explicit Fd(const int fd) : m_fd{fd} {}
+    ~Fd()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    int get() const { return m_fd; }
+
+private:
+    int m_fd{-1};
+};
+
+//--------------------------------------------------------------------------
+
+/// Fill the fields carried by messages::Stat.
+/// @return 0 or errno
+int stat_at(const int dirfd, const char* name, struct stat& st)
+{
+#ifdef STATX_TYPE
+    static std::atomic<bool> has_statx{true};
+    if (has_statx)
+    {
+        struct statx stx{};
+        if (statx(dirfd, name, AT_SYMLINK_NOFOLLOW,
+                  STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | STATX_CTIME,
+                  &stx)
+            == 0)
+        {
+            st.st_mode = stx.stx_mode;
+            st.st_size = static_cast<off_t>(stx.stx_size);
+            st.st_mtim = {stx.stx_mtime.tv_sec, stx.stx_mtime.tv_nsec};
+            st.st_ctim = {stx.stx_ctime.tv_sec, stx.stx_ctime.tv_nsec};
+            return 0;
+        }
+        if (errno != ENOSYS)
+        {
+            return errno;
+        }
+        // older kernel
+        has_statx = false;
+    }
+#endif
+    return (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) ? 0 : errno;
+}
+
+//--------------------------------------------------------------------------
+
+/// @param buffer reused by the calls, DIRENTS_BUFFER_SIZE
+/// @return 0 or errno
+int list_directory(const std::string& path, std::vector<char>& buffer,
+                   std::vector<ScanNode>& children)
+{
+    const Fd fd{open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)};
+    if (fd.get() < 0)
+    {
+        return errno;
+    }
+
+    buffer.resize(DIRENTS_BUFFER_SIZE);
+    while (true)
+    {
+        const auto size = syscall(SYS_getdents64, fd.get(), buffer.data(), buffer.size());
+        if (size < 0)
+        {
+            return errno;
+        }
+        if (size == 0)
+        {
+            return 0;
+        }
+        for (long offset = 0; offset < size;)
+        {
+            const auto* const record = buffer.data() + offset;
+            unsigned short reclen{};
+            std::memcpy(&reclen, record + offsetof(Dirent64Header, d_reclen),
+                        sizeof(reclen));
+            offset += reclen;
+
+            const auto* const name = record + DIRENT_NAME_OFFSET;
+            if ((std::strcmp(name, ".") == 0) or (std::strcmp(name, "..") == 0))
+            {
+                continue;
+            }
+            ScanNode child{};
+            child.name = name;
+            child.stat_errno = stat_at(fd.get(), name, child.st);
+            children.push_back(std::move(child));
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+/// Runs tasks by a pool of threads until none is left. A task can add more.
+/// Each thread takes its newest task first (depth-first, the working set stays
+/// small) and steals the oldest ones (big subtrees) of the others.
+template<typename _Task>
+class TaskPool : private boost::noncopyable
+{
+public:
+    using Push = std::function<void(_Task&&)>;
+
+    explicit TaskPool(const unsigned threads) : m_queues(threads) {}
+
+    /// @param process `process(task, buffer, push)`, `buffer` is a thread's own
+    ///        scratch space
+    template<typename _Process>
+    void run(std::vector<_Task>&& tasks, _Process process)
+    {
+        for (size_t i = 0; i < tasks.size(); ++i)
+        {
+            push(i % m_queues.size(), std::move(tasks[i]));
+        }
+
+        std::vector<std::thread> threads{};
+        for (size_t i = 1; i < m_queues.size(); ++i)
+        {
+            threads.emplace_back([this, i, &process] { work(i, process); });
+        }
+        work(0, process);
+        for (auto& thr: threads)
+        {
+            thr.join();
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex{};
+        std::deque<_Task> tasks{};
+    };
+
+    void push(const size_t queue, _Task&& task)
+    {
+        ++m_unfinished;
+        {
+            std::lock_guard lg{m_queues[queue].mutex};
+            m_queues[queue].tasks.push_back(std::move(task));
+            ++m_queued;
+        }
+        std::lock_guard lg{m_idle_mutex};
+        m_idle_condition.notify_one();
+    }
+
+    std::optional<_Task> pop(const size_t own)
+    {
+        {
+            auto& queue = m_queues[own];
+            std::lock_guard lg{queue.mutex};
+            if (not queue.tasks.empty())
+            {
+                auto task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                --m_queued;
+                return task;
+            }
+        }
+        for (size_t i = 1; i < m_queues.size(); ++i)
+        {
+            auto& queue = m_queues[(own + i) % m_queues.size()];
+            std::lock_guard lg{queue.mutex};
+            if (not queue.tasks.empty())
+            {
+                auto task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                --m_queued;
+                return task;
+            }
+        }
+        return std::nullopt;
+    }
+
+    template<typename _Process>
+    void work(const size_t own, _Process& process)
+    {
+        std::vector<char> buffer{};
+        const Push push_own = [this, own](_Task&& task) { push(own, std::move(task)); };
+        while (true)
+        {
+            if (auto task = pop(own))
+            {
+                process(*task, buffer, push_own);
+                if (--m_unfinished == 0)
+                {
+                    std::lock_guard lg{m_idle_mutex};
+                    m_idle_condition.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock lg{m_idle_mutex};
+            m_idle_condition.wait(
+                lg, [this] { return (m_queued > 0) or (m_unfinished == 0); });
+            if (m_unfinished == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    std::vector<Queue> m_queues;
+    /// queued and running
+    std::atomic<size_t> m_unfinished{0};
+    std::atomic<size_t> m_queued{0};
+    std::mutex m_idle_mutex{};
+    std::condition_variable m_idle_condition{};
+};
+
+//--------------------------------------------------------------------------
+
+struct ScanTask
+{
+    ScanNode* node{};
+    std::string path{};
+    /// relative to the served root, only with excludes
+    std::string tree_path{};
+    /// levels of descendants to include
+    uint32_t depth{};
+};
+
+} // namespace
+
+//==========================================================================
+
+Scanner::Scanner(const unsigned threads, const Excludes* excludes)
+    : m_threads{(threads == 0) ? std::max(1u, std::thread::hardware_concurrency())
+                               : threads}
+    , m_excludes{excludes}
+{
+}
+
+//--------------------------------------------------------------------------
+
+ScanNode Scanner::scan(const Path& path, const uint32_t depth, const Path& tree_path) const
+{
+    // TODO limit depth (possible loops via e.g. mount -oloop)
+
+    ScanNode root{};
+    root.name = path.filename().native();
+    root.stat_errno = stat_at(AT_FDCWD, path.c_str(), root.st);
+    if (root.stat_errno != 0)
+    {
+        log_warning("{} {}", path.native(), std::strerror(root.stat_errno));
+        return root;
+    }
+    if (not S_ISDIR(root.st.st_mode))
+    {
+        return root;
+    }
+    if (depth == 0)
+    {
+        root.unloaded = true;
+        return root;
+    }
+
+    std::vector<ScanTask> tasks{};
+    tasks.push_back({&root, path.native(), tree_path.native(), depth});
+    TaskPool<ScanTask> pool{m_threads};
+    const auto* const excludes
+        = ((m_excludes != nullptr) and not m_excludes->empty()) ? m_excludes : nullptr;
+    pool.run(std::move(tasks), [excludes](ScanTask& task, std::vector<char>& buffer,
+                                          const TaskPool<ScanTask>::Push& push) {
+        const auto res = list_directory(task.path, buffer, task.node->children);
+        if (res != 0)
+        {
+            log_warning("{} {}", task.path, std::strerror(res));
+        }
+        const auto child_depth
+            = (task.depth == UNLIMITED_DEPTH) ? task.depth : task.depth - 1;
+        // the children vector is complete, its elements do not move anymore
+        for (auto& child: task.node->children)
+        {
+            if (child.stat_errno != 0)
+            {
+                log_warning("{}/{} {}", task.path, child.name,
+                            std::strerror(child.stat_errno));
+                continue;
+            }
+            if (not S_ISDIR(child.st.st_mode))
+            {
+                continue;
+            }
+            std::string child_tree_path{};
+            if (excludes != nullptr)
+            {
+                child_tree_path = (Path{task.tree_path} / child.name).native();
+                if (excludes->excluded(child_tree_path))
+                {
+                    child.unloaded = true;
+                    continue;
+                }
+            }
+            if (child_depth == 0)
+            {
+                child.unloaded = true;
+                continue;
+            }
+            push({&child, task.path + "/" + child.name, std::move(child_tree_path),
+                  child_depth});
+        }
+    });
+
+    return root;
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<std::vector<ScanNode>>
+    Scanner::list(const Path& root, const std::vector<Path>& relatives) const
+{
+    std::vector<ScanNode> directories(relatives.size());
+    std::vector<ScanTask> tasks{};
+    for (size_t i = 0; i < relatives.size(); ++i)
+    {
+        tasks.push_back({&directories[i], (root / relatives[i]).native(), {}, 1});
+    }
+    const auto threads = std::max<size_t>(1, std::min<size_t>(m_threads, tasks.size()));
+    TaskPool<ScanTask> pool{static_cast<unsigned>(threads)};
+    pool.run(std::move(tasks), [](ScanTask& task, std::vector<char>& buffer,
+                                  const TaskPool<ScanTask>::Push&) {
+        const auto res = list_directory(task.path, buffer, task.node->children);
+        if (res != 0)
+        {
+            log_warning("{} {}", task.path, std::strerror(res));
+        }
+    });
+
+    std::vector<std::vector<ScanNode>> listings{};
+    listings.reserve(directories.size());
+    for (auto& directory: directories)
+    {
+        listings.push_back(std::move(directory.children));
+    }
+    return listings;
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<ScanNode> Scanner::list(const Path& directory)
+{
+    std::vector<char> buffer{};
+    std::vector<ScanNode> children{};
+    const auto res = list_directory(directory.native(), buffer, children);
+    if (res != 0)
+    {
+        throw std::system_error{res, std::generic_category(), directory.native()};
+    }
+    return children;
+}
+
+//==========================================================================
+} // namespace rewofs::server
@@ -0,0 +1,82 @@
+/// Fast directory tree reading.
+///
+/// @file
+
+#pragma once
+#ifndef SCANNER_HPP__V7TNE4KC
+#define SCANNER_HPP__V7TNE4KC
+
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/excludes.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+constexpr uint32_t UNLIMITED_DEPTH{std::numeric_limits<uint32_t>::max()};
+
+/// Directory entry. Children are in the order the directory lists them (the same
+/// as `readdir()`).
+struct ScanNode
+{
+    std::string name{};
+    /// only the fields carried by messages::Stat are filled
+    struct stat st{};
+    /// non-zero if the attributes could not be read
+    int stat_errno{0};
+    /// directory left out by the depth limit or excluded
+    bool unloaded{false};
+    std::vector<ScanNode> children{};
+};
+
+//==========================================================================
+
+/// Reads directories by `getdents64()` and the attributes by `statx()` relative
+/// to the directory descriptor with only the needed fields requested. Subtrees
+/// are read by a pool of threads, each takes its newest directory first and
+/// steals the oldest ones of the others.
+class Scanner : private boost::noncopyable
+{
+public:
+    using Path = boost::filesystem::path;
+
+    /// @param threads 0 for the number of CPUs
+    /// @param excludes descendant directories marked unloaded, not owned
+    explicit Scanner(const unsigned threads = 0, const Excludes* excludes = nullptr);
+
+    /// Read a subtree. Unreadable directories are logged and left empty.
+    /// @param depth levels of descendants to include, deeper directories are
+    ///        marked unloaded
+    /// @param tree_path `path` relative to the served root, for the excludes (the
+    ///        scanned directory itself is not checked)
+    ScanNode scan(const Path& path, const uint32_t depth,
+                  const Path& tree_path = "/") const;
+    /// List more directories in parallel. Unreadable directories are logged and
+    /// left empty.
+    /// @param relatives relative to `root`, an empty one for `root` itself
+    /// @return listings in the order of `relatives`
+    std::vector<std::vector<ScanNode>> list(const Path& root,
+                                            const std::vector<Path>& relatives) const;
+    /// List a directory.
+    /// @throw std::system_error if the directory can't be read
+    static std::vector<ScanNode> list(const Path& directory);
+
+private:
+    unsigned m_threads{1};
+    const Excludes* m_excludes{nullptr};
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
@@ -0,0 +1,240 @@
+/// @copydoc served_tree.hpp
+///
+/// @file
+
+#include <stdexcept>
+
+#include "rewofs/log.hpp"
+#include "rewofs/server/served_tree.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+namespace {
+
+/// Add the scanned descendants under `parent`.
+void insert_scanned(Tree& tree, Node& parent,
+                    const ScanNode& scanned)
+{
+    for (const auto& child: scanned.children)
+    {
+        if ((child.stat_errno != 0) or tree.has_child(parent, child.name))
+        {
+            // removed meanwhile
+            continue;
+        }
+        auto& node = tree.make_node(parent, child.name);
+        copy(child.st, node.st);
+        node.unloaded = child.unloaded;
+        insert_scanned(tree, node, child);
+    }
+}
+
+} // namespace
+
+//==========================================================================
+
+ServedTree::ServedTree(Path root, const Excludes* excludes)
+    : m_root{std::move(root)}
+    , m_excludes{excludes}
+{
+}
+
+//--------------------------------------------------------------------------
+
+ServedTree::Version ServedTree::get() const
+{
+    std::lock_guard lg{m_mutex};
+    return {m_published, m_generation};
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<ServedTree::Delta> ServedTree::changes_since(const uint64_t generation) const
+{
+    std::lock_guard lg{m_mutex};
+    if (not m_published or (generation < m_journal_base) or (generation > m_generation))
+    {
+        return std::nullopt;
+    }
+
+    Delta delta{m_generation, {}};
+    for (const auto& batch: m_journal)
+    {
+        if (batch.generation <= generation)
+        {
+            continue;
+        }
+        if (delta.changes.size() + batch.changes.size() > MAX_DELTA_CHANGES)
+        {
+            return std::nullopt;
+        }
+        delta.changes.insert(delta.changes.end(), batch.changes.begin(),
+                             batch.changes.end());
+    }
+    return delta;
+}
+
+//--------------------------------------------------------------------------
+
+void ServedTree::rescan(const Scanner& scanner, const uint64_t generation)
+{
+    log_info("reading the served tree");
+    const auto scanned = scanner.scan(m_root, UNLIMITED_DEPTH);
+
+    Tree tree{};
+    auto& root = tree.get_root();
+    copy(scanned.st, root.st);
+    insert_scanned(tree, root, scanned);
+    tree.rehash_subtree("/");
+    m_tree = std::move(tree);
+    log_info("served tree read, {} nodes, generation {}", m_tree.size(), generation);
+
+    const auto published = std::make_shared<const Tree>(m_tree);
+    std::lock_guard lg{m_mutex};
+    m_published = published;
+    m_generation = generation;
+    m_journal_base = generation;
+    m_journal.clear();
+    m_journal_changes = 0;
+}
+
+//--------------------------------------------------------------------------
+
+void ServedTree::apply(std::vector<Change> changes, const uint64_t generation,
+                       const Scanner& scanner)
+{
+    try
+    {
+        // directories with changed children
+        std::vector<Path> touched{};
+        for (const auto& change: changes)
+        {
+            apply_change(change, scanner);
+            touched.push_back(change.path.parent_path());
+            if (change.type == messages::ChangeType::Renamed)
+            {
+                touched.push_back(change.new_path.parent_path());
+            }
+        }
+        m_tree.rehash_ancestors(touched);
+    }
+    catch (const std::exception& err)
+    {
+        log_warning("served tree is inconsistent ({}), reading it again", err.what());
+        rescan(scanner, generation);
+        return;
+    }
+
+    const auto published = std::make_shared<const Tree>(m_tree);
+    std::lock_guard lg{m_mutex};
+    m_published = published;
+    m_generation = generation;
+    if (changes.empty())
+    {
+        return;
+    }
+    m_journal_changes += changes.size();
+    m_journal.push_back({generation, std::move(changes)});
+    while (m_journal_changes > MAX_JOURNAL_CHANGES)
+    {
+        m_journal_base = m_journal.front().generation;
+        m_journal_changes -= m_journal.front().changes.size();
+        m_journal.pop_front();
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void ServedTree::apply_change(const Change& change, const Scanner& scanner)
+{
+    switch (change.type)
+    {
+        case messages::ChangeType::Created:
+            create_node(change.path, change.st, scanner);
+            break;
+        case messages::ChangeType::Deleted:
+            if (m_tree.exists(change.path))
+            {
+                m_tree.remove(change.path);
+            }
+            break;
+        case messages::ChangeType::Modified:
+            if (not m_tree.exists(change.path)
+                or ((m_tree.get_node(change.path).st.st_mode & S_IFMT)
+                    != (change.st.st_mode & S_IFMT)))
+            {
+                create_node(change.path, change.st, scanner);
+            }
+            else
+            {
+                m_tree.get_node(change.path).st = change.st;
+            }
+            break;
+        case messages::ChangeType::Renamed:
+            if (m_tree.exists(change.new_path))
+            {
+                m_tree.remove(change.new_path);
+            }
+            if (m_tree.exists(change.path) and S_ISDIR(change.st.st_mode)
+                and (excluded(change.path) != excluded(change.new_path)))
+            {
+                // scanned or dropped content
+                m_tree.remove(change.path);
+                create_node(change.new_path, change.st, scanner);
+            }
+            else if (m_tree.exists(change.path))
+            {
+                m_tree.rename(change.path, change.new_path);
+                m_tree.get_node(change.new_path).st = change.st;
+            }
+            else
+            {
+                create_node(change.new_path, change.st, scanner);
+            }
+            break;
+        default:
+            throw std::runtime_error{"unknown change type"};
+    }
+}
+
+//--------------------------------------------------------------------------
+
+bool ServedTree::excluded(const Path& directory) const
+{
+    return (m_excludes != nullptr) and m_excludes->excluded(directory);
+}
+
+//--------------------------------------------------------------------------
+
+void ServedTree::create_node(const Path& path, const Stat& st,
+                             const Scanner& scanner)
+{
+    if (path == "/")
+    {
+        m_tree.get_root().st = st;
+        return;
+    }
+    if (m_tree.exists(path))
+    {
+        m_tree.remove(path);
+    }
+    auto& node = m_tree.make_node(path);
+    node.st = st;
+    if (S_ISDIR(st.st_mode) and excluded(path))
+    {
+        node.unloaded = true;
+        m_tree.rehash_subtree(path);
+    }
+    else if (S_ISDIR(st.st_mode))
+    {
+        // content of a new directory is not necessarily reported
+        insert_scanned(m_tree, node,
+                       scanner.scan(m_root / path.relative_path(), UNLIMITED_DEPTH, path));
+        m_tree.rehash_subtree(path);
+    }
+}
+
+//==========================================================================
+} // namespace rewofs::server
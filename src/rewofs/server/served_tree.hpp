@@ -0,0 +1,126 @@
+/// In-memory copy of the served tree.
+///
+/// @file
+
+#pragma once
+#ifndef SERVED_TREE_HPP__R6MXQ2PE
+#define SERVED_TREE_HPP__R6MXQ2PE
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/messages.hpp"
+#include "rewofs/server/excludes.hpp"
+#include "rewofs/server/scanner.hpp"
+#include "rewofs/tree.hpp"
+
+//==========================================================================
+namespace rewofs::server {
+//==========================================================================
+
+/// The served tree kept up to date by the watcher, so the tree requests do not
+/// read the filesystem. Uses the common Tree (see tree.hpp), an unmodified copy is an
+/// immutable version readable without locking.
+///
+/// Every update is stamped with the generation (see Generation) and recorded in
+/// a bounded journal. A client holding an older version gets only the changes
+/// made since then.
+///
+/// Directory hashes (Node::hash) are kept current, a client with an unrelated
+/// version downloads only the directories whose hashes differ.
+///
+/// Excluded directories (see Excludes) are unloaded nodes without children.
+class ServedTree : private boost::noncopyable
+{
+public:
+    using Path = boost::filesystem::path;
+    using Tree = rewofs::Tree;
+
+    /// Journal size limit, older changes are dropped.
+    static constexpr size_t MAX_JOURNAL_CHANGES{100000};
+    /// Longer change lists are not worth it, the whole tree is cheaper to send.
+    static constexpr size_t MAX_DELTA_CHANGES{10000};
+
+    /// See messages::Change.
+    struct Change
+    {
+        messages::ChangeType type{};
+        Path path{};
+        /// only for ChangeType::Renamed
+        Path new_path{};
+        /// absent if deleted
+        Stat st{};
+        /// only for ChangeType::Modified
+        bool reload{false};
+    };
+
+    struct Version
+    {
+        /// nullptr until the tree is read for the first time
+        std::shared_ptr<const Tree> tree{};
+        uint64_t generation{};
+    };
+
+    struct Delta
+    {
+        /// of the current version
+        uint64_t generation{};
+        std::vector<Change> changes{};
+    };
+
+    /// @param root the served directory
+    /// @param excludes not owned, the scanners are expected to use the same
+    explicit ServedTree(Path root, const Excludes* excludes = nullptr);
+
+    Version get() const;
+    /// @return changes needed to get from `generation` to the current version,
+    ///         nullopt if the journal does not reach that far or the list would be
+    ///         too long
+    std::optional<Delta> changes_since(const uint64_t generation) const;
+
+    /// Read the whole tree again and forget the journal.
+    void rescan(const Scanner& scanner, const uint64_t generation);
+    /// Update the tree. Created directories are scanned.
+    /// @param changes in the order of occurrence
+    void apply(std::vector<Change> changes, const uint64_t generation,
+               const Scanner& scanner);
+
+private:
+    struct Batch
+    {
+        uint64_t generation{};
+        std::vector<Change> changes{};
+    };
+
+    void apply_change(const Change& change, const Scanner& scanner);
+    bool excluded(const Path& directory) const;
+    /// Replace or create a node. Directories are scanned unless excluded.
+    void create_node(const Path& path, const Stat& st,
+                     const Scanner& scanner);
+
+    const Path m_root;
+    const Excludes* const m_excludes;
+    /// the working version, only the updating thread touches it
+    Tree m_tree{};
+
+    mutable std::mutex m_mutex{};
+    std::shared_ptr<const Tree> m_published{};
+    uint64_t m_generation{0};
+    /// the oldest generation the journal has changes for
+    uint64_t m_journal_base{0};
+    std::deque<Batch> m_journal{};
+    size_t m_journal_changes{0};
+};
+
+//==========================================================================
+} // namespace rewofs::server
+
+#endif /* include guard */
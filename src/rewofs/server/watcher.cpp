@@ -3,16 +3,16 @@
 /// @file
 
 #include <chrono>
+#include <set>
 
-#include "rewofs/disablewarnings.hpp"
-#include <boost/scope_exit.hpp>
-#include <inotifytools/inotifytools.h>
-#include <inotifytools/inotify.h>
-#include "rewofs/enablewarnings.hpp"
+#include <sys/inotify.h>
+#include <sys/stat.h>
 
 #include "rewofs/log.hpp"
 #include "rewofs/messages.hpp"
 #include "rewofs/path.hpp"
+#include "rewofs/server/fanotify.hpp"
+#include "rewofs/server/inotify.hpp"
 #include "rewofs/server/watcher.hpp"
 #include "rewofs/transport.hpp"
 
@@ -20,7 +20,51 @@
 namespace rewofs::server {
 //==========================================================================
 
-namespace fs = boost::filesystem;
+namespace {
+
+const std::string WATCH_PATH{"."};
+constexpr auto WATCH_EVENTS = IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
+                              | IN_CREATE | IN_DELETE | IN_DONT_FOLLOW;
+
+/// Attach the current attributes. Changes of entries already gone are dropped or
+/// turned to deletions.
+std::vector<ServedTree::Change>
+    stat_changes(const std::vector<ChangeCollector::Change>& changes)
+{
+    std::vector<ServedTree::Change> stated{};
+    stated.reserve(changes.size());
+    for (const auto& change: changes)
+    {
+        ServedTree::Change stated_change{change.type, change.path, change.new_path, {},
+                                         change.reload};
+        if (change.type != messages::ChangeType::Deleted)
+        {
+            const auto& current_path = (change.type == messages::ChangeType::Renamed)
+                                           ? change.new_path
+                                           : change.path;
+            struct stat st{};
+            if (lstat(map_path(current_path).c_str(), &st) == 0)
+            {
+                copy(st, stated_change.st);
+            }
+            else if (change.type == messages::ChangeType::Renamed)
+            {
+                // moved further, a later change tells where
+                stated_change.type = messages::ChangeType::Deleted;
+                stated_change.new_path.clear();
+            }
+            else
+            {
+                // already gone, a later change deletes it
+                continue;
+            }
+        }
+        stated.push_back(std::move(stated_change));
+    }
+    return stated;
+}
+
+} // namespace
 
 //==========================================================================
 
@@ -59,10 +103,288 @@ bool TemporalIgnores::check(const std::chrono::steady_clock::time_point now, con
 
 //==========================================================================
 
-Watcher::Watcher(server::Transport& transport, TemporalIgnores& temporal_ignores)
+void ChangeCollector::created(Path path)
+{
+    add({messages::ChangeType::Created, std::move(path), {}});
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::deleted(Path path)
+{
+    add({messages::ChangeType::Deleted, std::move(path), {}});
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::modified(Path path)
+{
+    // writes generate a flood of events for the same file
+    if (not m_changes.empty()
+        and (m_changes.back().type == messages::ChangeType::Modified)
+        and (m_changes.back().path == path))
+    {
+        return;
+    }
+    add({messages::ChangeType::Modified, std::move(path), {}});
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::reloaded(Path directory)
+{
+    // a build inside generates a flood of events
+    if (not m_reloaded.insert(directory).second)
+    {
+        return;
+    }
+    add({messages::ChangeType::Modified, std::move(directory), {}, true});
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::moved_from(const uint32_t cookie, Path path)
+{
+    // a deletion unless the counterpart arrives (moved out of the watched tree)
+    m_moves[cookie] = m_changes.size();
+    deleted(std::move(path));
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::moved_to(const uint32_t cookie, Path path)
+{
+    const auto it = m_moves.find(cookie);
+    if ((it == m_moves.end()) or (it->second >= m_changes.size()))
+    {
+        // moved in from outside
+        created(std::move(path));
+        return;
+    }
+    auto& change = m_changes[it->second];
+    change.type = messages::ChangeType::Renamed;
+    change.new_path = std::move(path);
+    m_moves.erase(it);
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::overflow()
+{
+    m_overflow = true;
+    m_changes.clear();
+    m_moves.clear();
+    m_reloaded.clear();
+}
+
+//--------------------------------------------------------------------------
+
+bool ChangeCollector::empty() const
+{
+    return not m_overflow and m_changes.empty();
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<std::vector<ChangeCollector::Change>> ChangeCollector::take()
+{
+    const auto overflowed = m_overflow;
+    auto changes = std::move(m_changes);
+    m_changes.clear();
+    m_moves.clear();
+    m_reloaded.clear();
+    m_overflow = false;
+
+    if (overflowed)
+    {
+        return std::nullopt;
+    }
+
+    std::set<Path> parents{};
+    for (const auto& change: changes)
+    {
+        if (change.type != messages::ChangeType::Modified)
+        {
+            parents.insert(change.path.parent_path());
+        }
+        if (change.type == messages::ChangeType::Renamed)
+        {
+            parents.insert(change.new_path.parent_path());
+        }
+    }
+    for (const auto& parent: parents)
+    {
+        changes.push_back({messages::ChangeType::Modified, parent, {}});
+    }
+
+    return changes;
+}
+
+//--------------------------------------------------------------------------
+
+void ChangeCollector::add(Change change)
+{
+    if (m_overflow)
+    {
+        return;
+    }
+    if (m_changes.size() >= MAX_CHANGES)
+    {
+        overflow();
+        return;
+    }
+    m_changes.emplace_back(std::move(change));
+}
+
+//==========================================================================
+
+Generation::Generation()
+    : m_value{static_cast<uint64_t>(
+        std::chrono::system_clock::now().time_since_epoch().count())}
+{
+}
+
+//--------------------------------------------------------------------------
+
+void Generation::bump()
+{
+    ++m_value;
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Generation::get() const
+{
+    return m_value.load();
+}
+
+//==========================================================================
+
+Debouncer::Debouncer(const std::chrono::milliseconds quiet,
+                     const std::chrono::milliseconds max_latency)
+    : m_quiet{quiet}, m_max_latency{max_latency}
+{
+}
+
+//--------------------------------------------------------------------------
+
+void Debouncer::set_limits(const std::chrono::milliseconds quiet,
+                           const std::chrono::milliseconds max_latency)
+{
+    m_quiet = quiet;
+    m_max_latency = max_latency;
+}
+
+//--------------------------------------------------------------------------
+
+void Debouncer::event(const Clock::time_point now)
+{
+    if (not m_first.has_value())
+    {
+        m_first = now;
+    }
+    m_last = now;
+}
+
+//--------------------------------------------------------------------------
+
+bool Debouncer::pending() const
+{
+    return m_first.has_value();
+}
+
+//--------------------------------------------------------------------------
+
+bool Debouncer::settled(const Clock::time_point now) const
+{
+    return pending() and (remaining(now) == std::chrono::milliseconds::zero());
+}
+
+//--------------------------------------------------------------------------
+
+std::chrono::milliseconds Debouncer::remaining(const Clock::time_point now) const
+{
+    if (not m_first.has_value())
+    {
+        return std::chrono::milliseconds::zero();
+    }
+    const auto deadline = std::min(m_last + m_quiet, *m_first + m_max_latency);
+    if (deadline <= now)
+    {
+        return std::chrono::milliseconds::zero();
+    }
+    // rounded up, not to wake up right before the deadline
+    return std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+}
+
+//--------------------------------------------------------------------------
+
+std::chrono::milliseconds Debouncer::take(const Clock::time_point now)
+{
+    const auto latency = m_first.has_value()
+                             ? std::chrono::duration_cast<std::chrono::milliseconds>(
+                                 now - *m_first)
+                             : std::chrono::milliseconds::zero();
+    m_first.reset();
+    return latency;
+}
+
+//==========================================================================
+
+flatbuffers::Offset<messages::Change> build_fbb_change(flatbuffers::FlatBufferBuilder& fbb,
+                                                       const ServedTree::Change& change)
+{
+    const auto is_renamed = (change.type == messages::ChangeType::Renamed);
+    const auto fbb_path = fbb.CreateString(change.path.native());
+    const auto fbb_new_path = is_renamed ? fbb.CreateString(change.new_path.native())
+                                         : flatbuffers::Offset<flatbuffers::String>{};
+    messages::Stat fbb_stat{};
+    copy(change.st, fbb_stat);
+
+    messages::ChangeBuilder builder{fbb};
+    builder.add_type(change.type);
+    builder.add_path(fbb_path);
+    if (is_renamed)
+    {
+        builder.add_new_path(fbb_new_path);
+    }
+    if (change.type != messages::ChangeType::Deleted)
+    {
+        builder.add_st(&fbb_stat);
+    }
+    if (change.reload)
+    {
+        builder.add_reload(true);
+    }
+    return builder.Finish();
+}
+
+//==========================================================================
+
+Watcher::Watcher(server::Transport& transport, TemporalIgnores& temporal_ignores,
+                 Generation& generation, ServedTree& served_tree,
+                 const Excludes& excludes)
     : m_transport{transport}
     , m_temporal_ignores{temporal_ignores}
+    , m_generation{generation}
+    , m_served_tree{served_tree}
+    , m_excludes{excludes}
+{
+}
+
+//--------------------------------------------------------------------------
+
+void Watcher::set_debounce(const std::chrono::milliseconds quiet,
+                           const std::chrono::milliseconds max_latency)
 {
+    m_debouncer.set_limits(quiet, max_latency);
+}
+
+//--------------------------------------------------------------------------
+
+void Watcher::set_backend(const Backend backend)
+{
+    m_backend = backend;
 }
 
 //--------------------------------------------------------------------------
@@ -91,102 +413,191 @@ void Watcher::wait()
 
 //--------------------------------------------------------------------------
 
+void Watcher::request_stats()
+{
+    m_stats_requested = true;
+}
+
+//--------------------------------------------------------------------------
+
 void Watcher::run()
 {
     log_info("watcher start");
 
-    static const std::string WATCH_PATH{"."};
-    static constexpr auto EVENTS = IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
-                            | IN_CREATE | IN_DELETE | IN_DONT_FOLLOW;
+    while (not m_quit and not m_events)
+    {
+        try
+        {
+            m_events = open_events();
+        }
+        catch (const std::system_error& err)
+        {
+            if (err.code().value() == ENOSPC)
+            {
+                log_critical("increase fs.inotify.max_user_watches or run with "
+                             "--watcher=fanotify");
+                return;
+            }
+            log_error("can't watch: {}", err.what());
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+        }
+    }
 
     while (not m_quit)
     {
-        // First do a fast inotify monitoring and then slow fingerprinting.
-        // inotifytools_watch_recursively() does not automatically watch new entries.
-
-        if (not inotifytools_initialize())
+        if (not m_served_tree.get().tree)
         {
-            log_critical("{}", strerror(inotifytools_error()));
-            break;
+            // watched already, changes made during the scan are collected
+            m_served_tree.rescan(m_scanner, m_generation.get());
         }
-        BOOST_SCOPE_EXIT_ALL()
-        {
-            // flush the inotify buffer
-            while (inotifytools_next_event(0) != nullptr) {}
-            inotifytools_cleanup();
-        };
 
-        if (not inotifytools_watch_recursively(WATCH_PATH.c_str(), EVENTS))
+        while (not m_quit and not m_debouncer.pending())
         {
-            if (inotifytools_error() == ENOSPC)
+            if (m_stats_requested.exchange(false))
             {
-                log_critical("increase fs.inotify.max_user_watches");
-                break;
+                log_stats();
             }
-            else
+            if (collect_events(std::chrono::seconds{1}) > 0)
             {
-                log_error("{}", strerror(inotifytools_error()));
+                m_debouncer.event(Debouncer::Clock::now());
             }
-            std::this_thread::sleep_for(std::chrono::seconds{1});
-            continue;
         }
-
-        inotify_event* event{nullptr};
-        do
+        // Local modifications (e.g. a checkout) come in bursts, notify after
+        // they settle.
+        while (not m_quit and not m_debouncer.settled(Debouncer::Clock::now()))
         {
-            event = inotifytools_next_event(1);
-        } while (not m_quit and ((event == nullptr) or (event->mask & IN_IGNORED)));
+            if (collect_events(m_debouncer.remaining(Debouncer::Clock::now())) > 0)
+            {
+                m_debouncer.event(Debouncer::Clock::now());
+            }
+        }
         if (m_quit)
         {
             break;
         }
 
-        const auto normalized
-            = (Path{"/"} / inotifytools_filename_from_wd(event->wd) / event->name)
-                  .lexically_normal();
-        if (m_temporal_ignores.check(std::chrono::steady_clock::now(), normalized))
+        collect_events(std::chrono::milliseconds{0});
+        const auto generation = m_generation.get();
+        // before the notification, the clients react by reading the tree
+        const auto tree_changes = m_tree_collector.take();
+        if (tree_changes.has_value())
         {
-            log_trace("inotify ignored '{}' {}", normalized.native(), event->mask);
-            continue;
+            m_served_tree.apply(stat_changes(*tree_changes), generation, m_scanner);
         }
-        log_trace("inotify '{}' {}", normalized.native(), event->mask);
-        //inotifytools_printf( event, "%T %w%f %e\n" );
+        else
+        {
+            m_served_tree.rescan(m_scanner, generation);
+        }
+        const auto latency = m_debouncer.take(Debouncer::Clock::now());
+        if (not m_collector.empty())
+        {
+            const auto changes = m_collector.take();
+            notify_change(changes.has_value()
+                              ? std::optional{stat_changes(*changes)}
+                              : std::nullopt);
+            ++m_notifications;
+            m_latency_sum += latency;
+            m_latency_max = std::max(m_latency_max, latency);
+            m_latency_last = latency;
+            log_trace("notified {} ms after the first change", latency.count());
+        }
+    }
+
+    log_info("watcher done");
+}
+
+//--------------------------------------------------------------------------
+
+std::unique_ptr<IEventSource> Watcher::open_events()
+{
+    if (m_backend == Backend::Fanotify)
+    {
+        try
+        {
+            return std::make_unique<FanotifySession>(WATCH_PATH, WATCH_EVENTS);
+        }
+        catch (const std::system_error& err)
+        {
+            // EPERM without CAP_SYS_ADMIN, EINVAL or ENOSYS on older kernels
+            log_warning("can't use fanotify, falling back to inotify: {}", err.what());
+            m_backend = Backend::Inotify;
+        }
+    }
+    return std::make_unique<InotifySession>(WATCH_PATH, WATCH_EVENTS, &m_excludes);
+}
+
+//--------------------------------------------------------------------------
+
+void Watcher::log_stats() const
+{
+    const auto average = (m_notifications > 0) ? m_latency_sum / m_notifications
+                                               : std::chrono::milliseconds::zero();
+    log_info("notifications: {}, latency last {} ms, average {} ms, max {} ms",
+             m_notifications, m_latency_last.count(), average.count(),
+             m_latency_max.count());
+}
 
-        // Local modifications may take some time. Fingerprint in a loop and
-        // notify after it is "stabilized".
-        std::vector<BreadthDirectoryItem> fingerprint{};
-        while (not m_quit)
+//--------------------------------------------------------------------------
+
+size_t Watcher::collect_events(const std::chrono::milliseconds timeout)
+{
+    const auto events = m_events->read(timeout);
+    size_t collected{0};
+    for (const auto& event: events)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
         {
-            try
+            m_generation.bump();
+            m_collector.overflow();
+            m_tree_collector.overflow();
+            ++collected;
+            continue;
+        }
+        ++collected;
+
+        // also the ignored changes, other clients do not know about them
+        m_generation.bump();
+
+        const auto& normalized = event.path;
+        // the content is not watched, the clients read it again when loaded
+        const auto excluded = m_excludes.excluded_ancestor(event.path);
+        const auto add = [&event, &excluded](ChangeCollector& collector) {
+            if (excluded.has_value())
             {
-                auto new_fingerprint = breadth_first_tree(WATCH_PATH);
-                if (fingerprint == new_fingerprint)
-                {
-                    log_trace("stabilized");
-                    break;
-                }
-                fingerprint = std::move(new_fingerprint);
+                collector.reloaded(*excluded);
             }
-            catch (const fs::filesystem_error& err)
+            else if (event.mask & IN_CREATE)
             {
-                // ignore errors caused by on-the-fly local tree modifications
-                if (err.code() != boost::system::errc::no_such_file_or_directory)
-                {
-                    throw;
-                }
-
+                collector.created(event.path);
             }
-            std::this_thread::sleep_for(std::chrono::seconds{1});
-        }
-        if (m_quit)
+            else if (event.mask & IN_DELETE)
+            {
+                collector.deleted(event.path);
+            }
+            else if (event.mask & IN_MOVED_FROM)
+            {
+                collector.moved_from(event.cookie, event.path);
+            }
+            else if (event.mask & IN_MOVED_TO)
+            {
+                collector.moved_to(event.cookie, event.path);
+            }
+            else if (event.mask & (IN_MODIFY | IN_ATTRIB))
+            {
+                collector.modified(event.path);
+            }
+        };
+        add(m_tree_collector);
+
+        if (m_temporal_ignores.check(std::chrono::steady_clock::now(), normalized))
         {
-            break;
+            log_trace("event ignored '{}' {}", normalized.native(), event.mask);
+            continue;
         }
-
-        notify_change();
+        log_trace("event '{}' {}", normalized.native(), event.mask);
+        add(m_collector);
     }
-
-    log_info("watcher done");
+    return collected;
 }
 
 //--------------------------------------------------------------------------
@@ -201,10 +612,35 @@ void Watcher::send(flatbuffers::FlatBufferBuilder& fbb, flatbuffers::Offset<_Msg
 
 //--------------------------------------------------------------------------
 
-void Watcher::notify_change()
+void Watcher::notify_change(
+    const std::optional<std::vector<ServedTree::Change>>& changes)
 {
     flatbuffers::FlatBufferBuilder fbb{};
+
+    std::vector<flatbuffers::Offset<messages::Change>> fbb_changes{};
+    if (changes.has_value())
+    {
+        for (const auto& change: *changes)
+        {
+            fbb_changes.push_back(build_fbb_change(fbb, change));
+        }
+        log_trace("notify {} changes", fbb_changes.size());
+    }
+    else
+    {
+        log_trace("notify unknown changes");
+    }
+
+    decltype(fbb.CreateVector(fbb_changes)) fbb_vector{};
+    if (changes.has_value())
+    {
+        fbb_vector = fbb.CreateVector(fbb_changes);
+    }
     messages::NotifyChangedBuilder builder{fbb};
+    if (changes.has_value())
+    {
+        builder.add_changes(fbb_vector);
+    }
     send(fbb, builder.Finish());
 }
 
@@ -6,9 +6,15 @@
 #ifndef WATCHER_HPP__DNJ8BT5L
 #define WATCHER_HPP__DNJ8BT5L
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <set>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "rewofs/disablewarnings.hpp"
 #include <boost/filesystem.hpp>
@@ -16,6 +22,11 @@
 #include <flatbuffers/flatbuffers.h>
 #include "rewofs/enablewarnings.hpp"
 
+#include "rewofs/messages.hpp"
+#include "rewofs/server/event_source.hpp"
+#include "rewofs/server/excludes.hpp"
+#include "rewofs/server/scanner.hpp"
+#include "rewofs/server/served_tree.hpp"
 #include "rewofs/server/transport.hpp"
 
 //==========================================================================
@@ -58,26 +69,178 @@ private:
 
 //==========================================================================
 
+/// Version of the served tree. Bumped on every change made by a client or seen by
+/// the watcher, so a client can tell if its tree is still current. Starts at the
+/// server start time to not repeat the values after a restart.
+class Generation : private boost::noncopyable
+{
+public:
+    Generation();
+
+    void bump();
+    uint64_t get() const;
+
+private:
+    std::atomic<uint64_t> m_value{};
+};
+
+//==========================================================================
+
+/// Turns filesystem events into a list of changes.
+class ChangeCollector : private boost::noncopyable
+{
+private:
+    using Path = boost::filesystem::path;
+
+public:
+    /// Larger batches are not worth it, the whole tree gets reloaded instead.
+    static constexpr size_t MAX_CHANGES{10000};
+
+    struct Change
+    {
+        messages::ChangeType type{};
+        Path path{};
+        /// only for ChangeType::Renamed
+        Path new_path{};
+        /// only for ChangeType::Modified, see messages::Change
+        bool reload{false};
+    };
+
+    void created(Path path);
+    void deleted(Path path);
+    void modified(Path path);
+    /// Something changed inside a directory with the content not watched. Repeated
+    /// calls are merged.
+    void reloaded(Path directory);
+    /// Rename is reported as a pair of events with the same cookie.
+    void moved_from(const uint32_t cookie, Path path);
+    void moved_to(const uint32_t cookie, Path path);
+    /// Some events were lost, the changes are unknown.
+    void overflow();
+
+    bool empty() const;
+    /// Get the collected changes and start over. Parents of created, deleted and
+    /// renamed entries are reported as modified.
+    /// @return nullopt if the changes are unknown
+    std::optional<std::vector<Change>> take();
+
+private:
+    void add(Change change);
+
+    std::vector<Change> m_changes{};
+    /// pending moves, cookie -> index to m_changes
+    std::unordered_map<uint32_t, size_t> m_moves{};
+    /// directories already passed to reloaded()
+    std::set<Path> m_reloaded{};
+    bool m_overflow{false};
+};
+
+//==========================================================================
+
+/// Decides when a burst of events is over. It is settled after a quiet period
+/// without events or after the maximal latency since its first event, whichever
+/// comes first.
+class Debouncer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Debouncer(const std::chrono::milliseconds quiet,
+              const std::chrono::milliseconds max_latency);
+
+    void set_limits(const std::chrono::milliseconds quiet,
+                    const std::chrono::milliseconds max_latency);
+    void event(const Clock::time_point now);
+    /// A burst started and was not taken yet.
+    bool pending() const;
+    bool settled(const Clock::time_point now) const;
+    /// @return time until settled, zero if settled or not pending
+    std::chrono::milliseconds remaining(const Clock::time_point now) const;
+    /// Start over.
+    /// @return time since the first event of the burst
+    std::chrono::milliseconds take(const Clock::time_point now);
+
+private:
+    std::chrono::milliseconds m_quiet{};
+    std::chrono::milliseconds m_max_latency{};
+    std::optional<Clock::time_point> m_first{};
+    Clock::time_point m_last{};
+};
+
+//==========================================================================
+
+flatbuffers::Offset<messages::Change> build_fbb_change(flatbuffers::FlatBufferBuilder& fbb,
+                                                       const ServedTree::Change& change);
+
+//==========================================================================
+
 class Watcher : private boost::noncopyable
 {
 public:
-    Watcher(server::Transport& transport, TemporalIgnores& temporal_ignores);
+    enum class Backend
+    {
+        /// a watch per directory, limited by fs.inotify.max_user_watches
+        Inotify,
+        /// a single mark of the whole filesystem, privileged, falls back to inotify
+        Fanotify,
+    };
 
+    /// @param excludes changes inside excluded directories are reported as a change
+    ///        of the outermost one (see messages::Change::reload)
+    Watcher(server::Transport& transport, TemporalIgnores& temporal_ignores,
+            Generation& generation, ServedTree& served_tree, const Excludes& excludes);
+
+    /// Notify after `quiet` without changes, but at most `max_latency` after the
+    /// first change. Call before start().
+    void set_debounce(const std::chrono::milliseconds quiet,
+                      const std::chrono::milliseconds max_latency);
+    /// Call before start().
+    void set_backend(const Backend backend);
     void start();
     void stop();
     void wait();
+    /// Log the notification latency statistics.
+    void request_stats();
 
 private:
     using Path = boost::filesystem::path;
 
+    static constexpr std::chrono::milliseconds DEFAULT_QUIET{100};
+    static constexpr std::chrono::milliseconds DEFAULT_MAX_LATENCY{1000};
+
     void run();
+    std::unique_ptr<IEventSource> open_events();
+    /// Feed the collectors with all pending events.
+    /// @param timeout for the first event
+    /// @return number of events
+    size_t collect_events(const std::chrono::milliseconds timeout);
+    void log_stats() const;
 
     template<typename _Msg>
     void send(flatbuffers::FlatBufferBuilder& fbb, flatbuffers::Offset<_Msg> msg);
-    void notify_change();
+    void
+        notify_change(const std::optional<std::vector<ServedTree::Change>>& changes);
 
     server::Transport& m_transport;
     TemporalIgnores& m_temporal_ignores;
+    Generation& m_generation;
+    ServedTree& m_served_tree;
+    const Excludes& m_excludes;
+    Scanner m_scanner{0, &m_excludes};
+    Backend m_backend{Backend::Inotify};
+    /// kept for the whole run
+    std::unique_ptr<IEventSource> m_events{};
+    /// changes to notify the clients about
+    ChangeCollector m_collector{};
+    /// all changes including the ones made by the clients, for the served tree
+    ChangeCollector m_tree_collector{};
+    Debouncer m_debouncer{DEFAULT_QUIET, DEFAULT_MAX_LATENCY};
+    /// from the first change to the clients notification
+    uint64_t m_notifications{0};
+    std::chrono::milliseconds m_latency_sum{};
+    std::chrono::milliseconds m_latency_max{};
+    std::chrono::milliseconds m_latency_last{};
+    std::atomic<bool> m_stats_requested{false};
     std::thread m_thread{};
     std::atomic<bool> m_quit{false};
 };
@@ -2,8 +2,15 @@
 ///
 /// @file
 
+#include <algorithm>
+#include <climits>
+#include <deque>
+#include <limits>
+
+#include <sys/statvfs.h>
+#include <unistd.h>
+
 #include "rewofs/disablewarnings.hpp"
-#include <boost/range/iterator_range.hpp>
 #include <boost/scope_exit.hpp>
 #include "rewofs/enablewarnings.hpp"
 
@@ -11,6 +18,7 @@
 #include "rewofs/messages.hpp"
 #include "rewofs/path.hpp"
 #include "rewofs/server/worker.hpp"
+#include "rewofs/tree_codec.hpp"
 
 //==========================================================================
 namespace rewofs::server {
@@ -70,56 +78,210 @@ int renameat2(int olddirfd, const char* oldpath, int newdirfd, const char* newpa
 
 //--------------------------------------------------------------------------
 
+/// entries (nodes and directories) per streamed tree chunk
+constexpr size_t TREE_CHUNK_ENTRIES{4096};
+/// directories of a streamed tree listed in parallel
+constexpr size_t TREE_LIST_BATCH{256};
+
+//--------------------------------------------------------------------------
+
 flatbuffers::Offset<messages::TreeNode>
-    build_fs_fbb_tree(flatbuffers::FlatBufferBuilder& fbb, const fs::path& path)
+    build_fbb_tree(flatbuffers::FlatBufferBuilder& fbb, const ScanNode& node)
 {
-    // TODO limit depth (possible loops via e.g. mount -oloop)
-
-    struct stat st{};
-    const auto res = lstat(path.c_str(), &st);
     messages::Stat fbb_stat{};
-    if (res == 0)
-    {
-        copy(st, fbb_stat);
-    }
-    else
+    if (node.stat_errno == 0)
     {
-        log_warning("{} {} {}", path.native(), res, errno);
+        copy(node.st, fbb_stat);
     }
 
     std::vector<flatbuffers::Offset<messages::TreeNode>> vec_children{};
-    try
+    vec_children.reserve(node.children.size());
+    for (const auto& child: node.children)
     {
-        if (not fs::is_symlink(path) and fs::is_directory(path))
-        {
-            const auto children
-                = boost::make_iterator_range(fs::directory_iterator{path}, {});
-            for (const auto& child : children)
-            {
-                vec_children.push_back(build_fs_fbb_tree(fbb, child.path()));
-            }
-        }
+        vec_children.push_back(build_fbb_tree(fbb, child));
     }
-    catch (const std::exception& exc)
+
+    const auto fbb_name = fbb.CreateString(node.name);
+    const auto fbb_children = fbb.CreateVector(vec_children);
+    messages::TreeNodeBuilder builder{fbb};
+    builder.add_name(fbb_name);
+    builder.add_st(&fbb_stat);
+    builder.add_children(fbb_children);
+    builder.add_unloaded(node.unloaded);
+    return builder.Finish();
+}
+
+//--------------------------------------------------------------------------
+
+/// @param depth levels of descendants to include
+flatbuffers::Offset<messages::TreeNode>
+    build_fbb_tree(flatbuffers::FlatBufferBuilder& fbb, const ServedTree::Tree& tree,
+                   const Node& node, const std::string_view name,
+                   const uint32_t depth)
+{
+    messages::Stat fbb_stat{};
+    copy(node.st, fbb_stat);
+
+    std::vector<flatbuffers::Offset<messages::TreeNode>> vec_children{};
+    const auto unloaded = S_ISDIR(node.st.st_mode) and ((depth == 0) or node.unloaded);
+    if (not unloaded)
     {
-        log_warning("{} {}", path.native(), exc.what());
+        const auto child_depth = (depth == UNLIMITED_DEPTH) ? depth : depth - 1;
+        vec_children.reserve(ServedTree::Tree::children_count(node));
+        tree.for_each_child(node, [&](const std::string_view child_name,
+                                      const Node& child) {
+            vec_children.push_back(
+                build_fbb_tree(fbb, tree, child, child_name, child_depth));
+        });
     }
 
-    const auto fbb_name = fbb.CreateString(path.filename().native());
+    const auto fbb_name = fbb.CreateString(name.data(), name.size());
     const auto fbb_children = fbb.CreateVector(vec_children);
     messages::TreeNodeBuilder builder{fbb};
     builder.add_name(fbb_name);
     builder.add_st(&fbb_stat);
     builder.add_children(fbb_children);
+    builder.add_unloaded(unloaded);
     return builder.Finish();
 }
 
+//--------------------------------------------------------------------------
+
+/// @return nullopt if not readable (e.g. removed meanwhile)
+std::optional<messages::Stat> stat_after(const fs::path& path)
+{
+    struct stat st{};
+    if (lstat(path.c_str(), &st) != 0)
+    {
+        return std::nullopt;
+    }
+    messages::Stat fbb_stat{};
+    copy(st, fbb_stat);
+    return fbb_stat;
+}
+
+//--------------------------------------------------------------------------
+
+/// Successful reply to a mutation, see messages::ResultErrno.
+/// @param target nullptr if removed
+/// @param parent nullptr if not changed
+/// @param old_parent rename only
+flatbuffers::Offset<messages::ResultErrno>
+    mutation_result(flatbuffers::FlatBufferBuilder& fbb, const fs::path* target,
+                    const fs::path* parent = nullptr,
+                    const fs::path* old_parent = nullptr)
+{
+    const auto st = (target != nullptr) ? stat_after(*target) : std::nullopt;
+    const auto parent_st = (parent != nullptr) ? stat_after(*parent) : std::nullopt;
+    const auto old_parent_st
+        = (old_parent != nullptr) ? stat_after(*old_parent) : std::nullopt;
+    messages::ResultErrnoBuilder builder{fbb};
+    builder.add_res_errno(0);
+    if (st.has_value())
+    {
+        builder.add_st(&*st);
+    }
+    if (parent_st.has_value())
+    {
+        builder.add_parent_st(&*parent_st);
+    }
+    if (old_parent_st.has_value())
+    {
+        builder.add_old_parent_st(&*old_parent_st);
+    }
+    return builder.Finish();
+}
+
+//--------------------------------------------------------------------------
+
+bool failed(const messages::ResultErrno& result)
+{
+    return result.res_errno() != 0;
+}
+
+bool failed(const messages::ResultStat& result)
+{
+    return result.res_errno() != 0;
+}
+
+bool failed(const messages::ResultReaddir& result)
+{
+    return result.res_errno() != 0;
+}
+
+bool failed(const messages::ResultReadlink& result)
+{
+    return result.res_errno() != 0;
+}
+
+bool failed(const messages::ResultRead& result)
+{
+    return result.res() < 0;
+}
+
+bool failed(const messages::ResultWrite& result)
+{
+    return result.res() < 0;
+}
+
+//--------------------------------------------------------------------------
+
+/// Wrap a result of a CommandBatch operation.
+/// @return the item and true if the result is a failure
+template<typename _Result>
+std::pair<flatbuffers::Offset<messages::BatchItem>, bool>
+    batch_item(flatbuffers::FlatBufferBuilder& fbb,
+               const flatbuffers::Offset<_Result> result)
+{
+    // valid only until the builder grows
+    const auto is_failed = failed(*flatbuffers::GetTemporaryPointer(fbb, result));
+    return {messages::CreateBatchItem(fbb, messages::MessageTraits<_Result>::enum_value,
+                                      result.Union()),
+            is_failed};
+}
+
+//--------------------------------------------------------------------------
+
+/// Directory listing from the filesystem, the hashes unknown.
+flatbuffers::Offset<messages::HashedDirectory>
+    list_unhashed(flatbuffers::FlatBufferBuilder& fbb, const ServedTree::Path& path)
+{
+    std::vector<ScanNode> listing{};
+    try
+    {
+        listing = Scanner::list(map_path(path.relative_path()));
+    }
+    catch (const std::system_error& err)
+    {
+        return messages::CreateHashedDirectoryDirect(fbb, path.c_str(),
+                                                     err.code().value());
+    }
+    std::vector<flatbuffers::Offset<messages::HashedNode>> children{};
+    for (const auto& listed: listing)
+    {
+        if (listed.stat_errno != 0)
+        {
+            continue;
+        }
+        messages::Stat fbb_stat{};
+        copy(listed.st, fbb_stat);
+        const auto fbb_name = fbb.CreateString(listed.name);
+        children.push_back(messages::CreateHashedNode(fbb, fbb_name, &fbb_stat,
+                                                      UNKNOWN_HASH));
+    }
+    return messages::CreateHashedDirectoryDirect(fbb, path.c_str(), 0,
+                                                 UNKNOWN_HASH, &children);
+}
+
 //==========================================================================
 } // namespace
 //==========================================================================
 
-Worker::Worker(server::Transport& transport, TemporalIgnores& temporal_ignores)
-    : m_transport{transport}, m_temporal_ignores{temporal_ignores}
+Worker::Worker(server::Transport& transport, TemporalIgnores& temporal_ignores,
+               Generation& generation, ServedTree& served_tree,
+               const Excludes& excludes)
+    : m_transport{transport}, m_temporal_ignores{temporal_ignores},
+      m_generation{generation}, m_served_tree{served_tree}, m_excludes{excludes}
 {
 #define SUB(_Msg, func) \
     m_distributor.subscribe<messages::_Msg>( \
@@ -127,7 +289,18 @@ Worker::Worker(server::Transport& transport, TemporalIgnores& temporal_ignores)
             process_message(mid, msg, &Worker::func); \
         });
     SUB(Ping, process_ping);
-    SUB(CommandReadTree, process_read_tree);
+    m_distributor.subscribe<messages::CommandReadTree>(
+        [this](const MessageId mid, const auto& msg) {
+            if (msg.stream())
+            {
+                stream_tree(mid, msg);
+            }
+            else
+            {
+                process_message(mid, msg, &Worker::process_read_tree);
+            }
+        });
+    SUB(CommandReadTreeHashes, process_read_tree_hashes);
     SUB(CommandStat, process_stat);
     SUB(CommandReaddir, process_readdir);
     SUB(CommandReadlink, process_readlink);
@@ -144,12 +317,22 @@ Worker::Worker(server::Transport& transport, TemporalIgnores& temporal_ignores)
     SUB(CommandRead, process_read);
     SUB(CommandWrite, process_write);
     SUB(CommandPreread, process_preread);
+    SUB(CommandFsync, process_fsync);
+    SUB(CommandFallocate, process_fallocate);
+    SUB(CommandLseek, process_lseek);
+    SUB(CommandStatfs, process_statfs);
+    SUB(CommandBatch, process_batch);
 }
 
 //--------------------------------------------------------------------------
 
 void Worker::start()
 {
+    std::array<char, HOST_NAME_MAX + 1> hostname{};
+    gethostname(hostname.data(), hostname.size() - 1);
+    // the served directory is the current one
+    m_server_id = std::string{hostname.data()} + ":" + fs::current_path().native();
+
     for (auto& thr: m_threads)
     {
         thr = std::thread{&Worker::run, this};
@@ -219,6 +402,8 @@ void Worker::run()
 void Worker::temporal_ignore(const boost::filesystem::path& path)
 {
     m_temporal_ignores.add(std::chrono::steady_clock::now(), path);
+    // the watcher does not see this change
+    m_generation.bump();
 }
 
 //--------------------------------------------------------------------------
@@ -239,7 +424,12 @@ void Worker::process_message(const MessageId mid, const _Msg& msg, _ProcFunc pro
 flatbuffers::Offset<messages::Pong>
     Worker::process_ping(flatbuffers::FlatBufferBuilder& fbb, const messages::Ping&)
 {
-    return messages::CreatePong(fbb);
+    return messages::CreatePongDirect(
+        fbb, m_server_id.c_str(), m_generation.get(),
+        static_cast<uint64_t>(messages::Capability::PackedTree
+                              | messages::Capability::TreeHashes
+                              | messages::Capability::Batch
+                              | messages::Capability::FileCommands));
 }
 
 //--------------------------------------------------------------------------
@@ -249,12 +439,32 @@ flatbuffers::Offset<messages::ResultReadTree>
                               const messages::CommandReadTree& msg)
 {
     const auto path = map_path(msg.path()->c_str());
+    const ServedTree::Path tree_path{msg.path()->str()};
     log_trace("read tree {}", path.native());
 
-    auto tree = build_fs_fbb_tree(fbb, path);
+    const auto depth = (msg.depth() == 0) ? UNLIMITED_DEPTH : msg.depth();
+    flatbuffers::Offset<messages::TreeNode> tree{};
+    uint64_t generation{};
+    const auto served = m_served_tree.get();
+    // an excluded directory has no content in memory
+    if (served.tree and served.tree->exists(tree_path)
+        and not served.tree->get_node(tree_path).unloaded)
+    {
+        generation = served.generation;
+        tree = build_fbb_tree(fbb, *served.tree, served.tree->get_node(tree_path),
+                              path.filename().native(), depth);
+    }
+    else
+    {
+        // not read by the watcher yet, lagging behind or excluded
+        // changes made during the read make the tree outdated
+        generation = m_generation.get();
+        tree = build_fbb_tree(fbb, m_scanner.scan(path, depth, tree_path));
+    }
     auto res_builder = messages::ResultReadTreeBuilder{fbb};
     res_builder.add_res_errno(0);
     res_builder.add_tree(tree);
+    res_builder.add_generation(generation);
     const auto ret = res_builder.Finish();
     log_trace("tree msg size ~ {}", ret.o);
     return ret;
@@ -262,6 +472,349 @@ flatbuffers::Offset<messages::ResultReadTree>
 
 //--------------------------------------------------------------------------
 
+void Worker::stream_tree(const MessageId mid, const messages::CommandReadTree& msg)
+{
+    const auto root = map_path(msg.path()->c_str());
+    log_trace("stream tree {}", root.native());
+
+    const ServedTree::Path tree_root{msg.path()->str()};
+    const auto served = m_served_tree.get();
+    // an excluded directory has no content in memory
+    const auto in_memory = served.tree and served.tree->exists(tree_root)
+                           and not served.tree->get_node(tree_root).unloaded;
+    if (in_memory and (msg.since_generation() != 0) and (tree_root == "/"))
+    {
+        if (const auto delta = m_served_tree.changes_since(msg.since_generation()))
+        {
+            send_tree_changes(mid, *delta);
+            return;
+        }
+    }
+    if ((msg.since_generation() != 0) and msg.changes_only())
+    {
+        // the client compares the hashes instead
+        flatbuffers::FlatBufferBuilder fbb{};
+        messages::ResultReadTreeChunkBuilder builder{fbb};
+        builder.add_res_errno(ESTALE);
+        builder.add_last(true);
+        const auto frame = make_frame(fbb, strong::value_of(mid), builder.Finish());
+        fbb.Finish(frame);
+        m_transport.send({fbb.GetBufferPointer(), fbb.GetSize()});
+        return;
+    }
+
+    // changes made during the read make the tree outdated
+    const auto generation = in_memory ? served.generation : m_generation.get();
+    const auto depth = (msg.depth() == 0) ? UNLIMITED_DEPTH : msg.depth();
+    const auto packed = msg.packed();
+
+    flatbuffers::FlatBufferBuilder fbb{};
+    std::vector<flatbuffers::Offset<messages::TreeDirectory>> directories{};
+    std::vector<flatbuffers::Offset<messages::TreeNode>> children{};
+    tree_codec::Encoder encoder{};
+    flatbuffers::Offset<messages::TreeNode> root_node{};
+    size_t entries{0};
+    size_t chunks{0};
+
+    const auto send_chunk = [&](const int res_errno, const bool last) {
+        flatbuffers::Offset<flatbuffers::Vector<uint8_t>> fbb_packed{};
+        flatbuffers::Offset<
+            flatbuffers::Vector<flatbuffers::Offset<messages::TreeDirectory>>>
+            fbb_directories{};
+        if (packed)
+        {
+            fbb_packed = fbb.CreateVector(encoder.finish());
+        }
+        else
+        {
+            fbb_directories = fbb.CreateVector(directories);
+        }
+        messages::ResultReadTreeChunkBuilder builder{fbb};
+        builder.add_res_errno(res_errno);
+        if (chunks == 0)
+        {
+            if (not root_node.IsNull())
+            {
+                builder.add_root(root_node);
+            }
+            builder.add_generation(generation);
+        }
+        builder.add_directories(fbb_directories);
+        builder.add_packed(fbb_packed);
+        builder.add_last(last);
+        const auto frame = make_frame(fbb, strong::value_of(mid), builder.Finish());
+        fbb.Finish(frame);
+        m_transport.send({fbb.GetBufferPointer(), fbb.GetSize()});
+
+        fbb.Clear();
+        directories.clear();
+        entries = 0;
+        ++chunks;
+    };
+    const auto add_child = [&](const std::string& name, const struct stat& st,
+                               const bool unloaded) {
+        if (packed)
+        {
+            tree_codec::Entry entry{};
+            entry.name = name;
+            entry.st_mode = st.st_mode;
+            entry.st_size = st.st_size;
+            entry.st_mtim = st.st_mtim;
+            entry.st_ctim = st.st_ctim;
+            entry.unloaded = unloaded;
+            encoder.add(entry);
+        }
+        else
+        {
+            messages::Stat fbb_stat{};
+            copy(st, fbb_stat);
+            const auto fbb_name = fbb.CreateString(name);
+            messages::TreeNodeBuilder builder{fbb};
+            builder.add_name(fbb_name);
+            builder.add_st(&fbb_stat);
+            builder.add_unloaded(unloaded);
+            children.push_back(builder.Finish());
+        }
+        ++entries;
+    };
+    const auto add_directory = [&](const fs::path& relative, const bool continued) {
+        if (packed)
+        {
+            // the path is implied by the order
+            encoder.end_directory(continued);
+        }
+        else
+        {
+            const auto fbb_path = fbb.CreateString(relative.native());
+            const auto fbb_children = fbb.CreateVector(children);
+            directories.push_back(
+                messages::CreateTreeDirectory(fbb, fbb_path, fbb_children, continued));
+            children.clear();
+        }
+        ++entries;
+    };
+
+    // listings in the order of `relatives`
+    const auto list = [&](const std::vector<fs::path>& relatives) {
+        if (not in_memory)
+        {
+            auto listings = m_scanner.list(root, relatives);
+            for (size_t i = 0; i < relatives.size(); ++i)
+            {
+                for (auto& listed: listings[i])
+                {
+                    listed.unloaded
+                        = (listed.stat_errno == 0) and S_ISDIR(listed.st.st_mode)
+                          and m_excludes.excluded(tree_root / relatives[i] / listed.name);
+                }
+            }
+            return listings;
+        }
+        std::vector<std::vector<ScanNode>> listings(relatives.size());
+        for (size_t i = 0; i < relatives.size(); ++i)
+        {
+            const auto path = tree_root / relatives[i];
+            if (not served.tree->exists(path))
+            {
+                continue;
+            }
+            served.tree->for_each_child(
+                served.tree->get_node(path),
+                [&listing = listings[i]](const std::string_view name,
+                                         const Node& child) {
+                    ScanNode listed{};
+                    listed.name = name;
+                    copy(child.st, listed.st);
+                    listed.unloaded = child.unloaded;
+                    listing.push_back(std::move(listed));
+                });
+        }
+        return listings;
+    };
+
+    struct stat root_st{};
+    if (in_memory)
+    {
+        copy(served.tree->get_node(tree_root).st, root_st);
+    }
+    else if (lstat(root.c_str(), &root_st) != 0)
+    {
+        send_chunk(errno, true);
+        return;
+    }
+    {
+        messages::Stat fbb_stat{};
+        copy(root_st, fbb_stat);
+        const auto fbb_name = fbb.CreateString(root.filename().native());
+        messages::TreeNodeBuilder builder{fbb};
+        builder.add_name(fbb_name);
+        builder.add_st(&fbb_stat);
+        root_node = builder.Finish();
+    }
+
+    struct Pending
+    {
+        fs::path relative{};
+        /// levels of descendants to include
+        uint32_t depth{};
+    };
+    // breadth-first, only the current level and the next one are queued
+    std::deque<Pending> pending{};
+    if (S_ISDIR(root_st.st_mode))
+    {
+        pending.push_back({{}, depth});
+    }
+    std::vector<Pending> batch{};
+    std::vector<fs::path> relatives{};
+
+    while (not pending.empty())
+    {
+        // a batch is listed in parallel and sent in the same order
+        batch.clear();
+        relatives.clear();
+        while (not pending.empty() and (batch.size() < TREE_LIST_BATCH))
+        {
+            relatives.push_back(pending.front().relative);
+            batch.push_back(std::move(pending.front()));
+            pending.pop_front();
+        }
+        auto listings = list(relatives);
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const auto& directory = batch[i];
+            auto& listing = listings[i];
+            const auto child_depth = (directory.depth == UNLIMITED_DEPTH)
+                                         ? directory.depth
+                                         : directory.depth - 1;
+
+            // removed meanwhile
+            listing.erase(std::remove_if(listing.begin(), listing.end(),
+                                         [](const ScanNode& node) {
+                                             return node.stat_errno != 0;
+                                         }),
+                          listing.end());
+            // neighbours share prefixes
+            std::sort(listing.begin(), listing.end(),
+                      [](const ScanNode& n1, const ScanNode& n2) {
+                          return n1.name < n2.name;
+                      });
+
+            for (const auto& listed: listing)
+            {
+                const auto is_directory = S_ISDIR(listed.st.st_mode);
+                const auto unloaded
+                    = is_directory and ((child_depth == 0) or listed.unloaded);
+                add_child(listed.name, listed.st, unloaded);
+                if (is_directory and not unloaded)
+                {
+                    pending.push_back({directory.relative / listed.name, child_depth});
+                }
+                if (entries >= TREE_CHUNK_ENTRIES)
+                {
+                    // a huge directory is split to more chunks
+                    add_directory(directory.relative, true);
+                    send_chunk(0, false);
+                }
+            }
+
+            add_directory(directory.relative, false);
+            if (entries >= TREE_CHUNK_ENTRIES)
+            {
+                send_chunk(0, false);
+            }
+        }
+    }
+
+    send_chunk(0, true);
+    log_trace("tree streamed in {} chunks", chunks);
+}
+
+//--------------------------------------------------------------------------
+
+void Worker::send_tree_changes(const MessageId mid, const ServedTree::Delta& delta)
+{
+    log_trace("tree changes {}", delta.changes.size());
+
+    flatbuffers::FlatBufferBuilder fbb{};
+    std::vector<flatbuffers::Offset<messages::Change>> fbb_changes{};
+    fbb_changes.reserve(delta.changes.size());
+    for (const auto& change: delta.changes)
+    {
+        fbb_changes.push_back(build_fbb_change(fbb, change));
+    }
+    const auto fbb_vector = fbb.CreateVector(fbb_changes);
+    messages::ResultReadTreeChunkBuilder builder{fbb};
+    builder.add_res_errno(0);
+    builder.add_generation(delta.generation);
+    builder.add_last(true);
+    builder.add_incremental(true);
+    builder.add_changes(fbb_vector);
+    const auto frame = make_frame(fbb, strong::value_of(mid), builder.Finish());
+    fbb.Finish(frame);
+    m_transport.send({fbb.GetBufferPointer(), fbb.GetSize()});
+}
+
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultReadTreeHashes>
+    Worker::process_read_tree_hashes(flatbuffers::FlatBufferBuilder& fbb,
+                                     const messages::CommandReadTreeHashes& msg)
+{
+    const auto served = m_served_tree.get();
+    if (not served.tree)
+    {
+        // not read by the watcher yet
+        return messages::CreateResultReadTreeHashes(fbb, EAGAIN);
+    }
+
+    std::vector<flatbuffers::Offset<messages::HashedDirectory>> directories{};
+    std::vector<flatbuffers::Offset<messages::HashedNode>> children{};
+    for (const auto* fbb_path: *msg.paths())
+    {
+        const ServedTree::Path path{fbb_path->str()};
+        log_trace("tree hashes {}", path.native());
+        if ((served.tree->exists(path) and served.tree->get_node(path).unloaded)
+            or (not served.tree->exists(path)
+                and served.tree->unloaded_ancestor(path).has_value()))
+        {
+            // excluded, listed without the hashes so the client descends
+            directories.push_back(list_unhashed(fbb, path));
+            continue;
+        }
+        if (not served.tree->exists(path))
+        {
+            directories.push_back(
+                messages::CreateHashedDirectoryDirect(fbb, path.c_str(), ENOENT));
+            continue;
+        }
+        const auto& node = served.tree->get_node(path);
+        if (not S_ISDIR(node.st.st_mode))
+        {
+            directories.push_back(
+                messages::CreateHashedDirectoryDirect(fbb, path.c_str(), ENOTDIR));
+            continue;
+        }
+
+        children.clear();
+        served.tree->for_each_child(node, [&fbb, &children](
+                                              const std::string_view name,
+                                              const Node& child) {
+            messages::Stat fbb_stat{};
+            copy(child.st, fbb_stat);
+            const auto fbb_name = fbb.CreateString(name.data(), name.size());
+            children.push_back(
+                messages::CreateHashedNode(fbb, fbb_name, &fbb_stat, child.hash));
+        });
+        directories.push_back(messages::CreateHashedDirectoryDirect(
+            fbb, path.c_str(), 0, node.hash, &children));
+    }
+    return messages::CreateResultReadTreeHashesDirect(fbb, 0, &directories,
+                                                      served.generation);
+}
+
+//--------------------------------------------------------------------------
+
 flatbuffers::Offset<messages::ResultStat>
     Worker::process_stat(flatbuffers::FlatBufferBuilder& fbb,
                          const messages::CommandStat& msg)
@@ -301,17 +854,13 @@ flatbuffers::Offset<messages::ResultReaddir>
 
     try
     {
-        const fs::directory_iterator end_itr{};
-        for (fs::directory_iterator itr{path}; itr != end_itr; ++itr)
+        for (const auto& child: Scanner::list(path))
         {
-            const auto fs_item_path = itr->path().filename();
-            const auto item_path = fbb.CreateString(fs_item_path.native());
-            struct stat st{};
-            const auto res = lstat(fs_item_path.c_str(), &st);
-            if (res == 0)
+            const auto item_path = fbb.CreateString(child.name);
+            if (child.stat_errno == 0)
             {
                 messages::Stat msg_st{};
-                copy(st, msg_st);
+                copy(child.st, msg_st);
                 const auto item = messages::CreateTreeNode(fbb, item_path, &msg_st);
                 items.push_back(item);
             }
@@ -324,7 +873,7 @@ flatbuffers::Offset<messages::ResultReaddir>
         const auto fb_items = fbb.CreateVector(items);
         return messages::CreateResultReaddir(fbb, 0, fb_items);
     }
-    catch (const fs::filesystem_error& exc)
+    catch (const std::system_error& exc)
     {
         return messages::CreateResultReaddir(fbb, exc.code().value());
     }
@@ -376,7 +925,8 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    const auto parent = path.parent_path();
+    return mutation_result(fbb, &path, &parent);
 }
 
 //--------------------------------------------------------------------------
@@ -396,7 +946,8 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    const auto parent = path.parent_path();
+    return mutation_result(fbb, nullptr, &parent);
 }
 
 //--------------------------------------------------------------------------
@@ -416,7 +967,8 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    const auto parent = path.parent_path();
+    return mutation_result(fbb, nullptr, &parent);
 }
 
 //--------------------------------------------------------------------------
@@ -436,7 +988,8 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    const auto parent = link_path.parent_path();
+    return mutation_result(fbb, &link_path, &parent);
 }
 
 //--------------------------------------------------------------------------
@@ -460,7 +1013,9 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    const auto parent = new_path.parent_path();
+    const auto old_parent = old_path.parent_path();
+    return mutation_result(fbb, &new_path, &parent, &old_parent);
 }
 
 //--------------------------------------------------------------------------
@@ -480,7 +1035,7 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    return mutation_result(fbb, &path);
 }
 
 //--------------------------------------------------------------------------
@@ -503,7 +1058,7 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    return mutation_result(fbb, &path);
 }
 
 //--------------------------------------------------------------------------
@@ -523,7 +1078,7 @@ flatbuffers::Offset<messages::ResultErrno>
         return messages::CreateResultErrno(fbb, errno);
     }
 
-    return messages::CreateResultErrno(fbb, 0);
+    return mutation_result(fbb, &path);
 }
 
 //--------------------------------------------------------------------------
@@ -559,6 +1114,15 @@ flatbuffers::Offset<messages::ResultErrno>
         file_ref.path = msg.path()->str();
     }
     assert(get_file_descriptor(msg.file_handle()).first.fd == res);
+    if (msg.flags() & O_CREAT)
+    {
+        const auto parent = path.parent_path();
+        return mutation_result(fbb, &path, &parent);
+    }
+    if (msg.flags() & O_TRUNC)
+    {
+        return mutation_result(fbb, &path);
+    }
     return messages::CreateResultErrno(fbb, 0);
 }
 
@@ -655,15 +1219,23 @@ flatbuffers::Offset<messages::ResultWrite>
 
     const auto res = write(file_ref.fd, msg.data()->data(), msg.data()->size());
     log_trace("fd:{} res:{}", file_ref.fd, res);
-
-    flguard.unlock();
-
     if (res < 0)
     {
         return messages::CreateResultWrite(fbb, res, errno);
     }
+    // before another write to the file
+    struct stat st{};
+    const auto stated = fstat(file_ref.fd, &st) == 0;
 
-    return messages::CreateResultWrite(fbb, res, 0);
+    flguard.unlock();
+
+    if (not stated)
+    {
+        return messages::CreateResultWrite(fbb, res, 0);
+    }
+    messages::Stat fbb_stat{};
+    copy(st, fbb_stat);
+    return messages::CreateResultWrite(fbb, res, 0, &fbb_stat);
 }
 
 //--------------------------------------------------------------------------
@@ -702,5 +1274,161 @@ flatbuffers::Offset<messages::ResultPreread>
     return messages::CreateResultPreread(fbb, res, 0, fbb_path, msg.offset(), data);
 }
 
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultErrno>
+    Worker::process_fsync(flatbuffers::FlatBufferBuilder& fbb,
+                          const messages::CommandFsync& msg)
+{
+    auto [file_ref, flguard] = get_file_descriptor(msg.file_handle());
+
+    const auto res = msg.datasync() ? fdatasync(file_ref.fd) : fsync(file_ref.fd);
+    log_trace("fd:{} res:{}", file_ref.fd, res);
+
+    if (res < 0)
+    {
+        return messages::CreateResultErrno(fbb, errno);
+    }
+    return messages::CreateResultErrno(fbb, 0);
+}
+
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultErrno>
+    Worker::process_fallocate(flatbuffers::FlatBufferBuilder& fbb,
+                              const messages::CommandFallocate& msg)
+{
+    auto [file_ref, flguard] = get_file_descriptor(msg.file_handle());
+
+    if (file_ref.is_valid())
+    {
+        temporal_ignore(*file_ref.path);
+    }
+
+    const auto res = fallocate(file_ref.fd, msg.mode(), static_cast<off_t>(msg.offset()),
+                               static_cast<off_t>(msg.length()));
+    log_trace("fd:{} res:{}", file_ref.fd, res);
+    if (res < 0)
+    {
+        return messages::CreateResultErrno(fbb, errno);
+    }
+    struct stat st{};
+    const auto stated = fstat(file_ref.fd, &st) == 0;
+
+    flguard.unlock();
+
+    if (not stated)
+    {
+        return messages::CreateResultErrno(fbb, 0);
+    }
+    messages::Stat fbb_stat{};
+    copy(st, fbb_stat);
+    return messages::CreateResultErrno(fbb, 0, &fbb_stat);
+}
+
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultLseek>
+    Worker::process_lseek(flatbuffers::FlatBufferBuilder& fbb,
+                          const messages::CommandLseek& msg)
+{
+    auto [file_ref, flguard] = get_file_descriptor(msg.file_handle());
+
+    const auto res = lseek(file_ref.fd, static_cast<off_t>(msg.offset()), msg.whence());
+    log_trace("fd:{} res:{}", file_ref.fd, res);
+
+    if (res < 0)
+    {
+        return messages::CreateResultLseek(fbb, res, errno);
+    }
+    return messages::CreateResultLseek(fbb, res, 0);
+}
+
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultStatfs>
+    Worker::process_statfs(flatbuffers::FlatBufferBuilder& fbb,
+                           const messages::CommandStatfs& msg)
+{
+    const auto path = map_path(msg.path()->c_str());
+
+    struct statvfs st{};
+    const auto res = statvfs(path.c_str(), &st);
+    log_trace("{} res:{}", path.native(), res);
+
+    if (res < 0)
+    {
+        return messages::CreateResultStatfs(fbb, errno);
+    }
+    return messages::CreateResultStatfs(fbb, 0, st.f_bsize, st.f_frsize, st.f_blocks,
+                                        st.f_bfree, st.f_bavail, st.f_files, st.f_ffree,
+                                        st.f_favail, st.f_namemax);
+}
+
+//--------------------------------------------------------------------------
+
+flatbuffers::Offset<messages::ResultBatch>
+    Worker::process_batch(flatbuffers::FlatBufferBuilder& fbb,
+                          const messages::CommandBatch& msg)
+{
+    std::vector<flatbuffers::Offset<messages::BatchItem>> results{};
+    if (msg.operations() != nullptr)
+    {
+        results.reserve(msg.operations()->size());
+        for (const auto* operation: *msg.operations())
+        {
+            const auto [result, is_failed] = process_operation(fbb, *operation);
+            results.push_back(result);
+            if (is_failed and msg.stop_on_error())
+            {
+                break;
+            }
+        }
+    }
+    log_trace("operations:{}", results.size());
+    return messages::CreateResultBatchDirect(fbb, &results);
+}
+
+//--------------------------------------------------------------------------
+
+std::pair<flatbuffers::Offset<messages::BatchItem>, bool>
+    Worker::process_operation(flatbuffers::FlatBufferBuilder& fbb,
+                              const messages::BatchItem& operation)
+{
+    if (operation.message() == nullptr)
+    {
+        return batch_item(fbb, messages::CreateResultErrno(fbb, EINVAL));
+    }
+
+#define OPERATION(_Msg, func) \
+    case messages::Message::_Msg: \
+        return batch_item(fbb, func(fbb, *operation.message_as_##_Msg()));
+    switch (operation.message_type())
+    {
+        OPERATION(CommandStat, process_stat)
+        OPERATION(CommandReaddir, process_readdir)
+        OPERATION(CommandReadlink, process_readlink)
+        OPERATION(CommandMkdir, process_mkdir)
+        OPERATION(CommandRmdir, process_rmdir)
+        OPERATION(CommandUnlink, process_unlink)
+        OPERATION(CommandSymlink, process_symlink)
+        OPERATION(CommandRename, process_rename)
+        OPERATION(CommandChmod, process_chmod)
+        OPERATION(CommandUtime, process_utime)
+        OPERATION(CommandTruncate, process_truncate)
+        OPERATION(CommandOpen, process_open)
+        OPERATION(CommandClose, process_close)
+        OPERATION(CommandRead, process_read)
+        OPERATION(CommandWrite, process_write)
+        OPERATION(CommandFsync, process_fsync)
+        OPERATION(CommandFallocate, process_fallocate)
+        default:
+            break;
+    }
+#undef OPERATION
+
+    return batch_item(fbb, messages::CreateResultErrno(fbb, ENOTSUP));
+}
+
 //==========================================================================
 } // namespace rewofs::server
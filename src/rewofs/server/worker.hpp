@@ -14,6 +14,8 @@
 #include "rewofs/enablewarnings.hpp"
 
 #include "rewofs/transport.hpp"
+#include "rewofs/server/scanner.hpp"
+#include "rewofs/server/served_tree.hpp"
 #include "rewofs/server/transport.hpp"
 #include "rewofs/server/watcher.hpp"
 
@@ -72,7 +74,9 @@ private:
 class Worker
 {
 public:
-    Worker(server::Transport& transport, TemporalIgnores& temporal_ignores);
+    /// @param excludes directories sent unloaded, loaded by the clients on demand
+    Worker(server::Transport& transport, TemporalIgnores& temporal_ignores,
+           Generation& generation, ServedTree& served_tree, const Excludes& excludes);
 
     void start();
     void stop();
@@ -107,6 +111,13 @@ private:
     flatbuffers::Offset<messages::ResultReadTree>
         process_read_tree(flatbuffers::FlatBufferBuilder& fbb,
                      const messages::CommandReadTree& msg);
+    /// Reply with a sequence of bounded size messages::ResultReadTreeChunk.
+    void stream_tree(const MessageId mid, const messages::CommandReadTree& msg);
+    /// Reply to CommandReadTree.since_generation.
+    void send_tree_changes(const MessageId mid, const ServedTree::Delta& delta);
+    flatbuffers::Offset<messages::ResultReadTreeHashes>
+        process_read_tree_hashes(flatbuffers::FlatBufferBuilder& fbb,
+                                 const messages::CommandReadTreeHashes& msg);
     flatbuffers::Offset<messages::ResultStat>
         process_stat(flatbuffers::FlatBufferBuilder& fbb,
                      const messages::CommandStat& msg);
@@ -155,11 +166,37 @@ private:
     flatbuffers::Offset<messages::ResultPreread>
         process_preread(flatbuffers::FlatBufferBuilder& fbb,
                         const messages::CommandPreread& msg);
+    flatbuffers::Offset<messages::ResultErrno>
+        process_fsync(flatbuffers::FlatBufferBuilder& fbb,
+                      const messages::CommandFsync& msg);
+    flatbuffers::Offset<messages::ResultErrno>
+        process_fallocate(flatbuffers::FlatBufferBuilder& fbb,
+                          const messages::CommandFallocate& msg);
+    flatbuffers::Offset<messages::ResultLseek>
+        process_lseek(flatbuffers::FlatBufferBuilder& fbb,
+                      const messages::CommandLseek& msg);
+    flatbuffers::Offset<messages::ResultStatfs>
+        process_statfs(flatbuffers::FlatBufferBuilder& fbb,
+                       const messages::CommandStatfs& msg);
+    flatbuffers::Offset<messages::ResultBatch>
+        process_batch(flatbuffers::FlatBufferBuilder& fbb,
+                      const messages::CommandBatch& msg);
+    /// A single operation of CommandBatch.
+    /// @return the result and true if the operation failed
+    std::pair<flatbuffers::Offset<messages::BatchItem>, bool>
+        process_operation(flatbuffers::FlatBufferBuilder& fbb,
+                          const messages::BatchItem& operation);
 
     std::pair<FileRef, std::unique_lock<std::mutex>> get_file_descriptor(const uint64_t fh);
 
     Transport& m_transport;
     TemporalIgnores& m_temporal_ignores;
+    Generation& m_generation;
+    ServedTree& m_served_tree;
+    const Excludes& m_excludes;
+    Scanner m_scanner{0, &m_excludes};
+    /// see messages::Pong
+    std::string m_server_id{};
     std::atomic<bool> m_quit{false};
     BlockingQueue<std::vector<uint8_t>> m_requests_queue{};
     std::thread m_recv_thread{};
@@ -136,12 +136,35 @@ void Deserializer::process_frame(const gsl::span<const uint8_t> raw_frame)
     const auto& frame = *flatbuffers::GetRoot<messages::Frame>(raw_frame.data());
     log_trace("deserializer got mid:{}", frame.id());
 
+    const auto now = std::chrono::steady_clock::now();
     std::unique_lock lg{m_mutex};
-    m_items.emplace(std::make_pair(
-        frame.id(), Item{std::chrono::steady_clock::now(),
-                         {raw_frame.data(), raw_frame.data() + raw_frame.size()}}));
+    drop_stale(now);
+    m_items[MessageId{frame.id()}].push_back(
+        Item{now, {raw_frame.data(), raw_frame.data() + raw_frame.size()}});
     m_cv.notify_all();
 }
 
+//--------------------------------------------------------------------------
+
+void Deserializer::drop_stale(const std::chrono::steady_clock::time_point now)
+{
+    // a scan now and then is enough
+    if (now - m_last_drop < std::chrono::seconds{10})
+    {
+        return;
+    }
+    m_last_drop = now;
+
+    for (auto it = m_items.begin(); it != m_items.end();)
+    {
+        auto& frames = it->second;
+        while (not frames.empty() and (now - frames.front().m_arrival > MAX_AGE))
+        {
+            frames.pop_front();
+        }
+        it = frames.empty() ? m_items.erase(it) : std::next(it);
+    }
+}
+
 //==========================================================================
 } // namespace rewofs
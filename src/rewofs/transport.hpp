@@ -8,6 +8,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <list>
 #include <mutex>
@@ -180,7 +181,8 @@ void Distributor::subscribe(std::function<void(const MessageId, const _Msg&)> ca
 
 //==========================================================================
 
-/// Wait for replies with a particular message ID.
+/// Wait for replies with a particular message ID. A reply may consist of more frames
+/// with the same ID (a stream), they are consumed in the arrival order.
 class Deserializer : private boost::noncopyable
 {
 public:
@@ -200,15 +202,23 @@ public:
                                  const std::chrono::milliseconds timeout);
 
 private:
+    /// frames nobody waited for (late replies, notifications) are dropped after
+    static constexpr std::chrono::minutes MAX_AGE{5};
+
     struct Item
     {
         std::chrono::steady_clock::time_point m_arrival{};
         std::vector<uint8_t> m_data{};
     };
 
+    /// Drop frames older than MAX_AGE.
+    void drop_stale(const std::chrono::steady_clock::time_point now);
+
     mutable std::mutex m_mutex{};
     std::condition_variable m_cv{};
-    std::unordered_map<MessageId, Item> m_items{};
+    /// frames of the same message ID ordered by arrival
+    std::unordered_map<MessageId, std::deque<Item>> m_items{};
+    std::chrono::steady_clock::time_point m_last_drop{};
 };
 
 //--------------------------------------------------------------------------
@@ -278,12 +288,17 @@ Deserializer::Result<_Msg>
         const auto it = m_items.find(mid);
         if (it != m_items.end())
         {
+            auto& item = it->second.front();
             const auto frame
-                = deserialize_and_match({it->second.m_data.data(), it->second.m_data.size()});
+                = deserialize_and_match({item.m_data.data(), item.m_data.size()});
             if (frame != nullptr)
             {
-                auto raw_frame = std::move(it->second.m_data);
-                m_items.erase(it);
+                auto raw_frame = std::move(item.m_data);
+                it->second.pop_front();
+                if (it->second.empty())
+                {
+                    m_items.erase(it);
+                }
                 return Result<_Msg>{std::move(raw_frame)};
             }
         }
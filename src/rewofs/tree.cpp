@@ -0,0 +1,1039 @@
+/// @copydoc tree.hpp
+///
+/// @file
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "rewofs/hash.hpp"
+#include "rewofs/tree.hpp"
+
+//==========================================================================
+namespace rewofs {
+//==========================================================================
+
+static constexpr uint64_t ROOT_PATH_HASH{0x5bd1e9955bd1e995ull};
+
+//--------------------------------------------------------------------------
+
+static bool path_has_prefix(const Tree::Path& path, const Tree::Path& prefix)
+{
+    auto pair = std::mismatch(path.begin(), path.end(), prefix.begin(), prefix.end());
+    return pair.second == prefix.end();
+}
+
+//--------------------------------------------------------------------------
+
+/// Copy on write. Make the object exclusively owned by `ptr`.
+template<typename _T>
+static _T& detach(std::shared_ptr<_T>& ptr)
+{
+    // Only the writer copies the pointers, other owners can just drop them.
+    if (ptr.use_count() > 1)
+    {
+        ptr = std::make_shared<_T>(*ptr);
+    }
+    else
+    {
+        // pairs with the release of the last dropped copy, its reads are done
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *ptr;
+}
+
+//==========================================================================
+
+void copy(const struct stat& src, Stat& dst)
+{
+    dst.st_mode = src.st_mode;
+    dst.st_size = src.st_size;
+    dst.st_mtim = src.st_mtim;
+    dst.st_ctim = src.st_ctim;
+}
+
+//--------------------------------------------------------------------------
+
+void copy(const Stat& src, struct stat& dst)
+{
+    dst = {};
+    dst.st_mode = src.st_mode;
+    dst.st_size = src.st_size;
+    dst.st_mtim = src.st_mtim;
+    dst.st_ctim = src.st_ctim;
+}
+
+//--------------------------------------------------------------------------
+
+bool is_same_content(const Stat& st1, const Stat& st2)
+{
+    const auto same_time = [](const timespec& t1, const timespec& t2) {
+        return (t1.tv_sec == t2.tv_sec) and (t1.tv_nsec == t2.tv_nsec);
+    };
+    return ((st1.st_mode & S_IFMT) == (st2.st_mode & S_IFMT))
+           and (st1.st_size == st2.st_size) and same_time(st1.st_mtim, st2.st_mtim)
+           and same_time(st1.st_ctim, st2.st_ctim);
+}
+
+//==========================================================================
+
+NamePool::Name NamePool::intern(const std::string_view name)
+{
+    if (name.size() > std::numeric_limits<uint8_t>::max())
+    {
+        throw std::system_error{ENAMETOOLONG, std::generic_category()};
+    }
+
+    if ((m_count + 1) * 10 > m_index.size() * 7)
+    {
+        grow_index();
+    }
+
+    const auto mask = m_index.size() - 1;
+    auto slot = std::hash<std::string_view>{}(name) & mask;
+    while (m_index[slot] != nullptr)
+    {
+        if (view(m_index[slot]) == name)
+        {
+            return m_index[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    const auto stored = store(name);
+    m_index[slot] = stored;
+    ++m_count;
+    return stored;
+}
+
+//--------------------------------------------------------------------------
+
+std::string_view NamePool::view(const Name name)
+{
+    assert(name != nullptr);
+    return {name + 1, static_cast<uint8_t>(name[0])};
+}
+
+//--------------------------------------------------------------------------
+
+size_t NamePool::size() const
+{
+    return m_count;
+}
+
+//--------------------------------------------------------------------------
+
+size_t NamePool::memory_usage() const
+{
+    return m_chunks.size() * CHUNK_SIZE + m_index.size() * sizeof(Name);
+}
+
+//--------------------------------------------------------------------------
+
+NamePool::Name NamePool::store(const std::string_view name)
+{
+    const auto needed = name.size() + 1;
+    if (needed > m_chunk_free)
+    {
+        m_chunks.emplace_back(std::make_unique<char[]>(CHUNK_SIZE));
+        m_chunk_free = CHUNK_SIZE;
+    }
+
+    char* dst = m_chunks.back().get() + (CHUNK_SIZE - m_chunk_free);
+    dst[0] = static_cast<char>(name.size());
+    std::copy(name.begin(), name.end(), dst + 1);
+    m_chunk_free -= needed;
+    return dst;
+}
+
+//--------------------------------------------------------------------------
+
+void NamePool::grow_index()
+{
+    std::vector<Name> old_index{std::max<size_t>(1024, m_index.size() * 2), nullptr};
+    std::swap(old_index, m_index);
+
+    const auto mask = m_index.size() - 1;
+    for (const auto name: old_index)
+    {
+        if (name != nullptr)
+        {
+            auto slot = std::hash<std::string_view>{}(view(name)) & mask;
+            while (m_index[slot] != nullptr)
+            {
+                slot = (slot + 1) & mask;
+            }
+            m_index[slot] = name;
+        }
+    }
+}
+
+//==========================================================================
+
+Tree::Tree()
+{
+    reset();
+}
+
+//--------------------------------------------------------------------------
+
+Node& Tree::get_root()
+{
+    return mutable_node(m_root);
+}
+
+//--------------------------------------------------------------------------
+
+const Node& Tree::get_root() const
+{
+    return node(m_root);
+}
+
+//--------------------------------------------------------------------------
+
+Node& Tree::make_node(Node& parent, const std::string_view name)
+{
+    assert(find_child(parent, name) == INVALID_NODE);
+    const auto interned = m_names->intern(name);
+    const auto id = allocate();
+    auto& new_node = mutable_node(id);
+    new_node.name = interned;
+    new_node.parent = parent.id;
+    new_node.path_hash = path_hash(parent.path_hash, name);
+    insert_child(parent, id);
+    index_insert(id);
+    return new_node;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::reset()
+{
+    m_names = std::make_shared<NamePool>();
+    m_chunks.clear();
+    m_free.clear();
+    m_size = 0;
+    m_index.clear();
+    m_index_size = 0;
+
+    m_root = allocate();
+    auto& root = mutable_node(m_root);
+    root.name = m_names->intern(".");
+    root.path_hash = ROOT_PATH_HASH;
+    // directory with read permissions
+    root.st.st_mode = 040444;
+    index_insert(m_root);
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::remove_single(const Path& path)
+{
+    if (path == "/")
+    {
+        throw std::system_error{EACCES, std::generic_category()};
+    }
+    auto& parent_node = get_node(path.parent_path());
+    const auto id = find_child(parent_node, path.filename().native());
+    if (id == INVALID_NODE)
+    {
+        throw std::system_error{ENOENT, std::generic_category()};
+    }
+    if (children_count(node(id)) > 0)
+    {
+        throw std::system_error{ENOTEMPTY, std::generic_category()};
+    }
+    erase_child(parent_node, path.filename().native());
+    index_erase(id);
+    release(id);
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::remove(const Path& path)
+{
+    if (path == "/")
+    {
+        throw std::system_error{EACCES, std::generic_category()};
+    }
+    auto& parent_node = get_node(path.parent_path());
+    const auto id = find_child(parent_node, path.filename().native());
+    if (id == INVALID_NODE)
+    {
+        throw std::system_error{ENOENT, std::generic_category()};
+    }
+
+    std::vector<NodeId> removed{id};
+    for_each_descendant(id, [&removed](const NodeId descendant) {
+        removed.push_back(descendant);
+    });
+    erase_child(parent_node, path.filename().native());
+    // the index needs the whole chain of parents
+    for (const auto removed_id: removed)
+    {
+        index_erase(removed_id);
+    }
+    for (const auto removed_id: removed)
+    {
+        release(removed_id);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+Node& Tree::make_node(const Path& path)
+{
+    if (path == "/")
+    {
+        throw std::system_error{EEXIST, std::generic_category()};
+    }
+    auto& parent_node = get_node(path.parent_path());
+    if (find_child(parent_node, path.filename().native()) != INVALID_NODE)
+    {
+        throw std::system_error{EEXIST, std::generic_category()};
+    }
+    return make_node(parent_node, path.filename().native());
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::rename(const Path& from, const Path& to)
+{
+    if ((from == "/") or (to == "/"))
+    {
+        throw std::system_error{EEXIST, std::generic_category()};
+    }
+
+    auto& parent_from = get_node(from.parent_path());
+    const auto id = find_child(parent_from, from.filename().native());
+    if (id == INVALID_NODE)
+    {
+        throw std::system_error{ENOENT, std::generic_category()};
+    }
+
+    auto& parent_to = get_node(to.parent_path());
+    if (find_child(parent_to, to.filename().native()) != INVALID_NODE)
+    {
+        throw std::system_error{EEXIST, std::generic_category()};
+    }
+    // a directory can't become its own descendant
+    if (path_has_prefix(to, from))
+    {
+        throw std::system_error{EINVAL, std::generic_category()};
+    }
+
+    const auto new_name = m_names->intern(to.filename().native());
+    auto& moved = mutable_node(id);
+    unindex_descendants(id);
+    index_erase(id);
+    erase_child(parent_from, from.filename().native());
+    moved.name = new_name;
+    moved.parent = parent_to.id;
+    moved.path_hash = path_hash(parent_to.path_hash, get_name(moved));
+    insert_child(parent_to, id);
+    index_insert(id);
+    index_descendants(id);
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::exchange(const Path& path1, const Path& path2)
+{
+    if (path_has_prefix(path1, path2) or path_has_prefix(path2, path1))
+    {
+        throw std::system_error{EINVAL, std::generic_category()};
+    }
+
+    auto& node1 = get_node(path1);
+    auto& node2 = get_node(path2);
+
+    unindex_descendants(node1.id);
+    unindex_descendants(node2.id);
+    std::swap(node1.st, node2.st);
+    std::swap(node1.children, node2.children);
+    std::swap(node1.hash, node2.hash);
+    std::swap(node1.unloaded, node2.unloaded);
+    for (auto* parent: {&node1, &node2})
+    {
+        if (parent->children)
+        {
+            for (const auto child_id: parent->children->slots)
+            {
+                if (child_id != INVALID_NODE)
+                {
+                    mutable_node(child_id).parent = parent->id;
+                }
+            }
+        }
+    }
+    index_descendants(node1.id);
+    index_descendants(node2.id);
+}
+
+//--------------------------------------------------------------------------
+
+Node& Tree::get_node(const Path& path)
+{
+    assert((path.native().size() > 0) and (path.native()[0] == '/'));
+    const auto id = lookup(path.native());
+    if (id == INVALID_NODE)
+    {
+        throw std::system_error{ENOENT, std::generic_category()};
+    }
+    return mutable_node(id);
+}
+
+//--------------------------------------------------------------------------
+
+const Node& Tree::get_node(const Path& path) const
+{
+    assert((path.native().size() > 0) and (path.native()[0] == '/'));
+    const auto id = lookup(path.native());
+    if (id == INVALID_NODE)
+    {
+        throw std::system_error{ENOENT, std::generic_category()};
+    }
+    return node(id);
+}
+
+//--------------------------------------------------------------------------
+
+bool Tree::exists(const Path& path) const
+{
+    return lookup(path.native()) != INVALID_NODE;
+}
+
+//--------------------------------------------------------------------------
+
+bool Tree::has_child(const Node& parent, const std::string_view name) const
+{
+    return find_child(parent, name) != INVALID_NODE;
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<Tree::Path> Tree::unloaded_ancestor(const Path& path) const
+{
+    Path ancestor{"/"};
+    auto id = m_root;
+    for (const auto& component: path.parent_path().relative_path())
+    {
+        if (node(id).unloaded)
+        {
+            return ancestor;
+        }
+        id = find_child(node(id), component.native());
+        if (id == INVALID_NODE)
+        {
+            return std::nullopt;
+        }
+        ancestor /= component;
+    }
+    if (node(id).unloaded)
+    {
+        return ancestor;
+    }
+    return std::nullopt;
+}
+
+//--------------------------------------------------------------------------
+
+std::string_view Tree::get_name(const Node& node)
+{
+    return NamePool::view(node.name);
+}
+
+//--------------------------------------------------------------------------
+
+size_t Tree::children_count(const Node& node)
+{
+    return node.children ? node.children->count : 0;
+}
+
+//--------------------------------------------------------------------------
+
+size_t Tree::size() const
+{
+    return m_size;
+}
+
+//--------------------------------------------------------------------------
+
+const NamePool& Tree::get_names() const
+{
+    return *m_names;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::compact_names()
+{
+    // amortized, the names are copied after at least as many were dropped
+    if (m_names->size() <= std::max(MIN_COMPACTED_NAMES, 2 * m_size))
+    {
+        return;
+    }
+
+    auto names = std::make_shared<NamePool>();
+    const auto move_name = [this, &names](const NodeId id) {
+        auto& moved = mutable_node(id);
+        moved.name = names->intern(get_name(moved));
+    };
+    move_name(m_root);
+    for_each_descendant(m_root, move_name);
+    m_names = std::move(names);
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Tree::path_hash(const std::string_view path)
+{
+    uint64_t hash{ROOT_PATH_HASH};
+    size_t pos{0};
+    while (pos < path.size())
+    {
+        const auto end = std::min(path.find('/', pos), path.size());
+        if (end > pos)
+        {
+            hash = path_hash(hash, path.substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+    return hash;
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Tree::path_hash(const uint64_t parent_hash, const std::string_view name)
+{
+    return hash_bytes(name, parent_hash);
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Tree::entry_hash(const std::string_view name, const Node& node)
+{
+    const std::array<uint64_t, 7> fields{
+        static_cast<uint64_t>(node.st.st_mode),
+        static_cast<uint64_t>(node.st.st_size),
+        static_cast<uint64_t>(node.st.st_mtim.tv_sec),
+        static_cast<uint64_t>(node.st.st_mtim.tv_nsec),
+        static_cast<uint64_t>(node.st.st_ctim.tv_sec),
+        static_cast<uint64_t>(node.st.st_ctim.tv_nsec),
+        S_ISDIR(node.st.st_mode) ? node.hash : 0};
+    return hash_bytes(name, hash_bytes(fields.data(), sizeof(fields)));
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::rehash_subtree(const Path& directory)
+{
+    const auto root = get_node(directory).id;
+    std::vector<NodeId> directories{root};
+    for_each_descendant(root, [this, &directories](const NodeId id) {
+        if (S_ISDIR(node(id).st.st_mode))
+        {
+            directories.push_back(id);
+        }
+    });
+    // reversed pre-order, children go before their parents
+    for (auto it = directories.rbegin(); it != directories.rend(); ++it)
+    {
+        const auto& dir = node(*it);
+        if (not S_ISDIR(dir.st.st_mode) or dir.unloaded)
+        {
+            continue;
+        }
+        const auto hash = children_hash(dir);
+        if (dir.hash != hash)
+        {
+            mutable_node(*it).hash = hash;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::rehash_ancestors(const std::vector<Path>& directories)
+{
+    std::vector<NodeId> ids{};
+    ids.reserve(directories.size());
+    for (const auto& path: directories)
+    {
+        ids.push_back(path.empty() ? INVALID_NODE : lookup(path.native()));
+    }
+    rehash_ancestors(ids);
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::rehash_ancestors(const std::vector<NodeId>& directories)
+{
+    // each directory once, the deepest first
+    std::unordered_map<NodeId, size_t> depths{};
+    for (auto id: directories)
+    {
+        size_t depth{0};
+        std::vector<NodeId> chain{};
+        for (; id != INVALID_NODE; id = node(id).parent)
+        {
+            const auto known = depths.find(id);
+            if (known != depths.end())
+            {
+                depth = known->second + 1;
+                break;
+            }
+            chain.push_back(id);
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+        {
+            depths.emplace(*it, depth++);
+        }
+    }
+
+    std::vector<std::pair<NodeId, size_t>> order(depths.begin(), depths.end());
+    std::sort(order.begin(), order.end(),
+              [](const auto& a, const auto& b) { return a.second > b.second; });
+    for (const auto& item: order)
+    {
+        const auto& dir = node(item.first);
+        if (not S_ISDIR(dir.st.st_mode) or dir.unloaded)
+        {
+            continue;
+        }
+        const auto hash = children_hash(dir);
+        if (dir.hash != hash)
+        {
+            mutable_node(item.first).hash = hash;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+const Node& Tree::node(const NodeId id) const
+{
+    assert((id >> CHUNK_BITS) < m_chunks.size());
+    return (*m_chunks[id >> CHUNK_BITS])[id & (CHUNK_NODES - 1)];
+}
+
+//--------------------------------------------------------------------------
+
+Node& Tree::mutable_node(const NodeId id)
+{
+    assert((id >> CHUNK_BITS) < m_chunks.size());
+    return detach(m_chunks[id >> CHUNK_BITS])[id & (CHUNK_NODES - 1)];
+}
+
+//--------------------------------------------------------------------------
+
+NodeId Tree::allocate()
+{
+    if (not m_free.empty())
+    {
+        const auto id = m_free.back();
+        m_free.pop_back();
+        ++m_size;
+        mutable_node(id).id = id;
+        return id;
+    }
+
+    if (m_size >= INVALID_NODE)
+    {
+        throw std::system_error{ENOSPC, std::generic_category()};
+    }
+    const auto id = static_cast<NodeId>(m_size);
+    if ((id >> CHUNK_BITS) >= m_chunks.size())
+    {
+        m_chunks.emplace_back(std::make_shared<Chunk>());
+    }
+    ++m_size;
+    mutable_node(id).id = id;
+    return id;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::release(const NodeId id)
+{
+    mutable_node(id) = Node{};
+    m_free.push_back(id);
+    --m_size;
+}
+
+//--------------------------------------------------------------------------
+
+NodeId Tree::lookup(const std::string_view path) const
+{
+    const auto hash = path_hash(path);
+    const auto mask = m_index_size - 1;
+    for (auto slot = hash & mask; index_slot(slot) != INVALID_NODE;
+         slot = (slot + 1) & mask)
+    {
+        const auto& candidate = node(index_slot(slot));
+        if ((candidate.path_hash == hash) and matches(candidate, path))
+        {
+            return candidate.id;
+        }
+    }
+    return INVALID_NODE;
+}
+
+//--------------------------------------------------------------------------
+
+bool Tree::matches(const Node& candidate, std::string_view path) const
+{
+    // compare the names from the leaf up to the root
+    const Node* current = &candidate;
+    while (true)
+    {
+        while (not path.empty() and (path.back() == '/'))
+        {
+            path.remove_suffix(1);
+        }
+        if (path.empty())
+        {
+            return current->id == m_root;
+        }
+        if (current->id == m_root)
+        {
+            return false;
+        }
+        const auto pos = path.rfind('/');
+        const auto component
+            = (pos == std::string_view::npos) ? path : path.substr(pos + 1);
+        if (component != get_name(*current))
+        {
+            return false;
+        }
+        path.remove_suffix(component.size());
+        current = &node(current->parent);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+template<typename _Func>
+void Tree::for_each_descendant(const NodeId ancestor, _Func&& func) const
+{
+    std::vector<NodeId> stack{};
+    const auto push_children = [this, &stack](const NodeId parent) {
+        const auto& children = node(parent).children;
+        if (children)
+        {
+            std::copy_if(children->slots.begin(), children->slots.end(),
+                         std::back_inserter(stack),
+                         [](const NodeId id) { return id != INVALID_NODE; });
+        }
+    };
+
+    push_children(ancestor);
+    while (not stack.empty())
+    {
+        const auto id = stack.back();
+        stack.pop_back();
+        func(id);
+        push_children(id);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+NodeId Tree::index_slot(const size_t slot) const
+{
+    return (*m_index[slot >> INDEX_SHARD_BITS])[slot & (INDEX_SHARD_SLOTS - 1)];
+}
+
+//--------------------------------------------------------------------------
+
+NodeId& Tree::mutable_index_slot(const size_t slot)
+{
+    return detach(m_index[slot >> INDEX_SHARD_BITS])[slot & (INDEX_SHARD_SLOTS - 1)];
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::index_insert(const NodeId id)
+{
+    if (m_size * 10 > m_index_size * 7)
+    {
+        index_grow();
+    }
+
+    const auto mask = m_index_size - 1;
+    auto slot = node(id).path_hash & mask;
+    while (index_slot(slot) != INVALID_NODE)
+    {
+        slot = (slot + 1) & mask;
+    }
+    mutable_index_slot(slot) = id;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::index_erase(const NodeId id)
+{
+    const auto mask = m_index_size - 1;
+    auto hole = node(id).path_hash & mask;
+    while (index_slot(hole) != id)
+    {
+        assert(index_slot(hole) != INVALID_NODE);
+        hole = (hole + 1) & mask;
+    }
+    mutable_index_slot(hole) = INVALID_NODE;
+
+    // backward shift deletion, keeps probe sequences unbroken
+    for (auto next = (hole + 1) & mask; index_slot(next) != INVALID_NODE;
+         next = (next + 1) & mask)
+    {
+        const auto moved = index_slot(next);
+        const auto home = node(moved).path_hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask))
+        {
+            mutable_index_slot(hole) = moved;
+            mutable_index_slot(next) = INVALID_NODE;
+            hole = next;
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::index_grow()
+{
+    const auto old_size = m_index_size;
+    auto old_index = std::move(m_index);
+
+    m_index_size = std::max(INDEX_SHARD_SLOTS, old_size * 2);
+    m_index.clear();
+    for (size_t i = 0; i < m_index_size / INDEX_SHARD_SLOTS; ++i)
+    {
+        m_index.emplace_back(std::make_shared<IndexShard>())->fill(INVALID_NODE);
+    }
+
+    const auto mask = m_index_size - 1;
+    for (const auto& shard: old_index)
+    {
+        for (const auto id: *shard)
+        {
+            if (id != INVALID_NODE)
+            {
+                auto slot = node(id).path_hash & mask;
+                while (index_slot(slot) != INVALID_NODE)
+                {
+                    slot = (slot + 1) & mask;
+                }
+                mutable_index_slot(slot) = id;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::unindex_descendants(const NodeId ancestor)
+{
+    for_each_descendant(ancestor, [this](const NodeId id) { index_erase(id); });
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::index_descendants(const NodeId ancestor)
+{
+    // pre-order, parents are re-hashed before their children
+    for_each_descendant(ancestor, [this](const NodeId id) {
+        auto& descendant = mutable_node(id);
+        descendant.path_hash
+            = path_hash(node(descendant.parent).path_hash, get_name(descendant));
+        index_insert(id);
+    });
+}
+
+//--------------------------------------------------------------------------
+
+NodeId Tree::find_child(const Node& parent, const std::string_view name) const
+{
+    if (not parent.children)
+    {
+        return INVALID_NODE;
+    }
+    const auto& set = *parent.children;
+
+    if (set.hashed)
+    {
+        const auto mask = set.slots.size() - 1;
+        for (auto slot = hash_slot(set, name); set.slots[slot] != INVALID_NODE;
+             slot = (slot + 1) & mask)
+        {
+            if (get_name(node(set.slots[slot])) == name)
+            {
+                return set.slots[slot];
+            }
+        }
+        return INVALID_NODE;
+    }
+
+    const auto it = std::lower_bound(
+        set.slots.begin(), set.slots.end(), name,
+        [this](const NodeId id, const std::string_view n) { return get_name(node(id)) < n; });
+    if ((it != set.slots.end()) and (get_name(node(*it)) == name))
+    {
+        return *it;
+    }
+    return INVALID_NODE;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::insert_child(Node& parent, const NodeId child)
+{
+    if (not parent.children)
+    {
+        parent.children = std::make_shared<ChildSet>();
+    }
+    auto& set = detach(parent.children);
+    const auto name = get_name(node(child));
+
+    if ((not set.hashed and (set.count >= ChildSet::HASH_THRESHOLD))
+        or (set.hashed and ((set.count + 1) * 10 > set.slots.size() * 7)))
+    {
+        rebuild_children(set, true);
+    }
+
+    if (set.hashed)
+    {
+        const auto mask = set.slots.size() - 1;
+        auto slot = hash_slot(set, name);
+        while (set.slots[slot] != INVALID_NODE)
+        {
+            slot = (slot + 1) & mask;
+        }
+        set.slots[slot] = child;
+    }
+    else
+    {
+        const auto it = std::lower_bound(set.slots.begin(), set.slots.end(), name,
+                                         [this](const NodeId id, const std::string_view n) {
+                                             return get_name(node(id)) < n;
+                                         });
+        set.slots.insert(it, child);
+    }
+    ++set.count;
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::erase_child(Node& parent, const std::string_view name)
+{
+    assert(parent.children);
+    auto& set = detach(parent.children);
+
+    if (set.hashed)
+    {
+        const auto mask = set.slots.size() - 1;
+        auto hole = hash_slot(set, name);
+        while (get_name(node(set.slots[hole])) != name)
+        {
+            hole = (hole + 1) & mask;
+            assert(set.slots[hole] != INVALID_NODE);
+        }
+        set.slots[hole] = INVALID_NODE;
+
+        // backward shift deletion, keeps probe sequences unbroken
+        for (auto next = (hole + 1) & mask; set.slots[next] != INVALID_NODE;
+             next = (next + 1) & mask)
+        {
+            const auto home = hash_slot(set, get_name(node(set.slots[next])));
+            if (((next - home) & mask) >= ((next - hole) & mask))
+            {
+                set.slots[hole] = set.slots[next];
+                set.slots[next] = INVALID_NODE;
+                hole = next;
+            }
+        }
+    }
+    else
+    {
+        const auto it = std::lower_bound(set.slots.begin(), set.slots.end(), name,
+                                         [this](const NodeId id, const std::string_view n) {
+                                             return get_name(node(id)) < n;
+                                         });
+        assert((it != set.slots.end()) and (get_name(node(*it)) == name));
+        set.slots.erase(it);
+    }
+    --set.count;
+
+    if (set.count == 0)
+    {
+        parent.children.reset();
+    }
+    else if (set.hashed and (set.count < ChildSet::HASH_THRESHOLD / 2))
+    {
+        rebuild_children(set, false);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+size_t Tree::hash_slot(const ChildSet& set, const std::string_view name) const
+{
+    assert(set.hashed);
+    return std::hash<std::string_view>{}(name) & (set.slots.size() - 1);
+}
+
+//--------------------------------------------------------------------------
+
+void Tree::rebuild_children(ChildSet& set, const bool hashed) const
+{
+    std::vector<NodeId> ids{};
+    ids.reserve(set.count);
+    std::copy_if(set.slots.begin(), set.slots.end(), std::back_inserter(ids),
+                 [](const NodeId id) { return id != INVALID_NODE; });
+
+    set.hashed = hashed;
+    if (hashed)
+    {
+        // keep the load factor at most 1/2 after the rebuild
+        size_t capacity{ChildSet::HASH_THRESHOLD * 2};
+        while (capacity < (ids.size() + 1) * 2)
+        {
+            capacity *= 2;
+        }
+        set.slots.assign(capacity, INVALID_NODE);
+        const auto mask = capacity - 1;
+        for (const auto id: ids)
+        {
+            auto slot = hash_slot(set, get_name(node(id)));
+            while (set.slots[slot] != INVALID_NODE)
+            {
+                slot = (slot + 1) & mask;
+            }
+            set.slots[slot] = id;
+        }
+    }
+    else
+    {
+        std::sort(ids.begin(), ids.end(), [this](const NodeId id1, const NodeId id2) {
+            return get_name(node(id1)) < get_name(node(id2));
+        });
+        set.slots = std::move(ids);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Tree::children_hash(const Node& directory) const
+{
+    // a sum does not depend on the order of the children
+    uint64_t sum{0};
+    for_each_child(directory, [&sum](const std::string_view name, const Node& child) {
+        sum += entry_hash(name, child);
+    });
+    return hash_bytes(&sum, sizeof(sum), children_count(directory));
+}
+
+//==========================================================================
+} // namespace rewofs
@@ -0,0 +1,263 @@
+/// Metadata tree shared by the client cache and the server.
+///
+/// @file
+
+#pragma once
+#ifndef TREE_HPP__W4KJ2DQM
+#define TREE_HPP__W4KJ2DQM
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+//==========================================================================
+namespace rewofs {
+//==========================================================================
+
+/// Index of a node in the tree arena.
+using NodeId = uint32_t;
+
+static constexpr NodeId INVALID_NODE{std::numeric_limits<NodeId>::max()};
+/// Node::hash of a directory with unknown content.
+static constexpr uint64_t UNKNOWN_HASH{0};
+
+//==========================================================================
+
+/// Node attributes. Only the fields carried by the protocol (see messages::Stat),
+/// the names follow `struct stat`.
+struct Stat
+{
+    mode_t st_mode{};
+    off_t st_size{};
+    timespec st_mtim{};
+    timespec st_ctim{};
+};
+
+void copy(const struct stat& src, Stat& dst);
+/// Fields not present in Stat are zeroed.
+void copy(const Stat& src, struct stat& dst);
+/// @return true if the content described by the attributes is the same (type,
+/// size, mtime and ctime match)
+bool is_same_content(const Stat& st1, const Stat& st2);
+
+//==========================================================================
+
+/// Append-only storage of unique names. Interned names are never moved nor freed
+/// so the handles stay valid for the whole pool lifetime. Names which are not used
+/// anymore are dropped by replacing the pool (see Tree::compact_names()).
+class NamePool : private boost::noncopyable
+{
+public:
+    /// Points to a length-prefixed name inside the pool.
+    using Name = const char*;
+
+    Name intern(const std::string_view name);
+    static std::string_view view(const Name name);
+    /// Number of interned names.
+    size_t size() const;
+    /// Approximate number of bytes held by the pool.
+    size_t memory_usage() const;
+
+private:
+    static constexpr size_t CHUNK_SIZE{64 * 1024};
+
+    Name store(const std::string_view name);
+    void grow_index();
+
+    std::vector<std::unique_ptr<char[]>> m_chunks{};
+    size_t m_chunk_free{0};
+    /// open addressing table of interned names
+    std::vector<Name> m_index{};
+    size_t m_count{0};
+};
+
+//==========================================================================
+
+/// Children of a directory. Small directories keep node IDs sorted by name,
+/// directories with a large fan-out switch to an open addressing hash table.
+struct ChildSet
+{
+    static constexpr size_t HASH_THRESHOLD{64};
+
+    bool hashed{false};
+    uint32_t count{0};
+    /// sorted IDs or hash table slots (INVALID_NODE marks an empty slot)
+    std::vector<NodeId> slots{};
+};
+
+//--------------------------------------------------------------------------
+
+struct Node
+{
+    Stat st{};
+    /// see Tree::path_hash()
+    uint64_t path_hash{};
+    /// Directories only, hash of the children (see Tree::rehash_subtree()). An
+    /// unloaded directory holds the hash reported by the server (UNKNOWN_HASH if
+    /// none), its children are not known.
+    uint64_t hash{};
+    NamePool::Name name{nullptr};
+    /// Not allocated for files and empty directories. Shared with older tree
+    /// versions, copied on write.
+    std::shared_ptr<ChildSet> children{};
+    NodeId id{INVALID_NODE};
+    NodeId parent{INVALID_NODE};
+    /// directory with the children not fetched yet
+    bool unloaded{false};
+};
+
+//==========================================================================
+
+/// Metadata tree. Nodes live in an arena of fixed size chunks so the references
+/// stay valid until the node is removed. Full paths are indexed by their hash so
+/// a lookup does not walk the path components.
+///
+/// A copy shares the storage with the original, the chunks (nodes, children
+/// sets, index) are duplicated only when modified. An unmodified copy is an
+/// immutable snapshot which can be read concurrently with the original being
+/// changed. References obtained from a tree are invalidated by modifications
+/// made after the tree was copied.
+class Tree
+{
+public:
+    using Path = boost::filesystem::path;
+
+    Tree();
+
+    /// Drop the whole tree.
+    void reset();
+
+    Node& get_root();
+    const Node& get_root() const;
+    Node& make_node(Node& parent, const std::string_view name);
+    Node& get_node(const Path& name);
+    const Node& get_node(const Path& name) const;
+    /// Remove a node only if it has no children.
+    void remove_single(const Path& path);
+    /// Remove a node including all its descendants.
+    void remove(const Path& path);
+    Node& make_node(const Path& path);
+    bool exists(const Path& path) const;
+    /// Fails if `to` exists.
+    void rename(const Path& from, const Path& to);
+    void exchange(const Path& node1, const Path& node2);
+
+    bool has_child(const Node& parent, const std::string_view name) const;
+    /// @return the nearest unloaded directory among the path ancestors, nullopt if
+    ///         all present ancestors are loaded
+    std::optional<Path> unloaded_ancestor(const Path& path) const;
+    static std::string_view get_name(const Node& node);
+    static size_t children_count(const Node& node);
+    /// Call `func(name, child)` for all direct children.
+    template<typename _Func>
+    void for_each_child(const Node& parent, _Func&& func) const;
+    /// Number of nodes including the root.
+    size_t size() const;
+    const NamePool& get_names() const;
+    /// Move the names of the present nodes to a new pool if the names of removed and
+    /// renamed nodes took over the current one. Other copies of the tree keep the
+    /// old pool. References to the nodes are invalidated.
+    void compact_names();
+
+    /// Hash of a normalized path, chained over its components.
+    static uint64_t path_hash(const std::string_view path);
+    static uint64_t path_hash(const uint64_t parent_hash, const std::string_view name);
+
+    /// Hash of a directory entry: the name, the attributes and Node::hash of
+    /// a directory. Two directories with the same Node::hash have the same content
+    /// down to the leaves (Merkle tree).
+    static uint64_t entry_hash(const std::string_view name, const Node& node);
+    /// Recompute Node::hash of the directory and all its descendant directories.
+    /// Unloaded directories keep their Node::hash. Does not update the ancestors.
+    void rehash_subtree(const Path& directory);
+    /// Recompute Node::hash of the directories whose children changed and of all
+    /// their ancestors. Missing paths are skipped.
+    void rehash_ancestors(const std::vector<Path>& directories);
+    /// @copydoc rehash_ancestors(const std::vector<Path>&)
+    /// Removed nodes and nodes other than directories are skipped.
+    void rehash_ancestors(const std::vector<NodeId>& directories);
+
+private:
+    /// smaller chunks are cheaper to copy on write
+    static constexpr size_t CHUNK_BITS{10};
+    static constexpr size_t CHUNK_NODES{1u << CHUNK_BITS};
+    using Chunk = std::array<Node, CHUNK_NODES>;
+    static constexpr size_t INDEX_SHARD_BITS{12};
+    static constexpr size_t INDEX_SHARD_SLOTS{1u << INDEX_SHARD_BITS};
+    using IndexShard = std::array<NodeId, INDEX_SHARD_SLOTS>;
+    /// the pool is not compacted below this number of names
+    static constexpr size_t MIN_COMPACTED_NAMES{4096};
+
+    const Node& node(const NodeId id) const;
+    /// Node exclusively owned by this tree.
+    Node& mutable_node(const NodeId id);
+    NodeId allocate();
+    void release(const NodeId id);
+    NodeId lookup(const std::string_view path) const;
+    bool matches(const Node& candidate, std::string_view path) const;
+    /// Call `func(id)` in pre-order.
+    template<typename _Func>
+    void for_each_descendant(const NodeId ancestor, _Func&& func) const;
+
+    NodeId index_slot(const size_t slot) const;
+    NodeId& mutable_index_slot(const size_t slot);
+    void index_insert(const NodeId id);
+    void index_erase(const NodeId id);
+    void index_grow();
+    /// Drop all descendants from the path index.
+    void unindex_descendants(const NodeId ancestor);
+    /// Recompute path hashes of all descendants (after a subtree move) and index them.
+    void index_descendants(const NodeId ancestor);
+
+    NodeId find_child(const Node& parent, const std::string_view name) const;
+    void insert_child(Node& parent, const NodeId child);
+    void erase_child(Node& parent, const std::string_view name);
+    size_t hash_slot(const ChildSet& set, const std::string_view name) const;
+    void rebuild_children(ChildSet& set, const bool hashed) const;
+    uint64_t children_hash(const Node& directory) const;
+
+    /// append-only, shared by all copies until compacted
+    std::shared_ptr<NamePool> m_names{};
+    std::vector<std::shared_ptr<Chunk>> m_chunks{};
+    std::vector<NodeId> m_free{};
+    size_t m_size{0};
+    NodeId m_root{INVALID_NODE};
+    /// open addressing table of node IDs keyed by Node::path_hash, split to shards
+    std::vector<std::shared_ptr<IndexShard>> m_index{};
+    size_t m_index_size{0};
+};
+
+//--------------------------------------------------------------------------
+
+template<typename _Func>
+void Tree::for_each_child(const Node& parent, _Func&& func) const
+{
+    if (not parent.children)
+    {
+        return;
+    }
+    for (const auto id: parent.children->slots)
+    {
+        if (id != INVALID_NODE)
+        {
+            const auto& child = node(id);
+            func(get_name(child), child);
+        }
+    }
+}
+
+//==========================================================================
+} // namespace rewofs
+
+#endif /* include guard */
@@ -0,0 +1,272 @@
+/// @copydoc tree_codec.hpp
+///
+/// @file
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <limits>
+#include <system_error>
+
+#include "rewofs/tree_codec.hpp"
+
+//==========================================================================
+namespace rewofs::tree_codec {
+//==========================================================================
+
+namespace {
+
+constexpr uint64_t VERSION{1};
+
+//--------------------------------------------------------------------------
+
+void put_varint(std::vector<uint8_t>& output, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        output.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    output.push_back(static_cast<uint8_t>(value));
+}
+
+//--------------------------------------------------------------------------
+
+/// Small negative numbers are encoded as small unsigned ones.
+void put_zigzag(std::vector<uint8_t>& output, const int64_t value)
+{
+    put_varint(output, (static_cast<uint64_t>(value) << 1)
+                           ^ static_cast<uint64_t>(value >> 63));
+}
+
+//--------------------------------------------------------------------------
+
+[[noreturn]] void malformed()
+{
+    throw std::system_error{EPROTO, std::generic_category()};
+}
+
+} // namespace
+
+//==========================================================================
+
+void Encoder::add(const Entry& entry)
+{
+    const auto limit = std::min(entry.name.size(), m_previous_name.size());
+    size_t shared{0};
+    while ((shared < limit) and (entry.name[shared] == m_previous_name[shared]))
+    {
+        ++shared;
+    }
+    put_varint(m_names, shared);
+    put_varint(m_names, entry.name.size() - shared);
+    m_names.insert(m_names.end(), entry.name.begin() + shared, entry.name.end());
+    m_previous_name.assign(entry.name);
+
+    put_varint(m_modes, (uint64_t{entry.st_mode} << 1) | (entry.unloaded ? 1 : 0));
+    put_zigzag(m_sizes, entry.st_size - m_previous_size);
+    m_previous_size = entry.st_size;
+    put_zigzag(m_mtimes, entry.st_mtim.tv_sec - m_previous_mtime);
+    m_previous_mtime = entry.st_mtim.tv_sec;
+    put_varint(m_mtime_nsecs, static_cast<uint64_t>(entry.st_mtim.tv_nsec));
+    // usually the same as mtime
+    put_zigzag(m_ctimes, entry.st_ctim.tv_sec - entry.st_mtim.tv_sec);
+    put_zigzag(m_ctimes, entry.st_ctim.tv_nsec - entry.st_mtim.tv_nsec);
+
+    ++m_directory_entries;
+    ++m_entries;
+}
+
+//--------------------------------------------------------------------------
+
+void Encoder::end_directory(const bool continued)
+{
+    put_varint(m_listings, (uint64_t{m_directory_entries} << 1) | (continued ? 1 : 0));
+    m_directory_entries = 0;
+    ++m_directories;
+}
+
+//--------------------------------------------------------------------------
+
+size_t Encoder::size() const
+{
+    return m_directories + m_entries;
+}
+
+//--------------------------------------------------------------------------
+
+std::vector<uint8_t> Encoder::finish()
+{
+    if (m_directory_entries > 0)
+    {
+        end_directory(false);
+    }
+
+    const std::array<std::vector<uint8_t>*, 7> columns{
+        {&m_listings, &m_names, &m_modes, &m_sizes, &m_mtimes, &m_mtime_nsecs,
+         &m_ctimes}};
+    std::vector<uint8_t> output{};
+    put_varint(output, VERSION);
+    put_varint(output, m_directories);
+    put_varint(output, m_entries);
+    for (const auto* const column: columns)
+    {
+        put_varint(output, column->size());
+    }
+    for (auto* const column: columns)
+    {
+        output.insert(output.end(), column->begin(), column->end());
+        column->clear();
+    }
+
+    m_directories = 0;
+    m_entries = 0;
+    m_previous_name.clear();
+    m_previous_size = 0;
+    m_previous_mtime = 0;
+    return output;
+}
+
+//==========================================================================
+
+Decoder::Column::Column(const uint8_t* const begin, const uint8_t* const end)
+    : m_data{begin}
+    , m_end{end}
+{
+}
+
+//--------------------------------------------------------------------------
+
+uint64_t Decoder::Column::varint()
+{
+    uint64_t value{0};
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        if (m_data == m_end)
+        {
+            malformed();
+        }
+        const auto byte = *m_data++;
+        value |= uint64_t{byte & 0x7fu} << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    malformed();
+}
+
+//--------------------------------------------------------------------------
+
+int64_t Decoder::Column::zigzag()
+{
+    const auto value = varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+//--------------------------------------------------------------------------
+
+std::string_view Decoder::Column::bytes(const size_t size)
+{
+    if (static_cast<size_t>(m_end - m_data) < size)
+    {
+        malformed();
+    }
+    const std::string_view res{reinterpret_cast<const char*>(m_data), size};
+    m_data += size;
+    return res;
+}
+
+//--------------------------------------------------------------------------
+
+Decoder::Decoder(const gsl::span<const uint8_t> data)
+{
+    Column header{data.data(), data.data() + data.size()};
+    if (header.varint() != VERSION)
+    {
+        malformed();
+    }
+    m_directories = header.varint();
+    header.varint(); // entries, informative
+
+    std::array<Column*, 7> columns{{&m_listings, &m_names, &m_modes, &m_sizes,
+                                    &m_mtimes, &m_mtime_nsecs, &m_ctimes}};
+    std::array<uint64_t, 7> sizes{};
+    for (auto& size: sizes)
+    {
+        size = header.varint();
+    }
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        const auto column = header.bytes(sizes[i]);
+        const auto* const begin = reinterpret_cast<const uint8_t*>(column.data());
+        *columns[i] = Column{begin, begin + column.size()};
+    }
+}
+
+//--------------------------------------------------------------------------
+
+std::optional<Directory> Decoder::next_directory()
+{
+    // skip the rest of the current one
+    while (m_directory_entries > 0)
+    {
+        next_entry();
+    }
+
+    if (m_directories == 0)
+    {
+        if (not m_listings.at_end() or not m_names.at_end() or not m_modes.at_end()
+            or not m_sizes.at_end() or not m_mtimes.at_end()
+            or not m_mtime_nsecs.at_end() or not m_ctimes.at_end())
+        {
+            malformed();
+        }
+        return std::nullopt;
+    }
+    --m_directories;
+
+    const auto listing = m_listings.varint();
+    if ((listing >> 1) > std::numeric_limits<uint32_t>::max())
+    {
+        malformed();
+    }
+    m_directory_entries = static_cast<uint32_t>(listing >> 1);
+    return Directory{m_directory_entries, (listing & 1) != 0};
+}
+
+//--------------------------------------------------------------------------
+
+Entry Decoder::next_entry()
+{
+    if (m_directory_entries == 0)
+    {
+        malformed();
+    }
+    --m_directory_entries;
+
+    Entry entry{};
+    const auto shared = m_names.varint();
+    if (shared > m_name.size())
+    {
+        malformed();
+    }
+    m_name.resize(shared);
+    m_name.append(m_names.bytes(m_names.varint()));
+    entry.name = m_name;
+
+    const auto mode = m_modes.varint();
+    entry.st_mode = static_cast<uint32_t>(mode >> 1);
+    entry.unloaded = (mode & 1) != 0;
+    m_previous_size += m_sizes.zigzag();
+    entry.st_size = m_previous_size;
+    m_previous_mtime += m_mtimes.zigzag();
+    entry.st_mtim.tv_sec = static_cast<time_t>(m_previous_mtime);
+    entry.st_mtim.tv_nsec = static_cast<long>(m_mtime_nsecs.varint());
+    entry.st_ctim.tv_sec = static_cast<time_t>(m_previous_mtime + m_ctimes.zigzag());
+    entry.st_ctim.tv_nsec = static_cast<long>(entry.st_mtim.tv_nsec + m_ctimes.zigzag());
+    return entry;
+}
+
+//==========================================================================
+} // namespace rewofs::tree_codec
@@ -0,0 +1,130 @@
+/// Compact columnar encoding of streamed tree chunks.
+///
+/// A chunk is a sequence of directory listings in the breadth-first order of
+/// ResultReadTreeChunk. The parent of a listing is implicit, it is the next
+/// listed directory in the order the directories were discovered. Entry
+/// attributes are stored column by column: front coded names, modes, delta coded
+/// sizes and timestamps. All numbers are LEB128 varints.
+///
+/// @file
+
+#pragma once
+#ifndef TREE_CODEC_HPP__J5RCXQ2M
+#define TREE_CODEC_HPP__J5RCXQ2M
+
+#include <cstdint>
+#include <ctime>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gsl/span>
+#include "rewofs/enablewarnings.hpp"
+
+//==========================================================================
+namespace rewofs::tree_codec {
+//==========================================================================
+
+/// Encoded directory entry, the attribute names follow `struct stat`.
+struct Entry
+{
+    std::string_view name{};
+    uint32_t st_mode{};
+    int64_t st_size{};
+    timespec st_mtim{};
+    timespec st_ctim{};
+    /// directory with the children not listed
+    bool unloaded{false};
+};
+
+/// Children list of a directory.
+struct Directory
+{
+    uint32_t entries{};
+    /// more children follow in the next chunk
+    bool continued{false};
+};
+
+//==========================================================================
+
+class Encoder
+{
+public:
+    /// Add an entry to the current directory. Names sorted within a directory
+    /// compress the best.
+    void add(const Entry& entry);
+    /// Close the current directory.
+    void end_directory(const bool continued);
+    /// Number of entries and directories added since the last finish().
+    size_t size() const;
+    /// @return the encoded chunk, the encoder is reset for the next one
+    std::vector<uint8_t> finish();
+
+private:
+    size_t m_directories{0};
+    size_t m_entries{0};
+    uint32_t m_directory_entries{0};
+    std::vector<uint8_t> m_listings{};
+    std::vector<uint8_t> m_names{};
+    std::vector<uint8_t> m_modes{};
+    std::vector<uint8_t> m_sizes{};
+    std::vector<uint8_t> m_mtimes{};
+    std::vector<uint8_t> m_mtime_nsecs{};
+    std::vector<uint8_t> m_ctimes{};
+    std::string m_previous_name{};
+    int64_t m_previous_size{0};
+    int64_t m_previous_mtime{0};
+};
+
+//==========================================================================
+
+/// Reads a chunk made by Encoder. Malformed data throw
+/// `std::system_error{EPROTO}`.
+class Decoder
+{
+public:
+    explicit Decoder(const gsl::span<const uint8_t> data);
+
+    /// @return nullopt after the last directory
+    std::optional<Directory> next_directory();
+    /// Next entry of the current directory. The name is valid until the next call.
+    Entry next_entry();
+
+private:
+    /// Bounds checked reader of a column.
+    class Column
+    {
+    public:
+        Column() = default;
+        Column(const uint8_t* const begin, const uint8_t* const end);
+
+        uint64_t varint();
+        int64_t zigzag();
+        std::string_view bytes(const size_t size);
+        bool at_end() const { return m_data == m_end; }
+
+    private:
+        const uint8_t* m_data{};
+        const uint8_t* m_end{};
+    };
+
+    size_t m_directories{0};
+    uint32_t m_directory_entries{0};
+    Column m_listings{};
+    Column m_names{};
+    Column m_modes{};
+    Column m_sizes{};
+    Column m_mtimes{};
+    Column m_mtime_nsecs{};
+    Column m_ctimes{};
+    std::string m_name{};
+    int64_t m_previous_size{0};
+    int64_t m_previous_mtime{0};
+};
+
+//==========================================================================
+} // namespace rewofs::tree_codec
+
+#endif /* include guard */
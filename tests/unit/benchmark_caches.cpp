@@ -0,0 +1,311 @@
+/// Caches benchmarks. Disabled by default, run them by
+/// `--gtest_also_run_disabled_tests --gtest_filter='*Benchmark*'`.
+///
+/// @file
+
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <malloc.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/cache.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace {
+
+/// Layout of the original std::map based tree node.
+struct LegacyNode
+{
+    std::string name{};
+    struct stat st{};
+    std::map<std::string, LegacyNode> children{};
+};
+
+//--------------------------------------------------------------------------
+
+size_t heap_usage()
+{
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+    return mallinfo2().uordblks;
+#else
+    return static_cast<size_t>(mallinfo().uordblks);
+#endif
+}
+
+//--------------------------------------------------------------------------
+
+/// Directories with a mix of repeated and unique names, similar to a source tree.
+template<typename _AddFunc>
+size_t generate_tree(const size_t dirs, const size_t files_per_dir, _AddFunc add)
+{
+    static const std::array<std::string, 4> COMMON_NAMES{
+        {"CMakeLists.txt", "README.md", "__init__.py", "index.js"}};
+
+    size_t count{0};
+    for (size_t d = 0; d < dirs; ++d)
+    {
+        const auto dir_name = "directory_" + std::to_string(d);
+        add("", dir_name);
+        ++count;
+        for (size_t f = 0; f < files_per_dir; ++f)
+        {
+            const auto file_name = (f < COMMON_NAMES.size())
+                                       ? COMMON_NAMES[f]
+                                       : "source_file_" + std::to_string(d * files_per_dir + f)
+                                             + ".cpp";
+            add(dir_name, file_name);
+            ++count;
+        }
+    }
+    return count;
+}
+
+} // namespace
+
+//==========================================================================
+
+TEST(CacheTreeBenchmark, DISABLED_BytesPerNode)
+{
+    static constexpr size_t DIRS{2000};
+    static constexpr size_t FILES_PER_DIR{100};
+
+    double legacy_bytes{};
+    {
+        const auto before = heap_usage();
+        auto root = std::make_unique<LegacyNode>();
+        const auto count = generate_tree(
+            DIRS, FILES_PER_DIR, [&root](const std::string& dir, const std::string& name) {
+                auto& parent = dir.empty() ? *root : root->children.at(dir);
+                LegacyNode node{};
+                node.name = name;
+                parent.children.emplace(name, std::move(node));
+            });
+        legacy_bytes = static_cast<double>(heap_usage() - before) / static_cast<double>(count);
+    }
+
+    double arena_bytes{};
+    {
+        const auto before = heap_usage();
+        auto tree = std::make_unique<client::cache::Tree>();
+        const auto count = generate_tree(
+            DIRS, FILES_PER_DIR, [&tree](const std::string& dir, const std::string& name) {
+                auto& parent = dir.empty() ? tree->get_root() : tree->get_node("/" + dir);
+                tree->make_node(parent, name);
+            });
+        arena_bytes = static_cast<double>(heap_usage() - before) / static_cast<double>(count);
+    }
+
+    // heap deltas depend on the allocator, reported only
+    std::cout << "bytes per node: legacy " << legacy_bytes << ", arena " << arena_bytes
+              << '\n';
+}
+
+//--------------------------------------------------------------------------
+
+TEST(CacheTreeBenchmark, DISABLED_DeepLookup)
+{
+    static constexpr size_t DEPTH{24};
+    static constexpr size_t FAN_OUT{20};
+    static constexpr size_t LOOKUPS{200000};
+
+    client::cache::Tree tree{};
+    LegacyNode legacy_root{};
+    std::vector<client::cache::Path> paths{};
+
+    // a chain of directories, each level has some siblings
+    client::cache::Path dir{"/"};
+    auto* parent = &tree.get_root();
+    auto* legacy_parent = &legacy_root;
+    for (size_t level = 0; level < DEPTH; ++level)
+    {
+        for (size_t i = 0; i < FAN_OUT; ++i)
+        {
+            const auto name = "entry_" + std::to_string(i);
+            tree.make_node(*parent, name);
+            legacy_parent->children[name].name = name;
+            paths.push_back(dir / name);
+        }
+        const auto name = "level_" + std::to_string(level);
+        parent = &tree.make_node(*parent, name);
+        legacy_parent = &legacy_parent->children[name];
+        legacy_parent->name = name;
+        dir /= name;
+    }
+    // only the deepest ones
+    paths.erase(paths.begin(), paths.end() - static_cast<ptrdiff_t>(4 * FAN_OUT));
+
+    const auto measure = [&paths](auto lookup) {
+        const auto start = std::chrono::steady_clock::now();
+        size_t found{0};
+        for (size_t i = 0; i < LOOKUPS; ++i)
+        {
+            found += lookup(paths[i % paths.size()]);
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_EQ(found, LOOKUPS);
+        return static_cast<double>(
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
+               / LOOKUPS;
+    };
+
+    const auto walk_ns = measure([&legacy_root](const client::cache::Path& path) {
+        const LegacyNode* node = &legacy_root;
+        auto it = path.begin();
+        for (++it; it != path.end(); ++it)
+        {
+            const auto child = node->children.find(it->native());
+            if (child == node->children.end())
+            {
+                return size_t{0};
+            }
+            node = &child->second;
+        }
+        return size_t{1};
+    });
+    const auto index_ns = measure([&tree](const client::cache::Path& path) {
+        return size_t{tree.get_node(path).id != client::cache::INVALID_NODE};
+    });
+
+    std::cout << "depth " << DEPTH + 1 << " lookup: component walk " << walk_ns
+              << " ns, path index " << index_ns << " ns\n";
+    EXPECT_LT(index_ns, walk_ns);
+}
+
+//==========================================================================
+
+TEST(ContentBenchmark, DISABLED_Streaming)
+{
+    static constexpr size_t FILE_SIZE{256 * 1024 * 1024};
+    static constexpr size_t WRITE_SIZE{32 * 1024};
+    static constexpr size_t READ_SIZE{128 * 1024};
+    static constexpr size_t FILES{2};
+
+    client::cache::Content content{};
+    std::vector<uint8_t> piece(WRITE_SIZE);
+
+    const auto mb_per_s = [](const auto elapsed) {
+        const auto seconds = std::chrono::duration<double>(elapsed).count();
+        return static_cast<double>(FILES * FILE_SIZE) / (1024 * 1024) / seconds;
+    };
+
+    const auto write_start = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < FILES; ++f)
+    {
+        const auto path = "/file" + std::to_string(f);
+        for (size_t offset = 0; offset < FILE_SIZE; offset += WRITE_SIZE)
+        {
+            piece[0] = static_cast<uint8_t>(offset / WRITE_SIZE);
+            content.write(path, offset, piece);
+        }
+    }
+    const auto write_elapsed = std::chrono::steady_clock::now() - write_start;
+
+    size_t hits{0};
+    size_t checksum{0};
+    std::vector<uint8_t> output(READ_SIZE);
+    const auto read_start = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < FILES; ++f)
+    {
+        const auto path = "/file" + std::to_string(f);
+        for (size_t offset = 0; offset < FILE_SIZE; offset += READ_SIZE)
+        {
+            auto output_it = output.begin();
+            hits += content.read(path, offset, READ_SIZE, [&output_it](const auto& buf) {
+                output_it = std::copy(buf.begin(), buf.end(), output_it);
+            });
+            checksum += output[0];
+        }
+    }
+    const auto read_elapsed = std::chrono::steady_clock::now() - read_start;
+
+    std::cout << "streaming " << FILES << "x" << FILE_SIZE / (1024 * 1024)
+              << " MB: write " << mb_per_s(write_elapsed) << " MB/s, read "
+              << mb_per_s(read_elapsed) << " MB/s (checksum " << checksum << ")\n";
+    EXPECT_EQ(hits, FILES * FILE_SIZE / READ_SIZE);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(ContentBenchmark, DISABLED_ScanResistance)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    static constexpr size_t CAPACITY_PAGES{64};
+    static constexpr size_t HOT_PAGES{48};
+    static constexpr size_t ROUNDS{100};
+    static constexpr size_t HOT_ACCESSES{200};
+    static constexpr size_t SCAN_LENGTH{200};
+
+    // working set reads interleaved with one-shot scans (e.g. `grep -r`)
+    std::vector<std::string> trace{};
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<size_t> hot_dist{0, HOT_PAGES - 1};
+    size_t scanned{0};
+    for (size_t round = 0; round < ROUNDS; ++round)
+    {
+        for (size_t i = 0; i < HOT_ACCESSES; ++i)
+        {
+            trace.push_back("/src/file" + std::to_string(hot_dist(rng)));
+        }
+        for (size_t i = 0; i < SCAN_LENGTH; ++i)
+        {
+            trace.push_back("/scan/file" + std::to_string(scanned++));
+        }
+    }
+
+    // plain LRU of whole pages
+    size_t lru_hits{0};
+    {
+        std::list<std::string> lru{};
+        std::unordered_map<std::string, std::list<std::string>::iterator> pages{};
+        for (const auto& path: trace)
+        {
+            const auto it = pages.find(path);
+            if (it != pages.end())
+            {
+                ++lru_hits;
+                lru.splice(lru.begin(), lru, it->second);
+                continue;
+            }
+            lru.push_front(path);
+            pages.emplace(path, lru.begin());
+            if (lru.size() > CAPACITY_PAGES)
+            {
+                pages.erase(lru.back());
+                lru.pop_back();
+            }
+        }
+    }
+    const auto lru_ratio
+        = static_cast<double>(lru_hits) / static_cast<double>(trace.size());
+
+    client::cache::Content content{};
+    content.set_capacity(CAPACITY_PAGES * PAGE);
+    std::vector<uint8_t> page(PAGE);
+    for (const auto& path: trace)
+    {
+        if (not content.read_partial(path, 0, page).empty())
+        {
+            content.write(path, 0, page);
+        }
+    }
+    const auto tinylfu_ratio = content.get_stats().hit_ratio();
+
+    std::cout << "hot set + scan trace hit ratio: LRU " << lru_ratio << ", W-TinyLFU "
+              << tinylfu_ratio << '\n';
+    EXPECT_GT(tinylfu_ratio, lru_ratio);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,116 @@
+/// Server tree scanner benchmarks. Disabled by default, see benchmark_caches.cpp.
+///
+/// @file
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <boost/range/iterator_range.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/scanner.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+/// Modules with components full of sources.
+void generate_tree(const fs::path& root)
+{
+    static constexpr size_t MODULES{20};
+    static constexpr size_t COMPONENTS{50};
+    static constexpr size_t FILES{50};
+
+    for (size_t m = 0; m < MODULES; ++m)
+    {
+        for (size_t c = 0; c < COMPONENTS; ++c)
+        {
+            const auto component = root / ("module_" + std::to_string(m))
+                                   / ("component_" + std::to_string(c));
+            fs::create_directories(component);
+            for (size_t f = 0; f < FILES; ++f)
+            {
+                std::ofstream{
+                    (component / ("source_file_" + std::to_string(f) + ".cpp")).native()}
+                    << f;
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+/// The former way: `directory_iterator` and `lstat()` by full paths.
+size_t scan_iterator(const fs::path& path)
+{
+    struct stat st{};
+    if (lstat(path.c_str(), &st) != 0)
+    {
+        return 1;
+    }
+    size_t entries{1};
+    if (S_ISDIR(st.st_mode))
+    {
+        for (const auto& child:
+             boost::make_iterator_range(fs::directory_iterator{path}, {}))
+        {
+            entries += scan_iterator(child.path());
+        }
+    }
+    return entries;
+}
+
+//--------------------------------------------------------------------------
+
+size_t count(const server::ScanNode& node)
+{
+    size_t entries{1};
+    for (const auto& child: node.children)
+    {
+        entries += count(child);
+    }
+    return entries;
+}
+
+} // namespace
+
+//==========================================================================
+
+TEST(ScannerBenchmark, DISABLED_Scan)
+{
+    const auto root = fs::temp_directory_path() / fs::unique_path();
+    generate_tree(root);
+
+    const auto measure = [](auto scan) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto entries = scan();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::make_pair(entries,
+                              std::chrono::duration<double, std::milli>(elapsed).count());
+    };
+    const auto iterator = measure([&root] { return scan_iterator(root); });
+    const auto single = measure([&root] {
+        return count(server::Scanner{1}.scan(root, server::UNLIMITED_DEPTH));
+    });
+    const auto parallel = measure(
+        [&root] { return count(server::Scanner{}.scan(root, server::UNLIMITED_DEPTH)); });
+    fs::remove_all(root);
+
+    EXPECT_EQ(single.first, iterator.first);
+    EXPECT_EQ(parallel.first, iterator.first);
+    std::cout << iterator.first << " entries: directory_iterator " << iterator.second
+              << " ms, scanner 1 thread " << single.second << " ms, scanner "
+              << std::thread::hardware_concurrency() << " threads " << parallel.second
+              << " ms\n";
+}
+
+//==========================================================================
+} // namespace rewofs::tests
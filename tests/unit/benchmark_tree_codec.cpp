@@ -0,0 +1,302 @@
+/// Tree transfer encoding benchmarks. Disabled by default, see benchmark_caches.cpp.
+///
+/// @file
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/cache.hpp"
+#include "rewofs/compression.hpp"
+#include "rewofs/messages.hpp"
+#include "rewofs/tree_codec.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace {
+
+struct ListedEntry
+{
+    std::string name{};
+    client::cache::Stat st{};
+};
+
+/// Children of a directory, the whole tree is listed breadth-first as the server
+/// streams it.
+struct Listing
+{
+    std::string path{};
+    std::vector<ListedEntry> children{};
+};
+
+using Chunks = std::vector<std::vector<uint8_t>>;
+
+constexpr size_t CHUNK_ENTRIES{4096};
+
+//--------------------------------------------------------------------------
+
+/// Modules with components full of sources, about 1M entries.
+std::vector<Listing> generate_listings()
+{
+    static constexpr size_t MODULES{100};
+    static constexpr size_t COMPONENTS{100};
+    static constexpr size_t FILES{98};
+    static constexpr time_t BASE_TIME{1600000000};
+
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<time_t> time_dist{0, 365 * 24 * 3600};
+    std::uniform_int_distribution<long> nsec_dist{0, 999999999};
+    std::uniform_int_distribution<off_t> size_dist{0, 200000};
+    const auto make_stat = [&](const mode_t mode) {
+        client::cache::Stat st{};
+        st.st_mode = mode;
+        st.st_size = S_ISDIR(mode) ? 4096 : size_dist(rng);
+        st.st_mtim = {BASE_TIME + time_dist(rng), nsec_dist(rng)};
+        st.st_ctim = st.st_mtim;
+        return st;
+    };
+
+    std::vector<Listing> listings{};
+    listings.push_back({"", {}});
+    for (size_t m = 0; m < MODULES; ++m)
+    {
+        listings[0].children.push_back(
+            {"module_" + std::to_string(m), make_stat(S_IFDIR | 0755)});
+    }
+    for (size_t m = 0; m < MODULES; ++m)
+    {
+        Listing module{"module_" + std::to_string(m), {}};
+        for (size_t c = 0; c < COMPONENTS; ++c)
+        {
+            module.children.push_back(
+                {"component_" + std::to_string(c), make_stat(S_IFDIR | 0755)});
+        }
+        listings.push_back(std::move(module));
+    }
+    for (size_t m = 0; m < MODULES; ++m)
+    {
+        for (size_t c = 0; c < COMPONENTS; ++c)
+        {
+            Listing component{
+                "module_" + std::to_string(m) + "/component_" + std::to_string(c), {}};
+            for (size_t f = 0; f < FILES; ++f)
+            {
+                const auto name = "source_file_" + std::to_string(f) + ".cpp";
+                component.children.push_back({name, make_stat(S_IFREG | 0644)});
+            }
+            listings.push_back(std::move(component));
+        }
+    }
+    for (auto& listing: listings)
+    {
+        std::sort(listing.children.begin(), listing.children.end(),
+                  [](const ListedEntry& e1, const ListedEntry& e2) {
+                      return e1.name < e2.name;
+                  });
+    }
+    return listings;
+}
+
+//--------------------------------------------------------------------------
+
+/// @param add_listing `add_listing(fbb, listing)`
+/// @param finish `finish(fbb)`, returns the chunk message offset
+template<typename _AddListing, typename _Finish>
+Chunks encode(const std::vector<Listing>& listings, _AddListing add_listing,
+              _Finish finish)
+{
+    Chunks chunks{};
+    flatbuffers::FlatBufferBuilder fbb{};
+    size_t entries{0};
+    for (const auto& listing: listings)
+    {
+        add_listing(fbb, listing);
+        entries += listing.children.size() + 1;
+        if (entries >= CHUNK_ENTRIES)
+        {
+            fbb.Finish(finish(fbb));
+            chunks.emplace_back(fbb.GetBufferPointer(),
+                                fbb.GetBufferPointer() + fbb.GetSize());
+            fbb.Clear();
+            entries = 0;
+        }
+    }
+    fbb.Finish(finish(fbb));
+    chunks.emplace_back(fbb.GetBufferPointer(), fbb.GetBufferPointer() + fbb.GetSize());
+    return chunks;
+}
+
+//--------------------------------------------------------------------------
+
+Chunks encode_flatbuffers(const std::vector<Listing>& listings)
+{
+    std::vector<flatbuffers::Offset<messages::TreeDirectory>> directories{};
+    return encode(
+        listings,
+        [&directories](flatbuffers::FlatBufferBuilder& fbb, const Listing& listing) {
+            std::vector<flatbuffers::Offset<messages::TreeNode>> children{};
+            for (const auto& child: listing.children)
+            {
+                messages::Stat fbb_stat{};
+                copy(child.st, fbb_stat);
+                const auto fbb_name = fbb.CreateString(child.name);
+                messages::TreeNodeBuilder builder{fbb};
+                builder.add_name(fbb_name);
+                builder.add_st(&fbb_stat);
+                children.push_back(builder.Finish());
+            }
+            directories.push_back(messages::CreateTreeDirectoryDirect(
+                fbb, listing.path.c_str(), &children, false));
+        },
+        [&directories](flatbuffers::FlatBufferBuilder& fbb) {
+            const auto chunk
+                = messages::CreateResultReadTreeChunkDirect(fbb, 0, 0, &directories);
+            directories.clear();
+            return chunk;
+        });
+}
+
+//--------------------------------------------------------------------------
+
+Chunks encode_packed(const std::vector<Listing>& listings)
+{
+    tree_codec::Encoder encoder{};
+    return encode(
+        listings,
+        [&encoder](flatbuffers::FlatBufferBuilder&, const Listing& listing) {
+            for (const auto& child: listing.children)
+            {
+                encoder.add({child.name, static_cast<uint32_t>(child.st.st_mode),
+                             child.st.st_size, child.st.st_mtim, child.st.st_ctim,
+                             false});
+            }
+            encoder.end_directory(false);
+        },
+        [&encoder](flatbuffers::FlatBufferBuilder& fbb) {
+            const auto packed = encoder.finish();
+            return messages::CreateResultReadTreeChunkDirect(fbb, 0, 0, nullptr, 0,
+                                                             false, &packed);
+        });
+}
+
+//--------------------------------------------------------------------------
+
+void decode_flatbuffers(const Chunks& chunks, client::cache::Tree& tree)
+{
+    for (const auto& data: chunks)
+    {
+        const auto& chunk
+            = *flatbuffers::GetRoot<messages::ResultReadTreeChunk>(data.data());
+        for (const auto* directory: *chunk.directories())
+        {
+            auto& node
+                = tree.get_node(client::cache::Path{"/"} / directory->path()->str());
+            for (const auto* child: *directory->children())
+            {
+                auto& new_node = tree.make_node(
+                    node, {child->name()->c_str(), child->name()->size()});
+                copy(*child->st(), new_node.st);
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+void decode_packed(const Chunks& chunks, client::cache::Tree& tree)
+{
+    std::deque<client::cache::Path> pending{"/"};
+    for (const auto& data: chunks)
+    {
+        const auto& chunk
+            = *flatbuffers::GetRoot<messages::ResultReadTreeChunk>(data.data());
+        tree_codec::Decoder decoder{{chunk.packed()->data(), chunk.packed()->size()}};
+        while (const auto directory = decoder.next_directory())
+        {
+            const auto path = std::move(pending.front());
+            pending.pop_front();
+            auto& node = tree.get_node(path);
+            for (uint32_t i = 0; i < directory->entries; ++i)
+            {
+                const auto entry = decoder.next_entry();
+                auto& new_node = tree.make_node(node, entry.name);
+                new_node.st = {static_cast<mode_t>(entry.st_mode),
+                               static_cast<off_t>(entry.st_size), entry.st_mtim,
+                               entry.st_ctim};
+                if (S_ISDIR(entry.st_mode))
+                {
+                    pending.push_back(path / std::string{entry.name});
+                }
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+std::pair<size_t, size_t> sizes_of(const Chunks& chunks)
+{
+    size_t size{0};
+    size_t compressed_size{0};
+    for (const auto& chunk: chunks)
+    {
+        size += chunk.size();
+        compressed_size += compress(chunk).size();
+    }
+    return {size, compressed_size};
+}
+
+} // namespace
+
+//==========================================================================
+
+TEST(TreeCodecBenchmark, DISABLED_SizeAndDecode)
+{
+    const auto listings = generate_listings();
+    size_t entries{0};
+    for (const auto& listing: listings)
+    {
+        entries += listing.children.size();
+    }
+
+    const auto flatbuffers_chunks = encode_flatbuffers(listings);
+    const auto packed_chunks = encode_packed(listings);
+    const auto flatbuffers_sizes = sizes_of(flatbuffers_chunks);
+    const auto packed_sizes = sizes_of(packed_chunks);
+
+    const auto measure = [entries](const Chunks& chunks, auto decode) {
+        client::cache::Tree tree{};
+        const auto start = std::chrono::steady_clock::now();
+        decode(chunks, tree);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        EXPECT_EQ(tree.size(), entries + 1);
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    };
+    const auto flatbuffers_ms = measure(flatbuffers_chunks, decode_flatbuffers);
+    const auto packed_ms = measure(packed_chunks, decode_packed);
+
+    const auto per_entry = [entries](const size_t size) {
+        return static_cast<double>(size) / static_cast<double>(entries);
+    };
+    std::cout << entries << " entries, bytes per entry (compressed): flatbuffers "
+              << per_entry(flatbuffers_sizes.first) << " ("
+              << per_entry(flatbuffers_sizes.second) << "), packed "
+              << per_entry(packed_sizes.first) << " (" << per_entry(packed_sizes.second)
+              << ")\n";
+    std::cout << "decode into the tree: flatbuffers " << flatbuffers_ms << " ms, packed "
+              << packed_ms << " ms\n";
+    EXPECT_LT(packed_sizes.first, flatbuffers_sizes.first);
+    EXPECT_LT(packed_sizes.second, flatbuffers_sizes.second);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
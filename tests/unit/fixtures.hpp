@@ -0,0 +1,71 @@
+/// Shared test fixtures.
+///
+/// @file
+
+#pragma once
+#ifndef FIXTURES_HPP__Q8NV3WKT
+#define FIXTURES_HPP__Q8NV3WKT
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <boost/filesystem.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/event_source.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+/// An empty temporary directory removed after the test.
+class TempDirectoryTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_directory
+            = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(m_directory);
+    }
+
+    void TearDown() override
+    {
+        boost::filesystem::remove_all(m_directory);
+    }
+
+    /// Create or overwrite a file.
+    /// @param path relative to the directory
+    void touch(const boost::filesystem::path& path, const std::string& content = "1")
+    {
+        std::ofstream{(m_directory / path).native()} << content;
+    }
+
+    boost::filesystem::path m_directory{};
+};
+
+//--------------------------------------------------------------------------
+
+/// Paths of the events with the mask bits.
+inline std::vector<std::string> event_paths(server::IEventSource& source,
+                                            const uint32_t mask)
+{
+    std::vector<std::string> paths{};
+    for (const auto& event: source.read(std::chrono::milliseconds{100}))
+    {
+        if (event.mask & mask)
+        {
+            paths.push_back(event.path.native());
+        }
+    }
+    return paths;
+}
+
+//==========================================================================
+} // namespace rewofs::tests
+
+#endif /* include guard */
@@ -2,6 +2,11 @@
 ///
 /// @file
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <tuple>
+
 #include "rewofs/disablewarnings.hpp"
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -17,140 +22,202 @@ namespace t = testing;
 
 //==========================================================================
 
-TEST(CacheTree, GetNode_Root)
+TEST(Cache, Snapshot_Publish)
 {
-    client::cache::Tree tree{};
-    EXPECT_NO_THROW(tree.get_node("/"));
-}
+    client::cache::Cache cache{};
+    const auto empty = cache.snapshot();
 
-//--------------------------------------------------------------------------
+    auto lg = cache.lock();
+    cache.make_node("/file");
+    EXPECT_THROW(cache.snapshot()->get_node("/file"), std::system_error);
+    cache.publish();
+    lg.unlock();
 
-TEST(CacheTree, GetNode_NonexistentInRoot)
-{
-    client::cache::Tree tree{};
-    EXPECT_THROW(tree.get_node("/nonexistent"), std::system_error);
+    EXPECT_NO_THROW(cache.snapshot()->get_node("/file"));
+    EXPECT_THROW(empty->get_node("/file"), std::system_error);
 }
 
 //--------------------------------------------------------------------------
 
-TEST(CacheTree, MakeNode_GetNode)
+TEST(Cache, Publish_Rehashes)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    auto& some = tree.make_node(root, "some");
-    EXPECT_NO_THROW(tree.get_node("/some"));
-    tree.make_node(root, "some2");
-    EXPECT_NO_THROW(tree.get_node("/some2"));
-    tree.make_node(some, "sub");
-    EXPECT_NO_THROW(tree.get_node("/some/sub"));
-    EXPECT_THROW(tree.get_node("/some/sub2"), std::system_error);
+    client::cache::Cache cache{};
+    const auto expect_hashed = [&cache] {
+        client::cache::Tree rehashed{*cache.snapshot()};
+        rehashed.rehash_subtree("/");
+        EXPECT_EQ(cache.snapshot()->get_root().hash, rehashed.get_root().hash);
+        EXPECT_EQ(cache.snapshot()->get_node("/a").hash, rehashed.get_node("/a").hash);
+    };
+
+    auto lg = cache.lock();
+    cache.get_root().st.st_mode = S_IFDIR | 0755;
+    cache.make_node("/a").st.st_mode = S_IFDIR | 0755;
+    cache.make_node("/a/b").st.st_mode = S_IFDIR | 0755;
+    cache.make_node("/a/b/file").st.st_mode = S_IFREG | 0644;
+    cache.publish();
+    expect_hashed();
+    const auto root_hash = cache.snapshot()->get_root().hash;
+
+    cache.get_node("/a/b/file").st.st_size = 10;
+    cache.publish();
+    expect_hashed();
+    EXPECT_NE(cache.snapshot()->get_root().hash, root_hash);
+
+    cache.rename("/a/b/file", "/a/file");
+    cache.make_node("/a/b/empty").st.st_mode = S_IFDIR | 0755;
+    cache.publish();
+    expect_hashed();
+
+    cache.remove("/a/b");
+    cache.publish();
+    expect_hashed();
 }
 
 //--------------------------------------------------------------------------
 
-TEST(CacheTree, Exchange)
+TEST(Cache, Snapshot_ConcurrentReaders)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    auto& node_a = tree.make_node(root, "node_a");
-    node_a.st.st_size = 100;
-    auto& node_b = tree.make_node(root, "node_b");
-    node_b.st.st_size = 1000;
-
-    tree.exchange("/node_a", "/node_b");
-
-    EXPECT_EQ(tree.get_node("/node_a").st.st_size, 1000);
-    EXPECT_EQ(tree.get_node("/node_b").st.st_size, 100);
-}
+    client::cache::Cache cache{};
+    {
+        auto lg = cache.lock();
+        cache.make_node("/a");
+        cache.make_node("/b");
+        cache.make_node("/a/x").st.st_size = 0;
+        cache.publish();
+    }
 
-//--------------------------------------------------------------------------
+    std::atomic<bool> quit{false};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> readers{};
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&]() {
+            while (not quit)
+            {
+                // the file is always in exactly one of the directories
+                const auto tree = cache.snapshot();
+                const auto in_a = tree->children_count(tree->get_node("/a"));
+                const auto in_b = tree->children_count(tree->get_node("/b"));
+                if (in_a + in_b != 1)
+                {
+                    ++failures;
+                }
+            }
+        });
+    }
 
-TEST(CacheTree, ExchangeRoot)
-{
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    tree.make_node(root, "node_a");
+    for (int i = 0; i < 2000; ++i)
+    {
+        auto lg = cache.lock();
+        const auto from = (i % 2 == 0) ? "/a/x" : "/b/x";
+        const auto to = (i % 2 == 0) ? "/b/x" : "/a/x";
+        cache.rename(from, to);
+        cache.get_node(to).st.st_size = i;
+        cache.make_node("/tmp" + std::to_string(i));
+        cache.publish();
+    }
+    quit = true;
+    for (auto& reader: readers)
+    {
+        reader.join();
+    }
 
-    EXPECT_THROW(tree.exchange("/", "/node_a"), std::exception);
-    EXPECT_THROW(tree.exchange("/node_a", "/"), std::exception);
+    EXPECT_EQ(failures, 0);
+    EXPECT_EQ(cache.snapshot()->get_node("/a/x").st.st_size, 1999);
 }
 
 //--------------------------------------------------------------------------
 
-TEST(CacheTree, ExchangeTheSame)
+TEST(Cache, Remove_DropsContent)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    tree.make_node(root, "node_a");
-
-    EXPECT_THROW(tree.exchange("/node_a", "/node_a"), std::exception);
+    client::cache::Cache cache{};
+    cache.make_node("/dir");
+    cache.make_node("/dir/file");
+    cache.make_node("/other");
+    cache.write("/dir/file", 0, {1, 2, 3});
+    cache.write("/other", 0, {4, 5});
+
+    cache.remove("/dir");
+
+    const auto ignore = [](const auto) {};
+    EXPECT_FALSE(cache.read("/dir/file", 0, 3, ignore));
+    EXPECT_TRUE(cache.read("/other", 0, 2, ignore));
+    cache.invalidate_content("/other");
+    EXPECT_FALSE(cache.read("/other", 0, 2, ignore));
 }
 
 //--------------------------------------------------------------------------
 
-TEST(CacheTree, ExchangeDifferentDirectory)
+TEST(Cache, ResetTree_KeepsUnchangedContent)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    auto& node_a = tree.make_node(root, "node_a");
-    node_a.st.st_size = 100;
-    auto& subdir = tree.make_node(root, "subdir");
-    auto& node_b = tree.make_node(subdir, "node_b");
-    node_b.st.st_size = 1000;
-
-    tree.exchange("/node_a", "/subdir/node_b");
-
-    EXPECT_EQ(tree.get_node("/node_a").st.st_size, 1000);
-    EXPECT_EQ(tree.get_node("/subdir/node_b").st.st_size, 100);
-}
+    const auto make_tree = [](const off_t changed_size, const bool with_removed) {
+        client::cache::Tree tree{};
+        tree.make_node("/dir");
+        tree.make_node("/dir/same").st.st_size = 3;
+        tree.make_node("/dir/changed").st.st_size = changed_size;
+        auto& touched = tree.make_node("/touched");
+        touched.st.st_size = 3;
+        touched.st.st_ctim.tv_sec = changed_size;
+        if (with_removed)
+        {
+            tree.make_node("/removed").st.st_size = 3;
+        }
+        return tree;
+    };
+
+    client::cache::Cache cache{};
+    cache.reset(make_tree(3, true));
+    for (const auto path: {"/dir/same", "/dir/changed", "/touched", "/removed"})
+    {
+        cache.write(path, 0, {1, 2, 3});
+    }
 
-//--------------------------------------------------------------------------
+    cache.reset(make_tree(4, false));
 
-TEST(CacheTree, ExchangeDirectories)
-{
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    auto& subdir_a = tree.make_node(root, "sub_a");
-    auto& node_a = tree.make_node(subdir_a, "node_a");
-    node_a.st.st_size = 100;
-    auto& subdir_b = tree.make_node(root, "sub_b");
-    auto& node_b = tree.make_node(subdir_b, "node_b");
-    node_b.st.st_size = 1000;
-
-    tree.exchange("/sub_a", "/sub_b");
-
-    EXPECT_EQ(tree.get_node("/sub_a/node_b").st.st_size, 1000);
-    EXPECT_EQ(tree.get_node("/sub_b/node_a").st.st_size, 100);
-    EXPECT_THROW(tree.get_node("/sub_a/node_a"), std::exception);
-    EXPECT_THROW(tree.get_node("/sub_b/node_b"), std::exception);
+    const auto ignore = [](const auto) {};
+    EXPECT_TRUE(cache.read("/dir/same", 0, 3, ignore));
+    EXPECT_FALSE(cache.read("/dir/changed", 0, 3, ignore));
+    EXPECT_FALSE(cache.read("/touched", 0, 3, ignore));
+    EXPECT_FALSE(cache.read("/removed", 0, 3, ignore));
 }
 
-//--------------------------------------------------------------------------
-
-TEST(CacheTree, ExchangeMissing)
+TEST(FrequencySketch, Counts)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    tree.make_node(root, "node_a");
+    client::cache::FrequencySketch sketch{64};
 
-    EXPECT_THROW(tree.exchange("/nonexistent1", "/nonexistent2"), std::exception);
-    EXPECT_THROW(tree.exchange("/node_a", "/nonexistent"), std::exception);
-    EXPECT_THROW(tree.exchange("/nonexistent", "/node_a"), std::exception);
+    EXPECT_EQ(sketch.frequency(1), 0);
+    for (size_t i = 0; i < 5; ++i)
+    {
+        sketch.increment(1);
+    }
+    sketch.increment(2);
+    EXPECT_EQ(sketch.frequency(1), 5);
+    EXPECT_EQ(sketch.frequency(2), 1);
+
+    // saturated
+    for (size_t i = 0; i < 20; ++i)
+    {
+        sketch.increment(1);
+    }
+    EXPECT_EQ(sketch.frequency(1), 15);
 }
 
 //--------------------------------------------------------------------------
 
-TEST(CacheTree, ExchangeSubDirectory)
+TEST(FrequencySketch, Aging)
 {
-    client::cache::Tree tree{};
-    auto& root = tree.get_root();
-    auto& s1 = tree.make_node(root, "s1");
-    tree.make_node(s1, "s2");
-
-    EXPECT_THROW(tree.exchange("/", "/s1/s2"), std::exception);
-    EXPECT_THROW(tree.exchange("/s1/s2", "/"), std::exception);
-    EXPECT_THROW(tree.exchange("/s1", "/s1/s2"), std::exception);
-    EXPECT_THROW(tree.exchange("/s1/s2", "/s1"), std::exception);
+    client::cache::FrequencySketch sketch{64};
+
+    for (size_t i = 0; i < 15; ++i)
+    {
+        sketch.increment(1);
+    }
+    // 10 increments per counter trigger the aging
+    for (uint64_t i = 0; i < 10 * 64; ++i)
+    {
+        sketch.increment(1000 + i);
+    }
+    EXPECT_LE(sketch.frequency(1), 8);
 }
 
 //==========================================================================
@@ -311,6 +378,221 @@ TEST(Content, RW_NestedWrites)
 
 //--------------------------------------------------------------------------
 
+TEST(Content, RW_AcrossPages)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    client::cache::Content content{};
+
+    const auto pattern = [](const size_t start, const size_t size) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            data[i] = static_cast<uint8_t>((start + i) % 251);
+        }
+        return data;
+    };
+    const auto read = [&content](const size_t start, const size_t size) {
+        std::vector<uint8_t> out{};
+        size_t pieces{0};
+        const auto hit
+            = content.read("/a", start, size, [&out, &pieces](const auto& buf) {
+                  std::copy(buf.begin(), buf.end(), std::back_inserter(out));
+                  ++pieces;
+              });
+        return std::make_tuple(hit, out, pieces);
+    };
+
+    // spans 3 pages
+    content.write("/a", PAGE - 100, pattern(PAGE - 100, PAGE + 200));
+    {
+        const auto [hit, out, pieces] = read(PAGE - 100, PAGE + 200);
+        EXPECT_TRUE(hit);
+        EXPECT_EQ(out, pattern(PAGE - 100, PAGE + 200));
+        EXPECT_EQ(pieces, 3);
+    }
+    EXPECT_FALSE(std::get<0>(read(PAGE - 101, 10)));
+    EXPECT_FALSE(std::get<0>(read(2 * PAGE + 95, 10)));
+
+    // fill a gap in the middle of a page, the neighbours get merged
+    content.write("/a", 3 * PAGE, pattern(3 * PAGE, 100));
+    content.write("/a", 3 * PAGE + 200, pattern(3 * PAGE + 200, 100));
+    EXPECT_FALSE(std::get<0>(read(3 * PAGE, 300)));
+    content.write("/a", 3 * PAGE + 50, pattern(3 * PAGE + 50, 200));
+    {
+        const auto [hit, out, pieces] = read(3 * PAGE, 300);
+        EXPECT_TRUE(hit);
+        EXPECT_EQ(out, pattern(3 * PAGE, 300));
+        EXPECT_EQ(pieces, 1);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Content, ReadPartial)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    client::cache::Content content{};
+
+    const auto missing_of = [](const std::vector<client::cache::Content::Range>& ranges) {
+        std::vector<std::pair<uintmax_t, size_t>> res{};
+        for (const auto& range: ranges)
+        {
+            res.emplace_back(range.start, range.size);
+        }
+        return res;
+    };
+
+    {
+        std::vector<uint8_t> out(10, 0xff);
+        EXPECT_THAT(missing_of(content.read_partial("/a", 5, out)),
+                    t::ElementsAre(t::Pair(5, 10)));
+        EXPECT_EQ(out, std::vector<uint8_t>(10, 0xff));
+    }
+
+    content.write("/a", 10, {1, 2, 3});
+    content.write("/a", 20, {4, 5});
+    {
+        std::vector<uint8_t> out(20, 0);
+        EXPECT_THAT(missing_of(content.read_partial("/a", 5, out)),
+                    t::ElementsAre(t::Pair(5, 5), t::Pair(13, 7), t::Pair(22, 3)));
+        EXPECT_THAT(out, t::ElementsAre(0, 0, 0, 0, 0, 1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 4,
+                                        5, 0, 0, 0));
+    }
+    {
+        std::vector<uint8_t> out(2, 0);
+        EXPECT_THAT(content.read_partial("/a", 11, out), t::IsEmpty());
+        EXPECT_THAT(out, t::ElementsAre(2, 3));
+    }
+
+    // most of the pages cached, a single hole
+    std::vector<uint8_t> data(4 * PAGE, 7);
+    content.write("/b", 0, data);
+    content.delete_file("/b");
+    content.write("/b", 0, {data.begin(), data.begin() + PAGE + 100});
+    content.write("/b", PAGE + 300, {data.begin(), data.begin() + 3 * PAGE - 300});
+    {
+        std::vector<uint8_t> out(4 * PAGE, 0);
+        EXPECT_THAT(missing_of(content.read_partial("/b", 0, out)),
+                    t::ElementsAre(t::Pair(PAGE + 100, 200)));
+        EXPECT_EQ(std::count(out.begin(), out.end(), 7), 4 * PAGE - 200);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Content, Eviction)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    client::cache::Content content{};
+    content.set_capacity(3 * PAGE);
+
+    // the same as CachedVfs, a miss is followed by a write
+    const auto fetch = [&content](const std::string& path, const uintmax_t start) {
+        std::vector<uint8_t> page(PAGE, 1);
+        if (not content.read_partial(path, start, page).empty())
+        {
+            content.write(path, start, page);
+        }
+    };
+    const auto is_cached = [&content](const std::string& path, const uintmax_t start) {
+        return content.read(path, start, PAGE, [](const auto) {});
+    };
+
+    fetch("/a", 0);
+    fetch("/a", PAGE);
+    fetch("/b", 0);
+    EXPECT_EQ(content.get_stats().size, 3 * PAGE);
+    EXPECT_EQ(content.get_stats().evictions, 0);
+
+    fetch("/a", 0);
+    // not accessed more often than the least recently used page
+    fetch("/c", 0);
+    EXPECT_EQ(content.get_stats().evictions, 1);
+    EXPECT_EQ(content.get_stats().pages, 3);
+    EXPECT_FALSE(is_cached("/c", 0));
+    // the second access wins
+    fetch("/c", 0);
+    EXPECT_EQ(content.get_stats().evictions, 2);
+    EXPECT_EQ(content.get_stats().size, 3 * PAGE);
+    EXPECT_FALSE(is_cached("/a", PAGE));
+    EXPECT_TRUE(is_cached("/a", 0));
+    EXPECT_TRUE(is_cached("/b", 0));
+    EXPECT_TRUE(is_cached("/c", 0));
+
+    content.delete_file("/b");
+    EXPECT_EQ(content.get_stats().size, 2 * PAGE);
+    EXPECT_EQ(content.get_stats().pages, 2);
+
+    // partial pages count by their size
+    content.write("/d", 10, {1, 2, 3});
+    EXPECT_EQ(content.get_stats().size, 2 * PAGE + 3);
+
+    content.shrink(PAGE);
+    EXPECT_EQ(content.get_stats().size, 3);
+    EXPECT_FALSE(is_cached("/a", 0));
+    EXPECT_FALSE(is_cached("/c", 0));
+
+    content.set_capacity(0);
+    EXPECT_EQ(content.get_stats().size, 0);
+    EXPECT_EQ(content.get_stats().pages, 0);
+    EXPECT_EQ(content.get_stats().evictions, 5);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Content, Eviction_ScanResistant)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    client::cache::Content content{};
+    content.set_capacity(8 * PAGE);
+
+    const auto fetch = [&content](const std::string& path) {
+        std::vector<uint8_t> page(PAGE, 1);
+        if (not content.read_partial(path, 0, page).empty())
+        {
+            content.write(path, 0, page);
+        }
+    };
+
+    for (size_t round = 0; round < 3; ++round)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            fetch("/hot" + std::to_string(i));
+        }
+    }
+    for (size_t i = 0; i < 100; ++i)
+    {
+        fetch("/scan" + std::to_string(i));
+    }
+
+    const auto before = content.get_stats();
+    for (size_t i = 0; i < 4; ++i)
+    {
+        fetch("/hot" + std::to_string(i));
+    }
+    EXPECT_EQ(content.get_stats().hit_bytes - before.hit_bytes, 4 * PAGE);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Content, Stats_HitRatio)
+{
+    client::cache::Content content{};
+    EXPECT_EQ(content.get_stats().hit_ratio(), 0.0);
+
+    content.write("/a", 0, {1, 2, 3, 4});
+    std::vector<uint8_t> out(8);
+    content.read_partial("/a", 0, out);
+    content.read_partial("/b", 0, out);
+    const auto stats = content.get_stats();
+    EXPECT_EQ(stats.hit_bytes, 4);
+    EXPECT_EQ(stats.miss_bytes, 12);
+    EXPECT_DOUBLE_EQ(stats.hit_ratio(), 0.25);
+}
+
+//--------------------------------------------------------------------------
+
 TEST(Content, DeletePath)
 {
     client::cache::Content content{};
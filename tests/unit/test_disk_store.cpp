@@ -0,0 +1,233 @@
+/// Test the persistent content cache.
+///
+/// @file
+
+#include <thread>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/disk_store.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+
+//==========================================================================
+
+class DiskStoreTest : public TempDirectoryTest
+{
+protected:
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        m_st.st_mode = S_IFREG;
+        m_st.st_size = 1000000;
+        m_st.st_mtim = {100, 1};
+        m_st.st_ctim = {100, 2};
+    }
+
+    static std::vector<std::pair<uintmax_t, size_t>>
+        missing_of(const std::vector<client::cache::Content::Range>& ranges)
+    {
+        std::vector<std::pair<uintmax_t, size_t>> res{};
+        for (const auto& range: ranges)
+        {
+            res.emplace_back(range.start, range.size);
+        }
+        return res;
+    }
+
+    client::cache::Stat m_st{};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, NotOpened)
+{
+    client::cache::DiskStore store{};
+    EXPECT_FALSE(store.is_open());
+
+    const std::vector<uint8_t> data{1, 2, 3};
+    store.write("/a", m_st, 0, data);
+    std::vector<uint8_t> out(3);
+    EXPECT_THAT(missing_of(store.read("/a", m_st, 0, out)), t::ElementsAre(t::Pair(0, 3)));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, RW_Persistent)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+
+    std::vector<uint8_t> data(PAGE + 100);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = static_cast<uint8_t>(i % 251);
+    }
+
+    {
+        client::cache::DiskStore store{};
+        store.open(m_directory, 10 * PAGE);
+        EXPECT_TRUE(store.is_open());
+        store.write("/a", m_st, PAGE - 50, data);
+        store.write("/a", m_st, 10, std::vector<uint8_t>{1, 2});
+        EXPECT_EQ(store.get_stats().pages, 3);
+    }
+
+    client::cache::DiskStore store{};
+    store.open(m_directory, 10 * PAGE);
+    EXPECT_EQ(store.get_stats().pages, 3);
+
+    std::vector<uint8_t> out(PAGE + 200, 0);
+    EXPECT_THAT(missing_of(store.read("/a", m_st, PAGE - 100, out)),
+                t::ElementsAre(t::Pair(PAGE - 100, 50), t::Pair(2 * PAGE + 50, 50)));
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), out.begin() + 50));
+    EXPECT_EQ(store.get_stats().hit_bytes, PAGE + 100);
+
+    std::vector<uint8_t> small(4, 0);
+    EXPECT_THAT(missing_of(store.read("/a", m_st, 9, small)),
+                t::ElementsAre(t::Pair(9, 1), t::Pair(12, 1)));
+    EXPECT_THAT(small, t::ElementsAre(0, 1, 2, 0));
+
+    // another file
+    EXPECT_THAT(missing_of(store.read("/b", m_st, 10, small)),
+                t::ElementsAre(t::Pair(10, 4)));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, ChangedFile)
+{
+    client::cache::DiskStore store{};
+    store.open(m_directory, 1024 * 1024);
+    store.write("/a", m_st, 0, std::vector<uint8_t>{1, 2, 3});
+
+    auto changed = m_st;
+    changed.st_mtim.tv_nsec = 5;
+    std::vector<uint8_t> out(3);
+    EXPECT_THAT(missing_of(store.read("/a", changed, 0, out)),
+                t::ElementsAre(t::Pair(0, 3)));
+    // dropped
+    EXPECT_EQ(store.get_stats().pages, 0);
+    EXPECT_EQ(store.get_stats().size, 0);
+    EXPECT_THAT(missing_of(store.read("/a", m_st, 0, out)), t::ElementsAre(t::Pair(0, 3)));
+
+    // a new version replaces the old one
+    store.write("/a", m_st, 0, std::vector<uint8_t>{1, 2, 3});
+    store.write("/a", changed, 1, std::vector<uint8_t>{7});
+    EXPECT_THAT(missing_of(store.read("/a", changed, 0, out)),
+                t::ElementsAre(t::Pair(0, 1), t::Pair(2, 1)));
+    EXPECT_EQ(out[1], 7);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, Eviction)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    const std::vector<uint8_t> data(PAGE, 1);
+
+    client::cache::DiskStore store{};
+    // headers do not fit for the third page
+    store.open(m_directory, 3 * PAGE);
+    store.write("/a", m_st, 0, data);
+    store.write("/b", m_st, 0, data);
+    std::vector<uint8_t> out(PAGE);
+    EXPECT_THAT(store.read("/a", m_st, 0, out), t::IsEmpty());
+    store.write("/c", m_st, 0, data);
+
+    const auto stats = store.get_stats();
+    EXPECT_EQ(stats.pages, 2);
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_LE(stats.size, 3 * PAGE);
+    EXPECT_THAT(store.read("/a", m_st, 0, out), t::IsEmpty());
+    EXPECT_THAT(store.read("/b", m_st, 0, out), t::SizeIs(1));
+    EXPECT_THAT(store.read("/c", m_st, 0, out), t::IsEmpty());
+
+    // a smaller capacity on the next start
+    client::cache::DiskStore reopened{};
+    reopened.open(m_directory, PAGE + 1000);
+    EXPECT_EQ(reopened.get_stats().pages, 1);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, RecencyPersisted)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    const std::vector<uint8_t> data(PAGE / 2, 1);
+    {
+        client::cache::DiskStore store{};
+        store.open(m_directory, 10 * PAGE);
+        store.write("/a", m_st, 0, data);
+        store.write("/b", m_st, 0, data);
+    }
+    // both look long unused
+    for (const auto& item: fs::directory_iterator{m_directory})
+    {
+        fs::last_write_time(item.path(), 1000);
+    }
+
+    {
+        client::cache::DiskStore store{};
+        store.open(m_directory, 10 * PAGE);
+        std::vector<uint8_t> out(data.size());
+        EXPECT_THAT(store.read("/a", m_st, 0, out), t::IsEmpty());
+    }
+
+    client::cache::DiskStore store{};
+    store.open(m_directory, PAGE);
+    EXPECT_EQ(store.get_stats().pages, 1);
+    std::vector<uint8_t> out(data.size());
+    EXPECT_THAT(store.read("/a", m_st, 0, out), t::IsEmpty());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(DiskStoreTest, Concurrent)
+{
+    static constexpr size_t PAGE{client::cache::Content::PAGE_SIZE};
+    static constexpr size_t FILES{8};
+
+    client::cache::DiskStore store{};
+    store.open(m_directory, 4 * PAGE);
+    std::vector<std::thread> threads{};
+    for (size_t idx = 0; idx < 4; ++idx)
+    {
+        threads.emplace_back([this, &store, idx] {
+            std::vector<uint8_t> out(PAGE);
+            for (size_t i = 0; i < 50; ++i)
+            {
+                const auto path = "/f" + std::to_string((i + idx) % FILES);
+                const std::vector<uint8_t> data(PAGE / 2, static_cast<uint8_t>(i));
+                store.write(path, m_st, (i % 2) * PAGE / 2, data);
+                const auto missing = store.read(path, m_st, 0, out);
+                EXPECT_LE(missing.size(), 1);
+            }
+        });
+    }
+    for (auto& thread: threads)
+    {
+        thread.join();
+    }
+
+    const auto stats = store.get_stats();
+    EXPECT_LE(stats.size, 4 * PAGE);
+    size_t files{0};
+    for (const auto& item: fs::directory_iterator{m_directory})
+    {
+        EXPECT_NE(item.path().extension(), ".tmp");
+        ++files;
+    }
+    EXPECT_EQ(files, stats.pages);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,153 @@
+/// Test the served tree exclude rules.
+///
+/// @file
+
+#include <fstream>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/excludes.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+using server::Excludes;
+
+//==========================================================================
+
+TEST(Excludes, Empty)
+{
+    Excludes excludes{};
+    EXPECT_TRUE(excludes.empty());
+    excludes.add("");
+    excludes.add("# comment");
+    excludes.add("   ");
+    EXPECT_TRUE(excludes.empty());
+    EXPECT_FALSE(excludes.excluded("/a"));
+    EXPECT_FALSE(excludes.inside_excluded("/a/b"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, Name)
+{
+    Excludes excludes{};
+    excludes.add("node_modules");
+    excludes.add(".cache/");
+    excludes.add("*.tmp");
+    EXPECT_FALSE(excludes.empty());
+    EXPECT_TRUE(excludes.excluded("/node_modules"));
+    EXPECT_TRUE(excludes.excluded("/a/b/node_modules"));
+    EXPECT_TRUE(excludes.excluded("/a/.cache"));
+    EXPECT_TRUE(excludes.excluded("/x.tmp"));
+    EXPECT_FALSE(excludes.excluded("/node_modules2"));
+    EXPECT_FALSE(excludes.excluded("/"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, Anchored)
+{
+    Excludes excludes{};
+    excludes.add("/build");
+    excludes.add("src/*/gen");
+    excludes.add("**/out");
+    excludes.add("doc/**/html");
+    EXPECT_TRUE(excludes.excluded("/build"));
+    EXPECT_FALSE(excludes.excluded("/a/build"));
+    EXPECT_TRUE(excludes.excluded("/src/x/gen"));
+    EXPECT_FALSE(excludes.excluded("/src/x/y/gen"));
+    EXPECT_TRUE(excludes.excluded("/out"));
+    EXPECT_TRUE(excludes.excluded("/a/b/out"));
+    EXPECT_TRUE(excludes.excluded("/doc/a/b/html"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, DoubleAsterisk)
+{
+    Excludes excludes{};
+    excludes.add("**/gen/out");
+    excludes.add("doc/**/html");
+    excludes.add("src/*");
+    excludes.add("tmp/**");
+    // leading `**/` matches any prefix including none
+    EXPECT_TRUE(excludes.excluded("/gen/out"));
+    EXPECT_TRUE(excludes.excluded("/a/gen/out"));
+    EXPECT_TRUE(excludes.excluded("/a/b/gen/out"));
+    EXPECT_FALSE(excludes.excluded("/agen/out"));
+    // `/**/` matches zero or more levels
+    EXPECT_TRUE(excludes.excluded("/doc/html"));
+    EXPECT_TRUE(excludes.excluded("/doc/a/html"));
+    EXPECT_TRUE(excludes.excluded("/doc/a/b/html"));
+    EXPECT_FALSE(excludes.excluded("/doc/ahtml"));
+    EXPECT_FALSE(excludes.excluded("/xdoc/html"));
+    // `*` does not cross levels
+    EXPECT_TRUE(excludes.excluded("/src/a"));
+    EXPECT_FALSE(excludes.excluded("/src/a/b"));
+    // trailing `/**` matches the content only
+    EXPECT_FALSE(excludes.excluded("/tmp"));
+    EXPECT_TRUE(excludes.excluded("/tmp/a"));
+    EXPECT_TRUE(excludes.excluded("/tmp/a/b"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, Negated)
+{
+    Excludes excludes{};
+    excludes.add("build*");
+    excludes.add("!build-keep");
+    EXPECT_TRUE(excludes.excluded("/build"));
+    EXPECT_FALSE(excludes.excluded("/build-keep"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, InsideExcluded)
+{
+    Excludes excludes{};
+    excludes.add("build");
+    EXPECT_FALSE(excludes.inside_excluded("/build"));
+    EXPECT_TRUE(excludes.inside_excluded("/build/x"));
+    EXPECT_TRUE(excludes.inside_excluded("/a/build/x/y"));
+    EXPECT_FALSE(excludes.inside_excluded("/a/x/y"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, ExcludedAncestor)
+{
+    Excludes excludes{};
+    excludes.add("build");
+    excludes.add("x");
+    EXPECT_FALSE(excludes.excluded_ancestor("/build").has_value());
+    EXPECT_EQ(excludes.excluded_ancestor("/a/build/f"), "/a/build");
+    // the outermost one
+    EXPECT_EQ(excludes.excluded_ancestor("/a/build/x/y"), "/a/build");
+    EXPECT_FALSE(excludes.excluded_ancestor("/a/y/f").has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Excludes, Load)
+{
+    const auto file = fs::temp_directory_path() / fs::unique_path();
+    std::ofstream{file.native()} << "# generated\nbuild/\r\n\n!build-keep\n";
+    Excludes excludes{};
+    excludes.load(file);
+    fs::remove(file);
+    EXPECT_TRUE(excludes.excluded("/build"));
+    EXPECT_FALSE(excludes.excluded("/build-keep"));
+
+    EXPECT_THROW(excludes.load(file), std::system_error);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
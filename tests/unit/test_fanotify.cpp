@@ -0,0 +1,102 @@
+/// Test the fanotify filesystem watching.
+///
+/// @file
+
+#include <memory>
+#include <system_error>
+
+#include <sys/inotify.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/fanotify.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+using server::FanotifySession;
+
+//==========================================================================
+
+class FanotifySessionTest : public TempDirectoryTest
+{
+protected:
+    static constexpr uint32_t EVENTS{IN_MODIFY | IN_ATTRIB};
+
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        fs::create_directories(m_directory / "watched" / "a");
+        try
+        {
+            m_session = std::make_unique<FanotifySession>(m_directory / "watched", EVENTS);
+        }
+        catch (const std::system_error& err)
+        {
+            GTEST_SKIP() << "fanotify not permitted: " << err.what();
+        }
+    }
+
+    void TearDown() override
+    {
+        m_session.reset();
+        TempDirectoryTest::TearDown();
+    }
+
+    std::unique_ptr<FanotifySession> m_session{};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(FanotifySessionTest, Created)
+{
+    fs::create_directories(m_directory / "watched" / "a" / "b");
+    EXPECT_THAT(event_paths(*m_session, IN_CREATE), t::ElementsAre("/a/b"));
+    touch("watched/a/b/f");
+    EXPECT_THAT(event_paths(*m_session, IN_CREATE), t::ElementsAre("/a/b/f"));
+    touch("outside");
+    EXPECT_TRUE(event_paths(*m_session, IN_CREATE).empty());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(FanotifySessionTest, Deleted)
+{
+    touch("watched/a/f");
+    event_paths(*m_session, IN_CREATE);
+    fs::remove_all(m_directory / "watched" / "a");
+    EXPECT_THAT(event_paths(*m_session, IN_DELETE), t::ElementsAre("/a/f", "/a"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(FanotifySessionTest, Moved)
+{
+    fs::rename(m_directory / "watched" / "a", m_directory / "watched" / "x");
+    const auto events = m_session->read(std::chrono::milliseconds{100});
+    ASSERT_EQ(events.size(), 2u);
+    EXPECT_EQ(events[0].mask, IN_MOVED_FROM | IN_ISDIR);
+    EXPECT_EQ(events[0].path, "/a");
+    EXPECT_EQ(events[1].mask, IN_MOVED_TO | IN_ISDIR);
+    EXPECT_EQ(events[1].path, "/x");
+    EXPECT_EQ(events[0].cookie, events[1].cookie);
+
+    touch("watched/x/f");
+    EXPECT_THAT(event_paths(*m_session, IN_CREATE), t::ElementsAre("/x/f"));
+
+    // moved out
+    fs::rename(m_directory / "watched" / "x", m_directory / "x");
+    EXPECT_THAT(event_paths(*m_session, IN_MOVE), t::ElementsAre("/x"));
+    touch("x/g");
+    EXPECT_TRUE(event_paths(*m_session, IN_CREATE).empty());
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,153 @@
+/// Test the recursive inotify watching.
+///
+/// @file
+
+#include <sys/inotify.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/inotify.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+using server::InotifySession;
+
+//==========================================================================
+
+class InotifySessionTest : public TempDirectoryTest
+{
+protected:
+    static constexpr uint32_t EVENTS{IN_MODIFY | IN_ATTRIB};
+
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        fs::create_directories(m_directory / "a" / "aa");
+        fs::create_directories(m_directory / "b");
+    }
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, Watch)
+{
+    InotifySession session{m_directory, EVENTS};
+    EXPECT_EQ(session.watches_count(), 4u);
+    EXPECT_TRUE(session.read(std::chrono::milliseconds{0}).empty());
+
+    touch("a/aa/f");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/a/aa/f"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, Created)
+{
+    InotifySession session{m_directory, EVENTS};
+
+    fs::create_directories(m_directory / "c");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/c"));
+    EXPECT_EQ(session.watches_count(), 5u);
+
+    fs::create_directories(m_directory / "c" / "cc");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/c/cc"));
+    touch("c/cc/f");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/c/cc/f"));
+    EXPECT_EQ(session.watches_count(), 6u);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, Deleted)
+{
+    InotifySession session{m_directory, EVENTS};
+
+    fs::remove_all(m_directory / "a");
+    EXPECT_THAT(event_paths(session, IN_DELETE), t::ElementsAre("/a/aa", "/a"));
+    EXPECT_EQ(session.watches_count(), 2u);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, Moved)
+{
+    InotifySession session{m_directory, EVENTS};
+
+    fs::rename(m_directory / "a", m_directory / "b" / "x");
+    EXPECT_THAT(event_paths(session, IN_MOVE), t::ElementsAre("/a", "/b/x"));
+    EXPECT_EQ(session.watches_count(), 4u);
+
+    touch("b/x/aa/f");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/b/x/aa/f"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, MovedOut)
+{
+    fs::create_directories(m_directory / "watched");
+    InotifySession session{m_directory / "watched", EVENTS};
+    fs::create_directories(m_directory / "watched" / "c" / "cc");
+    event_paths(session, IN_CREATE);
+    fs::create_directories(m_directory / "watched" / "c" / "cc" / "ccc");
+    event_paths(session, IN_CREATE);
+    EXPECT_EQ(session.watches_count(), 4u);
+
+    fs::rename(m_directory / "watched" / "c", m_directory / "c");
+    EXPECT_THAT(event_paths(session, IN_MOVE), t::ElementsAre("/c"));
+    EXPECT_EQ(session.watches_count(), 1u);
+    touch("c/cc/f");
+    EXPECT_TRUE(event_paths(session, IN_CREATE).empty());
+
+    // moved in
+    fs::rename(m_directory / "c", m_directory / "watched" / "d");
+    EXPECT_THAT(event_paths(session, IN_MOVE), t::ElementsAre("/d"));
+    EXPECT_EQ(session.watches_count(), 4u);
+    touch("watched/d/cc/ccc/f");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/d/cc/ccc/f"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(InotifySessionTest, Excluded)
+{
+    server::Excludes excludes{};
+    excludes.add("aa");
+    InotifySession session{m_directory, EVENTS, &excludes};
+    EXPECT_EQ(session.watches_count(), 4u);
+
+    // the entries are watched, the subdirectories are not
+    fs::create_directories(m_directory / "b" / "aa");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/b/aa"));
+    fs::create_directories(m_directory / "b" / "aa" / "sub");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/b/aa/sub"));
+    EXPECT_EQ(session.watches_count(), 5u);
+    touch("b/aa/f");
+    EXPECT_THAT(event_paths(session, IN_CREATE), t::ElementsAre("/b/aa/f"));
+    touch("b/aa/sub/f");
+    EXPECT_TRUE(event_paths(session, IN_CREATE).empty());
+
+    // moved to and from an excluded name
+    fs::rename(m_directory / "b" / "aa", m_directory / "b" / "x");
+    EXPECT_THAT(event_paths(session, IN_MOVE), t::ElementsAre("/b/aa", "/b/x"));
+    EXPECT_EQ(session.watches_count(), 6u);
+    fs::rename(m_directory / "b" / "x", m_directory / "a" / "aa2");
+    event_paths(session, IN_MOVE);
+    EXPECT_EQ(session.watches_count(), 6u);
+    fs::rename(m_directory / "a" / "aa2", m_directory / "b" / "aa");
+    event_paths(session, IN_MOVE);
+    EXPECT_EQ(session.watches_count(), 5u);
+    touch("b/aa/sub/g");
+    EXPECT_TRUE(event_paths(session, IN_CREATE).empty());
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,53 @@
+/// Test memory pressure parsing.
+///
+/// @file
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/pressure.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+TEST(Pressure, Psi)
+{
+    EXPECT_FALSE(client::parse_psi_some_avg10("").has_value());
+    EXPECT_FALSE(client::parse_psi_some_avg10("full avg10=1.00 avg60=0.00").has_value());
+
+    const auto avg10 = client::parse_psi_some_avg10(
+        "some avg10=12.50 avg60=3.10 avg300=0.70 total=123456\n"
+        "full avg10=1.00 avg60=0.00 avg300=0.00 total=1234\n");
+    ASSERT_TRUE(avg10.has_value());
+    EXPECT_DOUBLE_EQ(*avg10, 12.5);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Pressure, MemoryEvents)
+{
+    EXPECT_FALSE(client::parse_memory_events("").has_value());
+    EXPECT_FALSE(client::parse_memory_events("low 5\noom 1\n").has_value());
+
+    const auto events
+        = client::parse_memory_events("low 0\nhigh 12\nmax 3\noom 1\noom_kill 0\n");
+    ASSERT_TRUE(events.has_value());
+    EXPECT_EQ(*events, 15);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Pressure, CgroupPath)
+{
+    EXPECT_FALSE(client::parse_cgroup_path("").has_value());
+    EXPECT_FALSE(client::parse_cgroup_path("4:memory:/user\n").has_value());
+
+    EXPECT_EQ(client::parse_cgroup_path("0::/user.slice/app.scope\n"),
+              "/user.slice/app.scope");
+    EXPECT_EQ(client::parse_cgroup_path("12:pids:/x\n0::/\n"), "/");
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,184 @@
+/// Test the server tree scanner.
+///
+/// @file
+
+#include <algorithm>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <boost/range/iterator_range.hpp>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/scanner.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+
+//==========================================================================
+
+class ScannerTest : public TempDirectoryTest
+{
+protected:
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        fs::create_directories(m_directory / "a" / "aa" / "aaa");
+        fs::create_directories(m_directory / "b");
+        fs::create_directories(m_directory / "c" / "cc");
+        touch("f1", "12345");
+        touch("a/f2", "1");
+        touch("a/aa/aaa/f3", "123");
+        fs::create_symlink("a", m_directory / "l");
+    }
+
+    /// Names in the order of `directory_iterator`.
+    static std::vector<std::string> iterated(const fs::path& path)
+    {
+        std::vector<std::string> names{};
+        for (const auto& entry: boost::make_iterator_range(fs::directory_iterator{path}, {}))
+        {
+            names.push_back(entry.path().filename().native());
+        }
+        return names;
+    }
+
+    static std::vector<std::string> names_of(const std::vector<server::ScanNode>& nodes)
+    {
+        std::vector<std::string> names{};
+        for (const auto& node: nodes)
+        {
+            names.push_back(node.name);
+        }
+        return names;
+    }
+
+    /// Compare with the attributes by `lstat()` and the order by
+    /// `directory_iterator` recursively.
+    void expect_same(const server::ScanNode& node, const fs::path& path)
+    {
+        struct stat st{};
+        ASSERT_EQ(lstat(path.c_str(), &st), 0);
+        EXPECT_EQ(node.stat_errno, 0);
+        EXPECT_EQ(node.st.st_mode, st.st_mode) << path;
+        EXPECT_EQ(node.st.st_size, st.st_size) << path;
+        EXPECT_EQ(node.st.st_mtim.tv_sec, st.st_mtim.tv_sec) << path;
+        EXPECT_EQ(node.st.st_mtim.tv_nsec, st.st_mtim.tv_nsec) << path;
+        EXPECT_EQ(node.st.st_ctim.tv_sec, st.st_ctim.tv_sec) << path;
+        EXPECT_EQ(node.st.st_ctim.tv_nsec, st.st_ctim.tv_nsec) << path;
+        if (S_ISDIR(st.st_mode) and not node.unloaded)
+        {
+            EXPECT_EQ(names_of(node.children), iterated(path));
+            for (const auto& child: node.children)
+            {
+                expect_same(child, path / child.name);
+            }
+        }
+        else
+        {
+            EXPECT_TRUE(node.children.empty());
+        }
+    }
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(ScannerTest, Scan)
+{
+    for (const unsigned threads: {1u, 2u, 8u})
+    {
+        server::Scanner scanner{threads};
+        const auto root = scanner.scan(m_directory, server::UNLIMITED_DEPTH);
+        EXPECT_EQ(root.name, m_directory.filename().native());
+        EXPECT_FALSE(root.unloaded);
+        expect_same(root, m_directory);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ScannerTest, Scan_Depth)
+{
+    server::Scanner scanner{2};
+    const auto root = scanner.scan(m_directory, 2);
+    expect_same(root, m_directory);
+
+    const auto a = std::find_if(root.children.begin(), root.children.end(),
+                                [](const auto& node) { return node.name == "a"; });
+    ASSERT_NE(a, root.children.end());
+    EXPECT_FALSE(a->unloaded);
+    const auto aa = std::find_if(a->children.begin(), a->children.end(),
+                                 [](const auto& node) { return node.name == "aa"; });
+    ASSERT_NE(aa, a->children.end());
+    EXPECT_TRUE(aa->unloaded);
+    EXPECT_TRUE(aa->children.empty());
+
+    EXPECT_TRUE(scanner.scan(m_directory, 0).unloaded);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ScannerTest, Scan_Excluded)
+{
+    server::Excludes excludes{};
+    excludes.add("aa");
+    server::Scanner scanner{2, &excludes};
+    const auto root = scanner.scan(m_directory, server::UNLIMITED_DEPTH);
+    const auto a = std::find_if(root.children.begin(), root.children.end(),
+                                [](const auto& node) { return node.name == "a"; });
+    ASSERT_NE(a, root.children.end());
+    EXPECT_FALSE(a->unloaded);
+    const auto aa = std::find_if(a->children.begin(), a->children.end(),
+                                 [](const auto& node) { return node.name == "aa"; });
+    ASSERT_NE(aa, a->children.end());
+    EXPECT_TRUE(aa->unloaded);
+    EXPECT_TRUE(aa->children.empty());
+
+    // on demand
+    const auto loaded = scanner.scan(m_directory / "a" / "aa", server::UNLIMITED_DEPTH,
+                                     "/a/aa");
+    EXPECT_FALSE(loaded.unloaded);
+    EXPECT_THAT(names_of(loaded.children), t::ElementsAre("aaa"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ScannerTest, Scan_File)
+{
+    server::Scanner scanner{};
+    const auto node = scanner.scan(m_directory / "f1", server::UNLIMITED_DEPTH);
+    EXPECT_EQ(node.name, "f1");
+    EXPECT_TRUE(S_ISREG(node.st.st_mode));
+    EXPECT_EQ(node.st.st_size, 5);
+    EXPECT_TRUE(node.children.empty());
+
+    EXPECT_NE(scanner.scan(m_directory / "nonexistent", 1).stat_errno, 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ScannerTest, List)
+{
+    EXPECT_EQ(names_of(server::Scanner::list(m_directory)), iterated(m_directory));
+    EXPECT_THROW(server::Scanner::list(m_directory / "f1"), std::system_error);
+    EXPECT_THROW(server::Scanner::list(m_directory / "nonexistent"), std::system_error);
+
+    server::Scanner scanner{4};
+    const auto listings
+        = scanner.list(m_directory, {"c", "", "a/aa", "nonexistent", "a"});
+    ASSERT_EQ(listings.size(), 5u);
+    EXPECT_THAT(names_of(listings[0]), t::ElementsAre("cc"));
+    EXPECT_EQ(names_of(listings[1]), iterated(m_directory));
+    EXPECT_THAT(names_of(listings[2]), t::ElementsAre("aaa"));
+    EXPECT_TRUE(listings[3].empty());
+    EXPECT_EQ(names_of(listings[4]), iterated(m_directory / "a"));
+    EXPECT_FALSE(listings[4][0].unloaded);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,228 @@
+/// Test the server side copy of the served tree.
+///
+/// @file
+
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/server/served_tree.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace fs = boost::filesystem;
+using server::ServedTree;
+
+//==========================================================================
+
+class ServedTreeTest : public TempDirectoryTest
+{
+protected:
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        fs::create_directories(m_directory / "a" / "aa");
+        touch("a/f1", "12345");
+    }
+
+    ServedTree::Change change(const messages::ChangeType type, const ServedTree::Path& path,
+                              const ServedTree::Path& new_path = {})
+    {
+        ServedTree::Change change{type, path, new_path, {}};
+        struct stat st{};
+        const auto& current = new_path.empty() ? path : new_path;
+        if (lstat((m_directory / current.relative_path()).c_str(), &st) == 0)
+        {
+            copy(st, change.st);
+        }
+        return change;
+    }
+
+    static std::vector<std::string> paths_of(const std::vector<ServedTree::Change>& changes)
+    {
+        std::vector<std::string> paths{};
+        for (const auto& change: changes)
+        {
+            paths.push_back(change.path.native());
+        }
+        return paths;
+    }
+
+    server::Scanner m_scanner{2};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, Rescan)
+{
+    ServedTree served{m_directory};
+    EXPECT_FALSE(served.get().tree);
+    EXPECT_FALSE(served.changes_since(1).has_value());
+
+    served.rescan(m_scanner, 10);
+    const auto version = served.get();
+    ASSERT_TRUE(version.tree);
+    EXPECT_EQ(version.generation, 10u);
+    EXPECT_EQ(version.tree->size(), 4u);
+    EXPECT_TRUE(S_ISDIR(version.tree->get_root().st.st_mode));
+    EXPECT_TRUE(S_ISDIR(version.tree->get_node("/a/aa").st.st_mode));
+    EXPECT_EQ(version.tree->get_node("/a/f1").st.st_size, 5);
+
+    const auto delta = served.changes_since(10);
+    ASSERT_TRUE(delta.has_value());
+    EXPECT_EQ(delta->generation, 10u);
+    EXPECT_TRUE(delta->changes.empty());
+    // before the tree was read
+    EXPECT_FALSE(served.changes_since(9).has_value());
+    // unknown
+    EXPECT_FALSE(served.changes_since(11).has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, Apply)
+{
+    ServedTree served{m_directory};
+    served.rescan(m_scanner, 10);
+    const auto old_version = served.get();
+
+    fs::create_directories(m_directory / "b" / "bb");
+    touch("b/bb/f2");
+    served.apply({change(messages::ChangeType::Created, "/b")}, 12, m_scanner);
+
+    fs::rename(m_directory / "a" / "f1", m_directory / "b" / "f1");
+    fs::remove(m_directory / "a" / "aa");
+    served.apply({change(messages::ChangeType::Renamed, "/a/f1", "/b/f1"),
+                  change(messages::ChangeType::Deleted, "/a/aa")},
+                 15, m_scanner);
+
+    const auto version = served.get();
+    EXPECT_EQ(version.generation, 15u);
+    EXPECT_TRUE(version.tree->exists("/b/bb/f2"));
+    EXPECT_EQ(version.tree->get_node("/b/f1").st.st_size, 5);
+    EXPECT_FALSE(version.tree->exists("/a/f1"));
+    EXPECT_FALSE(version.tree->exists("/a/aa"));
+    // older versions are not affected
+    EXPECT_TRUE(old_version.tree->exists("/a/f1"));
+    EXPECT_FALSE(old_version.tree->exists("/b"));
+
+    EXPECT_THAT(paths_of(served.changes_since(10)->changes),
+                t::ElementsAre("/b", "/a/f1", "/a/aa"));
+    EXPECT_THAT(paths_of(served.changes_since(12)->changes),
+                t::ElementsAre("/a/f1", "/a/aa"));
+    EXPECT_THAT(paths_of(served.changes_since(13)->changes),
+                t::ElementsAre("/a/f1", "/a/aa"));
+    EXPECT_TRUE(served.changes_since(15)->changes.empty());
+    EXPECT_EQ(served.changes_since(10)->generation, 15u);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, Apply_Inconsistent)
+{
+    ServedTree served{m_directory};
+    served.rescan(m_scanner, 10);
+
+    fs::create_directories(m_directory / "c");
+    // the parent is unknown, the tree is read again
+    served.apply({change(messages::ChangeType::Created, "/x/y")}, 11, m_scanner);
+
+    EXPECT_EQ(served.get().generation, 11u);
+    EXPECT_TRUE(served.get().tree->exists("/c"));
+    EXPECT_FALSE(served.changes_since(10).has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, Apply_Hashes)
+{
+    ServedTree served{m_directory};
+    served.rescan(m_scanner, 10);
+    const auto old_version = served.get();
+    EXPECT_NE(old_version.tree->get_root().hash, UNKNOWN_HASH);
+
+    fs::create_directories(m_directory / "b" / "bb");
+    touch("a/aa/f2");
+    fs::rename(m_directory / "a" / "f1", m_directory / "b" / "bb" / "f1");
+    served.apply({change(messages::ChangeType::Created, "/b"),
+                  change(messages::ChangeType::Created, "/a/aa/f2"),
+                  change(messages::ChangeType::Modified, "/a/aa"),
+                  change(messages::ChangeType::Deleted, "/a/f1"),
+                  change(messages::ChangeType::Modified, "/a"),
+                  change(messages::ChangeType::Modified, "/")},
+                 11, m_scanner);
+
+    // the same as if read from scratch
+    ServedTree scanned{m_directory};
+    scanned.rescan(m_scanner, 1);
+    const auto version = served.get();
+    const auto expected = scanned.get();
+    EXPECT_NE(version.tree->get_root().hash, old_version.tree->get_root().hash);
+    for (const auto* path: {"/", "/a", "/a/aa", "/b", "/b/bb"})
+    {
+        EXPECT_EQ(version.tree->get_node(path).hash, expected.tree->get_node(path).hash)
+            << path;
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, Excluded)
+{
+    server::Excludes excludes{};
+    excludes.add("aa");
+    excludes.add("bb");
+    const server::Scanner scanner{2, &excludes};
+    ServedTree served{m_directory, &excludes};
+    served.rescan(scanner, 10);
+    EXPECT_TRUE(served.get().tree->get_node("/a/aa").unloaded);
+
+    fs::create_directories(m_directory / "b" / "bb" / "bbb");
+    fs::create_directories(m_directory / "c" / "cc");
+    served.apply({change(messages::ChangeType::Created, "/b")}, 11, scanner);
+    // into and out of the excluded
+    fs::rename(m_directory / "c", m_directory / "b" / "bb" / "c");
+    fs::rename(m_directory / "a" / "aa", m_directory / "a" / "x");
+    served.apply({change(messages::ChangeType::Deleted, "/c"),
+                  change(messages::ChangeType::Renamed, "/a/aa", "/a/x")},
+                 12, scanner);
+
+    const auto version = served.get();
+    EXPECT_TRUE(version.tree->get_node("/b/bb").unloaded);
+    EXPECT_FALSE(version.tree->exists("/b/bb/bbb"));
+    EXPECT_FALSE(version.tree->get_node("/a/x").unloaded);
+    EXPECT_TRUE(version.tree->exists("/a/x"));
+    EXPECT_EQ(version.tree->get_node("/b/bb").hash, UNKNOWN_HASH);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(ServedTreeTest, JournalLimits)
+{
+    ServedTree served{m_directory};
+    served.rescan(m_scanner, 1);
+
+    const std::vector<ServedTree::Change> batch(ServedTree::MAX_DELTA_CHANGES,
+                                                change(messages::ChangeType::Modified, "/a"));
+    const auto batches = ServedTree::MAX_JOURNAL_CHANGES / ServedTree::MAX_DELTA_CHANGES;
+    for (uint64_t generation = 2; generation < batches + 3; ++generation)
+    {
+        served.apply(batch, generation, m_scanner);
+    }
+
+    // truncated
+    EXPECT_FALSE(served.changes_since(1).has_value());
+    // too long
+    EXPECT_FALSE(served.changes_since(batches).has_value());
+    EXPECT_EQ(served.changes_since(batches + 1)->changes.size(),
+              ServedTree::MAX_DELTA_CHANGES);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
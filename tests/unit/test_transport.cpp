@@ -357,5 +357,32 @@ TEST(Deserializer, ProcessWantedMessage_ConsumeAfterProcess)
     }
 }
 
+//--------------------------------------------------------------------------
+
+TEST(Deserializer, ProcessStream_ConsumeInOrder)
+{
+    Deserializer deserializer{};
+
+    for (const int32_t value: {1, 2, 3})
+    {
+        flatbuffers::FlatBufferBuilder fbb{};
+        const auto cmd = messages::CreateResultErrno(fbb, value);
+        const auto frame = make_frame(fbb, 4, cmd);
+        fbb.Finish(frame);
+        deserializer.process_frame(
+            {fbb.GetBufferPointer(), fbb.GetBufferPointer() + fbb.GetSize()});
+    }
+
+    for (const int32_t value: {1, 2, 3})
+    {
+        const auto result = deserializer.wait_for_result<rmsg::ResultErrno>(
+            MessageId{4}, std::chrono::milliseconds{1});
+        ASSERT_TRUE(result.is_valid());
+        EXPECT_EQ(result.message().res_errno(), value);
+    }
+    EXPECT_FALSE(deserializer.wait_for_result<rmsg::ResultErrno>(
+        MessageId{4}, std::chrono::milliseconds{1}).is_valid());
+}
+
 //==========================================================================
 } // namespace rewofs::tests
@@ -0,0 +1,592 @@
+/// Test the metadata tree.
+///
+/// @file
+
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/tree.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+
+//==========================================================================
+
+TEST(Tree, GetNode_Root)
+{
+    Tree tree{};
+    EXPECT_NO_THROW(tree.get_node("/"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, GetNode_NonexistentInRoot)
+{
+    Tree tree{};
+    EXPECT_THROW(tree.get_node("/nonexistent"), std::system_error);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, MakeNode_GetNode)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& some = tree.make_node(root, "some");
+    EXPECT_NO_THROW(tree.get_node("/some"));
+    tree.make_node(root, "some2");
+    EXPECT_NO_THROW(tree.get_node("/some2"));
+    tree.make_node(some, "sub");
+    EXPECT_NO_THROW(tree.get_node("/some/sub"));
+    EXPECT_THROW(tree.get_node("/some/sub2"), std::system_error);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, Exchange)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& node_a = tree.make_node(root, "node_a");
+    node_a.st.st_size = 100;
+    auto& node_b = tree.make_node(root, "node_b");
+    node_b.st.st_size = 1000;
+
+    tree.exchange("/node_a", "/node_b");
+
+    EXPECT_EQ(tree.get_node("/node_a").st.st_size, 1000);
+    EXPECT_EQ(tree.get_node("/node_b").st.st_size, 100);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeRoot)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    tree.make_node(root, "node_a");
+
+    EXPECT_THROW(tree.exchange("/", "/node_a"), std::exception);
+    EXPECT_THROW(tree.exchange("/node_a", "/"), std::exception);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeTheSame)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    tree.make_node(root, "node_a");
+
+    EXPECT_THROW(tree.exchange("/node_a", "/node_a"), std::exception);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeDifferentDirectory)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& node_a = tree.make_node(root, "node_a");
+    node_a.st.st_size = 100;
+    auto& subdir = tree.make_node(root, "subdir");
+    auto& node_b = tree.make_node(subdir, "node_b");
+    node_b.st.st_size = 1000;
+
+    tree.exchange("/node_a", "/subdir/node_b");
+
+    EXPECT_EQ(tree.get_node("/node_a").st.st_size, 1000);
+    EXPECT_EQ(tree.get_node("/subdir/node_b").st.st_size, 100);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeDirectories)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& subdir_a = tree.make_node(root, "sub_a");
+    auto& node_a = tree.make_node(subdir_a, "node_a");
+    node_a.st.st_size = 100;
+    auto& subdir_b = tree.make_node(root, "sub_b");
+    auto& node_b = tree.make_node(subdir_b, "node_b");
+    node_b.st.st_size = 1000;
+
+    tree.exchange("/sub_a", "/sub_b");
+
+    EXPECT_EQ(tree.get_node("/sub_a/node_b").st.st_size, 1000);
+    EXPECT_EQ(tree.get_node("/sub_b/node_a").st.st_size, 100);
+    EXPECT_THROW(tree.get_node("/sub_a/node_a"), std::exception);
+    EXPECT_THROW(tree.get_node("/sub_b/node_b"), std::exception);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeMissing)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    tree.make_node(root, "node_a");
+
+    EXPECT_THROW(tree.exchange("/nonexistent1", "/nonexistent2"), std::exception);
+    EXPECT_THROW(tree.exchange("/node_a", "/nonexistent"), std::exception);
+    EXPECT_THROW(tree.exchange("/nonexistent", "/node_a"), std::exception);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeSubDirectory)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& s1 = tree.make_node(root, "s1");
+    tree.make_node(s1, "s2");
+
+    EXPECT_THROW(tree.exchange("/", "/s1/s2"), std::exception);
+    EXPECT_THROW(tree.exchange("/s1/s2", "/"), std::exception);
+    EXPECT_THROW(tree.exchange("/s1", "/s1/s2"), std::exception);
+    EXPECT_THROW(tree.exchange("/s1/s2", "/s1"), std::exception);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, RemoveSingle)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& dir = tree.make_node(root, "dir");
+    tree.make_node(dir, "file");
+
+    EXPECT_THROW(tree.remove_single("/"), std::system_error);
+    EXPECT_THROW(tree.remove_single("/nonexistent"), std::system_error);
+    EXPECT_THROW(tree.remove_single("/dir"), std::system_error);
+    tree.remove_single("/dir/file");
+    EXPECT_THROW(tree.get_node("/dir/file"), std::system_error);
+    tree.remove_single("/dir");
+    EXPECT_THROW(tree.get_node("/dir"), std::system_error);
+    EXPECT_EQ(tree.size(), 1);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, RemoveSubtree)
+{
+    Tree tree{};
+    tree.make_node("/a");
+    tree.make_node("/a/b");
+    tree.make_node("/a/b/c");
+    tree.make_node("/a/d");
+    tree.make_node("/e");
+    const auto size = tree.size();
+
+    EXPECT_THROW(tree.remove("/"), std::system_error);
+    EXPECT_THROW(tree.remove("/x"), std::system_error);
+    tree.remove("/a");
+
+    EXPECT_EQ(tree.size(), size - 4);
+    EXPECT_FALSE(tree.exists("/a"));
+    EXPECT_FALSE(tree.exists("/a/b/c"));
+    EXPECT_TRUE(tree.exists("/e"));
+    EXPECT_EQ(tree.children_count(tree.get_root()), 1);
+
+    tree.make_node("/a");
+    EXPECT_EQ(tree.children_count(tree.get_node("/a")), 0);
+    EXPECT_FALSE(tree.exists("/a/b"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, Rename)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& dir = tree.make_node(root, "dir");
+    tree.make_node(dir, "file").st.st_size = 100;
+    tree.make_node(root, "other");
+
+    tree.rename("/dir", "/other/moved");
+
+    EXPECT_THROW(tree.get_node("/dir"), std::system_error);
+    EXPECT_EQ(tree.get_node("/other/moved/file").st.st_size, 100);
+    EXPECT_EQ(tree.get_name(tree.get_node("/other/moved")), "moved");
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, RenameInvalid)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& dir = tree.make_node(root, "dir");
+    tree.make_node(dir, "sub");
+    tree.make_node(root, "file");
+
+    EXPECT_THROW(tree.rename("/nonexistent", "/x"), std::system_error);
+    EXPECT_THROW(tree.rename("/file", "/dir/sub"), std::system_error);
+    EXPECT_THROW(tree.rename("/dir", "/dir/sub/x"), std::system_error);
+    EXPECT_THROW(tree.rename("/", "/x"), std::system_error);
+    EXPECT_NO_THROW(tree.get_node("/dir/sub"));
+    EXPECT_NO_THROW(tree.get_node("/file"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ForEachChild_Sorted)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    tree.make_node(root, "c");
+    tree.make_node(root, "a");
+    tree.make_node(root, "b");
+
+    std::vector<std::string> names{};
+    tree.for_each_child(root, [&names](const auto name, const auto&) {
+        names.emplace_back(name);
+    });
+    EXPECT_THAT(names, t::ElementsAre("a", "b", "c"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, LargeFanOut)
+{
+    static constexpr int COUNT{1000};
+
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& dir = tree.make_node(root, "dir");
+    for (int i = 0; i < COUNT; ++i)
+    {
+        tree.make_node(dir, "f" + std::to_string(i)).st.st_size = i;
+    }
+    EXPECT_EQ(tree.children_count(dir), COUNT);
+
+    for (int i = 0; i < COUNT; i += 2)
+    {
+        tree.remove_single("/dir/f" + std::to_string(i));
+    }
+    for (int i = 1; i < COUNT; i += 2)
+    {
+        EXPECT_EQ(tree.get_node("/dir/f" + std::to_string(i)).st.st_size, i);
+    }
+    EXPECT_THROW(tree.get_node("/dir/f0"), std::system_error);
+
+    // shrink back below the hashing threshold
+    for (int i = 1; i < COUNT - 20; i += 2)
+    {
+        tree.rename("/dir/f" + std::to_string(i), "/f" + std::to_string(i));
+    }
+    EXPECT_EQ(tree.children_count(dir), 10);
+    EXPECT_EQ(tree.get_node("/dir/f999").st.st_size, 999);
+    EXPECT_EQ(tree.get_node("/f1").st.st_size, 1);
+
+    size_t visited{0};
+    tree.for_each_child(tree.get_root(), [&visited](const auto, const auto&) {
+        ++visited;
+    });
+    EXPECT_EQ(visited, COUNT / 2 - 10 + 1);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, PathIndex_RenameSubtree)
+{
+    Tree tree{};
+    auto& root = tree.get_root();
+    auto& a = tree.make_node(root, "a");
+    auto& b = tree.make_node(a, "b");
+    tree.make_node(b, "c").st.st_size = 7;
+    tree.make_node(root, "x");
+
+    tree.rename("/a", "/x/a2");
+
+    EXPECT_THROW(tree.get_node("/a/b/c"), std::system_error);
+    EXPECT_THROW(tree.get_node("/a/b"), std::system_error);
+    EXPECT_EQ(tree.get_node("/x/a2/b/c").st.st_size, 7);
+    EXPECT_EQ(tree.get_node("//x/a2//b/c/").st.st_size, 7);
+
+    // the old paths can be reused
+    tree.make_node("/a");
+    tree.make_node("/a/b");
+    EXPECT_THROW(tree.get_node("/a/b/c"), std::system_error);
+    EXPECT_EQ(tree.children_count(tree.get_node("/a/b")), 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, PathIndex_ExchangeSubtrees)
+{
+    Tree tree{};
+    tree.make_node("/p");
+    tree.make_node("/p/q");
+    tree.make_node("/p/q/r").st.st_size = 1;
+    tree.make_node("/s");
+    tree.make_node("/s/t").st.st_size = 2;
+
+    tree.exchange("/p", "/s");
+
+    EXPECT_EQ(tree.get_node("/s/q/r").st.st_size, 1);
+    EXPECT_EQ(tree.get_node("/p/t").st.st_size, 2);
+    EXPECT_THROW(tree.get_node("/p/q/r"), std::system_error);
+    EXPECT_THROW(tree.get_node("/s/t"), std::system_error);
+
+    // parents are consistent, removal through the new paths works
+    tree.remove_single("/s/q/r");
+    tree.remove_single("/s/q");
+    tree.rename("/p/t", "/s/t");
+    EXPECT_EQ(tree.get_node("/s/t").st.st_size, 2);
+    EXPECT_EQ(tree.children_count(tree.get_node("/p")), 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, PathIndex_Many)
+{
+    Tree tree{};
+    for (int d = 0; d < 50; ++d)
+    {
+        const auto dir = "/d" + std::to_string(d);
+        tree.make_node(dir);
+        for (int f = 0; f < 100; ++f)
+        {
+            tree.make_node(dir + "/f" + std::to_string(f)).st.st_size = d * 100 + f;
+        }
+    }
+    for (int d = 0; d < 50; d += 3)
+    {
+        for (int f = 0; f < 100; f += 2)
+        {
+            tree.remove_single("/d" + std::to_string(d) + "/f" + std::to_string(f));
+        }
+    }
+    for (int d = 0; d < 50; ++d)
+    {
+        for (int f = 0; f < 100; ++f)
+        {
+            const auto path = "/d" + std::to_string(d) + "/f" + std::to_string(f);
+            if ((d % 3 == 0) and (f % 2 == 0))
+            {
+                EXPECT_THROW(tree.get_node(path), std::system_error);
+            }
+            else
+            {
+                EXPECT_EQ(tree.get_node(path).st.st_size, d * 100 + f);
+            }
+        }
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, Copy_IsSnapshot)
+{
+    Tree tree{};
+    tree.make_node("/dir");
+    tree.make_node("/dir/file").st.st_size = 10;
+    for (int i = 0; i < 100; ++i)
+    {
+        tree.make_node("/dir/f" + std::to_string(i));
+    }
+
+    const Tree snapshot{tree};
+
+    tree.get_node("/dir/file").st.st_size = 20;
+    tree.rename("/dir", "/renamed");
+    tree.remove_single("/renamed/f0");
+    tree.make_node("/new");
+
+    EXPECT_EQ(snapshot.get_node("/dir/file").st.st_size, 10);
+    EXPECT_NO_THROW(snapshot.get_node("/dir/f0"));
+    EXPECT_EQ(snapshot.children_count(snapshot.get_node("/dir")), 101);
+    EXPECT_THROW(snapshot.get_node("/renamed"), std::system_error);
+    EXPECT_THROW(snapshot.get_node("/new"), std::system_error);
+
+    EXPECT_EQ(tree.get_node("/renamed/file").st.st_size, 20);
+    EXPECT_EQ(tree.children_count(tree.get_node("/renamed")), 100);
+    EXPECT_THROW(tree.get_node("/dir"), std::system_error);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, UnloadedAncestor)
+{
+    Tree tree{};
+    tree.make_node("/a");
+    tree.make_node("/a/b").unloaded = true;
+    tree.make_node("/a/file");
+
+    EXPECT_FALSE(tree.unloaded_ancestor("/a").has_value());
+    EXPECT_FALSE(tree.unloaded_ancestor("/a/file").has_value());
+    EXPECT_FALSE(tree.unloaded_ancestor("/a/x/y").has_value());
+    // the path itself does not count
+    EXPECT_FALSE(tree.unloaded_ancestor("/a/b").has_value());
+    EXPECT_EQ(tree.unloaded_ancestor("/a/b/c"), Tree::Path{"/a/b"});
+    EXPECT_EQ(tree.unloaded_ancestor("/a/b/c/d"), Tree::Path{"/a/b"});
+
+    tree.get_root().unloaded = true;
+    EXPECT_EQ(tree.unloaded_ancestor("/x"), Tree::Path{"/"});
+    EXPECT_EQ(tree.unloaded_ancestor("/a/b/c"), Tree::Path{"/"});
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, ExchangeUnloaded)
+{
+    Tree tree{};
+    tree.make_node("/loaded");
+    tree.make_node("/loaded/file");
+    tree.make_node("/lazy").unloaded = true;
+
+    tree.exchange("/loaded", "/lazy");
+    EXPECT_TRUE(tree.get_node("/loaded").unloaded);
+    EXPECT_EQ(tree.children_count(tree.get_node("/loaded")), 0);
+    EXPECT_EQ(tree.unloaded_ancestor("/loaded/file"), Tree::Path{"/loaded"});
+    EXPECT_FALSE(tree.get_node("/lazy").unloaded);
+    EXPECT_TRUE(tree.exists("/lazy/file"));
+    EXPECT_FALSE(tree.unloaded_ancestor("/lazy/file").has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, Rehash)
+{
+    const auto build = [](Tree& tree, const std::vector<std::string>& dirs) {
+        tree.get_root().st.st_mode = S_IFDIR | 0755;
+        for (const auto& path: dirs)
+        {
+            tree.make_node(path).st.st_mode = S_IFDIR | 0755;
+        }
+        auto& file = tree.make_node("/a/b/f");
+        file.st.st_mode = S_IFREG | 0644;
+        file.st.st_size = 10;
+    };
+    Tree tree{};
+    build(tree, {"/a", "/a/b", "/c", "/d"});
+    tree.rehash_subtree("/");
+    const auto root_hash = tree.get_root().hash;
+    const auto c_hash = tree.get_node("/c").hash;
+    EXPECT_NE(root_hash, UNKNOWN_HASH);
+    EXPECT_NE(tree.get_node("/a").hash, tree.get_node("/a/b").hash);
+    // empty directories
+    EXPECT_EQ(c_hash, tree.get_node("/d").hash);
+
+    // the creation order does not matter
+    Tree other{};
+    build(other, {"/d", "/c", "/a", "/a/b"});
+    other.rehash_subtree("/");
+    EXPECT_EQ(other.get_root().hash, root_hash);
+
+    // a change deep down propagates up to the root
+    tree.get_node("/a/b/f").st.st_size = 11;
+    tree.rehash_ancestors({"/a/b"});
+    EXPECT_NE(tree.get_root().hash, root_hash);
+    EXPECT_EQ(tree.get_node("/c").hash, c_hash);
+    auto full = tree;
+    full.rehash_subtree("/");
+    EXPECT_EQ(full.get_root().hash, tree.get_root().hash);
+    EXPECT_EQ(full.get_node("/a").hash, tree.get_node("/a").hash);
+
+    tree.remove("/d");
+    tree.rehash_ancestors({"/"});
+    EXPECT_NE(tree.get_root().hash, full.get_root().hash);
+
+    tree.get_node("/c").unloaded = true;
+    tree.get_node("/c").hash = UNKNOWN_HASH;
+    tree.rehash_ancestors({"/c", "/x/y", ""});
+    EXPECT_EQ(tree.get_node("/c").hash, UNKNOWN_HASH);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, Rehash_Unloaded)
+{
+    const auto build = [](Tree& tree) {
+        tree.get_root().st.st_mode = S_IFDIR | 0755;
+        tree.make_node("/a").st.st_mode = S_IFDIR | 0755;
+        tree.make_node("/a/b").st.st_mode = S_IFDIR | 0755;
+        tree.make_node("/c").st.st_mode = S_IFDIR | 0755;
+    };
+    Tree server{};
+    build(server);
+    auto& file = server.make_node("/a/b/f");
+    file.st.st_mode = S_IFREG | 0644;
+    file.st.st_size = 10;
+    server.rehash_subtree("/");
+
+    // loaded only to a depth
+    Tree tree{};
+    build(tree);
+    tree.get_node("/a/b").unloaded = true;
+    tree.rehash_subtree("/");
+    EXPECT_EQ(tree.get_node("/a/b").hash, UNKNOWN_HASH);
+    EXPECT_NE(tree.get_node("/a").hash, server.get_node("/a").hash);
+
+    // the reported hash stands for the content not loaded
+    tree.get_node("/a/b").hash = server.get_node("/a/b").hash;
+    tree.rehash_ancestors({"/a/b"});
+    EXPECT_EQ(tree.get_node("/a").hash, server.get_node("/a").hash);
+    EXPECT_EQ(tree.get_root().hash, server.get_root().hash);
+    tree.rehash_subtree("/");
+    EXPECT_EQ(tree.get_node("/a/b").hash, server.get_node("/a/b").hash);
+    EXPECT_EQ(tree.get_root().hash, server.get_root().hash);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Tree, CompactNames)
+{
+    Tree tree{};
+    tree.make_node("/dir");
+    tree.make_node("/dir/file");
+    for (int i = 0; i < 10000; ++i)
+    {
+        const auto name = "/f" + std::to_string(i);
+        tree.make_node(name);
+        tree.rename(name, name + "_renamed");
+        tree.remove_single(name + "_renamed");
+    }
+    const Tree snapshot{tree};
+    EXPECT_GT(tree.get_names().size(), 20000);
+
+    tree.compact_names();
+    // the root, "dir" and "file"
+    EXPECT_EQ(tree.get_names().size(), 3);
+    EXPECT_EQ(tree.get_name(tree.get_node("/dir/file")), "file");
+    EXPECT_NO_THROW(tree.make_node("/dir/f0"));
+    // the copy keeps the old pool
+    EXPECT_EQ(snapshot.get_name(snapshot.get_node("/dir/file")), "file");
+    EXPECT_GT(snapshot.get_names().size(), 20000);
+}
+
+//==========================================================================
+
+TEST(NamePool, Intern)
+{
+    NamePool pool{};
+
+    const auto abc = pool.intern("abc");
+    EXPECT_EQ(pool.intern("abc"), abc);
+    EXPECT_NE(pool.intern("abd"), abc);
+    EXPECT_EQ(pool.view(abc), "abc");
+    EXPECT_EQ(pool.view(pool.intern("")), "");
+    EXPECT_THROW(pool.intern(std::string(300, 'x')), std::system_error);
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        pool.intern(std::to_string(i));
+    }
+    EXPECT_EQ(pool.view(abc), "abc");
+    EXPECT_EQ(pool.view(pool.intern("1234")), "1234");
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,145 @@
+/// Test the columnar tree encoding.
+///
+/// @file
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/tree_codec.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+TEST(TreeCodec, Empty)
+{
+    tree_codec::Encoder encoder{};
+    const auto data = encoder.finish();
+    tree_codec::Decoder decoder{data};
+    EXPECT_FALSE(decoder.next_directory().has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(TreeCodec, RoundTrip)
+{
+    tree_codec::Encoder encoder{};
+    tree_codec::Entry entry{};
+    entry.name = "source_1.cpp";
+    entry.st_mode = S_IFREG | 0644;
+    entry.st_size = 1000;
+    entry.st_mtim = {1500000000, 123};
+    entry.st_ctim = {1500000000, 123};
+    encoder.add(entry);
+    entry.name = "source_10.cpp";
+    entry.st_size = 10;
+    entry.st_mtim = {1400000000, 999999999};
+    entry.st_ctim = {1600000000, 0};
+    encoder.add(entry);
+    encoder.end_directory(true);
+    // empty directory
+    encoder.end_directory(false);
+    entry.name = "s";
+    entry.st_mode = S_IFDIR | 0755;
+    entry.st_size = -1;
+    entry.unloaded = true;
+    encoder.add(entry);
+    encoder.end_directory(false);
+    EXPECT_EQ(encoder.size(), 6);
+
+    const auto data = encoder.finish();
+    EXPECT_EQ(encoder.size(), 0);
+    tree_codec::Decoder decoder{data};
+
+    auto directory = decoder.next_directory();
+    ASSERT_TRUE(directory.has_value());
+    EXPECT_EQ(directory->entries, 2);
+    EXPECT_TRUE(directory->continued);
+    auto decoded = decoder.next_entry();
+    EXPECT_EQ(decoded.name, "source_1.cpp");
+    EXPECT_EQ(decoded.st_mode, S_IFREG | 0644);
+    EXPECT_EQ(decoded.st_size, 1000);
+    EXPECT_EQ(decoded.st_mtim.tv_sec, 1500000000);
+    EXPECT_EQ(decoded.st_mtim.tv_nsec, 123);
+    EXPECT_EQ(decoded.st_ctim.tv_sec, 1500000000);
+    EXPECT_EQ(decoded.st_ctim.tv_nsec, 123);
+    EXPECT_FALSE(decoded.unloaded);
+    decoded = decoder.next_entry();
+    EXPECT_EQ(decoded.name, "source_10.cpp");
+    EXPECT_EQ(decoded.st_size, 10);
+    EXPECT_EQ(decoded.st_mtim.tv_sec, 1400000000);
+    EXPECT_EQ(decoded.st_mtim.tv_nsec, 999999999);
+    EXPECT_EQ(decoded.st_ctim.tv_sec, 1600000000);
+    EXPECT_EQ(decoded.st_ctim.tv_nsec, 0);
+    EXPECT_THROW(decoder.next_entry(), std::system_error);
+
+    directory = decoder.next_directory();
+    ASSERT_TRUE(directory.has_value());
+    EXPECT_EQ(directory->entries, 0);
+    EXPECT_FALSE(directory->continued);
+
+    directory = decoder.next_directory();
+    ASSERT_TRUE(directory.has_value());
+    EXPECT_EQ(directory->entries, 1);
+    decoded = decoder.next_entry();
+    EXPECT_EQ(decoded.name, "s");
+    EXPECT_EQ(decoded.st_mode, S_IFDIR | 0755);
+    EXPECT_EQ(decoded.st_size, -1);
+    EXPECT_TRUE(decoded.unloaded);
+
+    EXPECT_FALSE(decoder.next_directory().has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(TreeCodec, SkipEntries)
+{
+    tree_codec::Encoder encoder{};
+    encoder.add({"a", S_IFREG, 1, {}, {}, false});
+    encoder.add({"b", S_IFREG, 2, {}, {}, false});
+    encoder.end_directory(false);
+    encoder.add({"c", S_IFREG, 3, {}, {}, false});
+    encoder.end_directory(false);
+    const auto data = encoder.finish();
+
+    tree_codec::Decoder decoder{data};
+    ASSERT_TRUE(decoder.next_directory().has_value());
+    ASSERT_TRUE(decoder.next_directory().has_value());
+    const auto decoded = decoder.next_entry();
+    EXPECT_EQ(decoded.name, "c");
+    EXPECT_EQ(decoded.st_size, 3);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(TreeCodec, Malformed)
+{
+    tree_codec::Encoder encoder{};
+    encoder.add({"name", S_IFREG, 1, {}, {}, false});
+    encoder.end_directory(false);
+    const auto data = encoder.finish();
+
+    const auto decode_all = [](const gsl::span<const uint8_t> encoded) {
+        tree_codec::Decoder decoder{encoded};
+        while (decoder.next_directory().has_value())
+        {
+        }
+    };
+    decode_all(data);
+
+    // truncated
+    for (size_t size = 0; size < data.size(); ++size)
+    {
+        EXPECT_THROW(decode_all({data.data(), size}), std::system_error);
+    }
+
+    // trailing garbage in the last column
+    auto longer = data;
+    longer[9] = static_cast<uint8_t>(longer[9] + 1);
+    longer.push_back(0);
+    EXPECT_THROW(decode_all(longer), std::system_error);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
@@ -0,0 +1,98 @@
+/// Test the persisted tree snapshot.
+///
+/// @file
+
+#include <fstream>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/tree_store.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace fs = boost::filesystem;
+
+//==========================================================================
+
+class TreeStoreTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        m_file = fs::temp_directory_path() / fs::unique_path();
+    }
+
+    void TearDown() override
+    {
+        fs::remove(m_file);
+    }
+
+    fs::path m_file{};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(TreeStoreTest, Missing)
+{
+    EXPECT_FALSE(client::cache::load_tree(m_file, "tcp://a").has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(TreeStoreTest, SaveLoad)
+{
+    client::cache::Tree tree{};
+    auto& dir = tree.make_node(tree.get_root(), "dir");
+    dir.st.st_mode = S_IFDIR | 0755;
+    auto& lazy = tree.make_node(dir, "lazy");
+    lazy.unloaded = true;
+    lazy.hash = 1234;
+    auto& file = tree.make_node(dir, "file");
+    file.st.st_mode = S_IFREG | 0644;
+    file.st.st_size = 1234;
+    file.st.st_mtim = {10, 20};
+    file.st.st_ctim = {30, 40};
+    tree.make_node(tree.get_root(), "other");
+
+    client::cache::save_tree(m_file, "tcp://a", {"host:/srv", 7}, tree);
+
+    EXPECT_FALSE(client::cache::load_tree(m_file, "tcp://b").has_value());
+
+    const auto snapshot = client::cache::load_tree(m_file, "tcp://a");
+    ASSERT_TRUE(snapshot.has_value());
+    EXPECT_EQ(snapshot->tag.server_id, "host:/srv");
+    EXPECT_EQ(snapshot->tag.generation, 7);
+    EXPECT_EQ(snapshot->tree.size(), 5);
+    EXPECT_TRUE(snapshot->tree.exists("/other"));
+    EXPECT_TRUE(snapshot->tree.get_node("/dir/lazy").unloaded);
+    EXPECT_EQ(snapshot->tree.get_node("/dir/lazy").hash, 1234);
+    EXPECT_FALSE(snapshot->tree.get_node("/dir").unloaded);
+    const auto& loaded = snapshot->tree.get_node("/dir/file");
+    EXPECT_EQ(loaded.st.st_mode, S_IFREG | 0644);
+    EXPECT_EQ(loaded.st.st_size, 1234);
+    EXPECT_TRUE(client::cache::is_same_content(loaded.st, file.st));
+    EXPECT_EQ(snapshot->tree.get_node("/dir").st.st_mode, S_IFDIR | 0755);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(TreeStoreTest, Damaged)
+{
+    client::cache::Tree tree{};
+    tree.make_node(tree.get_root(), "a");
+    client::cache::save_tree(m_file, "tcp://a", {"id", 1}, tree);
+
+    // cut off the last name
+    fs::resize_file(m_file, fs::file_size(m_file) - 1);
+    EXPECT_FALSE(client::cache::load_tree(m_file, "tcp://a").has_value());
+
+    std::ofstream{m_file.native(), std::ios::trunc} << "garbage";
+    EXPECT_FALSE(client::cache::load_tree(m_file, "tcp://a").has_value());
+}
+
+//==========================================================================
+} // namespace rewofs::tests
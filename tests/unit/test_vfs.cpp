@@ -0,0 +1,890 @@
+/// Test the remote and cached VFS.
+///
+/// @file
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <flatbuffers/flatbuffers.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/cache.hpp"
+#include "rewofs/client/disk_store.hpp"
+#include "rewofs/client/transport.hpp"
+#include "rewofs/client/vfs.hpp"
+#include "rewofs/messages.hpp"
+#include "rewofs/server/excludes.hpp"
+#include "rewofs/server/served_tree.hpp"
+#include "rewofs/server/transport.hpp"
+#include "rewofs/server/watcher.hpp"
+#include "rewofs/server/worker.hpp"
+#include "rewofs/transport.hpp"
+#include "fixtures.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+namespace cache = client::cache;
+using client::CachedVfs;
+using client::IVfs;
+using client::RemoteVfs;
+
+//==========================================================================
+
+/// Answers the commands queued by a RemoteVfs in place of a server.
+class FakeServer
+{
+public:
+    /// @return the reply frame to the command
+    using Handler = std::function<flatbuffers::Offset<messages::Frame>(
+        flatbuffers::FlatBufferBuilder&, const messages::Frame&)>;
+
+    FakeServer(Serializer& serializer, Deserializer& deserializer, Handler handler)
+        : m_serializer{serializer}
+        , m_deserializer{deserializer}
+        , m_handler{std::move(handler)}
+    {
+        m_thread = std::thread{&FakeServer::run, this};
+    }
+
+    ~FakeServer()
+    {
+        m_quit = true;
+        m_thread.join();
+    }
+
+    /// Types of the received commands.
+    std::vector<messages::Message> get_commands() const
+    {
+        std::lock_guard lg{m_mutex};
+        return m_commands;
+    }
+
+private:
+    void run()
+    {
+        while (not m_quit)
+        {
+            if (not m_serializer.wait(std::chrono::milliseconds{10}))
+            {
+                continue;
+            }
+            std::vector<uint8_t> raw_frame{};
+            m_serializer.pop([&raw_frame](const gsl::span<const uint8_t> buf) {
+                raw_frame.assign(buf.data(), buf.data() + buf.size());
+            });
+            if (raw_frame.empty())
+            {
+                continue;
+            }
+            const auto& command = *messages::GetFrame(raw_frame.data());
+            {
+                std::lock_guard lg{m_mutex};
+                m_commands.push_back(command.message_type());
+            }
+            flatbuffers::FlatBufferBuilder fbb{};
+            fbb.Finish(m_handler(fbb, command));
+            m_deserializer.process_frame({fbb.GetBufferPointer(), fbb.GetSize()});
+        }
+    }
+
+    Serializer& m_serializer;
+    Deserializer& m_deserializer;
+    Handler m_handler;
+    mutable std::mutex m_mutex{};
+    std::vector<messages::Message> m_commands{};
+    std::atomic<bool> m_quit{false};
+    std::thread m_thread{};
+};
+
+//--------------------------------------------------------------------------
+
+static messages::Stat make_fbb_stat(const mode_t mode, const off_t size)
+{
+    struct stat st{};
+    st.st_mode = mode;
+    st.st_size = size;
+    messages::Stat fbb_st{};
+    copy(st, fbb_st);
+    return fbb_st;
+}
+
+//--------------------------------------------------------------------------
+
+static struct stat make_stat(const mode_t mode, const off_t size)
+{
+    struct stat st{};
+    st.st_mode = mode;
+    st.st_size = size;
+    return st;
+}
+
+//--------------------------------------------------------------------------
+
+/// @return errno of the thrown std::system_error, 0 if nothing was thrown
+template <typename Function>
+static int thrown_errno(Function&& function)
+{
+    try
+    {
+        function();
+    }
+    catch (const std::system_error& err)
+    {
+        return err.code().value();
+    }
+    return 0;
+}
+
+//--------------------------------------------------------------------------
+
+/// Subvfs of CachedVfs, the mutations reply `mutation`. The files live in the memory,
+/// a removed file stays reachable by its opened handles.
+class FakeVfs : public IVfs
+{
+public:
+    using Data = std::vector<uint8_t>;
+
+    void getattr(const Path& path, struct stat& st) override
+    {
+        ++getattr_calls;
+        const auto it = attributes.find(path);
+        if (it == attributes.end())
+        {
+            throw std::system_error{ENOENT, std::generic_category()};
+        }
+        st = it->second;
+    }
+    void readdir(const Path&, const DirFiller&) override { unsupported(); }
+    Path readlink(const Path&) override { unsupported(); }
+    Mutation mkdir(const Path&, mode_t) override { return mutation; }
+    Mutation rmdir(const Path&) override { return mutation; }
+    Mutation unlink(const Path& path) override
+    {
+        std::lock_guard lg{m_mutex};
+        m_files.erase(path);
+        return mutation;
+    }
+    Mutation symlink(const Path&, const Path&) override { return mutation; }
+    Mutation rename(const Path& old_path, const Path& new_path, const uint32_t) override
+    {
+        std::lock_guard lg{m_mutex};
+        const auto it = m_files.find(old_path);
+        if (it != m_files.end())
+        {
+            m_files[new_path] = it->second;
+            m_files.erase(it);
+        }
+        return mutation;
+    }
+    Mutation chmod(const Path&, const mode_t) override { return mutation; }
+    Mutation utimens(const Path&, const struct timespec[2]) override { return mutation; }
+    Mutation truncate(const Path&, const off_t) override { return mutation; }
+    Created create(const Path& path, const int, const mode_t mode) override
+    {
+        std::lock_guard lg{m_mutex};
+        auto& data = m_files[path];
+        data = std::make_shared<Data>();
+        const auto st = make_stat(S_IFREG | mode, 0);
+        return {add_handle(data), {st, std::nullopt, std::nullopt}};
+    }
+    FileHandle open(const Path& path, const int flags) override
+    {
+        std::lock_guard lg{m_mutex};
+        const auto it = m_files.find(path);
+        if (it == m_files.end())
+        {
+            throw std::system_error{ENOENT, std::generic_category()};
+        }
+        if (flags & O_TRUNC)
+        {
+            it->second->clear();
+        }
+        return add_handle(it->second);
+    }
+    void close(const FileHandle fh) override
+    {
+        std::lock_guard lg{m_mutex};
+        m_handles.erase(strong::value_of(fh));
+    }
+    size_t read(const FileHandle fh, const gsl::span<uint8_t> output,
+                const off_t offset) override
+    {
+        std::lock_guard lg{m_mutex};
+        ++read_calls;
+        const auto& data = *m_handles.at(strong::value_of(fh));
+        const auto start = std::min(data.size(), static_cast<size_t>(offset));
+        const auto size = std::min(data.size() - start, output.size());
+        std::copy_n(data.begin() + static_cast<ptrdiff_t>(start), size, output.begin());
+        return size;
+    }
+    Written write(const FileHandle fh, const gsl::span<const uint8_t> input,
+                  const off_t offset) override
+    {
+        std::lock_guard lg{m_mutex};
+        auto& data = *m_handles.at(strong::value_of(fh));
+        const auto start = static_cast<size_t>(offset);
+        data.resize(std::max(data.size(), start + input.size()));
+        std::copy(input.begin(), input.end(),
+                  data.begin() + static_cast<ptrdiff_t>(start));
+        return {input.size(), make_stat(S_IFREG | 0644, static_cast<off_t>(data.size()))};
+    }
+    void fsync(const FileHandle, const bool) override { unsupported(); }
+    Mutation fallocate(const FileHandle fh, const int mode, const off_t offset,
+                       const off_t length) override
+    {
+        std::lock_guard lg{m_mutex};
+        auto& data = *m_handles.at(strong::value_of(fh));
+        if (mode & FALLOC_FL_PUNCH_HOLE)
+        {
+            const auto start = std::min(data.size(), static_cast<size_t>(offset));
+            const auto size = std::min(data.size() - start, static_cast<size_t>(length));
+            std::fill_n(data.begin() + static_cast<ptrdiff_t>(start), size, 0);
+        }
+        return mutation;
+    }
+    off_t lseek(const FileHandle, const off_t, const int) override { unsupported(); }
+    void statfs(const Path&, struct statvfs& st) override
+    {
+        ++statfs_calls;
+        if (statfs_errno != 0)
+        {
+            throw std::system_error{statfs_errno, std::generic_category()};
+        }
+        st = {};
+        st.f_blocks = statfs_calls;
+    }
+    void access(const Path&, const int) override { unsupported(); }
+    void opendir(const Path&) override { unsupported(); }
+
+    /// @return content of the file at the path, empty if missing
+    Data content(const Path& path) const
+    {
+        std::lock_guard lg{m_mutex};
+        const auto it = m_files.find(path);
+        return (it == m_files.end()) ? Data{} : *it->second;
+    }
+
+    Mutation mutation{};
+    /// replies to getattr()
+    std::map<Path, struct stat> attributes{};
+    size_t getattr_calls{0};
+    size_t read_calls{0};
+    /// statfs() fails with it if not 0, otherwise replies f_blocks = statfs_calls
+    int statfs_errno{0};
+    size_t statfs_calls{0};
+
+private:
+    [[noreturn]] static void unsupported()
+    {
+        throw std::system_error{ENOTSUP, std::generic_category()};
+    }
+
+    FileHandle add_handle(const std::shared_ptr<Data>& data)
+    {
+        const auto handle = ++m_last_handle;
+        m_handles[handle] = data;
+        return FileHandle{handle};
+    }
+
+    /// the write-back uploads from its thread
+    mutable std::mutex m_mutex{};
+    std::map<Path, std::shared_ptr<Data>> m_files{};
+    std::map<uint64_t, std::shared_ptr<Data>> m_handles{};
+    uint64_t m_last_handle{0};
+};
+
+//==========================================================================
+
+class RemoteVfsTest : public t::Test
+{
+protected:
+    Serializer m_serializer{};
+    Deserializer m_deserializer{};
+    client::IdDispenser m_id_dispenser{};
+    RemoteVfs m_vfs{m_serializer, m_deserializer, m_id_dispenser};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Mutation_Reported)
+{
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            if (command.message_type() == messages::Message::CommandRename)
+            {
+                const auto st = make_fbb_stat(S_IFREG, 1);
+                const auto parent_st = make_fbb_stat(S_IFDIR, 2);
+                const auto old_parent_st = make_fbb_stat(S_IFDIR, 3);
+                return make_frame(fbb, command.id(),
+                                  messages::CreateResultErrno(fbb, 0, &st, &parent_st,
+                                                              &old_parent_st));
+            }
+            // an older server
+            return make_frame(fbb, command.id(), messages::CreateResultErrno(fbb, 0));
+        }};
+
+    const auto renamed = m_vfs.rename("/a/x", "/b/y", 0);
+    ASSERT_TRUE(renamed.st.has_value());
+    EXPECT_TRUE(S_ISREG(renamed.st->st_mode));
+    EXPECT_EQ(renamed.st->st_size, 1);
+    ASSERT_TRUE(renamed.parent_st.has_value());
+    EXPECT_EQ(renamed.parent_st->st_size, 2);
+    ASSERT_TRUE(renamed.old_parent_st.has_value());
+    EXPECT_EQ(renamed.old_parent_st->st_size, 3);
+
+    const auto made = m_vfs.mkdir("/c", 0755);
+    EXPECT_FALSE(made.st.has_value());
+    EXPECT_FALSE(made.parent_st.has_value());
+    EXPECT_FALSE(made.old_parent_st.has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Write_Reported)
+{
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            const auto& write = *command.message_as_CommandWrite();
+            const auto size = static_cast<int64_t>(write.data()->size());
+            const auto st
+                = make_fbb_stat(S_IFREG, static_cast<off_t>(write.offset()) + size);
+            return make_frame(fbb, command.id(),
+                              messages::CreateResultWrite(fbb, size, 0, &st));
+        }};
+
+    // fragmented, the largest reported size wins
+    const std::vector<uint8_t> data(IVfs::IO_FRAGMENT_SIZE * 2 + 10, 1);
+    const auto written = m_vfs.write(IVfs::FileHandle{1}, {data.data(), data.size()}, 5);
+    EXPECT_EQ(written.size, data.size());
+    ASSERT_TRUE(written.st.has_value());
+    EXPECT_EQ(written.st->st_size, static_cast<off_t>(data.size()) + 5);
+}
+
+//--------------------------------------------------------------------------
+
+/// Reply to a CommandBatch as the server does.
+/// @param fail errno of an operation, 0 if it succeeds
+static flatbuffers::Offset<messages::Frame>
+    reply_batch(flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command,
+                const std::function<int(const messages::BatchItem&)>& fail)
+{
+    const auto& batch = *command.message_as_CommandBatch();
+    std::vector<flatbuffers::Offset<messages::BatchItem>> results{};
+    for (const auto* operation: *batch.operations())
+    {
+        const auto res_errno = fail(*operation);
+        if (const auto* write = operation->message_as_CommandWrite(); write != nullptr)
+        {
+            const auto size = static_cast<int64_t>(write->data()->size());
+            const auto st
+                = make_fbb_stat(S_IFREG, static_cast<off_t>(write->offset()) + size);
+            const auto result = (res_errno == 0)
+                                    ? messages::CreateResultWrite(fbb, size, 0, &st)
+                                    : messages::CreateResultWrite(fbb, -1, res_errno);
+            results.push_back(messages::CreateBatchItem(
+                fbb, messages::Message::ResultWrite, result.Union()));
+        }
+        else
+        {
+            // the size tells the index of the operation
+            const auto st = make_fbb_stat(S_IFREG, static_cast<off_t>(results.size()));
+            const auto result = (res_errno == 0)
+                                    ? messages::CreateResultErrno(fbb, 0, &st)
+                                    : messages::CreateResultErrno(fbb, res_errno);
+            results.push_back(messages::CreateBatchItem(
+                fbb, messages::Message::ResultErrno, result.Union()));
+        }
+        if ((res_errno != 0) and batch.stop_on_error())
+        {
+            break;
+        }
+    }
+    const auto result = messages::CreateResultBatchDirect(fbb, &results);
+    return make_frame(fbb, command.id(), result);
+}
+
+//--------------------------------------------------------------------------
+
+static int fail_chmod(const messages::BatchItem& operation)
+{
+    return (operation.message_type() == messages::Message::CommandChmod) ? ENOENT : 0;
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Batch_Results)
+{
+    m_vfs.set_capabilities(static_cast<uint64_t>(messages::Capability::Batch));
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            return reply_batch(fbb, command, fail_chmod);
+        }};
+
+    RemoteVfs::Batch batch{m_vfs};
+    batch.mkdir("/a", 0755);
+    batch.chmod("/b", 0600);
+    batch.unlink("/c");
+    EXPECT_FALSE(batch.empty());
+    const auto results = batch.run(false);
+    EXPECT_TRUE(batch.empty());
+
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_EQ(results[0].res_errno, 0);
+    ASSERT_TRUE(results[0].mutation.st.has_value());
+    EXPECT_EQ(results[0].mutation.st->st_size, 0);
+    EXPECT_EQ(results[1].res_errno, ENOENT);
+    EXPECT_EQ(results[2].res_errno, 0);
+    ASSERT_TRUE(results[2].mutation.st.has_value());
+    EXPECT_EQ(results[2].mutation.st->st_size, 2);
+    // a single round trip
+    EXPECT_THAT(server.get_commands(), t::ElementsAre(messages::Message::CommandBatch));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Batch_StopOnError)
+{
+    m_vfs.set_capabilities(static_cast<uint64_t>(messages::Capability::Batch));
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            return reply_batch(fbb, command, fail_chmod);
+        }};
+
+    RemoteVfs::Batch batch{m_vfs};
+    batch.mkdir("/a", 0755);
+    batch.chmod("/b", 0600);
+    batch.unlink("/c");
+    const auto results = batch.run(true);
+
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_EQ(results[0].res_errno, 0);
+    EXPECT_EQ(results[1].res_errno, ENOENT);
+    EXPECT_EQ(results[2].res_errno, ECANCELED);
+    EXPECT_FALSE(results[2].mutation.st.has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Batch_WriteFragments)
+{
+    const std::vector<uint8_t> data(IVfs::IO_FRAGMENT_SIZE * 2 + 10, 1);
+    const auto failed_offset = data.size() + IVfs::IO_FRAGMENT_SIZE;
+    m_vfs.set_capabilities(static_cast<uint64_t>(messages::Capability::Batch));
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [failed_offset](flatbuffers::FlatBufferBuilder& fbb,
+                        const messages::Frame& command) {
+            return reply_batch(fbb, command, [failed_offset](const auto& operation) {
+                const auto* write = operation.message_as_CommandWrite();
+                return ((write != nullptr) and (write->offset() == failed_offset))
+                           ? ENOSPC
+                           : 0;
+            });
+        }};
+
+    RemoteVfs::Batch batch{m_vfs};
+    const auto fh = batch.create("/f", O_WRONLY | O_CREAT, 0644);
+    batch.write(fh, {data.data(), data.size()}, 0);
+    // the middle fragment fails
+    batch.write(fh, {data.data(), data.size()}, static_cast<off_t>(data.size()));
+    batch.close(fh);
+    const auto results = batch.run(false);
+
+    // a result per call, not per fragment
+    ASSERT_EQ(results.size(), 4);
+    EXPECT_EQ(results[0].res_errno, 0);
+    EXPECT_EQ(results[1].res_errno, 0);
+    EXPECT_EQ(results[1].size, data.size());
+    ASSERT_TRUE(results[1].mutation.st.has_value());
+    EXPECT_EQ(results[1].mutation.st->st_size, static_cast<off_t>(data.size()));
+    EXPECT_EQ(results[2].res_errno, ENOSPC);
+    EXPECT_EQ(results[3].res_errno, 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Batch_FrameSize)
+{
+    std::vector<size_t> frames{};
+    m_vfs.set_capabilities(static_cast<uint64_t>(messages::Capability::Batch));
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [&frames](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            frames.push_back(command.message_as_CommandBatch()->operations()->size());
+            return reply_batch(fbb, command, [](const auto&) { return 0; });
+        }};
+
+    RemoteVfs::Batch batch{m_vfs};
+    const std::vector<uint8_t> data(IVfs::IO_FRAGMENT_SIZE * 40, 1);
+    batch.write(IVfs::FileHandle{1}, {data.data(), data.size()}, 0);
+    batch.chmod("/f", 0600);
+    const auto results = batch.run(false);
+
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(results[0].res_errno, 0);
+    EXPECT_EQ(results[0].size, data.size());
+    EXPECT_EQ(results[1].res_errno, 0);
+    // split to frames the server accepts (up to 1MB)
+    ASSERT_GT(frames.size(), 1);
+    EXPECT_EQ(std::accumulate(frames.begin(), frames.end(), size_t{0}), 41);
+    for (const auto operations: frames)
+    {
+        EXPECT_LT(operations * IVfs::IO_FRAGMENT_SIZE, 1024 * 1024);
+    }
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsTest, Batch_WithoutCapability)
+{
+    FakeServer server{
+        m_serializer, m_deserializer,
+        [](flatbuffers::FlatBufferBuilder& fbb, const messages::Frame& command) {
+            if (command.message_type() == messages::Message::CommandChmod)
+            {
+                return make_frame(fbb, command.id(),
+                                  messages::CreateResultErrno(fbb, ENOENT));
+            }
+            const auto st = make_fbb_stat(S_IFDIR, 1);
+            return make_frame(fbb, command.id(),
+                              messages::CreateResultErrno(fbb, 0, &st));
+        }};
+
+    RemoteVfs::Batch batch{m_vfs};
+    batch.mkdir("/a", 0755);
+    batch.chmod("/b", 0600);
+    batch.unlink("/c");
+    const auto results = batch.run(true);
+
+    ASSERT_EQ(results.size(), 3);
+    EXPECT_EQ(results[0].res_errno, 0);
+    ASSERT_TRUE(results[0].mutation.st.has_value());
+    EXPECT_EQ(results[0].mutation.st->st_size, 1);
+    EXPECT_EQ(results[1].res_errno, ENOENT);
+    EXPECT_EQ(results[2].res_errno, ECANCELED);
+    // one by one, stopped after the failure
+    EXPECT_THAT(server.get_commands(),
+                t::ElementsAre(messages::Message::CommandMkdir,
+                               messages::Message::CommandChmod));
+}
+
+//==========================================================================
+
+/// A server running in the process serving a temporary directory.
+class RemoteVfsServerTest : public TempDirectoryTest
+{
+protected:
+    void SetUp() override
+    {
+        TempDirectoryTest::SetUp();
+        // the served directory is the current one
+        m_previous_directory = boost::filesystem::current_path();
+        boost::filesystem::current_path(m_directory);
+        const auto endpoint = "inproc://" + m_directory.filename().native();
+        m_server_transport.set_endpoint(endpoint);
+        m_worker.start();
+        m_transport.set_endpoint(endpoint);
+        m_transport.start();
+        m_vfs.set_capabilities(static_cast<uint64_t>(messages::Capability::Batch));
+    }
+
+    void TearDown() override
+    {
+        m_transport.stop();
+        m_transport.wait();
+        m_worker.stop();
+        m_worker.wait();
+        boost::filesystem::current_path(m_previous_directory);
+        TempDirectoryTest::TearDown();
+    }
+
+    boost::filesystem::path m_previous_directory{};
+    server::Transport m_server_transport{};
+    server::TemporalIgnores m_temporal_ignores{std::chrono::seconds{1}};
+    server::Generation m_generation{};
+    server::Excludes m_excludes{};
+    server::ServedTree m_served_tree{".", &m_excludes};
+    server::Worker m_worker{m_server_transport, m_temporal_ignores, m_generation,
+                            m_served_tree, m_excludes};
+    Serializer m_serializer{};
+    Deserializer m_deserializer{};
+    Distributor m_distributor{};
+    client::Transport m_transport{m_serializer, m_deserializer, m_distributor};
+    client::IdDispenser m_id_dispenser{};
+    RemoteVfs m_vfs{m_serializer, m_deserializer, m_id_dispenser};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(RemoteVfsServerTest, Batch)
+{
+    RemoteVfs::Batch batch{m_vfs};
+    batch.mkdir("/d", 0755);
+    const auto fh = batch.create("/d/f", O_WRONLY | O_CREAT, 0644);
+    const std::vector<uint8_t> data(IVfs::IO_FRAGMENT_SIZE + 10, 'x');
+    batch.write(fh, {data.data(), data.size()}, 0);
+    batch.close(fh);
+    batch.rename("/d/f", "/d/g", 0);
+    batch.chmod("/missing", 0600);
+    const auto results = batch.run(false);
+
+    ASSERT_EQ(results.size(), 6);
+    for (size_t i = 0; i < 5; ++i)
+    {
+        EXPECT_EQ(results[i].res_errno, 0) << i;
+    }
+    ASSERT_TRUE(results[0].mutation.st.has_value());
+    EXPECT_TRUE(S_ISDIR(results[0].mutation.st->st_mode));
+    EXPECT_EQ(results[2].size, data.size());
+    ASSERT_TRUE(results[2].mutation.st.has_value());
+    EXPECT_EQ(results[2].mutation.st->st_size, static_cast<off_t>(data.size()));
+    ASSERT_TRUE(results[4].mutation.st.has_value());
+    EXPECT_EQ(results[4].mutation.st->st_size, static_cast<off_t>(data.size()));
+    EXPECT_EQ(results[5].res_errno, ENOENT);
+
+    EXPECT_FALSE(boost::filesystem::exists(m_directory / "d" / "f"));
+    EXPECT_EQ(boost::filesystem::file_size(m_directory / "d" / "g"), data.size());
+}
+
+//==========================================================================
+
+class CachedVfsTest : public t::Test
+{
+protected:
+    void SetUp() override
+    {
+        auto lg = m_cache.lock();
+        m_cache.get_root().st.st_mode = S_IFDIR | 0755;
+        m_cache.make_node("/a").st.st_mode = S_IFDIR | 0755;
+        m_cache.make_node("/b").st.st_mode = S_IFDIR | 0755;
+        m_cache.make_node("/a/x").st.st_mode = S_IFREG | 0644;
+        m_cache.publish();
+    }
+
+    /// @return attributes of the published node
+    cache::Stat cached(const IVfs::Path& path) const
+    {
+        return m_cache.snapshot()->get_node(path).st;
+    }
+
+    FakeVfs m_subvfs{};
+    Serializer m_serializer{};
+    Deserializer m_deserializer{};
+    client::IdDispenser m_id_dispenser{};
+    cache::Cache m_cache{};
+    cache::DiskStore m_disk_store{};
+    CachedVfs m_vfs{m_subvfs,       m_serializer, m_deserializer,
+                    m_id_dispenser, m_cache,      m_disk_store};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Mutation_Reported)
+{
+    m_subvfs.mutation = {make_stat(S_IFDIR | 0700, 1), make_stat(S_IFDIR | 0755, 2),
+                         std::nullopt};
+    m_vfs.mkdir("/a/d", 0700);
+    EXPECT_EQ(cached("/a/d").st_mode, mode_t{S_IFDIR | 0700});
+    EXPECT_EQ(cached("/a/d").st_size, 1);
+    EXPECT_EQ(cached("/a").st_size, 2);
+
+    m_subvfs.mutation = {make_stat(S_IFREG | 0600, 3), make_stat(S_IFDIR | 0755, 4),
+                         make_stat(S_IFDIR | 0755, 5)};
+    m_vfs.rename("/a/x", "/b/y", 0);
+    EXPECT_FALSE(m_cache.snapshot()->exists("/a/x"));
+    EXPECT_EQ(cached("/b/y").st_mode, mode_t{S_IFREG | 0600});
+    EXPECT_EQ(cached("/b/y").st_size, 3);
+    EXPECT_EQ(cached("/b").st_size, 4);
+    EXPECT_EQ(cached("/a").st_size, 5);
+
+    m_subvfs.mutation = {std::nullopt, make_stat(S_IFDIR | 0755, 6), std::nullopt};
+    m_vfs.rmdir("/a/d");
+    EXPECT_FALSE(m_cache.snapshot()->exists("/a/d"));
+    EXPECT_EQ(cached("/a").st_size, 6);
+
+    m_subvfs.mutation = {make_stat(S_IFREG | 0640, 7), std::nullopt, std::nullopt};
+    m_vfs.chmod("/b/y", 0640);
+    EXPECT_EQ(cached("/b/y").st_mode, mode_t{S_IFREG | 0640});
+    EXPECT_EQ(cached("/b/y").st_size, 7);
+
+    EXPECT_EQ(m_subvfs.getattr_calls, 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Mutation_NotReported)
+{
+    // an older server, the attributes are fetched
+    m_subvfs.attributes["/a/d"] = make_stat(S_IFDIR | 0700, 1);
+    m_subvfs.attributes["/a"] = make_stat(S_IFDIR | 0755, 2);
+    m_vfs.mkdir("/a/d", 0700);
+    EXPECT_EQ(cached("/a/d").st_size, 1);
+    EXPECT_EQ(cached("/a").st_size, 2);
+    EXPECT_EQ(m_subvfs.getattr_calls, 2);
+
+    // the cached attributes are kept
+    m_vfs.rename("/a/x", "/b/y", 0);
+    EXPECT_EQ(cached("/b/y").st_mode, mode_t{S_IFREG | 0644});
+    EXPECT_EQ(m_subvfs.getattr_calls, 2);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, WriteBack_Rename)
+{
+    m_vfs.set_write_back(1 << 20);
+    m_vfs.start();
+    const FakeVfs::Data data{1, 2, 3};
+    const auto writer = m_vfs.create("/a/y", O_WRONLY, 0644).fh;
+    m_vfs.write(writer, data, 0);
+
+    // the queued data are uploaded before the server renames the file
+    m_vfs.rename("/a/y", "/b/z", 0);
+    EXPECT_EQ(m_subvfs.content("/b/z"), data);
+    const auto reader = m_vfs.open("/b/z", O_RDONLY);
+    FakeVfs::Data output(data.size());
+    EXPECT_EQ(m_vfs.read(reader, output, 0), data.size());
+    EXPECT_EQ(output, data);
+    m_vfs.close(reader);
+
+    // the opened file follows the rename
+    m_vfs.write(writer, data, 3);
+    EXPECT_EQ(cached("/b/z").st_size, 6);
+    m_vfs.close(writer);
+    EXPECT_EQ(m_subvfs.content("/b/z").size(), size_t{6});
+    EXPECT_EQ(cached("/b/z").st_size, 6);
+    EXPECT_FALSE(m_cache.snapshot()->exists("/a/y"));
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, WriteBack_Unlink)
+{
+    m_vfs.set_write_back(1 << 20);
+    m_vfs.start();
+    const FakeVfs::Data data{1, 2, 3};
+    const auto removed = m_vfs.create("/a/y", O_WRONLY, 0644).fh;
+    m_vfs.write(removed, data, 0);
+    m_vfs.unlink("/a/y");
+
+    // a new file at the same path is not touched by the removed one
+    const auto created = m_vfs.create("/a/y", O_WRONLY, 0644).fh;
+    m_vfs.write(removed, data, 3);
+    m_vfs.close(removed);
+    EXPECT_EQ(cached("/a/y").st_size, 0);
+    EXPECT_TRUE(m_subvfs.content("/a/y").empty());
+    m_vfs.close(created);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Access)
+{
+    EXPECT_EQ(thrown_errno([this] { m_vfs.access("/a/x", R_OK | W_OK); }), 0);
+    EXPECT_EQ(thrown_errno([this] { m_vfs.access("/a/x", X_OK); }), EACCES);
+    EXPECT_EQ(thrown_errno([this] { m_vfs.access("/a", R_OK | X_OK); }), 0);
+    EXPECT_EQ(thrown_errno([this] { m_vfs.access("/a/y", F_OK); }), ENOENT);
+    // evaluated from the cache
+    EXPECT_EQ(m_subvfs.getattr_calls, size_t{0});
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Lseek)
+{
+    {
+        auto lg = m_cache.lock();
+        m_cache.get_node("/a/x").st.st_size = 10;
+        m_cache.publish();
+    }
+    const auto fh = m_vfs.open("/a/x", O_RDONLY);
+    EXPECT_EQ(m_vfs.lseek(fh, 3, SEEK_DATA), 3);
+    EXPECT_EQ(m_vfs.lseek(fh, 3, SEEK_HOLE), 10);
+    EXPECT_EQ(thrown_errno([&] { m_vfs.lseek(fh, 10, SEEK_DATA); }), ENXIO);
+    EXPECT_EQ(thrown_errno([&] { m_vfs.lseek(fh, -1, SEEK_HOLE); }), EINVAL);
+    // the whence is checked before the offset
+    EXPECT_EQ(thrown_errno([&] { m_vfs.lseek(fh, 20, SEEK_SET); }), EINVAL);
+    m_vfs.close(fh);
+    EXPECT_EQ(thrown_errno([&] { m_vfs.lseek(fh, 0, SEEK_DATA); }), EBADF);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Statfs)
+{
+    struct statvfs st{};
+    // nothing to fall back to
+    m_subvfs.statfs_errno = ENOTCONN;
+    EXPECT_EQ(thrown_errno([&] { m_vfs.statfs("/", st); }), ENOTCONN);
+
+    // an older server
+    m_subvfs.statfs_errno = ENOSYS;
+    m_vfs.statfs("/", st);
+    EXPECT_EQ(st.f_bsize, 4096u);
+    EXPECT_EQ(st.f_blocks, fsblkcnt_t{0});
+
+    // kept for the TTL
+    m_subvfs.statfs_errno = 0;
+    m_vfs.statfs("/a", st);
+    EXPECT_EQ(st.f_bsize, 4096u);
+    EXPECT_EQ(m_subvfs.statfs_calls, size_t{2});
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Opendir)
+{
+    EXPECT_EQ(thrown_errno([this] { m_vfs.opendir("/a"); }), 0);
+    EXPECT_EQ(thrown_errno([this] { m_vfs.opendir("/a/x"); }), ENOTDIR);
+    EXPECT_EQ(thrown_errno([this] { m_vfs.opendir("/c"); }), ENOENT);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(CachedVfsTest, Fallocate)
+{
+    const FakeVfs::Data data{1, 2, 3};
+    const auto fh = m_vfs.create("/a/y", O_RDWR, 0644).fh;
+    m_vfs.write(fh, data, 0);
+    FakeVfs::Data output(data.size());
+
+    // a plain allocation keeps the cached content
+    m_subvfs.mutation = {make_stat(S_IFREG | 0644, 3), std::nullopt, std::nullopt};
+    m_vfs.fallocate(fh, FALLOC_FL_KEEP_SIZE, 0, 100);
+    m_vfs.read(fh, output, 0);
+    EXPECT_EQ(output, data);
+    EXPECT_EQ(m_subvfs.read_calls, size_t{0});
+
+    m_vfs.fallocate(fh, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 1, 1);
+    m_vfs.read(fh, output, 0);
+    EXPECT_EQ(output, (FakeVfs::Data{1, 0, 3}));
+    EXPECT_EQ(m_subvfs.read_calls, size_t{1});
+    EXPECT_EQ(cached("/a/y").st_size, 3);
+    m_vfs.close(fh);
+}
+
+//==========================================================================
+} // namespace rewofs::tests
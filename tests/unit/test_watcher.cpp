@@ -114,5 +114,188 @@ TEST(TemporalIgnores, MultipleAddsOfTheSameAfterExpiring)
     EXPECT_FALSE(ignores.check(NOW + 3100ms, "/b"));
 }
 
+//==========================================================================
+
+TEST(Generation, Bump)
+{
+    server::Generation generation{};
+    const auto first = generation.get();
+    EXPECT_GT(first, 0);
+    generation.bump();
+    generation.bump();
+    EXPECT_EQ(generation.get(), first + 2);
+
+    // a later start does not go back
+    server::Generation restarted{};
+    EXPECT_GE(restarted.get(), first);
+}
+
+//==========================================================================
+
+TEST(ChangeCollector, Empty)
+{
+    server::ChangeCollector collector{};
+
+    EXPECT_TRUE(collector.empty());
+    const auto changes = collector.take();
+    ASSERT_TRUE(changes.has_value());
+    EXPECT_TRUE(changes->empty());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(ChangeCollector, CreateModifyDelete)
+{
+    using messages::ChangeType;
+    server::ChangeCollector collector{};
+
+    collector.created("/dir/a");
+    collector.modified("/dir/a");
+    collector.modified("/dir/a");
+    collector.modified("/b");
+    collector.deleted("/dir/c");
+    EXPECT_FALSE(collector.empty());
+
+    const auto changes = collector.take();
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->size(), 5);
+    EXPECT_EQ((*changes)[0].type, ChangeType::Created);
+    EXPECT_EQ((*changes)[0].path, "/dir/a");
+    EXPECT_EQ((*changes)[1].type, ChangeType::Modified);
+    EXPECT_EQ((*changes)[1].path, "/dir/a");
+    EXPECT_EQ((*changes)[2].type, ChangeType::Modified);
+    EXPECT_EQ((*changes)[2].path, "/b");
+    EXPECT_EQ((*changes)[3].type, ChangeType::Deleted);
+    EXPECT_EQ((*changes)[3].path, "/dir/c");
+    // parent of the created and deleted entries
+    EXPECT_EQ((*changes)[4].type, ChangeType::Modified);
+    EXPECT_EQ((*changes)[4].path, "/dir");
+
+    EXPECT_TRUE(collector.empty());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(ChangeCollector, Moves)
+{
+    using messages::ChangeType;
+    server::ChangeCollector collector{};
+
+    collector.moved_from(1, "/a");
+    collector.moved_from(2, "/b");
+    collector.moved_to(1, "/x/a");
+    collector.moved_to(3, "/c");
+
+    const auto changes = collector.take();
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->size(), 5);
+    EXPECT_EQ((*changes)[0].type, ChangeType::Renamed);
+    EXPECT_EQ((*changes)[0].path, "/a");
+    EXPECT_EQ((*changes)[0].new_path, "/x/a");
+    // moved out of the tree
+    EXPECT_EQ((*changes)[1].type, ChangeType::Deleted);
+    EXPECT_EQ((*changes)[1].path, "/b");
+    // moved into the tree
+    EXPECT_EQ((*changes)[2].type, ChangeType::Created);
+    EXPECT_EQ((*changes)[2].path, "/c");
+    EXPECT_EQ((*changes)[3].path, "/");
+    EXPECT_EQ((*changes)[4].path, "/x");
+}
+
+//--------------------------------------------------------------------------
+
+TEST(ChangeCollector, Reloaded)
+{
+    using messages::ChangeType;
+    server::ChangeCollector collector{};
+
+    collector.reloaded("/build");
+    collector.modified("/a");
+    collector.reloaded("/build");
+
+    auto changes = collector.take();
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->size(), 2);
+    EXPECT_EQ((*changes)[0].type, ChangeType::Modified);
+    EXPECT_EQ((*changes)[0].path, "/build");
+    EXPECT_TRUE((*changes)[0].reload);
+    EXPECT_FALSE((*changes)[1].reload);
+
+    // merged only within a batch
+    collector.reloaded("/build");
+    changes = collector.take();
+    ASSERT_TRUE(changes.has_value());
+    ASSERT_EQ(changes->size(), 1);
+    EXPECT_TRUE((*changes)[0].reload);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(ChangeCollector, Overflow)
+{
+    server::ChangeCollector collector{};
+
+    collector.created("/a");
+    collector.overflow();
+    collector.created("/b");
+    EXPECT_FALSE(collector.empty());
+    EXPECT_FALSE(collector.take().has_value());
+
+    for (size_t i = 0; i <= server::ChangeCollector::MAX_CHANGES; ++i)
+    {
+        collector.created("/f" + std::to_string(i));
+    }
+    EXPECT_FALSE(collector.take().has_value());
+
+    collector.created("/a");
+    EXPECT_TRUE(collector.take().has_value());
+}
+
+//==========================================================================
+
+TEST(Debouncer, Quiet)
+{
+    using namespace std::chrono_literals;
+
+    server::Debouncer debouncer{100ms, 1s};
+    EXPECT_FALSE(debouncer.pending());
+    EXPECT_FALSE(debouncer.settled(NOW));
+    EXPECT_EQ(debouncer.remaining(NOW), 0ms);
+
+    debouncer.event(NOW);
+    EXPECT_TRUE(debouncer.pending());
+    EXPECT_EQ(debouncer.remaining(NOW), 100ms);
+    debouncer.event(NOW + 80ms);
+    EXPECT_FALSE(debouncer.settled(NOW + 150ms));
+    EXPECT_EQ(debouncer.remaining(NOW + 150ms), 30ms);
+    EXPECT_TRUE(debouncer.settled(NOW + 180ms));
+
+    EXPECT_EQ(debouncer.take(NOW + 200ms), 200ms);
+    EXPECT_FALSE(debouncer.pending());
+    EXPECT_FALSE(debouncer.settled(NOW + 1h));
+}
+
+//--------------------------------------------------------------------------
+
+TEST(Debouncer, MaxLatency)
+{
+    using namespace std::chrono_literals;
+
+    server::Debouncer debouncer{100ms, 1s};
+    // never quiet
+    for (auto time = NOW; time < NOW + 950ms; time += 50ms)
+    {
+        debouncer.event(time);
+        EXPECT_FALSE(debouncer.settled(time));
+    }
+    EXPECT_EQ(debouncer.remaining(NOW + 950ms), 50ms);
+    EXPECT_TRUE(debouncer.settled(NOW + 1s));
+    EXPECT_EQ(debouncer.take(NOW + 1s), 1s);
+
+    // a new burst
+    debouncer.event(NOW + 2s);
+    EXPECT_EQ(debouncer.remaining(NOW + 2s), 100ms);
+}
+
 //==========================================================================
 } // namespace rewofs::tests
@@ -0,0 +1,245 @@
+/// Test the write-back.
+///
+/// @file
+
+#include <mutex>
+#include <vector>
+
+#include "rewofs/disablewarnings.hpp"
+#include <gtest/gtest.h>
+#include "rewofs/enablewarnings.hpp"
+
+#include "rewofs/client/write_back.hpp"
+
+//==========================================================================
+namespace rewofs::tests {
+//==========================================================================
+
+namespace t = testing;
+
+//==========================================================================
+
+static std::vector<uint8_t> bytes(const size_t size, const uint8_t value)
+{
+    return std::vector<uint8_t>(size, value);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(DirtyExtents, Coalesce)
+{
+    client::DirtyExtents extents{};
+    extents.add(10, bytes(10, 1));
+    extents.add(30, bytes(10, 2));
+    EXPECT_EQ(extents.count(), 2);
+    EXPECT_EQ(extents.size(), 20);
+
+    // overlapping and adjacent
+    extents.add(15, bytes(15, 3));
+    EXPECT_EQ(extents.count(), 1);
+    EXPECT_EQ(extents.size(), 30);
+
+    const auto extent = extents.pop();
+    ASSERT_TRUE(extent.has_value());
+    EXPECT_EQ(extent->offset, 10);
+    std::vector<uint8_t> expected{};
+    for (const auto& [size, value]: {std::pair{5, 1}, {15, 3}, {10, 2}})
+    {
+        const auto part = bytes(static_cast<size_t>(size), static_cast<uint8_t>(value));
+        expected.insert(expected.end(), part.begin(), part.end());
+    }
+    EXPECT_EQ(extent->data, expected);
+    EXPECT_TRUE(extents.empty());
+    EXPECT_EQ(extents.size(), 0);
+    EXPECT_FALSE(extents.pop().has_value());
+}
+
+//--------------------------------------------------------------------------
+
+TEST(DirtyExtents, Overwrite)
+{
+    client::DirtyExtents extents{};
+    extents.add(0, bytes(100, 1));
+    extents.add(20, bytes(10, 2));
+    EXPECT_EQ(extents.count(), 1);
+    EXPECT_EQ(extents.size(), 100);
+
+    const auto extent = extents.pop();
+    ASSERT_TRUE(extent.has_value());
+    EXPECT_EQ(extent->data[19], 1);
+    EXPECT_EQ(extent->data[20], 2);
+    EXPECT_EQ(extent->data[29], 2);
+    EXPECT_EQ(extent->data[30], 1);
+}
+
+//--------------------------------------------------------------------------
+
+TEST(DirtyExtents, AdjacentLimit)
+{
+    constexpr auto HALF = client::DirtyExtents::MAX_EXTENT / 2;
+    client::DirtyExtents extents{};
+    extents.add(0, bytes(HALF, 1));
+    extents.add(HALF, bytes(HALF, 2));
+    EXPECT_EQ(extents.count(), 1);
+    // sequential writes are not coalesced without limits
+    extents.add(2 * HALF, bytes(HALF, 3));
+    EXPECT_EQ(extents.count(), 2);
+    EXPECT_EQ(extents.size(), 3 * HALF);
+    EXPECT_EQ(extents.pop()->data.size(), 2 * HALF);
+    EXPECT_EQ(extents.pop()->offset, 2 * HALF);
+}
+
+//==========================================================================
+
+class WriteBackTest : public t::Test
+{
+protected:
+    struct Upload
+    {
+        client::WriteBack::Handle handle{};
+        off_t offset{};
+        size_t size{};
+    };
+
+    void TearDown() override
+    {
+        m_write_back.stop();
+        m_write_back.wait();
+    }
+
+    std::vector<Upload> uploads() const
+    {
+        std::lock_guard lg{m_mutex};
+        return m_uploads;
+    }
+
+    mutable std::mutex m_mutex{};
+    std::vector<Upload> m_uploads{};
+    int m_fail_errno{0};
+    client::WriteBack m_write_back{
+        [this](const client::WriteBack::Handle handle, const off_t offset,
+               const gsl::span<const uint8_t> data) {
+            std::lock_guard lg{m_mutex};
+            if (m_fail_errno != 0)
+            {
+                throw std::system_error{m_fail_errno, std::generic_category()};
+            }
+            m_uploads.push_back({handle, offset, data.size()});
+        }};
+};
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, Flush)
+{
+    m_write_back.start();
+    const auto data = bytes(100, 1);
+    m_write_back.write(1, "/a", 0, data);
+    m_write_back.write(1, "/a", 100, data);
+    m_write_back.write(2, "/b", 0, data);
+
+    m_write_back.flush(1);
+    m_write_back.flush_path("/b");
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+    EXPECT_FALSE(m_write_back.has_queued(1));
+
+    size_t uploaded_a{0};
+    size_t uploaded_b{0};
+    for (const auto& upload: uploads())
+    {
+        (upload.handle == 1 ? uploaded_a : uploaded_b) += upload.size;
+    }
+    EXPECT_EQ(uploaded_a, 200);
+    EXPECT_EQ(uploaded_b, 100);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, ErrorReportedOnce)
+{
+    {
+        std::lock_guard lg{m_mutex};
+        m_fail_errno = ENOSPC;
+    }
+    m_write_back.start();
+    m_write_back.write(1, "/a", 0, bytes(10, 1));
+    m_write_back.flush_path("/a");
+
+    try
+    {
+        m_write_back.flush(1);
+        FAIL() << "no error";
+    }
+    catch (const std::system_error& err)
+    {
+        EXPECT_EQ(err.code().value(), ENOSPC);
+    }
+    EXPECT_NO_THROW(m_write_back.flush(1));
+    m_write_back.forget(1);
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, Capacity)
+{
+    m_write_back.set_capacity(150);
+    // not uploading yet, a write over the capacity would block
+    m_write_back.write(1, "/a", 0, bytes(100, 1));
+    m_write_back.write(1, "/a", 100, bytes(50, 1));
+    EXPECT_EQ(m_write_back.dirty_size(), 150);
+
+    m_write_back.start();
+    m_write_back.write(1, "/a", 1000, bytes(100, 1));
+    m_write_back.flush(1);
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+    EXPECT_EQ(uploads().size(), 2);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, FlushPath_Inside)
+{
+    m_write_back.write(1, "/d/a", 0, bytes(10, 1));
+    m_write_back.write(2, "/dd", 0, bytes(10, 1));
+    m_write_back.start();
+    m_write_back.flush_path("/d");
+    EXPECT_FALSE(m_write_back.has_queued(1));
+    m_write_back.flush_path("/dd");
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, Stop_Uploads)
+{
+    m_write_back.write(1, "/a", 0, bytes(10, 1));
+    m_write_back.write(1, "/a", 100, bytes(10, 1));
+    m_write_back.write(2, "/b", 0, bytes(10, 1));
+    m_write_back.stop();
+    m_write_back.start();
+    m_write_back.wait();
+    EXPECT_EQ(uploads().size(), 3);
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+}
+
+//--------------------------------------------------------------------------
+
+TEST_F(WriteBackTest, Stop_DropsAfterFailure)
+{
+    {
+        std::lock_guard lg{m_mutex};
+        m_fail_errno = EHOSTUNREACH;
+    }
+    m_write_back.write(1, "/a", 0, bytes(10, 1));
+    m_write_back.write(1, "/a", 100, bytes(10, 1));
+    m_write_back.write(2, "/b", 0, bytes(10, 1));
+    m_write_back.stop();
+    m_write_back.start();
+    m_write_back.wait();
+    EXPECT_EQ(m_write_back.dirty_size(), 0);
+    EXPECT_THROW(m_write_back.write(1, "/a", 0, bytes(10, 1)), std::system_error);
+}
+
+//==========================================================================
+} // namespace rewofs::tests